@@ -29,10 +29,30 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <ctype.h>
 #include <ulfius.h>
 #include <sqlite3.h>
 #include <jansson.h>
 #include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <semaphore.h>
+#include <math.h>
+#include <zlib.h>
+#include <dirent.h>
+#include <sched.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 // Default values if not provided by Makefile
 #ifndef PORT
@@ -43,6 +63,152 @@
 #define DATABASE_FILE "workflow_templates.db"
 #endif
 
+#ifndef POOL_SIZE
+#define POOL_SIZE 10
+#endif
+
+// How long a request waits for a free pooled connection before giving up
+#ifndef POOL_WAIT_TIMEOUT_MS
+#define POOL_WAIT_TIMEOUT_MS 2000
+#endif
+
+// How long a connection retries a locked database before failing with SQLITE_BUSY
+#ifndef DB_BUSY_TIMEOUT_MS
+#define DB_BUSY_TIMEOUT_MS 5000
+#endif
+
+// Group commit: the writer keeps collecting queued writes for this long
+// (or until WRITER_MAX_BATCH of them are queued) before committing them together
+#ifndef WRITER_COMMIT_WINDOW_MS
+#define WRITER_COMMIT_WINDOW_MS 2
+#endif
+
+#ifndef WRITER_MAX_BATCH
+#define WRITER_MAX_BATCH 256
+#endif
+
+// JSON parsing threads of --import, the single writer applies what they parse in file order
+#ifndef IMPORT_THREADS
+#define IMPORT_THREADS 4
+#endif
+
+// Threads sharing one substring scan of the catalog snapshot, once its text outgrows SCAN_PARALLEL_BYTES:
+// the requesting thread and a pool of SCAN_THREADS - 1 started with the snapshot, shared by all requests
+#ifndef SCAN_THREADS
+#define SCAN_THREADS 4
+#endif
+
+// Serve unfiltered search totals from the counters table instead of counting rows.
+// The counter is kept by triggers and can drift if templates are edited with them disabled.
+#ifndef APPROXIMATE_TOTAL_COUNT
+#define APPROXIMATE_TOTAL_COUNT 0
+#endif
+
+// Memory budget of the GET response cache in bytes, split evenly across its shards. 0 disables it.
+#ifndef RESPONSE_CACHE_BYTES
+#define RESPONSE_CACHE_BYTES 33554432
+#endif
+
+// Keep gzip and brotli copies of cached bodies and send the one the client accepts
+#ifndef RESPONSE_COMPRESSION
+#define RESPONSE_COMPRESSION 1
+#endif
+
+#if RESPONSE_COMPRESSION
+#include <brotli/encode.h>
+#endif
+
+// Compress large JSON columns of templates on write. Compressed values are always readable,
+// whatever this is set to, so it can be turned off again without a migration.
+#ifndef STORAGE_COMPRESSION
+#define STORAGE_COMPRESSION 0
+#endif
+
+// Answer the listing GETs from an immutable in-memory copy of the catalog instead of SQLite.
+// Every committed write batch publishes a new copy, re-reading only the templates it changed.
+#ifndef CATALOG_SNAPSHOT
+#define CATALOG_SNAPSHOT 0
+#endif
+
+// The catalog snapshot is saved here once writes pause, and mapped on the next start instead of
+// being read from the database again when the database has not changed since
+#ifndef CATALOG_FILE
+#define CATALOG_FILE DATABASE_FILE ".catalog"
+#endif
+
+// Views of workflow and collection pages are counted in memory and added to the view columns
+// every VIEW_FLUSH_SECONDS, in one write. 0 stops counting them.
+#ifndef VIEW_FLUSH_SECONDS
+#define VIEW_FLUSH_SECONDS 30
+#endif
+
+// Full-text index over template names and descriptions, rowid is the template id
+#define SEARCH_INDEX_SCHEMA "CREATE VIRTUAL TABLE IF NOT EXISTS templates_fts USING fts5(" \
+                            "name, description, prefix = '2 3', tokenize = 'unicode61 remove_diacritics 2');"
+// Incrementally maintained row counts plus data_version, bumped by every committed write batch
+#define COUNTERS_SCHEMA "CREATE TABLE IF NOT EXISTS counters (name TEXT PRIMARY KEY, value INTEGER NOT NULL);" \
+                        "INSERT OR IGNORE INTO counters (name, value) SELECT 'templates', COUNT(*) FROM templates;" \
+                        "INSERT OR IGNORE INTO counters (name, value) VALUES ('data_version', 0);" \
+                        "INSERT OR IGNORE INTO counters (name, value) VALUES ('database_id', random() & 0xFFFFFFFF);" \
+                        "CREATE TRIGGER IF NOT EXISTS templates_count_insert AFTER INSERT ON templates BEGIN " \
+                        "UPDATE counters SET value = value + 1 WHERE name = 'templates'; END;" \
+                        "CREATE TRIGGER IF NOT EXISTS templates_count_delete AFTER DELETE ON templates BEGIN " \
+                        "UPDATE counters SET value = value - 1 WHERE name = 'templates'; END;"
+
+// Only columns a PUT writes queue a render: view counts flushed in the background leave rendered bodies
+#define RENDER_TEMPLATE_UPDATE_TRIGGER "CREATE TRIGGER IF NOT EXISTS render_template_update " \
+                                       "AFTER UPDATE OF name, price, purchase_url, created_at, description, workflow_data, " \
+                                       "workflow_info, nodes_data, image_data, user_id, last_updated_by ON templates BEGIN " \
+                                       "INSERT OR IGNORE INTO render_queue VALUES (NEW.id); END;"
+
+// Response bodies of the workflow GET endpoints rendered at write time. Triggers queue every
+// template whose body may have changed, the writer re-renders the queue before each commit.
+#define RENDER_STORE_SCHEMA "CREATE TABLE IF NOT EXISTS template_renders (" \
+                            "template_id INTEGER PRIMARY KEY REFERENCES templates(id) ON DELETE CASCADE, " \
+                            "detail TEXT NOT NULL, import TEXT NOT NULL);" \
+                            "CREATE TABLE IF NOT EXISTS render_queue (template_id INTEGER PRIMARY KEY);" \
+                            "CREATE TRIGGER IF NOT EXISTS render_template_insert AFTER INSERT ON templates BEGIN " \
+                            "INSERT OR IGNORE INTO render_queue VALUES (NEW.id); END;" \
+                            RENDER_TEMPLATE_UPDATE_TRIGGER \
+                            "CREATE TRIGGER IF NOT EXISTS render_user_update AFTER UPDATE ON users BEGIN " \
+                            "INSERT OR IGNORE INTO render_queue SELECT id FROM templates WHERE user_id = NEW.id; END;" \
+                            "CREATE TRIGGER IF NOT EXISTS render_category_update AFTER UPDATE ON categories BEGIN " \
+                            "INSERT OR IGNORE INTO render_queue SELECT template_id FROM template_categories WHERE category_id = NEW.id; END;" \
+                            "CREATE TRIGGER IF NOT EXISTS render_template_category_insert AFTER INSERT ON template_categories BEGIN " \
+                            "INSERT OR IGNORE INTO render_queue VALUES (NEW.template_id); END;" \
+                            "CREATE TRIGGER IF NOT EXISTS render_template_category_delete AFTER DELETE ON template_categories BEGIN " \
+                            "INSERT OR IGNORE INTO render_queue VALUES (OLD.template_id); END;"
+
+// Stored JSON column, NULL unless it is well formed (so it can be spliced into a response as is).
+// Compressed values are inflated by stored_json(), only valid JSON is ever compressed.
+#define VALID_JSON(column) "CASE WHEN typeof(" column ") = 'blob' THEN stored_json(" column ") " \
+                           "WHEN json_valid(" column ") THEN " column " END"
+
+// Hashes of what a template row was last written from, so identical writes can be skipped
+#define CONTENT_HASH_SCHEMA "ALTER TABLE templates ADD COLUMN content_hash INTEGER;" \
+                            "ALTER TABLE templates ADD COLUMN data_hash INTEGER;"
+
+// Preset deflate dictionaries for compressed template columns. Never deleted: every compressed
+// value names the dictionary it was compressed with.
+#define STORAGE_SCHEMA "CREATE TABLE IF NOT EXISTS storage_dictionaries (" \
+                       "id INTEGER PRIMARY KEY, data BLOB NOT NULL, created_at TEXT DEFAULT CURRENT_TIMESTAMP);"
+// Compressed value layout: format byte, dictionary id and inflated length (both big endian), zlib stream
+#define STORED_FORMAT_DEFLATE 'z'
+#define STORED_HEADER_SIZE 9
+// Categories of template t as a JSON array text, in category id order
+#define TEMPLATE_CATEGORIES_JSON "(SELECT json_group_array(json(category)) FROM (SELECT json_object('id', c.id, 'name', c.name) AS category " \
+                                 "FROM template_categories tc JOIN categories c ON c.id = tc.category_id " \
+                                 "WHERE tc.template_id = t.id ORDER BY tc.category_id))"
+
+// Columns of a catalog snapshot template, in the order catalog_make_template() reads them
+#define CATALOG_TEMPLATE_SQL "SELECT t.id, t.name, t.total_views, t.purchase_url, t.user_id, t.description, t.created_at, " \
+                             VALID_JSON("t.nodes_data") ", t.price FROM templates t"
+
+// bm25 column weights used by sort=relevance, a name hit outranks a description hit
+#define SEARCH_NAME_WEIGHT "10.0"
+#define SEARCH_DESCRIPTION_WEIGHT "1.0"
+#define SEARCH_SCORE_EXPR "bm25(templates_fts, " SEARCH_NAME_WEIGHT ", " SEARCH_DESCRIPTION_WEIGHT ")"
+
 // Buffer size constants to replace magic numbers
 #define MAX_SQL_BUFFER_SIZE 4096
 #define MEDIUM_SQL_BUFFER_SIZE 3072
@@ -52,22 +218,557 @@
 #define PARAM_NAME_BUFFER_SIZE 32
 #define SEARCH_PATTERN_BUFFER_SIZE 256
 #define CATEGORY_BUFFER_SIZE 512
-#define MAX_CONNECTIONS 10
+#define CURSOR_BUFFER_SIZE 96
+#define PRAGMA_BUFFER_SIZE 48
+#define CATALOG_BLOCK_SIZE 65536
+#define CATALOG_INTERN_INITIAL_SLOTS 1024
+#define CATALOG_ARRAY_CONTAINER_MAX 4096
+#define CATALOG_BITMAP_WORDS 1024
+#define CATALOG_TEXT_SEGMENT_BITS 12
+#define CATALOG_NULL_NAME 1
+#define CATALOG_NULL_DESCRIPTION 2
+#define SCAN_PARALLEL_BYTES 4194304
+#define CATALOG_FILE_MAGIC "NRCATLG"
+#define CATALOG_FILE_FORMAT 2
+#define CATALOG_FILE_BYTE_ORDER 0x01020304
+#define CATALOG_FILE_NULL UINT64_MAX
+#define CATALOG_SAVE_DELAY_MS 2000
+#define VIEW_COUNTER_SHARDS 16
+#define VIEW_COUNTER_SLOTS 4096
+#define VIEW_PROBE_LIMIT 32
+#define STMT_CACHE_SIZE 64
+#define JSON_WRITER_INITIAL_SIZE 16384
+#define JSON_WRITER_MAX_DEPTH 16
+#define COUNT_CACHE_SIZE 256
+#define COUNT_CACHE_KEY_SIZE 768
+#define RESPONSE_CACHE_SHARDS 16
+#define RESPONSE_CACHE_BUCKETS 1024
+#define RESPONSE_CACHE_KEY_SIZE 2048
+#define RESPONSE_CACHE_MAX_PARAMS 64
+#define ETAG_BUFFER_SIZE 48
+#define HTTP_DATE_BUFFER_SIZE 32
+#define COMPRESSION_MIN_BYTES 1024
+#define GZIP_LEVEL 9
+#define BROTLI_QUALITY 9
+#define STORAGE_COMPRESSION_MIN_BYTES 256
+#define STORAGE_DICTIONARY_SIZE 32768
+#define STORAGE_TRAINING_SAMPLES 1000
+#define STORAGE_TRAINING_MIN_ROWS 50
+#define STORAGE_TOKEN_TABLE_SIZE 65536
+#define STORAGE_TOKEN_MAX_LENGTH 256
+#define NAME_DICTIONARY_BUCKETS 1024
+#define INGEST_CHUNK_ITEMS 1000
+#define INGEST_ERROR_SIZE 256
+#define IMPORT_LOOKAHEAD_FILES 64
+#define EXPORT_CATEGORY_DEPTH 8
 
 // Ulfius framework uses signature methods in order to identify endpoints,
 // mark parameters as unused if necessary
 #define UNUSED(x) (void)(x)
 
-// Connection pool structure
+// Turn a numeric macro into a string literal for SQL text
+#define STRINGIFY_VALUE(x) #x
+#define STRINGIFY(x) STRINGIFY_VALUE(x)
+
+// Prepared statement cache entry, keyed by the exact SQL text
+typedef struct {
+    char *sql;
+    unsigned long hash;
+    sqlite3_stmt *stmt;
+    int in_use;
+    unsigned long last_used;
+} stmt_cache_entry_t;
+
+// Prepared statement cache owned by a single pooled connection.
+// Only the thread currently holding the connection touches it, so no locking is needed.
+typedef struct {
+    sqlite3 *db;
+    stmt_cache_entry_t entries[STMT_CACHE_SIZE];
+    unsigned long tick;
+} stmt_cache_t;
+
+// Statement cache counters, shared by all connections
+typedef struct {
+    atomic_ulong hits;
+    atomic_ulong misses;
+    atomic_ulong evictions;
+} stmt_cache_stats_t;
+
+// Cached search total, valid while data_version has not moved
+typedef struct {
+    char key[COUNT_CACHE_KEY_SIZE];
+    unsigned long hash;
+    unsigned long version;
+    int count;
+    int valid;
+} count_cache_entry_t;
+
+// Direct-mapped search total cache shared by all request threads
+typedef struct {
+    pthread_mutex_t mutex;
+    count_cache_entry_t entries[COUNT_CACHE_SIZE];
+    atomic_ulong hits;
+    atomic_ulong misses;
+} count_cache_t;
+
+// Content codings a cached body can be sent with, identity is the body itself
+typedef enum {
+    ENCODING_IDENTITY,
+    ENCODING_GZIP,
+    ENCODING_BROTLI,
+    ENCODING_COUNT
+} content_encoding_t;
+
+// Compressed copies of a body, NULL where a coding is unavailable or would not make it smaller
+typedef struct {
+    char *data[ENCODING_COUNT];
+    size_t length[ENCODING_COUNT];
+} encoded_bodies_t;
+
+// Cached GET response, only served while data_version still equals version.
+// headers holds the response headers as consecutive NUL terminated name/value pairs.
+typedef struct response_cache_entry {
+    char *key;
+    unsigned long hash;
+    unsigned long version;
+    long status;
+    char *body;
+    size_t body_length;
+    encoded_bodies_t encoded;
+    char *headers;
+    size_t headers_length;
+    size_t size;
+    struct response_cache_entry *bucket_next;
+    struct response_cache_entry *lru_prev;
+    struct response_cache_entry *lru_next;
+} response_cache_entry_t;
+
+// One shard of the response cache: a chained hash table plus an LRU list, most recent first
+typedef struct {
+    pthread_mutex_t mutex;
+    response_cache_entry_t *buckets[RESPONSE_CACHE_BUCKETS];
+    response_cache_entry_t *lru_head;
+    response_cache_entry_t *lru_tail;
+    size_t bytes;
+    size_t entries;
+} response_cache_shard_t;
+
+// Response cache shared by all request threads, a key always maps to the same shard
+typedef struct {
+    response_cache_shard_t shards[RESPONSE_CACHE_SHARDS];
+    atomic_ulong hits;
+    atomic_ulong misses;
+    atomic_ulong stores;
+    atomic_ulong evictions;
+    atomic_ulong not_modified;
+    atomic_ulong compressed;
+} response_cache_t;
+
+// Key, data version and modification time captured by the lookup callback for the store callback.
+// key is empty when the response is not to be cached.
+typedef struct {
+    unsigned long hash;
+    unsigned long version;
+    long long modified;
+    char key[];
+} response_cache_pending_t;
+
+// Append-only JSON writer for the hot list and detail endpoints. The whole response is written
+// into one growing buffer, stored JSON columns are copied in verbatim instead of being parsed.
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+    int failed;
+    int depth;
+    int has_members[JSON_WRITER_MAX_DEPTH];
+} json_writer_t;
+
+// Preset dictionary of compressed template columns, immutable once stored
+typedef struct {
+    int id;
+    unsigned char *data;
+    size_t length;
+} storage_dictionary_t;
+
+// Dictionaries loaded so far, shared by all connections. Each is allocated on its own and only ever
+// appended, so a pointer to one stays valid after the lock is released and the array grows.
+typedef struct {
+    pthread_mutex_t mutex;
+    storage_dictionary_t **dictionaries;
+    int count;
+    int capacity;
+    atomic_int active_id;
+    atomic_int enabled;
+    atomic_ulong compressed;
+    atomic_ulong inflated;
+    atomic_ulong failures;
+} storage_t;
+
+// A repeated quoted string seen while training a dictionary
+typedef struct {
+    const char *text;
+    size_t length;
+    unsigned long hash;
+    int count;
+} storage_token_t;
+
+// A name known to map to a row id, with the parent of categories (0 for users and root categories)
+typedef struct name_entry {
+    char *name;
+    int id;
+    int parent_id;
+    struct name_entry *next;
+} name_entry_t;
+
+// Process-wide name -> id map of a small table only written through the writer connection.
+// Loaded on first use, kept current on insert and dropped on rollback, so it never names an uncommitted row.
+typedef struct {
+    pthread_rwlock_t lock;
+    const char *load_sql;
+    name_entry_t *buckets[NAME_DICTIONARY_BUCKETS];
+    int loaded;
+    int entries;
+    atomic_ulong hits;
+    atomic_ulong misses;
+} name_dictionary_t;
+
+// A template of the catalog snapshot, one allocation holding its category ids and strings.
+// Templates a write batch did not touch are shared by consecutive snapshots, refs counts them
+// and is only ever changed by the writer thread.
+typedef struct {
+    int refs;
+    int id;
+    int user_id;
+    int total_views;
+    int has_price;
+    double price;
+    const char *name;
+    const char *purchase_url;
+    const char *description;
+    const char *created_at;
+    const char *nodes;
+    int category_count;
+    int category_ids[];
+} catalog_template_t;
+
+typedef struct {
+    int id;
+    int parent;
+    const char *name;
+    const char *icon;
+    const char *json;
+} catalog_category_t;
+
+typedef struct {
+    int id;
+    int verified;
+    const char *name;
+    const char *username;
+    const char *bio;
+    const char *links;
+    const char *avatar;
+} catalog_user_t;
+
+typedef struct {
+    int id;
+    int rank;
+    int has_total_views;
+    int total_views;
+    const char *name;
+    const char *description;
+    const char *created_at;
+    int first_workflow;
+    int workflow_count;
+    int first_category;
+    int category_count;
+} catalog_collection_t;
+
+// 2^16 ids of a bitmap sharing their high 16 bits: a sorted array of the low bits while there are
+// at most CATALOG_ARRAY_CONTAINER_MAX of them, one bit per id beyond that
+typedef struct {
+    int key;
+    int cardinality;
+    int capacity;
+    uint16_t *values;
+    uint64_t *words;                     // CATALOG_BITMAP_WORDS of them, NULL for an array
+} catalog_container_t;
+
+// Set of template ids in the layout of a roaring bitmap, containers in key order. Bitmaps of
+// categories no template of a write batch was in are shared by consecutive snapshots, like templates.
+typedef struct {
+    int refs;
+    int cardinality;
+    catalog_container_t *containers;
+    int container_count;
+    int container_capacity;
+} catalog_bitmap_t;
+
+// Matching templates of a category, for ordering the facets of a search
+typedef struct {
+    int index;
+    int count;
+} catalog_facet_t;
+
+// Names and descriptions of the templates whose ids share their bits above CATALOG_TEXT_SEGMENT_BITS,
+// ASCII letters folded to lower case as LIKE compares them. Row i is text[offsets[i]..offsets[i + 1]):
+// the name, a NUL, the description and a NUL. One allocation, shared by consecutive snapshots while
+// no template of its id range changes.
+typedef struct {
+    int refs;
+    int key;
+    int count;
+    int *ids;
+    unsigned char *nulls;                // CATALOG_NULL_NAME and CATALOG_NULL_DESCRIPTION of each row
+    size_t *offsets;
+    char *text;
+} catalog_text_segment_t;
+
+// Block of a snapshot's string arena, strings never move once copied in
+typedef struct catalog_block {
+    struct catalog_block *next;
+    size_t used;
+    size_t size;
+    char data[];
+} catalog_block_t;
+
+// Open addressing set of the strings interned while a snapshot is built
+typedef struct {
+    const char **slots;
+    size_t capacity;
+    size_t count;
+} catalog_interner_t;
+
+// Immutable copy of everything the listing endpoints read. Arrays are kept in the order the
+// endpoints list them or search them by. Strings of the small tables are interned in one arena.
+typedef struct {
+    catalog_template_t **templates;      // by id
+    int template_count;
+    catalog_category_t *categories;      // by name, parent is an index into it or -1
+    int *categories_by_id;               // indexes into categories, by category id
+    catalog_bitmap_t **category_templates; // template ids of each of categories
+    int category_count;
+    catalog_user_t *users;               // by id
+    int user_count;
+    catalog_collection_t *collections;   // by rank, name and id
+    int collection_count;
+    int *collection_workflows;           // template ids, contiguous per collection
+    int *collection_categories;          // category ids, contiguous per collection
+    catalog_text_segment_t **text_segments; // by key
+    int text_segment_count;
+    size_t text_bytes;
+    catalog_block_t *strings;
+    unsigned long version;               // counters.data_version of the database state it was read from
+} catalog_t;
+
+// The published snapshot. Readers register in the reader count of the epoch's parity and never
+// block; the writer swaps the pointer, moves the epoch on and waits for the old parity to drain
+// before freeing the snapshot it replaced.
+typedef struct {
+    _Atomic(catalog_t *) current;
+    atomic_uint epoch;
+    atomic_long readers[2];
+    int *changed;                        // templates of the write batch being committed, writer thread only
+    int changed_count;
+    int changed_capacity;
+    atomic_ulong reads;
+    atomic_ulong publishes;
+    atomic_ulong reloaded_templates;
+    atomic_ulong rebuilt_bitmaps;
+    atomic_ulong scans;
+    atomic_ulong parallel_scans;
+    atomic_ulong failures;
+    int unsaved;                         // published since CATALOG_FILE was written, writer thread only
+    int mapped;                          // the first snapshot came from CATALOG_FILE
+    double load_ms;
+    atomic_ulong saves;
+} catalog_state_t;
+
+// Workers of large substring scans. A scan queues all its parts but the first and runs that one itself,
+// then takes back whichever of its parts no worker has picked yet, so a busy pool never stalls a search.
+typedef struct {
+    pthread_t threads[SCAN_THREADS > 1 ? SCAN_THREADS - 1 : 1];
+    int thread_count;
+    int running;
+    pthread_mutex_t mutex;
+    pthread_cond_t work_cond;
+    pthread_cond_t done_cond;
+    struct catalog_scan *head;
+    struct catalog_scan **tail;
+} scan_pool_t;
+
+// Start of CATALOG_FILE. The sections follow in a fixed order: the string arena, templates, categories,
+// users, collections, category bitmaps and text segments, in the machine's own byte order. Pointers
+// are stored as offsets, strings of the small tables into the arena, CATALOG_FILE_NULL for NULL.
+typedef struct {
+    char magic[8];
+    uint32_t format;
+    uint32_t byte_order;                 // CATALOG_FILE_BYTE_ORDER as written, files of other machines differ
+    uint64_t database_id;
+    uint64_t data_version;
+    uint64_t size;                       // of the whole file, a shorter one was cut off
+    uint64_t checksum;                   // catalog_file_checksum() of everything after the header
+    uint64_t strings_size;
+    uint32_t template_count;
+    uint32_t category_count;
+    uint32_t user_count;
+    uint32_t collection_count;
+    uint32_t collection_workflow_count;
+    uint32_t collection_category_count;
+    uint32_t text_segment_count;
+    uint32_t text_segment_bits;
+    uint32_t word_size;                  // sizeof(size_t), the width of text segment offsets
+} catalog_file_header_t;
+
+// What a GET of a cached endpoint counts a view of
+typedef enum {
+    VIEW_NONE,
+    VIEW_TEMPLATE,
+    VIEW_COLLECTION
+} view_kind_t;
+
+// Views of one template or collection. key is 0 while the slot is free, then kind << 32 | id.
+typedef struct {
+    atomic_uint_fast64_t key;
+    atomic_uint count;
+} view_slot_t;
+
+// Views recorded by the request threads assigned to a shard, into the table of the current epoch's
+// parity. Like catalog readers, recorders register in the shard's reader count of that parity, so
+// the flusher can move the epoch on and wait for the old table to be left alone before draining it.
+typedef struct {
+    atomic_long readers[2];
+    atomic_ulong recorded;
+    atomic_ulong dropped;                // the table had no free slot near the key's
+    view_slot_t slots[2][VIEW_COUNTER_SLOTS];
+} view_shard_t;
+
+// Views of one template or collection taken from the shards by a flush
+typedef struct {
+    uint64_t key;
+    unsigned int count;
+} view_count_t;
+
+// The view flusher thread and its counters
 typedef struct {
-    sqlite3 *connections[MAX_CONNECTIONS];
-    int available[MAX_CONNECTIONS];
+    pthread_t thread;
     pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int running;
+    atomic_uint epoch;
+    atomic_uint threads;                 // request threads given a shard so far
+    atomic_ulong flushes;
+    atomic_ulong flushed;
+    atomic_ulong failed_flushes;
+} view_counters_t;
+
+// Outcome of template writes
+typedef struct {
+    atomic_ulong inserted;
+    atomic_ulong updated;
+    atomic_ulong unchanged;
+} template_write_stats_t;
+
+// Bulk ingest counters
+typedef struct {
+    atomic_ulong requests;
+    atomic_ulong items;
+    atomic_ulong failed_items;
+} ingest_stats_t;
+
+// Rendered template counters
+typedef struct {
+    atomic_ulong hits;
+    atomic_ulong misses;
+    atomic_ulong renders;
+} render_stats_t;
+
+// Connection pool structure.
+// Free connections are kept in a lock-free stack of slot indexes. The head packs
+// a modification tag in the upper 32 bits (against ABA) and slot + 1 in the lower
+// 32 bits, 0 meaning empty. The semaphore counts free slots so callers can wait.
+typedef struct {
+    sqlite3 *connections[POOL_SIZE];
+    stmt_cache_t caches[POOL_SIZE];
+    atomic_uint_fast32_t next_free[POOL_SIZE];
+    atomic_uint_fast64_t free_head;
+    sem_t free_count;
     int pool_size;
 } db_pool_t;
 
-// Global connection pool
+// Connection pool counters
+typedef struct {
+    atomic_ulong acquisitions;
+    atomic_ulong waits;
+    atomic_ulong timeouts;
+    atomic_long in_use;
+    atomic_long peak_in_use;
+} db_pool_stats_t;
+
+// A unit of work executed by the writer thread inside its current transaction.
+// run() returns 0 on success, anything else marks the job as failed.
+typedef struct write_job {
+    int (*run)(sqlite3 *db, void *arg);
+    void *arg;
+    int result;
+    int done;
+    struct write_job *next;
+} write_job_t;
+
+// The single writer connection and its job queue.
+// All mutations are funnelled through it so readers never contend for the write lock.
+typedef struct {
+    sqlite3 *db;
+    stmt_cache_t cache;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t queue_cond;
+    pthread_cond_t done_cond;
+    write_job_t *head;
+    write_job_t *tail;
+    int queued;
+    int running;
+} db_writer_t;
+
+// Writer counters
+typedef struct {
+    atomic_ulong jobs;
+    atomic_ulong failed_jobs;
+    atomic_ulong commits;
+    atomic_ulong failed_commits;
+    atomic_ulong rolled_back_jobs;
+    atomic_ulong largest_batch;
+} db_writer_stats_t;
+
+// Global connection pool (read-only connections) and writer
 static db_pool_t pool = {0};
+static db_pool_stats_t pool_stats = {0};
+static db_writer_t writer = {0};
+static db_writer_stats_t writer_stats = {0};
+
+// Cleared when SQLite lacks FTS5, search then falls back to LIKE scans
+static atomic_int search_index_available = 0;
+
+// Mirror of counters.data_version, published after each commit so readers can key caches on it
+static atomic_ulong data_version = 0;
+// Second of the last commit times two, plus one when several commits shared that second
+static atomic_llong data_modified_at = 0;
+// Random per database, keeps ETags from matching across a recreated database
+static unsigned long database_id = 0;
+static count_cache_t count_cache = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+static response_cache_t response_cache = {0};
+static ingest_stats_t ingest_stats = {0};
+static template_write_stats_t template_write_stats = {0};
+static name_dictionary_t category_dictionary = { .lock = PTHREAD_RWLOCK_INITIALIZER, .load_sql = "SELECT name, id, parent_id FROM categories;" };
+static name_dictionary_t user_dictionary = { .lock = PTHREAD_RWLOCK_INITIALIZER, .load_sql = "SELECT username, id, 0 FROM users;" };
+static storage_t storage = { .mutex = PTHREAD_MUTEX_INITIALIZER, .enabled = STORAGE_COMPRESSION };
+static render_stats_t render_stats = {0};
+static catalog_state_t catalog = {0};
+static scan_pool_t scan_pool = { .mutex = PTHREAD_MUTEX_INITIALIZER, .work_cond = PTHREAD_COND_INITIALIZER,
+                                 .done_cond = PTHREAD_COND_INITIALIZER, .tail = &scan_pool.head };
+static view_counters_t view_counters = {0};
+static view_shard_t view_shards[VIEW_COUNTER_SHARDS];
+static stmt_cache_stats_t stmt_cache_stats = {0};
 
 // Forward declarations
 int callback_options(const struct _u_request *request, struct _u_response *response, void *user_data);
@@ -78,530 +779,5420 @@ int callback_get_collection_by_id(const struct _u_request *request, struct _u_re
 int callback_search_templates(const struct _u_request *request, struct _u_response *response, void *user_data);
 int callback_get_workflow_by_id(const struct _u_request *request, struct _u_response *response, void *user_data);
 int callback_create_workflow(const struct _u_request *request, struct _u_response *response, void *user_data);
+int callback_delete_workflow(const struct _u_request *request, struct _u_response *response, void *user_data);
 int callback_get_all_workflows(const struct _u_request *request, struct _u_response *response, void *user_data);
 int callback_create_collection(const struct _u_request *request, struct _u_response *response, void *user_data);
 int callback_add_workflow_to_collection(const struct _u_request *request, struct _u_response *response, void *user_data);
 int callback_get_workflow_for_import(const struct _u_request *request, struct _u_response *response, void *user_data);
+int callback_get_metrics(const struct _u_request *request, struct _u_response *response, void *user_data);
+int callback_response_cache_lookup(const struct _u_request *request, struct _u_response *response, void *user_data);
+int callback_response_cache_store(const struct _u_request *request, struct _u_response *response, void *user_data);
+
+// Database writer
+int start_db_writer();
+void stop_db_writer();
+int submit_write_job(int (*run)(sqlite3 *db, void *arg), void *arg);
+void deadline_after_ms(struct timespec *deadline, long ms);
+int migrate_schema(sqlite3 *db);
+int load_counters(sqlite3 *db);
+int migrate_render_store(sqlite3 *db);
+int migrate_collection_items(sqlite3 *db);
+int render_queued_templates(sqlite3 *db);
+int drain_render_queue(sqlite3 *db);
+int register_storage_functions(sqlite3 *db);
+int load_storage(sqlite3 *db);
+int compare_ints(const void *a, const void *b);
+void publish_catalog(sqlite3 *db);
+void discard_catalog_changes();
+void save_pending_catalog();
+int like_match(const char *pattern, const char *text);
+
+// Push a slot onto the lock-free free list
+void pool_push_free_slot(int slot) {
+    uint_fast64_t head = atomic_load(&pool.free_head);
+    uint_fast64_t new_head;
+    do {
+        atomic_store(&pool.next_free[slot], (uint_fast32_t)(head & 0xFFFFFFFFu));
+        new_head = (((head >> 32) + 1) << 32) | (uint_fast64_t)(slot + 1);
+    } while (!atomic_compare_exchange_weak(&pool.free_head, &head, new_head));
+}
+
+// Pop a slot from the lock-free free list, -1 if it is empty
+int pool_pop_free_slot() {
+    uint_fast64_t head = atomic_load(&pool.free_head);
+    uint_fast64_t new_head;
+    do {
+        uint_fast32_t top = (uint_fast32_t)(head & 0xFFFFFFFFu);
+        if (top == 0) {
+            return -1;
+        }
+        new_head = (((head >> 32) + 1) << 32) | atomic_load(&pool.next_free[top - 1]);
+    } while (!atomic_compare_exchange_weak(&pool.free_head, &head, new_head));
+    return (int)(head & 0xFFFFFFFFu) - 1;
+}
 
-// Initialize connection pool
+// Initialize the writer and the read-only connection pool
 int init_database() {
-    if (pthread_mutex_init(&pool.mutex, NULL) != 0) {
-        fprintf(stderr, "Failed to initialize mutex\n");
+    // The writer goes first: it creates the WAL files the read-only connections rely on
+    if (start_db_writer() != 0) {
+        return -1;
+    }
+
+    if (sem_init(&pool.free_count, 0, 0) != 0) {
+        fprintf(stderr, "Failed to initialize pool semaphore\n");
+        stop_db_writer();
         return -1;
     }
     
-    for (int i = 0; i < MAX_CONNECTIONS; i++) {
-        int rc = sqlite3_open(DATABASE_FILE, &pool.connections[i]);
+    for (int i = 0; i < POOL_SIZE; i++) {
+        int rc = sqlite3_open_v2(DATABASE_FILE, &pool.connections[i], SQLITE_OPEN_READONLY, NULL);
         if (rc) {
             fprintf(stderr, "Can't open database connection %d: %s\n", i, sqlite3_errmsg(pool.connections[i]));
             // Clean up already opened connections
-            for (int j = 0; j < i; j++) {
+            for (int j = 0; j <= i; j++) {
                 sqlite3_close(pool.connections[j]);
+                pool.connections[j] = NULL;
             }
-            pthread_mutex_destroy(&pool.mutex);
+            sem_destroy(&pool.free_count);
+            stop_db_writer();
             return -1;
         }
         
-        // Configure each connection
-        sqlite3_exec(pool.connections[i], "PRAGMA journal_mode=WAL;", NULL, NULL, NULL);
-        sqlite3_exec(pool.connections[i], "PRAGMA foreign_keys=ON;", NULL, NULL, NULL);
-        sqlite3_exec(pool.connections[i], "PRAGMA synchronous=NORMAL;", NULL, NULL, NULL);
+        // Configure each connection, journal mode and foreign keys are the writer's business
+        sqlite3_busy_timeout(pool.connections[i], DB_BUSY_TIMEOUT_MS);
+        sqlite3_exec(pool.connections[i], "PRAGMA query_only=ON;", NULL, NULL, NULL);
         sqlite3_exec(pool.connections[i], "PRAGMA cache_size=10000;", NULL, NULL, NULL);
         sqlite3_exec(pool.connections[i], "PRAGMA temp_store=MEMORY;", NULL, NULL, NULL);
+        register_storage_functions(pool.connections[i]);
         
-        pool.available[i] = 1;
+        pool.caches[i].db = pool.connections[i];
         pool.pool_size++;
     }
     
-    printf("Database connection pool initialized successfully with %d connections\n", pool.pool_size);
+    // Publish the connections only once all of them are open
+    for (int i = pool.pool_size - 1; i >= 0; i--) {
+        pool_push_free_slot(i);
+        sem_post(&pool.free_count);
+    }
+    
+    printf("Database connection pool initialized successfully with %d read-only connections and 1 writer\n", pool.pool_size);
     return 0;
 }
 
-// Get a connection from the pool
+// Get a connection from the pool, waiting up to POOL_WAIT_TIMEOUT_MS when all are busy.
+// Returns NULL on timeout, callers answer with an error instead of opening extra connections.
 sqlite3* get_db_connection() {
-    pthread_mutex_lock(&pool.mutex);
-    
-    for (int i = 0; i < MAX_CONNECTIONS; i++) {
-        if (pool.available[i]) {
-            pool.available[i] = 0;
-            pthread_mutex_unlock(&pool.mutex);
-            return pool.connections[i];
+    if (sem_trywait(&pool.free_count) != 0) {
+        atomic_fetch_add(&pool_stats.waits, 1);
+
+        struct timespec deadline;
+        deadline_after_ms(&deadline, POOL_WAIT_TIMEOUT_MS);
+
+        int rc;
+        while ((rc = sem_timedwait(&pool.free_count, &deadline)) != 0 && errno == EINTR) {
+            // Interrupted by a signal, keep waiting
+        }
+        if (rc != 0) {
+            atomic_fetch_add(&pool_stats.timeouts, 1);
+            fprintf(stderr, "get_db_connection: no connection available after %d ms\n", POOL_WAIT_TIMEOUT_MS);
+            return NULL;
         }
     }
-    
-    pthread_mutex_unlock(&pool.mutex);
-    
-    // No connections available, fallback to creating a new one
-    sqlite3 *db;
-    int rc = sqlite3_open(DATABASE_FILE, &db);
-    if (rc) {
-        fprintf(stderr, "Fallback connection failed: %s\n", sqlite3_errmsg(db));
-        sqlite3_close(db);
+
+    // The semaphore guarantees a free slot is on the stack
+    int slot = pool_pop_free_slot();
+    if (slot < 0) {
+        sem_post(&pool.free_count);
         return NULL;
     }
-    
-    sqlite3_exec(db, "PRAGMA journal_mode=WAL;", NULL, NULL, NULL);
-    sqlite3_exec(db, "PRAGMA foreign_keys=ON;", NULL, NULL, NULL);
-    sqlite3_exec(db, "PRAGMA synchronous=NORMAL;", NULL, NULL, NULL);
-    
-    return db;
+
+    atomic_fetch_add(&pool_stats.acquisitions, 1);
+    long in_use = atomic_fetch_add(&pool_stats.in_use, 1) + 1;
+    long peak = atomic_load(&pool_stats.peak_in_use);
+    while (in_use > peak && !atomic_compare_exchange_weak(&pool_stats.peak_in_use, &peak, in_use)) {
+        // Another thread raised the peak, retry with its value
+    }
+
+    return pool.connections[slot];
 }
 
 // Return a connection to the pool
 void return_db_connection(sqlite3 *db) {
     if (!db) return;
     
-    pthread_mutex_lock(&pool.mutex);
-    
-    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+    for (int i = 0; i < pool.pool_size; i++) {
         if (pool.connections[i] == db) {
-            pool.available[i] = 1;
-            pthread_mutex_unlock(&pool.mutex);
+            atomic_fetch_sub(&pool_stats.in_use, 1);
+            pool_push_free_slot(i);
+            sem_post(&pool.free_count);
             return;
         }
     }
     
-    pthread_mutex_unlock(&pool.mutex);
-    
-    // This was a fallback connection, close it
-    sqlite3_close(db);
+    fprintf(stderr, "return_db_connection: connection does not belong to the pool\n");
+}
+
+// Finalize every statement held by a cache, must run before closing its connection
+void clear_stmt_cache(stmt_cache_t *cache) {
+    for (int i = 0; i < STMT_CACHE_SIZE; i++) {
+        stmt_cache_entry_t *entry = &cache->entries[i];
+        if (entry->stmt) {
+            sqlite3_finalize(entry->stmt);
+        }
+        free(entry->sql);
+        memset(entry, 0, sizeof(*entry));
+    }
+    cache->tick = 0;
 }
 
-// Clean up the connection pool
+// Clean up the connection pool, no connection may be checked out at this point
 void cleanup_db_pool() {
-    pthread_mutex_lock(&pool.mutex);
-    
-    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+    for (int i = 0; i < pool.pool_size; i++) {
         if (pool.connections[i]) {
+            clear_stmt_cache(&pool.caches[i]);
             sqlite3_close(pool.connections[i]);
             pool.connections[i] = NULL;
         }
     }
     
-    pthread_mutex_unlock(&pool.mutex);
-    pthread_mutex_destroy(&pool.mutex);
+    pool.pool_size = 0;
+    atomic_store(&pool.free_head, 0);
+    sem_destroy(&pool.free_count);
+
+    stop_db_writer();
 }
 
-// Utility function to parse integer parameter with default
-int get_int_param(const struct _u_request *request, const char *param_name, int default_value) {
-    const char *param_str = u_map_get(request->map_url, param_name);
-    if (param_str && strlen(param_str) > 0) {
-        int value = atoi(param_str);
-        return value > 0 ? value : default_value;
+// djb2 string hash, used to skip full SQL comparisons on cache lookups
+unsigned long hash_string(const char *str) {
+    unsigned long hash = 5381;
+    int c;
+    while ((c = (unsigned char)*str++)) {
+        hash = ((hash << 5) + hash) + c;
     }
-    return default_value;
+    return hash;
 }
 
-// Get or create user if user does not exist
-int get_or_create_user(sqlite3 *db, json_t *user_json) {
-    if (!db) {
-        fprintf(stderr, "get_or_create_user ERROR: Invalid database.\n");
-        return 0;
+// djb2 over a buffer that may hold NUL bytes
+unsigned long hash_bytes(const char *data, size_t length) {
+    unsigned long hash = 5381;
+    for (size_t i = 0; i < length; i++) {
+        hash = ((hash << 5) + hash) + (unsigned char)data[i];
     }
+    return hash;
+}
 
-    if (!json_is_object(user_json)) {
-        fprintf(stderr, "get_or_create_user ERROR: Invalid input.\n");
-        return 0;
+// 64-bit FNV-1a of one field, chained from hash. The length goes in first so that field
+// boundaries count, and NULL (data == NULL) hashes differently from an empty string.
+uint64_t hash_field(uint64_t hash, const void *data, size_t length) {
+    const unsigned char *bytes = data;
+    uint64_t marker = data ? (uint64_t)length : UINT64_MAX;
+    for (int i = 0; i < 8; i++) {
+        hash = (hash ^ ((marker >> (i * 8)) & 0xFF)) * 0x100000001b3ULL;
     }
-
-    /*
-    const char *username = json_string_value(json_object_get(user_json, "username"));
-    if (!username || strlen(username) == 0) {
-        fprintf(stderr, "get_or_create_user ERROR: 'username' is a required field in the user object.\n");
-        return 0; // Username is mandatory for lookup or creation
+    for (size_t i = 0; data && i < length; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
     }
-    */
-
-   const char *username = "Default API User";
+    return hash;
+}
 
-    int user_id = 1;
+uint64_t hash_text_field(uint64_t hash, const char *text) {
+    return hash_field(hash, text, text ? strlen(text) : 0);
+}
 
-    // Check if user already exists
-    const char *user_check_sql = "SELECT id FROM users WHERE username = ?;";
-    sqlite3_stmt *user_stmt;
-    if (sqlite3_prepare_v2(db, user_check_sql, -1, &user_stmt, 0) != SQLITE_OK) {
-        fprintf(stderr, "get_or_create_user ERROR: Failed to prepare user check statement: %s\n", sqlite3_errmsg(db));
-        return 0;
+// Find the statement cache attached to a pooled connection
+stmt_cache_t* get_stmt_cache(sqlite3 *db) {
+    if (writer.cache.db == db) {
+        return &writer.cache;
     }
+    for (int i = 0; i < pool.pool_size; i++) {
+        if (pool.caches[i].db == db) {
+            return &pool.caches[i];
+        }
+    }
+    return NULL;
+}
 
-    sqlite3_bind_text(user_stmt, 1, username, -1, SQLITE_STATIC);
-    int step_result = sqlite3_step(user_stmt);
+// Get a prepared statement for sql, compiling it only the first time it is seen on this connection.
+// Dynamic queries are cached by their final text, so every query shape gets its own entry.
+// The statement must be handed back with release_cached_statement() instead of sqlite3_finalize().
+sqlite3_stmt* prepare_cached_statement(sqlite3 *db, const char *sql) {
+    stmt_cache_t *cache = get_stmt_cache(db);
+    sqlite3_stmt *stmt = NULL;
+
+    if (cache) {
+        unsigned long hash = hash_string(sql);
+        for (int i = 0; i < STMT_CACHE_SIZE; i++) {
+            stmt_cache_entry_t *entry = &cache->entries[i];
+            if (entry->stmt && !entry->in_use && entry->hash == hash && strcmp(entry->sql, sql) == 0) {
+                entry->in_use = 1;
+                entry->last_used = ++cache->tick;
+                atomic_fetch_add(&stmt_cache_stats.hits, 1);
+                return entry->stmt;
+            }
+        }
+    }
 
-    if (step_result == SQLITE_ROW) {
-        user_id = sqlite3_column_int(user_stmt, 0);
-        sqlite3_finalize(user_stmt); // Clean up immediately
-    } else if (step_result == SQLITE_DONE) {
-        // User does not exist, so create them
-        sqlite3_finalize(user_stmt); // Clean up check statement
+    atomic_fetch_add(&stmt_cache_stats.misses, 1);
+    if (sqlite3_prepare_v3(db, sql, -1, cache ? SQLITE_PREPARE_PERSISTENT : 0, &stmt, NULL) != SQLITE_OK) {
+        sqlite3_finalize(stmt);
+        return NULL;
+    }
 
-        const char *user_name = json_string_value(json_object_get(user_json, "name"));
-        const char *user_bio = json_string_value(json_object_get(user_json, "bio"));
-        json_t *verified_json = json_object_get(user_json, "verified");
-        json_t *links_json = json_object_get(user_json, "links");
-        const char *avatar = json_string_value(json_object_get(user_json, "avatar"));
+    if (cache) {
+        // Take a free slot, or evict the least recently used idle statement
+        stmt_cache_entry_t *slot = NULL;
+        for (int i = 0; i < STMT_CACHE_SIZE; i++) {
+            stmt_cache_entry_t *entry = &cache->entries[i];
+            if (!entry->stmt) {
+                slot = entry;
+                break;
+            }
+            if (!entry->in_use && (!slot || entry->last_used < slot->last_used)) {
+                slot = entry;
+            }
+        }
 
-        const char *create_user_sql = "INSERT INTO users (name, username, bio, verified, links, avatar) VALUES (?, ?, ?, ?, ?, ?);";
-        sqlite3_stmt *create_stmt;
-        if (sqlite3_prepare_v2(db, create_user_sql, -1, &create_stmt, 0) == SQLITE_OK) {
-            sqlite3_bind_text(create_stmt, 1, user_name ? user_name : username, -1, SQLITE_STATIC);
-            sqlite3_bind_text(create_stmt, 2, username, -1, SQLITE_STATIC);
-            sqlite3_bind_text(create_stmt, 3, user_bio ? user_bio : "", -1, SQLITE_STATIC);
-            sqlite3_bind_int(create_stmt, 4, json_is_true(verified_json) ? 1 : 0);
-            
-            char *links_str = links_json ? json_dumps(links_json, JSON_COMPACT) : NULL;
-            sqlite3_bind_text(create_stmt, 5, links_str ? links_str : "[]", -1, SQLITE_TRANSIENT);
-            
-            sqlite3_bind_text(create_stmt, 6, avatar ? avatar : "", -1, SQLITE_STATIC);
-            
-            if (sqlite3_step(create_stmt) == SQLITE_DONE) {
-                user_id = sqlite3_last_insert_rowid(db);
-            } else {
-                 fprintf(stderr, "get_or_create_user ERROR: Failed to insert new user: %s\n", sqlite3_errmsg(db));
+        if (slot) {
+            char *sql_copy = strdup(sql);
+            if (sql_copy) {
+                if (slot->stmt) {
+                    sqlite3_finalize(slot->stmt);
+                    free(slot->sql);
+                    atomic_fetch_add(&stmt_cache_stats.evictions, 1);
+                }
+                slot->sql = sql_copy;
+                slot->hash = hash_string(sql);
+                slot->stmt = stmt;
+                slot->in_use = 1;
+                slot->last_used = ++cache->tick;
             }
-            
-            sqlite3_finalize(create_stmt);
-            if (links_str) free(links_str);
-        } else {
-             fprintf(stderr, "get_or_create_user ERROR: Failed to prepare create user statement: %s\n", sqlite3_errmsg(db));
         }
-    } else {
-        // An actual error occurred during the SELECT step
-        fprintf(stderr, "get_or_create_user ERROR: Failed to step on user check statement: %s\n", sqlite3_errmsg(db));
-        sqlite3_finalize(user_stmt);
     }
-    
-    return user_id;
+
+    return stmt;
 }
 
-// Get or create category if user does not exist
-int get_or_create_category(sqlite3 *db, json_t *category_json) {
-    if (!db || !json_is_object(category_json)) {
-        return 0;
+// Hand a statement back to the cache, or finalize it if it was never cached
+void release_cached_statement(sqlite3 *db, sqlite3_stmt *stmt) {
+    if (!stmt) return;
+
+    stmt_cache_t *cache = get_stmt_cache(db);
+    if (cache) {
+        for (int i = 0; i < STMT_CACHE_SIZE; i++) {
+            if (cache->entries[i].stmt == stmt) {
+                sqlite3_reset(stmt);
+                sqlite3_clear_bindings(stmt);
+                cache->entries[i].in_use = 0;
+                return;
+            }
+        }
     }
 
-    const char *name = json_string_value(json_object_get(category_json, "name"));
-    if (!name || strlen(name) == 0) {
-        fprintf(stderr, "get_or_create_category: Category name is missing or empty.\n");
-        return 0; // Name is a required field
-    }
+    sqlite3_finalize(stmt);
+}
 
-    // Check if a category with this name already exists.
-    sqlite3_stmt *stmt;
-    const char *sql_select = "SELECT id FROM categories WHERE name = ?;";
-    if (sqlite3_prepare_v2(db, sql_select, -1, &stmt, 0) != SQLITE_OK) {
-        fprintf(stderr, "get_or_create_category: Failed to prepare select category statement: %s\n", sqlite3_errmsg(db));
-        return 0;
+// Run a statement without results from the statement cache
+int exec_cached_statement(sqlite3 *db, const char *sql) {
+    sqlite3_stmt *stmt = prepare_cached_statement(db, sql);
+    if (!stmt) {
+        return -1;
     }
-    sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+    int rc = sqlite3_step(stmt) == SQLITE_DONE ? 0 : -1;
+    release_cached_statement(db, stmt);
+    return rc;
+}
 
-    int category_id = 0;
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
-        category_id = sqlite3_column_int(stmt, 0);
+// Turn free text into an FTS5 query: every word becomes a quoted prefix term, all terms must match.
+// Returns the number of terms written, 0 when the text has nothing the index can match.
+int build_fts_query(const char *text, char *out, size_t out_size) {
+    size_t used = 0;
+    int terms = 0;
+    const unsigned char *p = (const unsigned char *)text;
+
+    out[0] = '\0';
+    while (*p) {
+        // Words are runs of ASCII letters, digits and any non-ASCII UTF-8 bytes
+        while (*p && *p < 0x80 && !isalnum(*p)) p++;
+        const unsigned char *start = p;
+        while (*p && (*p >= 0x80 || isalnum(*p))) p++;
+        size_t len = p - start;
+        if (len == 0) break;
+
+        // Room for the separator, quotes, prefix star and terminator
+        if (used + len + 5 > out_size) break;
+        used += snprintf(out + used, out_size - used, "%s\"%.*s\"*", terms > 0 ? " " : "", (int)len, (const char *)start);
+        terms++;
     }
-    sqlite3_finalize(stmt);
+    return terms;
+}
 
-    if (category_id > 0) {
-        return category_id; // Category already exists, return its ID.
+// Refill the full-text index from the templates table inside the caller's transaction,
+// returns the number of indexed templates or -1
+int fill_search_index(sqlite3 *db) {
+    if (sqlite3_exec(db, "DELETE FROM templates_fts;", NULL, NULL, NULL) != SQLITE_OK ||
+        sqlite3_exec(db, "INSERT INTO templates_fts (rowid, name, description) "
+                         "SELECT id, name, COALESCE(description, '') FROM templates;", NULL, NULL, NULL) != SQLITE_OK) {
+        fprintf(stderr, "fill_search_index: %s\n", sqlite3_errmsg(db));
+        return -1;
     }
+    return sqlite3_changes(db);
+}
 
-    // Category does not exist, so we need to create it.
-    // First, resolve the parent category if one is specified.
-    int parent_id = 0;
-    json_t *parent_json = json_object_get(category_json, "parent");
-    if (json_is_object(parent_json)) {
-        // Recursively call this function to get or create the parent.
-        parent_id = get_or_create_category(db, parent_json);
+// Refill the full-text index in a transaction of its own, returns the number of indexed templates or -1
+int rebuild_search_index(sqlite3 *db) {
+    if (sqlite3_exec(db, "BEGIN IMMEDIATE;", NULL, NULL, NULL) != SQLITE_OK) {
+        fprintf(stderr, "rebuild_search_index: BEGIN failed: %s\n", sqlite3_errmsg(db));
+        return -1;
+    }
+    
+    int indexed = fill_search_index(db);
+    if (indexed < 0) {
+        sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+        return -1;
+    }
+    if (sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL) != SQLITE_OK) {
+        fprintf(stderr, "rebuild_search_index: COMMIT failed: %s\n", sqlite3_errmsg(db));
+        sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+        return -1;
     }
+    return indexed;
+}
 
-    const char *icon = json_string_value(json_object_get(category_json, "icon"));
+// Whether the database has a table (or virtual table) of that name
+int table_exists(sqlite3 *db, const char *name) {
+    int exists = 0;
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(db, "SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = ?;", -1, &stmt, 0) == SQLITE_OK) {
+        sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+        exists = sqlite3_step(stmt) == SQLITE_ROW;
+        sqlite3_finalize(stmt);
+    }
+    return exists;
+}
 
-    // Prepare to insert the new category. We let the database handle the ID.
-    const char *sql_insert = "INSERT INTO categories (name, icon, parent_id) VALUES (?, ?, ?);";
-    if (sqlite3_prepare_v2(db, sql_insert, -1, &stmt, 0) != SQLITE_OK) {
-        fprintf(stderr, "get_or_create_category: Failed to prepare insert category statement: %s\n", sqlite3_errmsg(db));
+// Migration: create the full-text index and fill it. A SQLite built without FTS5 keeps the
+// database without one, search then falls back to LIKE.
+int migrate_search_index(sqlite3 *db) {
+    if (table_exists(db, "templates_fts")) {
         return 0;
     }
-
-    sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 2, icon ? icon : "🏷️", -1, SQLITE_STATIC); // Provide a default icon
-    if (parent_id > 0) {
-        sqlite3_bind_int(stmt, 3, parent_id);
-    } else {
-        sqlite3_bind_null(stmt, 3);
+    if (sqlite3_exec(db, SEARCH_INDEX_SCHEMA, NULL, NULL, NULL) != SQLITE_OK) {
+        fprintf(stderr, "Can't create full-text search index: %s\n", sqlite3_errmsg(db));
+        return 0;
     }
-
-    if (sqlite3_step(stmt) == SQLITE_DONE) {
-        category_id = sqlite3_last_insert_rowid(db);
-    } else {
-        // This could fail due to a race condition (another request inserted it).
-        // The UNIQUE constraint on 'name' would be violated. We can try selecting again.
-        fprintf(stderr, "get_or_create_category: Insert failed for '%s', retrying select. Error: %s\n", name, sqlite3_errmsg(db));
-        
-        const char *sql_reselect = "SELECT id FROM categories WHERE name = ?;";
-        sqlite3_stmt *reselect_stmt;
-        if (sqlite3_prepare_v2(db, sql_reselect, -1, &reselect_stmt, 0) == SQLITE_OK) {
-            sqlite3_bind_text(reselect_stmt, 1, name, -1, SQLITE_STATIC);
-            if (sqlite3_step(reselect_stmt) == SQLITE_ROW) {
-                category_id = sqlite3_column_int(reselect_stmt, 0);
-            }
-            sqlite3_finalize(reselect_stmt);
-        }
+    int indexed = fill_search_index(db);
+    if (indexed < 0) {
+        return -1;
     }
-    sqlite3_finalize(stmt);
+    printf("Created full-text search index with %d templates\n", indexed);
+    return 0;
+}
 
-    return category_id;
+// Keep the full-text entry of a template in sync, runs inside the caller's transaction
+int index_template_for_search(sqlite3 *db, int template_id, const char *name, const char *description) {
+    if (!atomic_load(&search_index_available)) {
+        return 0;
+    }
+    
+    sqlite3_stmt *delete_stmt = prepare_cached_statement(db, "DELETE FROM templates_fts WHERE rowid = ?;");
+    if (!delete_stmt) {
+        return -1;
+    }
+    sqlite3_bind_int(delete_stmt, 1, template_id);
+    int rc = sqlite3_step(delete_stmt);
+    release_cached_statement(db, delete_stmt);
+    if (rc != SQLITE_DONE) {
+        return -1;
+    }
+    
+    sqlite3_stmt *insert_stmt = prepare_cached_statement(db, "INSERT INTO templates_fts (rowid, name, description) VALUES (?, ?, ?);");
+    if (!insert_stmt) {
+        return -1;
+    }
+    sqlite3_bind_int(insert_stmt, 1, template_id);
+    sqlite3_bind_text(insert_stmt, 2, name ? name : "", -1, SQLITE_STATIC);
+    sqlite3_bind_text(insert_stmt, 3, description ? description : "", -1, SQLITE_STATIC);
+    rc = sqlite3_step(insert_stmt);
+    release_cached_statement(db, insert_stmt);
+    
+    return rc == SQLITE_DONE ? 0 : -1;
 }
 
-// Get categories for a template
-json_t* get_template_categories(sqlite3 *db, int template_id) {
-    const char *sql = "SELECT c.id, c.name FROM categories c "
-                      "JOIN template_categories tc ON c.id = tc.category_id "
-                      "WHERE tc.template_id = ?;";
+// Load data_version and the database id from the counters table
+int load_counters(sqlite3 *db) {
     sqlite3_stmt *stmt;
-    json_t *categories_array = json_array();
-
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, 0) == SQLITE_OK) {
-        sqlite3_bind_int(stmt, 1, template_id);
+    if (sqlite3_prepare_v2(db, "SELECT name, value FROM counters WHERE name IN ('data_version', 'database_id');", -1, &stmt, 0) == SQLITE_OK) {
         while (sqlite3_step(stmt) == SQLITE_ROW) {
-            json_t *category_obj = json_object();
-            json_object_set_new(category_obj, "id", json_integer(sqlite3_column_int(stmt, 0)));
-            json_object_set_new(category_obj, "name", json_string((const char*)sqlite3_column_text(stmt, 1)));
-            json_array_append_new(categories_array, category_obj);
+            if (strcmp((const char *)sqlite3_column_text(stmt, 0), "data_version") == 0) {
+                atomic_store(&data_version, (unsigned long)sqlite3_column_int64(stmt, 1));
+            } else {
+                database_id = (unsigned long)sqlite3_column_int64(stmt, 1);
+            }
         }
         sqlite3_finalize(stmt);
     }
-    return categories_array;
+    // Changes made before startup are not dated, so date them no later than now
+    atomic_store(&data_modified_at, (long long)time(NULL) * 2);
+    return 0;
 }
 
-// Get categories for a collection
-json_t* get_collection_categories(sqlite3 *db, int collection_id) {
-    const char *sql = "SELECT c.id, c.name FROM categories c "
-                      "JOIN collection_categories cc ON c.id = cc.category_id "
-                      "WHERE cc.collection_id = ?;";
+// Migration: add the content hash columns. Rows without hashes simply count as changed on their next write.
+int migrate_content_hashes(sqlite3 *db) {
     sqlite3_stmt *stmt;
-    json_t *categories_array = json_array();
+    if (sqlite3_prepare_v2(db, "SELECT 1 FROM pragma_table_info('templates') WHERE name = 'content_hash';", -1, &stmt, 0) != SQLITE_OK) {
+        return -1;
+    }
+    int present = sqlite3_step(stmt) == SQLITE_ROW;
+    sqlite3_finalize(stmt);
+    if (present) {
+        return 0;
+    }
 
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, 0) == SQLITE_OK) {
-        sqlite3_bind_int(stmt, 1, collection_id);
-        while (sqlite3_step(stmt) == SQLITE_ROW) {
-            json_t *category_obj = json_object();
-            json_object_set_new(category_obj, "id", json_integer(sqlite3_column_int(stmt, 0)));
-            json_object_set_new(category_obj, "name", json_string((const char*)sqlite3_column_text(stmt, 1)));
-            json_array_append_new(categories_array, category_obj);
+    return sqlite3_exec(db, CONTENT_HASH_SCHEMA, NULL, NULL, NULL) == SQLITE_OK ? 0 : -1;
+}
+
+// A schema change: its SQL runs first, then its function, either may be missing. Both have to be
+// idempotent, databases from before the versioned schema already have some of the later steps.
+typedef struct {
+    const char *sql;
+    int (*apply)(sqlite3 *db);
+} schema_migration_t;
+
+// Schema changes applied in place at startup, in order. PRAGMA user_version holds how many a
+// database already has, sql/init_database.sql creates databases with all of them. Only ever append.
+static const schema_migration_t schema_migrations[] = {
+    // 1: indexes of the category filters, the render triggers, the collection order and the category tree
+    { "CREATE INDEX IF NOT EXISTS template_categories_category ON template_categories(category_id);"
+      "CREATE INDEX IF NOT EXISTS collection_categories_category ON collection_categories(category_id);"
+      "CREATE INDEX IF NOT EXISTS templates_user ON templates(user_id);"
+      "CREATE INDEX IF NOT EXISTS collections_rank_name ON collections(rank, name);"
+      "CREATE INDEX IF NOT EXISTS categories_parent ON categories(parent_id);", NULL },
+    // 2: view count updates no longer re-render templates
+    { "DROP TRIGGER IF EXISTS render_template_update;" RENDER_TEMPLATE_UPDATE_TRIGGER, NULL },
+    // 3: row counts, data_version and the database id, kept by triggers and the writer
+    { COUNTERS_SCHEMA, NULL },
+    // 4: hashes that let identical writes be skipped
+    { NULL, migrate_content_hashes },
+    // 5: full-text index of names and descriptions
+    { NULL, migrate_search_index },
+    // 6: deflate dictionaries of compressed template columns
+    { STORAGE_SCHEMA, NULL },
+    // 7: workflow bodies rendered at write time
+    { NULL, migrate_render_store },
+    // 8: workflow entries of collection details rendered at write time
+    { NULL, migrate_collection_items },
+};
+#define SCHEMA_VERSION ((int)(sizeof(schema_migrations) / sizeof(schema_migrations[0])))
+
+// Apply the migrations a database is missing, each in its own transaction along with its version
+int migrate_schema(sqlite3 *db) {
+    int version = -1;
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(db, "PRAGMA user_version;", -1, &stmt, 0) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            version = sqlite3_column_int(stmt, 0);
         }
         sqlite3_finalize(stmt);
     }
-    return categories_array;
-}
+    if (version < 0) {
+        fprintf(stderr, "Can't read schema version: %s\n", sqlite3_errmsg(db));
+        return -1;
+    }
+    if (version > SCHEMA_VERSION) {
+        fprintf(stderr, "Database schema version %d is newer than this server's (%d)\n", version, SCHEMA_VERSION);
+        return -1;
+    }
 
-// GET /health
-int callback_get_health(const struct _u_request *request, struct _u_response *response, void *user_data) {
-    UNUSED(request);
-    UNUSED(user_data);
+    for (; version < SCHEMA_VERSION; version++) {
+        char set_version[PRAGMA_BUFFER_SIZE];
+        snprintf(set_version, sizeof(set_version), "PRAGMA user_version = %d;", version + 1);
+        if (sqlite3_exec(db, "BEGIN IMMEDIATE;", NULL, NULL, NULL) != SQLITE_OK ||
+            (schema_migrations[version].sql && sqlite3_exec(db, schema_migrations[version].sql, NULL, NULL, NULL) != SQLITE_OK) ||
+            (schema_migrations[version].apply && schema_migrations[version].apply(db) != 0) ||
+            sqlite3_exec(db, set_version, NULL, NULL, NULL) != SQLITE_OK ||
+            sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL) != SQLITE_OK) {
+            fprintf(stderr, "Schema migration %d failed: %s\n", version + 1, sqlite3_errmsg(db));
+            sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+            return -1;
+        }
+        printf("Applied schema migration %d\n", version + 1);
+    }
+    return 0;
+}
 
-    sqlite3 *db = get_db_connection();
-    if (!db) {
-        ulfius_set_string_body_response(response, 500, "Database connection failed");
-        return U_CALLBACK_CONTINUE;
+// Read a row count maintained by the counters table, -1 if it is missing
+int get_counter(sqlite3 *db, const char *name) {
+    int value = -1;
+    sqlite3_stmt *stmt = prepare_cached_statement(db, "SELECT value FROM counters WHERE name = ?;");
+    if (stmt) {
+        sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            value = sqlite3_column_int(stmt, 0);
+        }
+        release_cached_statement(db, stmt);
     }
+    return value;
+}
 
-    json_t *health_object = json_object();
-    json_object_set_new(health_object, "status", json_string("OK"));
-    
-    return_db_connection(db);
-    
-    ulfius_set_json_body_response(response, 200, health_object);
-    json_decref(health_object);
-    
-    return U_CALLBACK_CONTINUE;
+void write_be32(unsigned char *out, uint32_t value) {
+    out[0] = (unsigned char)(value >> 24);
+    out[1] = (unsigned char)(value >> 16);
+    out[2] = (unsigned char)(value >> 8);
+    out[3] = (unsigned char)value;
 }
 
-// GET /templates/categories
-int callback_get_categories(const struct _u_request *request, struct _u_response *response, void *user_data) {
-    UNUSED(request);
-    UNUSED(user_data);
+uint32_t read_be32(const unsigned char *in) {
+    return ((uint32_t)in[0] << 24) | ((uint32_t)in[1] << 16) | ((uint32_t)in[2] << 8) | (uint32_t)in[3];
+}
 
-    sqlite3 *db = get_db_connection();
-    if (!db) {
-        ulfius_set_string_body_response(response, 500, "Database connection failed");
-        return U_CALLBACK_CONTINUE;
+// A loaded dictionary by id, NULL if it has not been loaded yet. Call with storage.mutex held.
+const storage_dictionary_t* lookup_storage_dictionary(int id) {
+    for (int i = 0; i < storage.count; i++) {
+        if (storage.dictionaries[i]->id == id) {
+            return storage.dictionaries[i];
+        }
     }
+    return NULL;
+}
 
-    const char *sql = 
-        "SELECT c.id, c.name, c.icon, p.id AS parent_id, p.name AS parent_name, p.icon AS parent_icon "
-        "FROM categories c "
-        "LEFT JOIN categories p ON c.parent_id = p.id "
-        "ORDER BY c.name;";
-    sqlite3_stmt *stmt;
-    
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
-    if (rc != SQLITE_OK) {
-        return_db_connection(db);
-        ulfius_set_string_body_response(response, 500, "Database error");
-        return U_CALLBACK_CONTINUE;
+// Find a dictionary by id, loading it from db the first time it is needed. NULL if it does not exist.
+// The query runs without the lock, two threads loading the same dictionary keep the first copy.
+const storage_dictionary_t* find_storage_dictionary(sqlite3 *db, int id) {
+    pthread_mutex_lock(&storage.mutex);
+    const storage_dictionary_t *found = lookup_storage_dictionary(id);
+    pthread_mutex_unlock(&storage.mutex);
+    if (found) {
+        return found;
     }
-    
-    json_t *categories_array = json_array();
-    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
-        json_t *category = json_object();
-        json_object_set_new(category, "id", json_integer(sqlite3_column_int(stmt, 0)));
-        json_object_set_new(category, "name", json_string((const char*)sqlite3_column_text(stmt, 1)));
-        json_object_set_new(category, "icon", json_string((const char*)sqlite3_column_text(stmt, 2)));
 
-        if (sqlite3_column_type(stmt, 3) != SQLITE_NULL) {
-            json_t *parent_obj = json_object();
-            json_object_set_new(parent_obj, "id", json_integer(sqlite3_column_int(stmt, 3)));
-            json_object_set_new(parent_obj, "name", json_string((const char*)sqlite3_column_text(stmt, 4)));
-            json_object_set_new(parent_obj, "icon", json_string((const char*)sqlite3_column_text(stmt, 5)));
-            json_object_set_new(category, "parent", parent_obj);
-        } else {
-            json_object_set_new(category, "parent", json_null());
+    storage_dictionary_t *loaded = NULL;
+    sqlite3_stmt *stmt = prepare_cached_statement(db, "SELECT data FROM storage_dictionaries WHERE id = ?;");
+    if (stmt) {
+        sqlite3_bind_int(stmt, 1, id);
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            const void *data = sqlite3_column_blob(stmt, 0);
+            size_t length = sqlite3_column_bytes(stmt, 0);
+            loaded = malloc(sizeof(storage_dictionary_t));
+            unsigned char *copy = malloc(length > 0 ? length : 1);
+            if (loaded && copy) {
+                memcpy(copy, data, length);
+                loaded->id = id;
+                loaded->data = copy;
+                loaded->length = length;
+            } else {
+                free(loaded);
+                free(copy);
+                loaded = NULL;
+            }
         }
-        
-        json_array_append_new(categories_array, category);
+        release_cached_statement(db, stmt);
+    }
+    if (!loaded) {
+        return NULL;
     }
-    
-    sqlite3_finalize(stmt);
-    return_db_connection(db);
 
-    json_t *response_json = json_object();
-    json_object_set_new(response_json, "categories", categories_array);
-    
-    ulfius_set_json_body_response(response, 200, response_json);
-    json_decref(response_json);
-    
-    return U_CALLBACK_CONTINUE;
+    pthread_mutex_lock(&storage.mutex);
+    found = lookup_storage_dictionary(id);
+    if (!found && storage.count == storage.capacity) {
+        int capacity = storage.capacity ? storage.capacity * 2 : 16;
+        storage_dictionary_t **grown = realloc(storage.dictionaries, capacity * sizeof(storage_dictionary_t *));
+        if (grown) {
+            storage.dictionaries = grown;
+            storage.capacity = capacity;
+        }
+    }
+    if (!found && storage.count < storage.capacity) {
+        storage.dictionaries[storage.count++] = loaded;
+        found = loaded;
+        loaded = NULL;
+    }
+    pthread_mutex_unlock(&storage.mutex);
+
+    if (loaded) {
+        free(loaded->data);
+        free(loaded);
+    }
+    return found;
 }
 
-// GET /templates/collections
-int callback_get_collections(const struct _u_request *request, struct _u_response *response, void *user_data) {
-    UNUSED(user_data);
-    
-    sqlite3 *db = get_db_connection();
-    if (!db) {
-        ulfius_set_string_body_response(response, 500, "Database connection failed");
-        return U_CALLBACK_CONTINUE;
+void cleanup_storage() {
+    pthread_mutex_lock(&storage.mutex);
+    for (int i = 0; i < storage.count; i++) {
+        free(storage.dictionaries[i]->data);
+        free(storage.dictionaries[i]);
     }
+    free(storage.dictionaries);
+    storage.dictionaries = NULL;
+    storage.count = 0;
+    storage.capacity = 0;
+    pthread_mutex_unlock(&storage.mutex);
+}
 
-    const char *search_query = u_map_get(request->map_url, "search");
-    
-    // Parse category parameters (category[] array)
-    int category_ids[MAX_CATEGORIES];
-    int category_count = 0;
-    char param_name[PARAM_NAME_BUFFER_SIZE];
-    for (int i = 0; i < MAX_CATEGORIES; i++) {
-        snprintf(param_name, sizeof(param_name), "category[%d]", i);
-        const char *value = u_map_get(request->map_url, param_name);
-        if (value) {
-            category_ids[category_count++] = atoi(value);
-        }
+// SQL store_json(text): the value compressed with the active dictionary when compression is on
+// and it pays off, otherwise the value itself
+void sql_store_json(sqlite3_context *context, int argc, sqlite3_value **argv) {
+    UNUSED(argc);
+    sqlite3_value *value = argv[0];
+    if (!atomic_load(&storage.enabled) || sqlite3_value_type(value) != SQLITE_TEXT ||
+        sqlite3_value_bytes(value) < STORAGE_COMPRESSION_MIN_BYTES) {
+        sqlite3_result_value(context, value);
+        return;
     }
-    
-    // Build dynamic SQL query
-    char main_sql[SMALL_SQL_BUFFER_SIZE];
-    strcpy(main_sql, "SELECT DISTINCT c.id, c.rank, c.name, c.description, c.total_views, c.created_at FROM collections c");
-    
-    int where_added = 0;
-    
-    // Add category join if needed
-    if (category_count > 0) {
-        strcat(main_sql, " JOIN collection_categories cc ON c.id = cc.collection_id");
-        strcat(main_sql, " WHERE cc.category_id IN (");
-        for (int i = 0; i < category_count; i++) {
-            if (i > 0) strcat(main_sql, ",");
-            strcat(main_sql, "?");
-        }
-        strcat(main_sql, ")");
-        where_added = 1;
+
+    const unsigned char *text = sqlite3_value_text(value);
+    size_t length = sqlite3_value_bytes(value);
+    int dictionary_id = atomic_load(&storage.active_id);
+    const storage_dictionary_t *dictionary = dictionary_id > 0
+        ? find_storage_dictionary(sqlite3_context_db_handle(context), dictionary_id) : NULL;
+
+    z_stream stream = {0};
+    if (deflateInit(&stream, Z_BEST_COMPRESSION) != Z_OK) {
+        sqlite3_result_value(context, value);
+        return;
     }
-    
-    // Add search condition
-    if (search_query && strlen(search_query) > 0) {
-        if (where_added) {
-            strcat(main_sql, " AND ");
-        } else {
-            strcat(main_sql, " WHERE ");
-        }
-        strcat(main_sql, "c.name LIKE ?");
+    if (dictionary && deflateSetDictionary(&stream, dictionary->data, dictionary->length) != Z_OK) {
+        dictionary = NULL;
     }
-    
-    strcat(main_sql, " ORDER BY c.rank, c.name;");
-    
-    sqlite3_stmt *main_stmt;
-    if (sqlite3_prepare_v2(db, main_sql, -1, &main_stmt, 0) != SQLITE_OK) {
-        return_db_connection(db);
-        ulfius_set_string_body_response(response, 500, "Database error on prepare");
-        return U_CALLBACK_CONTINUE;
+
+    size_t bound = STORED_HEADER_SIZE + deflateBound(&stream, length);
+    unsigned char *stored = malloc(bound);
+    int rc = Z_STREAM_ERROR;
+    if (stored) {
+        stream.next_in = (Bytef *)text;
+        stream.avail_in = length;
+        stream.next_out = stored + STORED_HEADER_SIZE;
+        stream.avail_out = bound - STORED_HEADER_SIZE;
+        rc = deflate(&stream, Z_FINISH);
     }
-    
-    int param_idx = 1;
-    
-    // Bind category parameters
-    for (int i = 0; i < category_count; i++) {
-        sqlite3_bind_int(main_stmt, param_idx++, category_ids[i]);
+    size_t stored_length = STORED_HEADER_SIZE + stream.total_out;
+    deflateEnd(&stream);
+
+    if (rc != Z_STREAM_END || stored_length >= length) {
+        free(stored);
+        sqlite3_result_value(context, value);
+        return;
     }
-    
-    // Bind search parameter
-    if (search_query && strlen(search_query) > 0) {
-        char search_pattern[SEARCH_PATTERN_BUFFER_SIZE];
-        snprintf(search_pattern, sizeof(search_pattern), "%%%s%%", search_query);
-        sqlite3_bind_text(main_stmt, param_idx++, search_pattern, -1, SQLITE_STATIC);
+    stored[0] = STORED_FORMAT_DEFLATE;
+    write_be32(stored + 1, dictionary ? (uint32_t)dictionary->id : 0);
+    write_be32(stored + 5, (uint32_t)length);
+    sqlite3_result_blob(context, stored, stored_length, &free);
+    atomic_fetch_add(&storage.compressed, 1);
+}
+
+// SQL stored_json(value): text as stored before compression. Text and NULL pass through,
+// blobs that were not written by store_json() give NULL like any other invalid JSON.
+void sql_stored_json(sqlite3_context *context, int argc, sqlite3_value **argv) {
+    UNUSED(argc);
+    sqlite3_value *value = argv[0];
+    if (sqlite3_value_type(value) != SQLITE_BLOB) {
+        sqlite3_result_value(context, value);
+        return;
     }
 
-    json_t *collections_array = json_array();
-    while (sqlite3_step(main_stmt) == SQLITE_ROW) {
-        int collection_id = sqlite3_column_int(main_stmt, 0);
-        json_t *collection_obj = json_object();
-        json_object_set_new(collection_obj, "id", json_integer(collection_id));
-        json_object_set_new(collection_obj, "rank", json_integer(sqlite3_column_int(main_stmt, 1)));
-        json_object_set_new(collection_obj, "name", json_string((const char *)sqlite3_column_text(main_stmt, 2)));
-        
-        // Handle nullable totalViews
-        if (sqlite3_column_type(main_stmt, 4) != SQLITE_NULL) {
-            json_object_set_new(collection_obj, "totalViews", json_integer(sqlite3_column_int(main_stmt, 4)));
-        } else {
-            json_object_set_new(collection_obj, "totalViews", json_null());
+    const unsigned char *stored = sqlite3_value_blob(value);
+    size_t stored_length = sqlite3_value_bytes(value);
+    if (stored_length < STORED_HEADER_SIZE || stored[0] != STORED_FORMAT_DEFLATE) {
+        sqlite3_result_null(context);
+        return;
+    }
+    uint32_t dictionary_id = read_be32(stored + 1);
+    uint32_t length = read_be32(stored + 5);
+
+    char *text = malloc((size_t)length + 1);
+    z_stream stream = {0};
+    int rc = Z_MEM_ERROR;
+    if (text && inflateInit(&stream) == Z_OK) {
+        stream.next_in = (Bytef *)(stored + STORED_HEADER_SIZE);
+        stream.avail_in = stored_length - STORED_HEADER_SIZE;
+        stream.next_out = (Bytef *)text;
+        stream.avail_out = length;
+        rc = inflate(&stream, Z_FINISH);
+        if (rc == Z_NEED_DICT) {
+            const storage_dictionary_t *dictionary = find_storage_dictionary(sqlite3_context_db_handle(context), (int)dictionary_id);
+            rc = dictionary && inflateSetDictionary(&stream, dictionary->data, dictionary->length) == Z_OK
+                ? inflate(&stream, Z_FINISH) : Z_DATA_ERROR;
         }
-        
-        json_object_set_new(collection_obj, "createdAt", json_string((const char *)sqlite3_column_text(main_stmt, 5)));
-        
-        // Get workflows for this collection
-        json_t *workflows_array = json_array();
-        const char *workflow_sql = "SELECT template_id FROM collection_workflows WHERE collection_id = ? ORDER BY template_id;";
-        sqlite3_stmt *workflow_stmt;
-        
-        if (sqlite3_prepare_v2(db, workflow_sql, -1, &workflow_stmt, 0) == SQLITE_OK) {
-            sqlite3_bind_int(workflow_stmt, 1, collection_id);
-            while (sqlite3_step(workflow_stmt) == SQLITE_ROW) {
-                json_t *workflow_ref = json_object();
-                json_object_set_new(workflow_ref, "id", json_integer(sqlite3_column_int(workflow_stmt, 0)));
-                json_array_append_new(workflows_array, workflow_ref);
-            }
-            sqlite3_finalize(workflow_stmt);
+        if (stream.total_out != length) {
+            rc = Z_DATA_ERROR;
         }
-        
-        json_object_set_new(collection_obj, "workflows", workflows_array);
-        
-        // Add empty nodes array to match the expected structure
-        json_object_set_new(collection_obj, "nodes", json_array());
-        
-        json_array_append_new(collections_array, collection_obj);
+        inflateEnd(&stream);
     }
-    sqlite3_finalize(main_stmt);
-    return_db_connection(db);
-    
-    // Wrap in a root object with "collections" key to match the expected structure
-    json_t *response_json = json_object();
-    json_object_set_new(response_json, "collections", collections_array);
-    
-    ulfius_set_json_body_response(response, 200, response_json);
-    json_decref(response_json);
-    return U_CALLBACK_CONTINUE;
+
+    if (rc != Z_STREAM_END) {
+        fprintf(stderr, "stored_json: can't inflate value compressed with dictionary %u\n", dictionary_id);
+        atomic_fetch_add(&storage.failures, 1);
+        free(text);
+        sqlite3_result_null(context);
+        return;
+    }
+    text[length] = '\0';
+    sqlite3_result_text(context, text, length, &free);
+    atomic_fetch_add(&storage.inflated, 1);
 }
 
-// GET /templates/collections/<id>
-int callback_get_collection_by_id(const struct _u_request *request, struct _u_response *response, void *user_data) {
-    UNUSED(user_data);
+// Make store_json() and stored_json() available on a connection
+int register_storage_functions(sqlite3 *db) {
+    if (sqlite3_create_function(db, "store_json", 1, SQLITE_UTF8, NULL, &sql_store_json, NULL, NULL) != SQLITE_OK ||
+        sqlite3_create_function(db, "stored_json", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL, &sql_stored_json, NULL, NULL) != SQLITE_OK) {
+        fprintf(stderr, "Can't register storage functions: %s\n", sqlite3_errmsg(db));
+        return -1;
+    }
+    return 0;
+}
+
+// Count every quoted string of a JSON text (keys keep their colon), the raw material of a dictionary
+void count_storage_tokens(const char *text, storage_token_t *tokens, int *distinct) {
+    const char *p = text;
+    while ((p = strchr(p, '"')) != NULL) {
+        const char *start = p++;
+        while (*p && *p != '"') {
+            p += (*p == '\\' && p[1]) ? 2 : 1;
+        }
+        if (!*p) {
+            return;
+        }
+        p++;
+        size_t length = (size_t)(p - start) + (*p == ':' ? 1 : 0);
+        if (length < 4 || length > STORAGE_TOKEN_MAX_LENGTH) {
+            continue;
+        }
+
+        unsigned long hash = 5381;
+        for (size_t i = 0; i < length; i++) {
+            hash = ((hash << 5) + hash) + (unsigned char)start[i];
+        }
+        size_t slot = hash % STORAGE_TOKEN_TABLE_SIZE;
+        while (tokens[slot].text && (tokens[slot].hash != hash || tokens[slot].length != length ||
+                                     memcmp(tokens[slot].text, start, length) != 0)) {
+            slot = (slot + 1) % STORAGE_TOKEN_TABLE_SIZE;
+        }
+        if (tokens[slot].text) {
+            tokens[slot].count++;
+        } else if (*distinct < STORAGE_TOKEN_TABLE_SIZE * 3 / 4) {
+            // Keep the table sparse enough for linear probing, later tokens are simply not counted
+            tokens[slot].text = start;
+            tokens[slot].length = length;
+            tokens[slot].hash = hash;
+            tokens[slot].count = 1;
+            (*distinct)++;
+        }
+    }
+}
+
+// Most bytes saved first
+int compare_storage_tokens(const void *a, const void *b) {
+    const storage_token_t *x = a, *y = b;
+    size_t score_x = (size_t)x->count * x->length;
+    size_t score_y = (size_t)y->count * y->length;
+    return score_x < score_y ? 1 : score_x > score_y ? -1 : 0;
+}
+
+// Train a dictionary on a random sample of the current templates and store it as the active one.
+// Deflate reaches the end of the dictionary with the shortest distances, so the strings that
+// save the most go last. Returns the new dictionary id, 0 when there is nothing to learn from, or -1.
+int create_storage_dictionary(sqlite3 *db) {
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(db, "SELECT stored_json(workflow_data), stored_json(nodes_data), stored_json(workflow_info) "
+                               "FROM templates ORDER BY random() LIMIT " STRINGIFY(STORAGE_TRAINING_SAMPLES) ";",
+                           -1, &stmt, 0) != SQLITE_OK) {
+        return -1;
+    }
+
+    storage_token_t *tokens = calloc(STORAGE_TOKEN_TABLE_SIZE, sizeof(storage_token_t));
+    char **samples = calloc(STORAGE_TRAINING_SAMPLES * 3, sizeof(char *));
+    if (!tokens || !samples) {
+        sqlite3_finalize(stmt);
+        free(tokens);
+        free(samples);
+        return -1;
+    }
+
+    // Tokens point into the samples, so they are kept until the dictionary is built
+    int sample_count = 0, distinct = 0;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        for (int column = 0; column < 3; column++) {
+            const char *text = (const char *)sqlite3_column_text(stmt, column);
+            if (text && (samples[sample_count] = strdup(text))) {
+                count_storage_tokens(samples[sample_count++], tokens, &distinct);
+            }
+        }
+    }
+    sqlite3_finalize(stmt);
+
+    // Only strings seen more than once are worth a place
+    int kept = 0;
+    for (int i = 0; i < STORAGE_TOKEN_TABLE_SIZE; i++) {
+        if (tokens[i].text && tokens[i].count > 1) {
+            tokens[kept++] = tokens[i];
+        }
+    }
+    qsort(tokens, kept, sizeof(storage_token_t), compare_storage_tokens);
+
+    int chosen = 0;
+    size_t length = 0;
+    while (chosen < kept && length + tokens[chosen].length <= STORAGE_DICTIONARY_SIZE) {
+        length += tokens[chosen++].length;
+    }
+
+    int id = 0;
+    unsigned char *dictionary = length > 0 ? malloc(length) : NULL;
+    if (dictionary) {
+        size_t offset = 0;
+        for (int i = chosen - 1; i >= 0; i--) {
+            memcpy(dictionary + offset, tokens[i].text, tokens[i].length);
+            offset += tokens[i].length;
+        }
+
+        id = -1;
+        if (sqlite3_prepare_v2(db, "INSERT INTO storage_dictionaries (data) VALUES (?);", -1, &stmt, 0) == SQLITE_OK) {
+            sqlite3_bind_blob(stmt, 1, dictionary, length, SQLITE_STATIC);
+            if (sqlite3_step(stmt) == SQLITE_DONE) {
+                id = (int)sqlite3_last_insert_rowid(db);
+                atomic_store(&storage.active_id, id);
+            }
+            sqlite3_finalize(stmt);
+        }
+        free(dictionary);
+    }
+
+    for (int i = 0; i < sample_count; i++) {
+        free(samples[i]);
+    }
+    free(samples);
+    free(tokens);
+    return id;
+}
+
+// Pick the newest dictionary for writes. With compression on and none trained yet, one is trained
+// as soon as there are enough templates.
+int load_storage(sqlite3 *db) {
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(db, "SELECT (SELECT MAX(id) FROM storage_dictionaries), (SELECT COUNT(*) FROM templates);", -1, &stmt, 0) != SQLITE_OK) {
+        return -1;
+    }
+    int active_id = 0, templates = 0;
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        active_id = sqlite3_column_int(stmt, 0);
+        templates = sqlite3_column_int(stmt, 1);
+    }
+    sqlite3_finalize(stmt);
+    atomic_store(&storage.active_id, active_id);
+
+    if (atomic_load(&storage.enabled) && active_id == 0 && templates >= STORAGE_TRAINING_MIN_ROWS) {
+        int id = create_storage_dictionary(db);
+        if (id > 0) {
+            printf("Trained storage dictionary %d on %d templates\n", id, templates);
+        }
+    }
+    return 0;
+}
+
+// Forget every entry, the caller holds the write lock
+void clear_name_dictionary_locked(name_dictionary_t *dictionary) {
+    for (int i = 0; i < NAME_DICTIONARY_BUCKETS; i++) {
+        name_entry_t *entry = dictionary->buckets[i];
+        while (entry) {
+            name_entry_t *next = entry->next;
+            free(entry->name);
+            free(entry);
+            entry = next;
+        }
+        dictionary->buckets[i] = NULL;
+    }
+    dictionary->entries = 0;
+    dictionary->loaded = 0;
+}
+
+// Add or update an entry, the caller holds the write lock
+void put_name_entry_locked(name_dictionary_t *dictionary, const char *name, int id, int parent_id) {
+    unsigned long bucket = hash_string(name) % NAME_DICTIONARY_BUCKETS;
+    for (name_entry_t *entry = dictionary->buckets[bucket]; entry; entry = entry->next) {
+        if (strcmp(entry->name, name) == 0) {
+            entry->id = id;
+            entry->parent_id = parent_id;
+            return;
+        }
+    }
+
+    name_entry_t *entry = malloc(sizeof(name_entry_t));
+    if (!entry || !(entry->name = strdup(name))) {
+        free(entry);
+        return;
+    }
+    entry->id = id;
+    entry->parent_id = parent_id;
+    entry->next = dictionary->buckets[bucket];
+    dictionary->buckets[bucket] = entry;
+    dictionary->entries++;
+}
+
+// Read the whole table unless already loaded, the caller holds the write lock
+void load_name_dictionary_locked(sqlite3 *db, name_dictionary_t *dictionary) {
+    if (dictionary->loaded) {
+        return;
+    }
+
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(db, dictionary->load_sql, -1, &stmt, 0) == SQLITE_OK) {
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            const char *row_name = (const char *)sqlite3_column_text(stmt, 0);
+            if (row_name) {
+                put_name_entry_locked(dictionary, row_name, sqlite3_column_int(stmt, 1), sqlite3_column_int(stmt, 2));
+            }
+        }
+        dictionary->loaded = sqlite3_finalize(stmt) == SQLITE_OK;
+    }
+    if (!dictionary->loaded) {
+        clear_name_dictionary_locked(dictionary);
+    }
+}
+
+// Load the category and user dictionaries from the writer connection
+void load_name_dictionaries(sqlite3 *db) {
+    name_dictionary_t *dictionaries[] = { &category_dictionary, &user_dictionary };
+    for (size_t i = 0; i < sizeof(dictionaries) / sizeof(dictionaries[0]); i++) {
+        pthread_rwlock_wrlock(&dictionaries[i]->lock);
+        load_name_dictionary_locked(db, dictionaries[i]);
+        pthread_rwlock_unlock(&dictionaries[i]->lock);
+    }
+}
+
+// Id of name, 0 if the table has no such row. Reloads the table after an invalidation.
+int lookup_name(sqlite3 *db, name_dictionary_t *dictionary, const char *name, int *parent_id) {
+    pthread_rwlock_rdlock(&dictionary->lock);
+    if (!dictionary->loaded) {
+        pthread_rwlock_unlock(&dictionary->lock);
+        pthread_rwlock_wrlock(&dictionary->lock);
+        load_name_dictionary_locked(db, dictionary);
+    }
+
+    int id = 0;
+    for (name_entry_t *entry = dictionary->buckets[hash_string(name) % NAME_DICTIONARY_BUCKETS]; entry; entry = entry->next) {
+        if (strcmp(entry->name, name) == 0) {
+            id = entry->id;
+            if (parent_id) {
+                *parent_id = entry->parent_id;
+            }
+            break;
+        }
+    }
+    pthread_rwlock_unlock(&dictionary->lock);
+
+    atomic_fetch_add(id > 0 ? &dictionary->hits : &dictionary->misses, 1);
+    return id;
+}
+
+// Record a row just inserted through the writer connection
+void remember_name(name_dictionary_t *dictionary, const char *name, int id, int parent_id) {
+    pthread_rwlock_wrlock(&dictionary->lock);
+    if (dictionary->loaded) {
+        put_name_entry_locked(dictionary, name, id, parent_id);
+    }
+    pthread_rwlock_unlock(&dictionary->lock);
+}
+
+// Drop both dictionaries after a rollback, they are read again from the database on next use
+void invalidate_name_dictionaries() {
+    name_dictionary_t *dictionaries[] = { &category_dictionary, &user_dictionary };
+    for (size_t i = 0; i < sizeof(dictionaries) / sizeof(dictionaries[0]); i++) {
+        pthread_rwlock_wrlock(&dictionaries[i]->lock);
+        clear_name_dictionary_locked(dictionaries[i]);
+        pthread_rwlock_unlock(&dictionaries[i]->lock);
+    }
+}
+
+// Look up a cached search total computed at the given data version, -1 on a miss
+int count_cache_get(const char *key, unsigned long version) {
+    unsigned long hash = hash_string(key);
+    count_cache_entry_t *entry = &count_cache.entries[hash % COUNT_CACHE_SIZE];
+    int count = -1;
+    
+    pthread_mutex_lock(&count_cache.mutex);
+    if (entry->valid && entry->hash == hash && entry->version == version && strcmp(entry->key, key) == 0) {
+        count = entry->count;
+    }
+    pthread_mutex_unlock(&count_cache.mutex);
+    
+    atomic_fetch_add(count >= 0 ? &count_cache.hits : &count_cache.misses, 1);
+    return count;
+}
+
+// Remember a search total, replacing whatever shared its slot
+void count_cache_put(const char *key, unsigned long version, int count) {
+    if (strlen(key) >= COUNT_CACHE_KEY_SIZE) {
+        return;
+    }
+    unsigned long hash = hash_string(key);
+    count_cache_entry_t *entry = &count_cache.entries[hash % COUNT_CACHE_SIZE];
+    
+    pthread_mutex_lock(&count_cache.mutex);
+    // Never overwrite a newer total with one computed against an older snapshot
+    if (!entry->valid || entry->hash != hash || entry->version <= version) {
+        strcpy(entry->key, key);
+        entry->hash = hash;
+        entry->version = version;
+        entry->count = count;
+        entry->valid = 1;
+    }
+    pthread_mutex_unlock(&count_cache.mutex);
+}
+
+int compare_strings(const void *a, const void *b) {
+    return strcmp(*(const char * const *)a, *(const char * const *)b);
+}
+
+void init_response_cache() {
+    for (int i = 0; i < RESPONSE_CACHE_SHARDS; i++) {
+        pthread_mutex_init(&response_cache.shards[i].mutex, NULL);
+    }
+}
+
+void free_encoded_bodies(encoded_bodies_t *encoded) {
+    for (int i = 0; i < ENCODING_COUNT; i++) {
+        free(encoded->data[i]);
+        encoded->data[i] = NULL;
+        encoded->length[i] = 0;
+    }
+}
+
+void free_response_cache_entry(response_cache_entry_t *entry) {
+    free(entry->key);
+    free(entry->body);
+    free(entry->headers);
+    free_encoded_bodies(&entry->encoded);
+    free(entry);
+}
+
+// Compress a body once with every supported coding. Small bodies are left alone, the headers
+// would eat most of the saving.
+void encode_body(const char *body, size_t length, encoded_bodies_t *encoded) {
+    memset(encoded, 0, sizeof(*encoded));
+#if RESPONSE_COMPRESSION
+    if (length < COMPRESSION_MIN_BYTES) {
+        return;
+    }
+
+    z_stream stream = {0};
+    // 16 + MAX_WBITS writes a gzip header and trailer instead of a zlib one
+    if (deflateInit2(&stream, GZIP_LEVEL, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) == Z_OK) {
+        size_t bound = deflateBound(&stream, length);
+        char *gzip = malloc(bound);
+        if (gzip) {
+            stream.next_in = (Bytef *)body;
+            stream.avail_in = length;
+            stream.next_out = (Bytef *)gzip;
+            stream.avail_out = bound;
+            if (deflate(&stream, Z_FINISH) == Z_STREAM_END && stream.total_out < length) {
+                encoded->data[ENCODING_GZIP] = gzip;
+                encoded->length[ENCODING_GZIP] = stream.total_out;
+            } else {
+                free(gzip);
+            }
+        }
+        deflateEnd(&stream);
+    }
+
+    size_t brotli_length = BrotliEncoderMaxCompressedSize(length);
+    char *brotli = brotli_length > 0 ? malloc(brotli_length) : NULL;
+    if (brotli && BrotliEncoderCompress(BROTLI_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, length,
+                                        (const uint8_t *)body, &brotli_length, (uint8_t *)brotli) &&
+        brotli_length < length) {
+        encoded->data[ENCODING_BROTLI] = brotli;
+        encoded->length[ENCODING_BROTLI] = brotli_length;
+    } else {
+        free(brotli);
+    }
+#else
+    UNUSED(body);
+    UNUSED(length);
+#endif
+}
+
+// Pick a coding from Accept-Encoding: br over gzip at equal weight, q=0 refuses one, * stands for the unnamed
+content_encoding_t negotiate_encoding(const struct _u_request *request) {
+    const char *accept = u_map_get_case(request->map_header, "Accept-Encoding");
+    if (!RESPONSE_COMPRESSION || !accept) {
+        return ENCODING_IDENTITY;
+    }
+
+    double gzip_q = -1, brotli_q = -1, any_q = -1;
+    const char *p = accept;
+    while (*p) {
+        while (*p == ' ' || *p == '\t' || *p == ',') p++;
+        const char *name = p;
+        while (*p && *p != ',' && *p != ';' && *p != ' ' && *p != '\t') p++;
+        size_t name_length = p - name;
+
+        double q = 1;
+        while (*p && *p != ',') {
+            if (*p == ';') {
+                const char *param = p + 1;
+                while (*param == ' ' || *param == '\t') param++;
+                if ((param[0] == 'q' || param[0] == 'Q') && param[1] == '=') {
+                    q = strtod(param + 2, NULL);
+                }
+            }
+            p++;
+        }
+
+        if (name_length == 2 && strncasecmp(name, "br", 2) == 0) {
+            brotli_q = q;
+        } else if ((name_length == 4 && strncasecmp(name, "gzip", 4) == 0) ||
+                   (name_length == 6 && strncasecmp(name, "x-gzip", 6) == 0)) {
+            gzip_q = q;
+        } else if (name_length == 1 && name[0] == '*') {
+            any_q = q;
+        }
+    }
+    if (brotli_q < 0) brotli_q = any_q;
+    if (gzip_q < 0) gzip_q = any_q;
+
+    if (brotli_q > 0 && brotli_q >= gzip_q) {
+        return ENCODING_BROTLI;
+    }
+    return gzip_q > 0 ? ENCODING_GZIP : ENCODING_IDENTITY;
+}
+
+// Swap the body for its compressed copy if the client accepts one. Each coding is a different
+// representation, so it gets its own strong ETag: the coding is appended inside the quotes.
+void send_encoded_body(struct _u_response *response, const encoded_bodies_t *encoded, content_encoding_t encoding) {
+    static const char *const names[ENCODING_COUNT] = { "identity", "gzip", "br" };
+    static const char *const suffixes[ENCODING_COUNT] = { "", "-gz", "-br" };
+    if (encoding == ENCODING_IDENTITY || !encoded->data[encoding]) {
+        return;
+    }
+
+    ulfius_set_binary_body_response(response, response->status, encoded->data[encoding], encoded->length[encoding]);
+    u_map_put(response->map_header, "Content-Encoding", names[encoding]);
+
+    const char *etag = u_map_get(response->map_header, "ETag");
+    size_t etag_length = etag ? strlen(etag) : 0;
+    char tagged[ETAG_BUFFER_SIZE];
+    if (etag_length >= 2 && etag[etag_length - 1] == '"' && etag_length + 3 < sizeof(tagged)) {
+        snprintf(tagged, sizeof(tagged), "%.*s%s\"", (int)(etag_length - 1), etag, suffixes[encoding]);
+        u_map_put(response->map_header, "ETag", tagged);
+    }
+    atomic_fetch_add(&response_cache.compressed, 1);
+}
+
+// Take an entry out of its shard's hash chain and LRU list, the caller holds the shard lock
+void unlink_response_cache_entry(response_cache_shard_t *shard, response_cache_entry_t *entry) {
+    response_cache_entry_t **link = &shard->buckets[(entry->hash / RESPONSE_CACHE_SHARDS) % RESPONSE_CACHE_BUCKETS];
+    while (*link && *link != entry) {
+        link = &(*link)->bucket_next;
+    }
+    if (*link) {
+        *link = entry->bucket_next;
+    }
+    if (entry->lru_prev) {
+        entry->lru_prev->lru_next = entry->lru_next;
+    } else {
+        shard->lru_head = entry->lru_next;
+    }
+    if (entry->lru_next) {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    } else {
+        shard->lru_tail = entry->lru_prev;
+    }
+    shard->bytes -= entry->size;
+    shard->entries--;
+}
+
+void cleanup_response_cache() {
+    for (int i = 0; i < RESPONSE_CACHE_SHARDS; i++) {
+        response_cache_shard_t *shard = &response_cache.shards[i];
+        pthread_mutex_lock(&shard->mutex);
+        while (shard->lru_head) {
+            response_cache_entry_t *entry = shard->lru_head;
+            unlink_response_cache_entry(shard, entry);
+            free_response_cache_entry(entry);
+        }
+        pthread_mutex_unlock(&shard->mutex);
+    }
+}
+
+// Normalized cache key: method, path without trailing slash, then the query parameters sorted by
+// name and length-prefixed so that no value can collide with another parameter list.
+// HEAD shares the GET entry, the server drops the body on the way out.
+// Returns -1 when the request has too many parameters or the key does not fit.
+int build_response_cache_key(const struct _u_request *request, char *out, size_t out_size) {
+    const char *names[RESPONSE_CACHE_MAX_PARAMS];
+    const char **keys = u_map_enum_keys(request->map_url);
+    int count = u_map_count(request->map_url);
+    if (count < 0 || count > RESPONSE_CACHE_MAX_PARAMS) {
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        names[i] = keys[i];
+    }
+    qsort(names, count, sizeof(names[0]), compare_strings);
+
+    const char *path = request->url_path ? request->url_path : "";
+    size_t path_length = strlen(path);
+    while (path_length > 1 && path[path_length - 1] == '/') {
+        path_length--;
+    }
+
+    const char *method = strcmp(request->http_verb, "HEAD") == 0 ? "GET" : request->http_verb;
+    int written = snprintf(out, out_size, "%s %.*s?", method, (int)path_length, path);
+    size_t used = written > 0 ? (size_t)written : out_size;
+    for (int i = 0; i < count && used < out_size; i++) {
+        const char *value = u_map_get(request->map_url, names[i]);
+        if (!value) {
+            value = "";
+        }
+        written = snprintf(out + used, out_size - used, "%zu:%s%zu:%s", strlen(names[i]), names[i], strlen(value), value);
+        used = written > 0 ? used + written : out_size;
+    }
+    return used < out_size ? 0 : -1;
+}
+
+// Copy a cached response into the reply if one exists for this data version, compressed with
+// encoding when the entry has that copy. Entries left over from an older version are dropped on sight.
+int response_cache_get(const char *key, unsigned long hash, unsigned long version, content_encoding_t encoding,
+                       struct _u_response *response) {
+    response_cache_shard_t *shard = &response_cache.shards[hash % RESPONSE_CACHE_SHARDS];
+    int found = 0;
+
+    pthread_mutex_lock(&shard->mutex);
+    response_cache_entry_t *entry = shard->buckets[(hash / RESPONSE_CACHE_SHARDS) % RESPONSE_CACHE_BUCKETS];
+    while (entry && (entry->hash != hash || strcmp(entry->key, key) != 0)) {
+        entry = entry->bucket_next;
+    }
+    if (entry && entry->version != version) {
+        unlink_response_cache_entry(shard, entry);
+        free_response_cache_entry(entry);
+    } else if (entry) {
+        // Move to the front of the LRU list
+        if (entry->lru_prev) {
+            entry->lru_prev->lru_next = entry->lru_next;
+            if (entry->lru_next) {
+                entry->lru_next->lru_prev = entry->lru_prev;
+            } else {
+                shard->lru_tail = entry->lru_prev;
+            }
+            entry->lru_prev = NULL;
+            entry->lru_next = shard->lru_head;
+            shard->lru_head->lru_prev = entry;
+            shard->lru_head = entry;
+        }
+        ulfius_set_binary_body_response(response, entry->status, entry->body, entry->body_length);
+        for (size_t offset = 0; offset < entry->headers_length; ) {
+            const char *name = entry->headers + offset;
+            const char *value = name + strlen(name) + 1;
+            u_map_put(response->map_header, name, value);
+            offset = (size_t)(value - entry->headers) + strlen(value) + 1;
+        }
+        send_encoded_body(response, &entry->encoded, encoding);
+        found = 1;
+    }
+    pthread_mutex_unlock(&shard->mutex);
+
+    return found;
+}
+
+// Store a finished response and its compressed copies under the key and version captured before it was built
+void response_cache_put(const response_cache_pending_t *pending, const struct _u_response *response, const encoded_bodies_t *encoded) {
+    size_t key_length = strlen(pending->key);
+    const char **names = u_map_enum_keys(response->map_header);
+    int header_count = u_map_count(response->map_header);
+    size_t headers_length = 0;
+    for (int i = 0; i < header_count; i++) {
+        const char *value = u_map_get(response->map_header, names[i]);
+        headers_length += strlen(names[i]) + 1 + strlen(value ? value : "") + 1;
+    }
+
+    size_t size = sizeof(response_cache_entry_t) + key_length + 1 + response->binary_body_length + headers_length;
+    for (int i = 0; i < ENCODING_COUNT; i++) {
+        size += encoded->length[i];
+    }
+    if (size > RESPONSE_CACHE_BYTES / RESPONSE_CACHE_SHARDS) {
+        return;
+    }
+
+    response_cache_entry_t *entry = calloc(1, sizeof(response_cache_entry_t));
+    if (!entry) {
+        return;
+    }
+    entry->key = malloc(key_length + 1);
+    entry->body = malloc(response->binary_body_length + 1);
+    entry->headers = malloc(headers_length + 1);
+    if (!entry->key || !entry->body || !entry->headers) {
+        free_response_cache_entry(entry);
+        return;
+    }
+    memcpy(entry->key, pending->key, key_length + 1);
+    if (response->binary_body_length > 0) {
+        memcpy(entry->body, response->binary_body, response->binary_body_length);
+    }
+    entry->body_length = response->binary_body_length;
+    for (int i = 0; i < header_count; i++) {
+        const char *value = u_map_get(response->map_header, names[i]);
+        size_t name_length = strlen(names[i]) + 1;
+        size_t value_length = strlen(value ? value : "") + 1;
+        memcpy(entry->headers + entry->headers_length, names[i], name_length);
+        memcpy(entry->headers + entry->headers_length + name_length, value ? value : "", value_length);
+        entry->headers_length += name_length + value_length;
+    }
+    entry->hash = pending->hash;
+    entry->version = pending->version;
+    entry->status = response->status;
+    entry->size = size;
+    for (int i = 0; i < ENCODING_COUNT; i++) {
+        if (encoded->data[i] && (entry->encoded.data[i] = malloc(encoded->length[i]))) {
+            memcpy(entry->encoded.data[i], encoded->data[i], encoded->length[i]);
+            entry->encoded.length[i] = encoded->length[i];
+        }
+    }
+
+    response_cache_shard_t *shard = &response_cache.shards[entry->hash % RESPONSE_CACHE_SHARDS];
+    response_cache_entry_t **bucket = &shard->buckets[(entry->hash / RESPONSE_CACHE_SHARDS) % RESPONSE_CACHE_BUCKETS];
+
+    pthread_mutex_lock(&shard->mutex);
+    // A concurrent miss may have stored the same key first, keep the latest copy
+    for (response_cache_entry_t *existing = *bucket; existing; existing = existing->bucket_next) {
+        if (existing->hash == entry->hash && strcmp(existing->key, entry->key) == 0) {
+            unlink_response_cache_entry(shard, existing);
+            free_response_cache_entry(existing);
+            break;
+        }
+    }
+    entry->bucket_next = *bucket;
+    *bucket = entry;
+    entry->lru_next = shard->lru_head;
+    if (shard->lru_head) {
+        shard->lru_head->lru_prev = entry;
+    } else {
+        shard->lru_tail = entry;
+    }
+    shard->lru_head = entry;
+    shard->bytes += size;
+    shard->entries++;
+
+    // Evict least recently used entries over budget, and anything outdated by a write on the way
+    while (shard->lru_tail != entry &&
+           (shard->bytes > RESPONSE_CACHE_BYTES / RESPONSE_CACHE_SHARDS || shard->lru_tail->version < entry->version)) {
+        response_cache_entry_t *victim = shard->lru_tail;
+        unlink_response_cache_entry(shard, victim);
+        free_response_cache_entry(victim);
+        atomic_fetch_add(&response_cache.evictions, 1);
+    }
+    pthread_mutex_unlock(&shard->mutex);
+
+    atomic_fetch_add(&response_cache.stores, 1);
+}
+
+// Strong ETag of everything served at a data version
+void format_version_etag(unsigned long version, char *out, size_t out_size) {
+    snprintf(out, out_size, "\"%lx-%lx\"", database_id, version);
+}
+
+// Strong ETag of a body that may outlive data versions, such as a rendered template
+void format_content_etag(const char *body, size_t length, char *out, size_t out_size) {
+    snprintf(out, out_size, "\"%lx-%zx\"", hash_bytes(body, length), length);
+}
+
+// IMF-fixdate, the only format HTTP/1.1 servers send
+void format_http_date(long long seconds, char *out, size_t out_size) {
+    time_t time_value = (time_t)seconds;
+    struct tm tm;
+    gmtime_r(&time_value, &tm);
+    strftime(out, out_size, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+// Parse an IMF-fixdate, -1 for anything else (obsolete formats are simply never answered with 304)
+long long parse_http_date(const char *text) {
+    static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    char month[4];
+    struct tm tm = {0};
+    if (sscanf(text, "%*3s, %d %3s %d %d:%d:%d GMT", &tm.tm_mday, month, &tm.tm_year,
+               &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 6 || strlen(month) != 3) {
+        return -1;
+    }
+    const char *found = strstr(months, month);
+    if (!found || (found - months) % 3 != 0) {
+        return -1;
+    }
+    tm.tm_mon = (int)(found - months) / 3;
+    tm.tm_year -= 1900;
+    return (long long)timegm(&tm);
+}
+
+// Length of an entity tag up to its closing quote and content coding suffix
+size_t etag_base_length(const char *tag, size_t length) {
+    if (length > 0 && tag[length - 1] == '"') {
+        length--;
+    }
+    if (length >= 3 && (strncmp(tag + length - 3, "-gz", 3) == 0 || strncmp(tag + length - 3, "-br", 3) == 0)) {
+        length -= 3;
+    }
+    return length;
+}
+
+// Whether an If-None-Match list names etag. GET uses the weak comparison, so W/ prefixes are ignored,
+// and a 304 leaves the body alone, so the tag of any content coding of the same body matches.
+int etag_list_matches(const char *list, const char *etag) {
+    if (etag[0] == 'W' && etag[1] == '/') etag += 2;
+    size_t etag_length = etag_base_length(etag, strlen(etag));
+
+    const char *p = list;
+    while (*p) {
+        while (*p == ' ' || *p == '\t' || *p == ',') p++;
+        if (*p == '*') {
+            return 1;
+        }
+        if (p[0] == 'W' && p[1] == '/') p += 2;
+        const char *start = p;
+        if (*p == '"') {
+            p = strchr(p + 1, '"');
+            if (!p) {
+                return 0;
+            }
+            p++;
+        } else {
+            while (*p && *p != ',') p++;
+        }
+        if (etag_base_length(start, p - start) == etag_length && strncmp(start, etag, etag_length) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Conditional GET: If-None-Match decides on its own when present, otherwise If-Modified-Since is
+// honoured unless several commits shared the last modification second
+int request_not_modified(const struct _u_request *request, const char *etag, long long modified) {
+    const char *if_none_match = u_map_get_case(request->map_header, "If-None-Match");
+    if (if_none_match) {
+        return etag && etag_list_matches(if_none_match, etag);
+    }
+    
+    const char *if_modified_since = u_map_get_case(request->map_header, "If-Modified-Since");
+    if (if_modified_since && !(modified & 1)) {
+        long long since = parse_http_date(if_modified_since);
+        return since >= 0 && since >= modified / 2;
+    }
+    return 0;
+}
+
+// Turn the response into a bodiless 304, its validators and other headers stay
+void send_not_modified(struct _u_response *response) {
+    ulfius_set_empty_body_response(response, 304);
+    u_map_remove_from_key(response->map_header, "Content-Type");
+    u_map_remove_from_key(response->map_header, "Content-Encoding");
+    atomic_fetch_add(&response_cache.not_modified, 1);
+}
+
+// Add milliseconds to the current CLOCK_REALTIME time
+void deadline_after_ms(struct timespec *deadline, long ms) {
+    clock_gettime(CLOCK_REALTIME, deadline);
+    deadline->tv_sec += ms / 1000;
+    deadline->tv_nsec += (ms % 1000) * 1000000L;
+    if (deadline->tv_nsec >= 1000000000L) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+// Increment the persistent data version inside the current transaction, returns the new value or 0
+unsigned long bump_data_version(sqlite3 *db) {
+    unsigned long version = 0;
+    sqlite3_stmt *stmt = prepare_cached_statement(db, "UPDATE counters SET value = value + 1 WHERE name = 'data_version' RETURNING value;");
+    if (stmt) {
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            version = (unsigned long)sqlite3_column_int64(stmt, 0);
+        }
+        release_cached_statement(db, stmt);
+    }
+    return version;
+}
+
+// Date the version just published. Last-Modified only has second resolution, so a second that
+// saw several commits is flagged and If-Modified-Since is not trusted for it.
+void mark_data_modified() {
+    long long now = (long long)time(NULL);
+    long long previous = atomic_load(&data_modified_at);
+    atomic_store(&data_modified_at, previous / 2 >= now ? (previous | 1) : now * 2);
+}
+
+// Run one batch of jobs inside a single transaction and commit it
+void run_write_batch(write_job_t *batch) {
+    int in_transaction = sqlite3_exec(writer.db, "BEGIN IMMEDIATE;", NULL, NULL, NULL) == SQLITE_OK;
+    int data_changes = 0;
+    if (!in_transaction) {
+        fprintf(stderr, "run_write_batch: BEGIN failed: %s\n", sqlite3_errmsg(writer.db));
+    }
+
+    for (write_job_t *job = batch; job; job = job->next) {
+        if (!in_transaction) {
+            job->result = -1;
+            continue;
+        }
+
+        // A failed job takes back whatever it wrote before failing, the rest of the batch still commits
+        if (exec_cached_statement(writer.db, "SAVEPOINT write_job;") != 0) {
+            job->result = -1;
+            continue;
+        }
+        int job_changes_before = sqlite3_total_changes(writer.db);
+        job->result = job->run(writer.db, job->arg);
+        // Rows a failed job wrote are rolled back, but total_changes still counts them
+        if (job->result == 0) {
+            data_changes += sqlite3_total_changes(writer.db) - job_changes_before;
+        }
+        if (job->result != 0) {
+            exec_cached_statement(writer.db, "ROLLBACK TO write_job;");
+            invalidate_name_dictionaries();
+            atomic_fetch_add(&writer_stats.rolled_back_jobs, 1);
+        }
+        exec_cached_statement(writer.db, "RELEASE write_job;");
+    }
+
+    if (in_transaction) {
+        // Bring rendered bodies up to date in the same commit as the writes that outdated them
+        if (drain_render_queue(writer.db) < 0) {
+            fprintf(stderr, "run_write_batch: rendering failed: %s\n", sqlite3_errmsg(writer.db));
+        }
+        // A batch of no-op and failed writes keeps the data version, and with it every cached
+        // response and the catalog snapshot
+        int changed = data_changes > 0;
+        unsigned long version = changed ? bump_data_version(writer.db) : 0;
+        if (sqlite3_exec(writer.db, "COMMIT;", NULL, NULL, NULL) == SQLITE_OK) {
+            atomic_fetch_add(&writer_stats.commits, 1);
+            // Publish only once the new data is visible to readers, the catalog snapshot first so a
+            // reader that sees the new version also finds the new data
+            if (changed) {
+                publish_catalog(writer.db);
+                if (version > 0) {
+                    atomic_store(&data_version, version);
+                } else {
+                    atomic_fetch_add(&data_version, 1);
+                }
+                mark_data_modified();
+            } else {
+                discard_catalog_changes();
+            }
+        } else {
+            fprintf(stderr, "run_write_batch: COMMIT failed: %s\n", sqlite3_errmsg(writer.db));
+            sqlite3_exec(writer.db, "ROLLBACK;", NULL, NULL, NULL);
+            invalidate_name_dictionaries();
+            discard_catalog_changes();
+            atomic_fetch_add(&writer_stats.failed_commits, 1);
+            for (write_job_t *job = batch; job; job = job->next) {
+                job->result = -1;
+            }
+        }
+    }
+}
+
+// Writer thread: takes every queued job, waits a short commit window for more,
+// then applies the whole batch as one transaction (group commit)
+void* db_writer_thread(void *arg) {
+    UNUSED(arg);
+
+    pthread_mutex_lock(&writer.mutex);
+    while (writer.running || writer.head) {
+        if (!writer.head) {
+            if (!catalog.unsaved) {
+                pthread_cond_wait(&writer.queue_cond, &writer.mutex);
+                continue;
+            }
+            // Save the catalog snapshot once writes have paused for a while, not after every batch
+            struct timespec deadline;
+            deadline_after_ms(&deadline, CATALOG_SAVE_DELAY_MS);
+            if (pthread_cond_timedwait(&writer.queue_cond, &writer.mutex, &deadline) == ETIMEDOUT && !writer.head) {
+                pthread_mutex_unlock(&writer.mutex);
+                save_pending_catalog();
+                pthread_mutex_lock(&writer.mutex);
+            }
+            continue;
+        }
+
+        if (WRITER_COMMIT_WINDOW_MS > 0 && writer.running && writer.queued < WRITER_MAX_BATCH) {
+            struct timespec deadline;
+            deadline_after_ms(&deadline, WRITER_COMMIT_WINDOW_MS);
+            while (writer.running && writer.queued < WRITER_MAX_BATCH &&
+                   pthread_cond_timedwait(&writer.queue_cond, &writer.mutex, &deadline) != ETIMEDOUT) {
+                // Keep collecting until the window closes or the batch is full
+            }
+        }
+
+        // Detach up to WRITER_MAX_BATCH jobs from the queue
+        write_job_t *batch = writer.head;
+        write_job_t *last = batch;
+        int batch_size = 1;
+        while (last->next && batch_size < WRITER_MAX_BATCH) {
+            last = last->next;
+            batch_size++;
+        }
+        writer.head = last->next;
+        if (!writer.head) {
+            writer.tail = NULL;
+        }
+        writer.queued -= batch_size;
+        last->next = NULL;
+        pthread_mutex_unlock(&writer.mutex);
+
+        run_write_batch(batch);
+
+        unsigned long largest = atomic_load(&writer_stats.largest_batch);
+        while ((unsigned long)batch_size > largest &&
+               !atomic_compare_exchange_weak(&writer_stats.largest_batch, &largest, (unsigned long)batch_size)) {
+            // Retry with the updated value
+        }
+
+        pthread_mutex_lock(&writer.mutex);
+        write_job_t *job = batch;
+        while (job) {
+            // Read next before flagging done, the submitter owns the job memory
+            write_job_t *next = job->next;
+            job->done = 1;
+            job = next;
+        }
+        pthread_cond_broadcast(&writer.done_cond);
+    }
+    pthread_mutex_unlock(&writer.mutex);
+    save_pending_catalog();
+
+    return NULL;
+}
+
+// Queue a job for the writer thread and wait until its transaction has been committed.
+// Returns the job result, or -1 if the job or its commit failed.
+int submit_write_job(int (*run)(sqlite3 *db, void *arg), void *arg) {
+    write_job_t job = {0};
+    job.run = run;
+    job.arg = arg;
+
+    pthread_mutex_lock(&writer.mutex);
+    if (!writer.running) {
+        pthread_mutex_unlock(&writer.mutex);
+        return -1;
+    }
+    if (writer.tail) {
+        writer.tail->next = &job;
+    } else {
+        writer.head = &job;
+    }
+    writer.tail = &job;
+    writer.queued++;
+    pthread_cond_signal(&writer.queue_cond);
+
+    while (!job.done) {
+        pthread_cond_wait(&writer.done_cond, &writer.mutex);
+    }
+    pthread_mutex_unlock(&writer.mutex);
+
+    atomic_fetch_add(&writer_stats.jobs, 1);
+    if (job.result != 0) {
+        atomic_fetch_add(&writer_stats.failed_jobs, 1);
+    }
+    return job.result;
+}
+
+void close_writer_connection() {
+    clear_stmt_cache(&writer.cache);
+    sqlite3_close(writer.db);
+    writer.db = NULL;
+    writer.cache.db = NULL;
+}
+
+// Open the writer connection with its statement cache and bring the schema up to date,
+// shared by the writer thread and the offline modes that write
+int open_writer_connection() {
+    int rc = sqlite3_open(DATABASE_FILE, &writer.db);
+    if (rc) {
+        fprintf(stderr, "Can't open writer database connection: %s\n", sqlite3_errmsg(writer.db));
+        sqlite3_close(writer.db);
+        writer.db = NULL;
+        return -1;
+    }
+
+    sqlite3_busy_timeout(writer.db, DB_BUSY_TIMEOUT_MS);
+    sqlite3_exec(writer.db, "PRAGMA journal_mode=WAL;", NULL, NULL, NULL);
+    sqlite3_exec(writer.db, "PRAGMA foreign_keys=ON;", NULL, NULL, NULL);
+    sqlite3_exec(writer.db, "PRAGMA synchronous=NORMAL;", NULL, NULL, NULL);
+    sqlite3_exec(writer.db, "PRAGMA cache_size=10000;", NULL, NULL, NULL);
+    sqlite3_exec(writer.db, "PRAGMA temp_store=MEMORY;", NULL, NULL, NULL);
+    // REPLACE only fires the delete triggers that keep counters exact with recursive triggers on
+    sqlite3_exec(writer.db, "PRAGMA recursive_triggers=ON;", NULL, NULL, NULL);
+    writer.cache.db = writer.db;
+    register_storage_functions(writer.db);
+    if (migrate_schema(writer.db) != 0) {
+        close_writer_connection();
+        return -1;
+    }
+    load_counters(writer.db);
+    atomic_store(&search_index_available, table_exists(writer.db, "templates_fts"));
+    if (!atomic_load(&search_index_available)) {
+        fprintf(stderr, "Full-text search unavailable, falling back to LIKE\n");
+    }
+    load_storage(writer.db);
+    render_queued_templates(writer.db);
+    load_name_dictionaries(writer.db);
+    return 0;
+}
+
+// Open the writer connection and start its thread
+int start_db_writer() {
+    if (open_writer_connection() != 0) {
+        return -1;
+    }
+
+    pthread_mutex_init(&writer.mutex, NULL);
+    pthread_cond_init(&writer.queue_cond, NULL);
+    pthread_cond_init(&writer.done_cond, NULL);
+    writer.running = 1;
+
+    if (pthread_create(&writer.thread, NULL, &db_writer_thread, NULL) != 0) {
+        fprintf(stderr, "Failed to start database writer thread\n");
+        writer.running = 0;
+        pthread_cond_destroy(&writer.done_cond);
+        pthread_cond_destroy(&writer.queue_cond);
+        pthread_mutex_destroy(&writer.mutex);
+        close_writer_connection();
+        return -1;
+    }
+
+    return 0;
+}
+
+// Drain the queue, stop the writer thread and close its connection
+void stop_db_writer() {
+    if (!writer.db) return;
+
+    pthread_mutex_lock(&writer.mutex);
+    writer.running = 0;
+    pthread_cond_signal(&writer.queue_cond);
+    pthread_mutex_unlock(&writer.mutex);
+    pthread_join(writer.thread, NULL);
+
+    pthread_cond_destroy(&writer.done_cond);
+    pthread_cond_destroy(&writer.queue_cond);
+    pthread_mutex_destroy(&writer.mutex);
+    close_writer_connection();
+}
+
+// Add count views of key to a shard's table of the current epoch, never blocking and never touching the
+// database. Returns 0 when the table has no free slot near the key's.
+int record_views(view_shard_t *shard, uint64_t key, unsigned int count) {
+    unsigned int parity;
+    for (;;) {
+        unsigned int epoch = atomic_load(&view_counters.epoch);
+        atomic_fetch_add(&shard->readers[epoch & 1], 1);
+        // Registered under an epoch the flusher has already moved past: it may be draining that table
+        if (atomic_load(&view_counters.epoch) == epoch) {
+            parity = epoch & 1;
+            break;
+        }
+        atomic_fetch_sub(&shard->readers[epoch & 1], 1);
+    }
+    
+    size_t slot = (size_t)((key * 0x9e3779b97f4a7c15ULL) >> 32) & (VIEW_COUNTER_SLOTS - 1);
+    int recorded = 0;
+    for (int probe = 0; probe < VIEW_PROBE_LIMIT && !recorded; probe++) {
+        view_slot_t *entry = &shard->slots[parity][slot];
+        uint_fast64_t current = atomic_load(&entry->key);
+        if (current == 0 && atomic_compare_exchange_strong(&entry->key, &current, key)) {
+            current = key;
+        }
+        if (current == key) {
+            atomic_fetch_add(&entry->count, count);
+            recorded = 1;
+        }
+        slot = (slot + 1) & (VIEW_COUNTER_SLOTS - 1);
+    }
+    atomic_fetch_sub(&shard->readers[parity], 1);
+    return recorded;
+}
+
+// Count a GET of a template or collection page, the :id of its URL. Each request thread sticks to
+// the shard it is handed on its first view, so threads rarely write to the same cache lines.
+void count_view(const struct _u_request *request, view_kind_t kind) {
+    static _Thread_local int shard = -1;
+    if (VIEW_FLUSH_SECONDS <= 0 || kind == VIEW_NONE || strcmp(request->http_verb, "GET") != 0) {
+        return;
+    }
+    const char *id_str = u_map_get(request->map_url, "id");
+    int id = id_str ? atoi(id_str) : 0;
+    if (id <= 0) {
+        return;
+    }
+    if (shard < 0) {
+        shard = atomic_fetch_add(&view_counters.threads, 1) % VIEW_COUNTER_SHARDS;
+    }
+    view_shard_t *counters = &view_shards[shard];
+    int recorded = record_views(counters, (uint64_t)kind << 32 | (uint32_t)id, 1);
+    atomic_fetch_add(recorded ? &counters->recorded : &counters->dropped, 1);
+}
+
+int compare_view_counts(const void *a, const void *b) {
+    uint64_t x = ((const view_count_t *)a)->key, y = ((const view_count_t *)b)->key;
+    return (x > y) - (x < y);
+}
+
+typedef struct {
+    const view_count_t *counts;
+    int count;
+} view_flush_job_t;
+
+// Writer job of a flush: add the counted views to the rows, ids that no longer exist are skipped.
+// Flushed templates are queued for rendering, so their stored bodies, ETags and snapshot entries
+// carry the new totalViews once the batch commits.
+int run_view_flush(sqlite3 *db, void *arg) {
+    view_flush_job_t *job = arg;
+    for (int i = 0; i < job->count; i++) {
+        int is_template = job->counts[i].key >> 32 == VIEW_TEMPLATE;
+        const char *sql = is_template
+            ? "UPDATE templates SET total_views = COALESCE(total_views, 0) + ?2 WHERE id = ?1;"
+            : "UPDATE collections SET total_views = COALESCE(total_views, 0) + ?2 WHERE id = ?1;";
+        sqlite3_stmt *stmt = prepare_cached_statement(db, sql);
+        if (!stmt) {
+            return -1;
+        }
+        sqlite3_bind_int(stmt, 1, (int)(job->counts[i].key & 0xFFFFFFFFu));
+        sqlite3_bind_int64(stmt, 2, job->counts[i].count);
+        int rc = sqlite3_step(stmt);
+        release_cached_statement(db, stmt);
+        if (rc != SQLITE_DONE) {
+            return -1;
+        }
+        if (is_template && sqlite3_changes(db) > 0) {
+            stmt = prepare_cached_statement(db, "INSERT OR IGNORE INTO render_queue VALUES (?);");
+            if (!stmt) {
+                return -1;
+            }
+            sqlite3_bind_int(stmt, 1, (int)(job->counts[i].key & 0xFFFFFFFFu));
+            rc = sqlite3_step(stmt);
+            release_cached_statement(db, stmt);
+            if (rc != SQLITE_DONE) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Take the views recorded since the last flush out of every shard and write them in one job. Views a
+// failed write could not apply are recorded again for the next flush. Returns the views written or -1.
+long flush_views() {
+    unsigned int parity = atomic_fetch_add(&view_counters.epoch, 1) & 1;
+    view_count_t *counts = NULL;
+    int count = 0, capacity = 0;
+    for (int i = 0; i < VIEW_COUNTER_SHARDS; i++) {
+        view_shard_t *shard = &view_shards[i];
+        while (atomic_load(&shard->readers[parity]) > 0) {
+            sched_yield();
+        }
+        for (int slot = 0; slot < VIEW_COUNTER_SLOTS; slot++) {
+            view_slot_t *entry = &shard->slots[parity][slot];
+            uint64_t key = atomic_load(&entry->key);
+            if (key == 0) {
+                continue;
+            }
+            if (count == capacity) {
+                int grown_capacity = capacity ? capacity * 2 : 256;
+                view_count_t *grown = realloc(counts, grown_capacity * sizeof(view_count_t));
+                if (grown) {
+                    counts = grown;
+                    capacity = grown_capacity;
+                }
+            }
+            unsigned int views = atomic_exchange(&entry->count, 0);
+            atomic_store(&entry->key, 0);
+            if (views == 0) {
+                continue;
+            }
+            if (count < capacity) {
+                counts[count].key = key;
+                counts[count].count = views;
+                count++;
+            } else {
+                atomic_fetch_add(&shard->dropped, views);
+            }
+        }
+    }
+    
+    // A page viewed from threads of several shards has a count in each
+    qsort(counts, count, sizeof(view_count_t), compare_view_counts);
+    int unique_count = 0;
+    long total = 0;
+    for (int i = 0; i < count; i++) {
+        total += counts[i].count;
+        if (unique_count > 0 && counts[unique_count - 1].key == counts[i].key) {
+            counts[unique_count - 1].count += counts[i].count;
+        } else {
+            counts[unique_count++] = counts[i];
+        }
+    }
+    
+    if (unique_count > 0) {
+        view_flush_job_t job = { counts, unique_count };
+        if (submit_write_job(run_view_flush, &job) == 0) {
+            atomic_fetch_add(&view_counters.flushes, 1);
+            atomic_fetch_add(&view_counters.flushed, total);
+        } else {
+            fprintf(stderr, "Failed to write %ld views, keeping them for the next flush\n", total);
+            atomic_fetch_add(&view_counters.failed_flushes, 1);
+            for (int i = 0; i < unique_count; i++) {
+                view_shard_t *shard = &view_shards[i % VIEW_COUNTER_SHARDS];
+                if (!record_views(shard, counts[i].key, counts[i].count)) {
+                    atomic_fetch_add(&shard->dropped, counts[i].count);
+                }
+            }
+            total = -1;
+        }
+    }
+    free(counts);
+    return total;
+}
+
+// Flusher thread: writes the recorded views every VIEW_FLUSH_SECONDS, and once more when stopped
+void *view_flusher_thread(void *arg) {
+    UNUSED(arg);
+    
+    pthread_mutex_lock(&view_counters.mutex);
+    while (view_counters.running) {
+        struct timespec deadline;
+        deadline_after_ms(&deadline, VIEW_FLUSH_SECONDS * 1000L);
+        while (view_counters.running &&
+               pthread_cond_timedwait(&view_counters.cond, &view_counters.mutex, &deadline) != ETIMEDOUT) {
+            // Only a stop ends the wait early
+        }
+        pthread_mutex_unlock(&view_counters.mutex);
+        flush_views();
+        pthread_mutex_lock(&view_counters.mutex);
+    }
+    pthread_mutex_unlock(&view_counters.mutex);
+    
+    return NULL;
+}
+
+int start_view_flusher() {
+    pthread_mutex_init(&view_counters.mutex, NULL);
+    pthread_cond_init(&view_counters.cond, NULL);
+    view_counters.running = 1;
+    if (pthread_create(&view_counters.thread, NULL, &view_flusher_thread, NULL) != 0) {
+        fprintf(stderr, "Failed to start view flusher thread, views are not counted\n");
+        view_counters.running = 0;
+        pthread_cond_destroy(&view_counters.cond);
+        pthread_mutex_destroy(&view_counters.mutex);
+        return -1;
+    }
+    return 0;
+}
+
+// Write the views still pending and stop the flusher, before the writer is stopped
+void stop_view_flusher() {
+    if (!view_counters.running) {
+        return;
+    }
+    pthread_mutex_lock(&view_counters.mutex);
+    view_counters.running = 0;
+    pthread_cond_signal(&view_counters.cond);
+    pthread_mutex_unlock(&view_counters.mutex);
+    pthread_join(view_counters.thread, NULL);
+    pthread_cond_destroy(&view_counters.cond);
+    pthread_mutex_destroy(&view_counters.mutex);
+}
+
+// Utility function to parse integer parameter with default
+int get_int_param(const struct _u_request *request, const char *param_name, int default_value) {
+    const char *param_str = u_map_get(request->map_url, param_name);
+    if (param_str && strlen(param_str) > 0) {
+        int value = atoi(param_str);
+        return value > 0 ? value : default_value;
+    }
+    return default_value;
+}
+
+// Keyset cursors: the last row of a page as hex encoded "id" or "id:score", handed
+// back in the X-Next-Cursor header so the next page seeks instead of skipping rows
+void encode_cursor(int last_id, int has_score, double score, char *out, size_t out_size) {
+    char payload[CURSOR_BUFFER_SIZE / 2];
+    if (has_score) {
+        snprintf(payload, sizeof(payload), "%d:%.17g", last_id, score);
+    } else {
+        snprintf(payload, sizeof(payload), "%d", last_id);
+    }
+    
+    size_t used = 0;
+    for (const unsigned char *p = (const unsigned char *)payload; *p && used + 3 <= out_size; p++) {
+        used += snprintf(out + used, out_size - used, "%02x", *p);
+    }
+    out[used] = '\0';
+}
+
+// Returns 0 on success, -1 when the cursor was not produced by encode_cursor
+int decode_cursor(const char *cursor, int *last_id, int *has_score, double *score) {
+    char payload[CURSOR_BUFFER_SIZE / 2];
+    size_t len = strlen(cursor);
+    if (len == 0 || len % 2 != 0 || len / 2 >= sizeof(payload)) {
+        return -1;
+    }
+    
+    for (size_t i = 0; i < len / 2; i++) {
+        unsigned int byte;
+        if (!isxdigit((unsigned char)cursor[2 * i]) || !isxdigit((unsigned char)cursor[2 * i + 1]) ||
+            sscanf(cursor + 2 * i, "%2x", &byte) != 1) {
+            return -1;
+        }
+        payload[i] = (char)byte;
+    }
+    payload[len / 2] = '\0';
+    
+    char *end;
+    long id = strtol(payload, &end, 10);
+    if (end == payload || id <= 0 || id > INT32_MAX) {
+        return -1;
+    }
+    *last_id = (int)id;
+    *has_score = 0;
+    
+    if (*end == ':') {
+        char *score_end;
+        *score = strtod(end + 1, &score_end);
+        if (score_end == end + 1 || *score_end != '\0') {
+            return -1;
+        }
+        *has_score = 1;
+    } else if (*end != '\0') {
+        return -1;
+    }
+    return 0;
+}
+
+// Make room for at least extra more bytes
+int jw_reserve(json_writer_t *writer, size_t extra) {
+    if (writer->failed) {
+        return -1;
+    }
+    if (writer->length + extra <= writer->capacity) {
+        return 0;
+    }
+    
+    size_t capacity = writer->capacity ? writer->capacity : JSON_WRITER_INITIAL_SIZE;
+    while (capacity < writer->length + extra) {
+        capacity *= 2;
+    }
+    char *data = realloc(writer->data, capacity);
+    if (!data) {
+        writer->failed = 1;
+        return -1;
+    }
+    writer->data = data;
+    writer->capacity = capacity;
+    return 0;
+}
+
+void jw_append(json_writer_t *writer, const char *bytes, size_t length) {
+    if (jw_reserve(writer, length) == 0) {
+        memcpy(writer->data + writer->length, bytes, length);
+        writer->length += length;
+    }
+}
+
+void jw_init(json_writer_t *writer) {
+    memset(writer, 0, sizeof(*writer));
+    jw_reserve(writer, JSON_WRITER_INITIAL_SIZE);
+}
+
+void jw_free(json_writer_t *writer) {
+    free(writer->data);
+    writer->data = NULL;
+}
+
+// Comma between siblings, then "key": when inside an object
+void jw_prefix(json_writer_t *writer, const char *key) {
+    if (writer->has_members[writer->depth]) {
+        jw_append(writer, ",", 1);
+    }
+    writer->has_members[writer->depth] = 1;
+    if (key) {
+        jw_append(writer, "\"", 1);
+        jw_append(writer, key, strlen(key));
+        jw_append(writer, "\":", 2);
+    }
+}
+
+void jw_open(json_writer_t *writer, const char *key, char bracket) {
+    jw_prefix(writer, key);
+    jw_append(writer, &bracket, 1);
+    if (writer->depth + 1 < JSON_WRITER_MAX_DEPTH) {
+        writer->depth++;
+        writer->has_members[writer->depth] = 0;
+    } else {
+        writer->failed = 1;
+    }
+}
+
+void jw_close(json_writer_t *writer, char bracket) {
+    jw_append(writer, &bracket, 1);
+    if (writer->depth > 0) {
+        writer->depth--;
+    }
+}
+
+#define jw_begin_object(writer, key) jw_open(writer, key, '{')
+#define jw_end_object(writer) jw_close(writer, '}')
+#define jw_begin_array(writer, key) jw_open(writer, key, '[')
+#define jw_end_array(writer) jw_close(writer, ']')
+
+// SWAR tests over 8 bytes at once: any byte below 0x20, or equal to c
+#define JW_ONES 0x0101010101010101ULL
+#define JW_HIGHS 0x8080808080808080ULL
+#define jw_has_less(word, n) (((word) - JW_ONES * (n)) & ~(word) & JW_HIGHS)
+#define jw_has_byte(word, c) jw_has_less((word) ^ (JW_ONES * (c)), 1)
+
+// Quoted string with the same escaping as jansson, so bodies match the DOM based ones.
+// Runs of 8 bytes without quotes, backslashes or control characters are copied in one go.
+void jw_escaped(json_writer_t *writer, const char *value) {
+    size_t length = strlen(value);
+    // Worst case every byte becomes a 6 byte \uXXXX sequence
+    if (jw_reserve(writer, length * 6 + 3) != 0) {
+        return;
+    }
+    
+    char *out = writer->data + writer->length;
+    const unsigned char *in = (const unsigned char *)value;
+    const unsigned char *end = in + length;
+    *out++ = '"';
+    
+    while (in < end) {
+        if (end - in >= 8) {
+            uint64_t word;
+            memcpy(&word, in, sizeof(word));
+            if (!(jw_has_less(word, 0x20) | jw_has_byte(word, '"') | jw_has_byte(word, '\\'))) {
+                memcpy(out, in, sizeof(word));
+                out += sizeof(word);
+                in += sizeof(word);
+                continue;
+            }
+        }
+        
+        unsigned char c = *in++;
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            *out++ = (char)c;
+            continue;
+        }
+        *out++ = '\\';
+        switch (c) {
+            case '"': *out++ = '"'; break;
+            case '\\': *out++ = '\\'; break;
+            case '\b': *out++ = 'b'; break;
+            case '\f': *out++ = 'f'; break;
+            case '\n': *out++ = 'n'; break;
+            case '\r': *out++ = 'r'; break;
+            case '\t': *out++ = 't'; break;
+            default:
+                out += sprintf(out, "u%04X", c);
+                break;
+        }
+    }
+    
+    *out++ = '"';
+    writer->length = out - writer->data;
+}
+
+// A NULL value leaves the member out, like setting json_string(NULL) on a jansson object
+void jw_string(json_writer_t *writer, const char *key, const char *value) {
+    if (!value) return;
+    jw_prefix(writer, key);
+    jw_escaped(writer, value);
+}
+
+void jw_string_or_null(json_writer_t *writer, const char *key, const char *value) {
+    jw_prefix(writer, key);
+    if (value) {
+        jw_escaped(writer, value);
+    } else {
+        jw_append(writer, "null", 4);
+    }
+}
+
+void jw_int(json_writer_t *writer, const char *key, long long value) {
+    char number[24];
+    jw_prefix(writer, key);
+    jw_append(writer, number, snprintf(number, sizeof(number), "%lld", value));
+}
+
+void jw_bool(json_writer_t *writer, const char *key, int value) {
+    jw_prefix(writer, key);
+    jw_append(writer, value ? "true" : "false", value ? 4 : 5);
+}
+
+void jw_null(json_writer_t *writer, const char *key) {
+    jw_prefix(writer, key);
+    jw_append(writer, "null", 4);
+}
+
+// Real formatted like jansson: %.17g, always with a dot or exponent, no '+' or leading zeros in it
+void jw_real(json_writer_t *writer, const char *key, double value) {
+    char number[32];
+    if (isnan(value) || isinf(value)) {
+        jw_null(writer, key);
+        return;
+    }
+    
+    int length = snprintf(number, sizeof(number), "%.17g", value);
+    if (!strchr(number, '.') && !strchr(number, 'e')) {
+        length += snprintf(number + length, sizeof(number) - length, ".0");
+    }
+    char *exponent = strchr(number, 'e');
+    if (exponent) {
+        char *digits = exponent + 1;
+        char *start = digits;
+        if (*start == '-') start++, digits++;
+        if (*start == '+') start++;
+        while (*start == '0' && start[1] != '\0') start++;
+        memmove(digits, start, strlen(start) + 1);
+        length = strlen(number);
+    }
+    
+    jw_prefix(writer, key);
+    jw_append(writer, number, length);
+}
+
+// Copy a stored JSON object or array as is. Anything else (NULL, or text the query did not
+// vouch for with json_valid()) is replaced by fallback, the same default the DOM code used.
+void jw_raw(json_writer_t *writer, const char *key, const char *json_text, const char *fallback) {
+    jw_prefix(writer, key);
+    if (json_text && (json_text[0] == '{' || json_text[0] == '[')) {
+        jw_append(writer, json_text, strlen(json_text));
+    } else {
+        jw_append(writer, fallback, strlen(fallback));
+    }
+}
+
+// Hand the finished document to ulfius, returns 0 on success
+int jw_send(json_writer_t *writer, struct _u_response *response, unsigned int status) {
+    if (writer->failed) {
+        ulfius_set_string_body_response(response, 500, "Out of memory");
+        return -1;
+    }
+    ulfius_set_binary_body_response(response, status, writer->data, writer->length);
+    u_map_put(response->map_header, "Content-Type", "application/json");
+    return 0;
+}
+
+// Copy length bytes and a terminator into the string arena of a snapshot
+char *catalog_copy(catalog_t *snapshot, const char *text, size_t length) {
+    catalog_block_t *block = snapshot->strings;
+    if (!block || block->size - block->used < length + 1) {
+        size_t size = length + 1 > CATALOG_BLOCK_SIZE ? length + 1 : CATALOG_BLOCK_SIZE;
+        block = malloc(sizeof(catalog_block_t) + size);
+        if (!block) {
+            return NULL;
+        }
+        block->next = snapshot->strings;
+        block->used = 0;
+        block->size = size;
+        snapshot->strings = block;
+    }
+    
+    char *copy = block->data + block->used;
+    memcpy(copy, text, length);
+    copy[length] = '\0';
+    block->used += length + 1;
+    return copy;
+}
+
+// Arena copy of text shared with every equal string interned before, NULL stays NULL.
+// Sets *failed when out of memory.
+const char *catalog_intern(catalog_t *snapshot, catalog_interner_t *interner, const unsigned char *text, int *failed) {
+    if (!text) {
+        return NULL;
+    }
+    
+    if ((interner->count + 1) * 2 > interner->capacity) {
+        size_t capacity = interner->capacity ? interner->capacity * 2 : CATALOG_INTERN_INITIAL_SLOTS;
+        const char **slots = calloc(capacity, sizeof(const char *));
+        if (!slots) {
+            *failed = 1;
+            return NULL;
+        }
+        for (size_t i = 0; i < interner->capacity; i++) {
+            if (interner->slots[i]) {
+                size_t slot = hash_bytes(interner->slots[i], strlen(interner->slots[i])) & (capacity - 1);
+                while (slots[slot]) {
+                    slot = (slot + 1) & (capacity - 1);
+                }
+                slots[slot] = interner->slots[i];
+            }
+        }
+        free(interner->slots);
+        interner->slots = slots;
+        interner->capacity = capacity;
+    }
+    
+    size_t length = strlen((const char *)text);
+    size_t slot = hash_bytes((const char *)text, length) & (interner->capacity - 1);
+    while (interner->slots[slot]) {
+        if (strcmp(interner->slots[slot], (const char *)text) == 0) {
+            return interner->slots[slot];
+        }
+        slot = (slot + 1) & (interner->capacity - 1);
+    }
+    
+    char *copy = catalog_copy(snapshot, (const char *)text, length);
+    if (!copy) {
+        *failed = 1;
+        return NULL;
+    }
+    interner->slots[slot] = copy;
+    interner->count++;
+    return copy;
+}
+
+// Room for one more item in a growing array, returns the (possibly moved) array or NULL
+void *catalog_grow(void *items, int *capacity, int count, size_t item_size) {
+    if (count < *capacity) {
+        return items;
+    }
+    int grown_capacity = *capacity ? *capacity * 2 : 64;
+    void *grown = realloc(items, (size_t)grown_capacity * item_size);
+    if (grown) {
+        *capacity = grown_capacity;
+    }
+    return grown;
+}
+
+// Copy the current row of a CATALOG_TEMPLATE_SQL statement and its category ids into one block
+catalog_template_t *catalog_make_template(sqlite3_stmt *stmt, const int *category_ids, int category_count) {
+    const int text_columns[] = { 1, 3, 5, 6, 7 };
+    const int text_count = sizeof(text_columns) / sizeof(text_columns[0]);
+    size_t lengths[sizeof(text_columns) / sizeof(text_columns[0])];
+    size_t total = 0;
+    for (int i = 0; i < text_count; i++) {
+        lengths[i] = sqlite3_column_text(stmt, text_columns[i]) ? (size_t)sqlite3_column_bytes(stmt, text_columns[i]) + 1 : 0;
+        total += lengths[i];
+    }
+    
+    catalog_template_t *template = malloc(sizeof(catalog_template_t) + category_count * sizeof(int) + total);
+    if (!template) {
+        return NULL;
+    }
+    template->refs = 1;
+    template->id = sqlite3_column_int(stmt, 0);
+    template->total_views = sqlite3_column_int(stmt, 2);
+    template->user_id = sqlite3_column_int(stmt, 4);
+    template->has_price = sqlite3_column_type(stmt, 8) != SQLITE_NULL;
+    template->price = sqlite3_column_double(stmt, 8);
+    template->category_count = category_count;
+    memcpy(template->category_ids, category_ids, category_count * sizeof(int));
+    
+    const char **fields[] = { &template->name, &template->purchase_url, &template->description, &template->created_at, &template->nodes };
+    char *cursor = (char *)(template->category_ids + category_count);
+    for (int i = 0; i < text_count; i++) {
+        *fields[i] = NULL;
+        if (lengths[i] > 0) {
+            memcpy(cursor, sqlite3_column_text(stmt, text_columns[i]), lengths[i]);
+            *fields[i] = cursor;
+            cursor += lengths[i];
+        }
+    }
+    return template;
+}
+
+// Drop a snapshot's hold on a template, freeing it with the last one
+void catalog_release_template(catalog_template_t *template) {
+    if (--template->refs == 0) {
+        free(template);
+    }
+}
+
+void free_catalog_bitmap(catalog_bitmap_t *bitmap) {
+    if (!bitmap) {
+        return;
+    }
+    for (int i = 0; i < bitmap->container_count; i++) {
+        free(bitmap->containers[i].values);
+        free(bitmap->containers[i].words);
+    }
+    free(bitmap->containers);
+    free(bitmap);
+}
+
+// Drop a snapshot's hold on a category bitmap, freeing it with the last one
+void catalog_release_bitmap(catalog_bitmap_t *bitmap) {
+    if (bitmap && --bitmap->refs == 0) {
+        free_catalog_bitmap(bitmap);
+    }
+}
+
+catalog_bitmap_t *catalog_new_bitmap() {
+    catalog_bitmap_t *bitmap = calloc(1, sizeof(catalog_bitmap_t));
+    if (bitmap) {
+        bitmap->refs = 1;
+    }
+    return bitmap;
+}
+
+// Start a container for key after the last one, NULL when out of memory
+catalog_container_t *catalog_add_container(catalog_bitmap_t *bitmap, int key) {
+    catalog_container_t *grown = catalog_grow(bitmap->containers, &bitmap->container_capacity, bitmap->container_count, sizeof(catalog_container_t));
+    if (!grown) {
+        return NULL;
+    }
+    bitmap->containers = grown;
+    catalog_container_t *container = &grown[bitmap->container_count++];
+    memset(container, 0, sizeof(catalog_container_t));
+    container->key = key;
+    return container;
+}
+
+// Add an id greater than every id of bitmap
+int catalog_bitmap_append(catalog_bitmap_t *bitmap, int id) {
+    int key = id >> 16;
+    uint16_t low = id & 0xFFFF;
+    catalog_container_t *container = bitmap->container_count > 0 ? &bitmap->containers[bitmap->container_count - 1] : NULL;
+    if (!container || container->key != key) {
+        container = catalog_add_container(bitmap, key);
+        if (!container) {
+            return -1;
+        }
+    }
+    
+    if (!container->words && container->cardinality == CATALOG_ARRAY_CONTAINER_MAX) {
+        // Full array, from here on a bitmap is smaller
+        container->words = calloc(CATALOG_BITMAP_WORDS, sizeof(uint64_t));
+        if (!container->words) {
+            return -1;
+        }
+        for (int i = 0; i < container->cardinality; i++) {
+            container->words[container->values[i] >> 6] |= 1ULL << (container->values[i] & 63);
+        }
+        free(container->values);
+        container->values = NULL;
+    }
+    if (container->words) {
+        container->words[low >> 6] |= 1ULL << (low & 63);
+    } else {
+        uint16_t *grown = catalog_grow(container->values, &container->capacity, container->cardinality, sizeof(uint16_t));
+        if (!grown) {
+            return -1;
+        }
+        container->values = grown;
+        container->values[container->cardinality] = low;
+    }
+    container->cardinality++;
+    bitmap->cardinality++;
+    return 0;
+}
+
+// Merge a container into the bits of the same key: OR, or AND with intersect set
+void catalog_container_combine(const catalog_container_t *container, uint64_t *words, int intersect) {
+    if (container->words) {
+        for (int i = 0; i < CATALOG_BITMAP_WORDS; i++) {
+            words[i] = intersect ? words[i] & container->words[i] : words[i] | container->words[i];
+        }
+    } else if (!intersect) {
+        for (int i = 0; i < container->cardinality; i++) {
+            words[container->values[i] >> 6] |= 1ULL << (container->values[i] & 63);
+        }
+    } else {
+        uint64_t kept[CATALOG_BITMAP_WORDS] = {0};
+        for (int i = 0; i < container->cardinality; i++) {
+            uint16_t value = container->values[i];
+            kept[value >> 6] |= words[value >> 6] & (1ULL << (value & 63));
+        }
+        memcpy(words, kept, sizeof(kept));
+    }
+}
+
+// Append the ids set in words as the container for key, in whichever form is smaller
+int catalog_bitmap_put_words(catalog_bitmap_t *bitmap, int key, const uint64_t *words) {
+    int cardinality = 0;
+    for (int i = 0; i < CATALOG_BITMAP_WORDS; i++) {
+        cardinality += __builtin_popcountll(words[i]);
+    }
+    if (cardinality == 0) {
+        return 0;
+    }
+    
+    catalog_container_t *container = catalog_add_container(bitmap, key);
+    if (!container) {
+        return -1;
+    }
+    if (cardinality > CATALOG_ARRAY_CONTAINER_MAX) {
+        container->words = malloc(CATALOG_BITMAP_WORDS * sizeof(uint64_t));
+        if (!container->words) {
+            return -1;
+        }
+        memcpy(container->words, words, CATALOG_BITMAP_WORDS * sizeof(uint64_t));
+    } else {
+        container->values = malloc(cardinality * sizeof(uint16_t));
+        if (!container->values) {
+            return -1;
+        }
+        int count = 0;
+        for (int i = 0; i < CATALOG_BITMAP_WORDS; i++) {
+            for (uint64_t word = words[i]; word; word &= word - 1) {
+                container->values[count++] = (uint16_t)(i * 64 + __builtin_ctzll(word));
+            }
+        }
+        container->capacity = cardinality;
+    }
+    container->cardinality = cardinality;
+    bitmap->cardinality += cardinality;
+    return 0;
+}
+
+// Union of count bitmaps, or their intersection with intersect set, as a new bitmap (NULL when out of memory)
+catalog_bitmap_t *catalog_combine_bitmaps(catalog_bitmap_t *const *bitmaps, int count, int intersect) {
+    catalog_bitmap_t *result = catalog_new_bitmap();
+    int positions[MAX_CATEGORIES] = {0};
+    uint64_t words[CATALOG_BITMAP_WORDS];
+    while (result) {
+        // Containers are visited key by key, the lowest key still ahead first
+        int key = -1;
+        for (int i = 0; i < count; i++) {
+            if (positions[i] < bitmaps[i]->container_count && (key < 0 || bitmaps[i]->containers[positions[i]].key < key)) {
+                key = bitmaps[i]->containers[positions[i]].key;
+            }
+        }
+        if (key < 0) {
+            break;
+        }
+        
+        int present = 0;
+        memset(words, 0, sizeof(words));
+        for (int i = 0; i < count; i++) {
+            if (positions[i] < bitmaps[i]->container_count && bitmaps[i]->containers[positions[i]].key == key) {
+                catalog_container_combine(&bitmaps[i]->containers[positions[i]++], words, intersect && present++ > 0);
+            }
+        }
+        if ((!intersect || present == count) && catalog_bitmap_put_words(result, key, words) != 0) {
+            free_catalog_bitmap(result);
+            result = NULL;
+        }
+    }
+    return result;
+}
+
+// How many ids two bitmaps share
+int catalog_bitmap_and_count(const catalog_bitmap_t *a, const catalog_bitmap_t *b) {
+    int count = 0, i = 0, j = 0;
+    while (i < a->container_count && j < b->container_count) {
+        const catalog_container_t *x = &a->containers[i];
+        const catalog_container_t *y = &b->containers[j];
+        if (x->key != y->key) {
+            if (x->key < y->key) i++; else j++;
+            continue;
+        }
+        i++;
+        j++;
+        
+        if (x->words && y->words) {
+            for (int k = 0; k < CATALOG_BITMAP_WORDS; k++) {
+                count += __builtin_popcountll(x->words[k] & y->words[k]);
+            }
+        } else if (x->words || y->words) {
+            const catalog_container_t *array = x->words ? y : x;
+            const uint64_t *bits = x->words ? x->words : y->words;
+            for (int k = 0; k < array->cardinality; k++) {
+                count += (bits[array->values[k] >> 6] >> (array->values[k] & 63)) & 1;
+            }
+        } else {
+            int p = 0, q = 0;
+            while (p < x->cardinality && q < y->cardinality) {
+                if (x->values[p] == y->values[q]) {
+                    count++;
+                    p++;
+                    q++;
+                } else if (x->values[p] < y->values[q]) {
+                    p++;
+                } else {
+                    q++;
+                }
+            }
+        }
+    }
+    return count;
+}
+
+// Greatest id of bitmap below limit, -1 if there is none
+int catalog_bitmap_previous(const catalog_bitmap_t *bitmap, long long limit) {
+    if (limit <= 0) {
+        return -1;
+    }
+    long long id = limit - 1;
+    int key = (int)(id >> 16);
+    int low = (int)(id & 0xFFFF);
+    
+    // Last container at or below key
+    int first = 0, last = bitmap->container_count;
+    while (first < last) {
+        int middle = first + (last - first) / 2;
+        if (bitmap->containers[middle].key <= key) {
+            first = middle + 1;
+        } else {
+            last = middle;
+        }
+    }
+    for (int i = first - 1; i >= 0; i--) {
+        const catalog_container_t *container = &bitmap->containers[i];
+        if (container->key < key) {
+            low = 0xFFFF;
+        }
+        if (container->words) {
+            int word = low >> 6;
+            uint64_t bits = container->words[word] & (~0ULL >> (63 - (low & 63)));
+            while (!bits && word > 0) {
+                bits = container->words[--word];
+            }
+            if (bits) {
+                return (container->key << 16) | (word * 64 + 63 - __builtin_clzll(bits));
+            }
+        } else {
+            int lower = 0, upper = container->cardinality;
+            while (lower < upper) {
+                int middle = lower + (upper - lower) / 2;
+                if (container->values[middle] <= low) {
+                    lower = middle + 1;
+                } else {
+                    upper = middle;
+                }
+            }
+            if (lower > 0) {
+                return (container->key << 16) | container->values[lower - 1];
+            }
+        }
+    }
+    return -1;
+}
+
+void free_catalog(catalog_t *snapshot) {
+    if (!snapshot) {
+        return;
+    }
+    for (int i = 0; i < snapshot->template_count; i++) {
+        catalog_release_template(snapshot->templates[i]);
+    }
+    free(snapshot->templates);
+    for (int i = 0; snapshot->category_templates && i < snapshot->category_count; i++) {
+        catalog_release_bitmap(snapshot->category_templates[i]);
+    }
+    free(snapshot->category_templates);
+    for (int i = 0; i < snapshot->text_segment_count; i++) {
+        if (--snapshot->text_segments[i]->refs == 0) {
+            free(snapshot->text_segments[i]);
+        }
+    }
+    free(snapshot->text_segments);
+    free(snapshot->categories);
+    free(snapshot->categories_by_id);
+    free(snapshot->users);
+    free(snapshot->collections);
+    free(snapshot->collection_workflows);
+    free(snapshot->collection_categories);
+    while (snapshot->strings) {
+        catalog_block_t *next = snapshot->strings->next;
+        free(snapshot->strings);
+        snapshot->strings = next;
+    }
+    free(snapshot);
+}
+
+// Read (owner id, value) rows ordered by owner, the owner of values[i] is owners[i]
+int catalog_load_pairs(sqlite3 *db, const char *sql, int **owners, int **values, int *count) {
+    sqlite3_stmt *stmt = prepare_cached_statement(db, sql);
+    if (!stmt) {
+        return -1;
+    }
+    
+    int owner_capacity = 0, value_capacity = 0, rc;
+    *count = 0;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        int *grown_owners = catalog_grow(*owners, &owner_capacity, *count, sizeof(int));
+        if (grown_owners) *owners = grown_owners;
+        int *grown_values = catalog_grow(*values, &value_capacity, *count, sizeof(int));
+        if (grown_values) *values = grown_values;
+        if (!grown_owners || !grown_values) {
+            break;
+        }
+        (*owners)[*count] = sqlite3_column_int(stmt, 0);
+        (*values)[*count] = sqlite3_column_int(stmt, 1);
+        (*count)++;
+    }
+    release_cached_statement(db, stmt);
+    return rc == SQLITE_DONE ? 0 : -1;
+}
+
+// First index of owner in a sorted owners array, and how many entries it has
+int catalog_find_range(const int *owners, int count, int owner, int *length) {
+    int low = 0, high = count;
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        if (owners[middle] < owner) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    int end = low;
+    while (end < count && owners[end] == owner) {
+        end++;
+    }
+    *length = end - low;
+    return low;
+}
+
+// Read every template with its category ids in one pass over each table
+int catalog_load_templates(sqlite3 *db, catalog_t *snapshot) {
+    int *owners = NULL, *category_ids = NULL, link_count = 0;
+    if (catalog_load_pairs(db, "SELECT template_id, category_id FROM template_categories ORDER BY template_id, category_id;",
+                           &owners, &category_ids, &link_count) != 0) {
+        free(owners);
+        free(category_ids);
+        return -1;
+    }
+    
+    sqlite3_stmt *stmt = prepare_cached_statement(db, CATALOG_TEMPLATE_SQL " ORDER BY t.id;");
+    int rc = SQLITE_ERROR, capacity = 0, link = 0;
+    while (stmt && (rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        int id = sqlite3_column_int(stmt, 0);
+        while (link < link_count && owners[link] < id) {
+            link++;
+        }
+        int first = link;
+        while (link < link_count && owners[link] == id) {
+            link++;
+        }
+        
+        catalog_template_t **grown = catalog_grow(snapshot->templates, &capacity, snapshot->template_count, sizeof(catalog_template_t *));
+        catalog_template_t *template = grown ? catalog_make_template(stmt, category_ids + first, link - first) : NULL;
+        if (grown) snapshot->templates = grown;
+        if (!template) {
+            rc = SQLITE_NOMEM;
+            break;
+        }
+        snapshot->templates[snapshot->template_count++] = template;
+    }
+    if (stmt) release_cached_statement(db, stmt);
+    free(owners);
+    free(category_ids);
+    return rc == SQLITE_DONE ? 0 : -1;
+}
+
+// Read one template as it is now. NULL with *rc == SQLITE_DONE when it no longer exists.
+catalog_template_t *catalog_read_template(sqlite3 *db, int template_id, int *rc) {
+    int *category_ids = NULL, category_count = 0, capacity = 0;
+    sqlite3_stmt *category_stmt = prepare_cached_statement(db, "SELECT category_id FROM template_categories WHERE template_id = ? ORDER BY category_id;");
+    if (!category_stmt) {
+        *rc = SQLITE_ERROR;
+        return NULL;
+    }
+    sqlite3_bind_int(category_stmt, 1, template_id);
+    while ((*rc = sqlite3_step(category_stmt)) == SQLITE_ROW) {
+        int *grown = catalog_grow(category_ids, &capacity, category_count, sizeof(int));
+        if (!grown) {
+            *rc = SQLITE_NOMEM;
+            break;
+        }
+        category_ids = grown;
+        category_ids[category_count++] = sqlite3_column_int(category_stmt, 0);
+    }
+    release_cached_statement(db, category_stmt);
+    if (*rc != SQLITE_DONE) {
+        free(category_ids);
+        return NULL;
+    }
+    
+    catalog_template_t *template = NULL;
+    sqlite3_stmt *stmt = prepare_cached_statement(db, CATALOG_TEMPLATE_SQL " WHERE t.id = ?;");
+    if (!stmt) {
+        *rc = SQLITE_ERROR;
+    } else {
+        sqlite3_bind_int(stmt, 1, template_id);
+        *rc = sqlite3_step(stmt);
+        if (*rc == SQLITE_ROW) {
+            template = catalog_make_template(stmt, category_ids, category_count);
+            *rc = template ? SQLITE_ROW : SQLITE_NOMEM;
+        }
+        release_cached_statement(db, stmt);
+    }
+    free(category_ids);
+    return template;
+}
+
+// Share the templates of previous, except the changed ones (sorted, unique) which are read again
+int catalog_merge_templates(sqlite3 *db, catalog_t *snapshot, catalog_t *previous, const int *changed, int changed_count) {
+    snapshot->templates = malloc(((size_t)previous->template_count + changed_count + 1) * sizeof(catalog_template_t *));
+    if (!snapshot->templates) {
+        return -1;
+    }
+    
+    int i = 0, j = 0;
+    while (i < previous->template_count || j < changed_count) {
+        if (j == changed_count || (i < previous->template_count && previous->templates[i]->id < changed[j])) {
+            catalog_template_t *shared = previous->templates[i++];
+            shared->refs++;
+            snapshot->templates[snapshot->template_count++] = shared;
+            continue;
+        }
+        
+        int template_id = changed[j++];
+        if (i < previous->template_count && previous->templates[i]->id == template_id) {
+            i++;
+        }
+        int rc;
+        catalog_template_t *template = catalog_read_template(db, template_id, &rc);
+        if (template) {
+            snapshot->templates[snapshot->template_count++] = template;
+        } else if (rc != SQLITE_DONE) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int compare_catalog_category_names(const void *a, const void *b) {
+    return strcmp(((const catalog_category_t *)a)->name, ((const catalog_category_t *)b)->name);
+}
+
+// Index of the category called name, -1 if there is none
+int catalog_find_category(const catalog_t *snapshot, const char *name) {
+    catalog_category_t key = { .name = name };
+    catalog_category_t *found = bsearch(&key, snapshot->categories, snapshot->category_count, sizeof(catalog_category_t), compare_catalog_category_names);
+    return found ? (int)(found - snapshot->categories) : -1;
+}
+
+// Category with the given id, NULL if there is none
+const catalog_category_t *catalog_category_by_id(const catalog_t *snapshot, int category_id) {
+    int low = 0, high = snapshot->category_count;
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        int id = snapshot->categories[snapshot->categories_by_id[middle]].id;
+        if (id == category_id) {
+            return &snapshot->categories[snapshot->categories_by_id[middle]];
+        }
+        if (id < category_id) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return NULL;
+}
+
+// Position of the first template with an id of at least template_id, template_count if there is none
+int catalog_find_template(const catalog_t *snapshot, int template_id) {
+    int low = 0, high = snapshot->template_count;
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        if (snapshot->templates[middle]->id < template_id) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// User with the given id, NULL if there is none
+const catalog_user_t *catalog_user_by_id(const catalog_t *snapshot, int user_id) {
+    int low = 0, high = snapshot->user_count;
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        if (snapshot->users[middle].id == user_id) {
+            return &snapshot->users[middle];
+        }
+        if (snapshot->users[middle].id < user_id) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return NULL;
+}
+
+// Read categories in name order, parents resolved to indexes exactly like the LEFT JOIN of GET /templates/categories
+int catalog_load_categories(sqlite3 *db, catalog_t *snapshot, catalog_interner_t *interner) {
+    sqlite3_stmt *stmt = prepare_cached_statement(db, "SELECT c.id, c.name, c.icon, p.name, json_object('id', c.id, 'name', c.name) "
+                                                      "FROM categories c LEFT JOIN categories p ON c.parent_id = p.id ORDER BY c.name;");
+    if (!stmt) {
+        return -1;
+    }
+    
+    // Parent names are interned too, so they are found again by name below
+    const char **parent_names = NULL;
+    int capacity = 0, parent_capacity = 0, failed = 0, rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        catalog_category_t *grown = catalog_grow(snapshot->categories, &capacity, snapshot->category_count, sizeof(catalog_category_t));
+        if (grown) snapshot->categories = grown;
+        const char **grown_parents = catalog_grow(parent_names, &parent_capacity, snapshot->category_count, sizeof(const char *));
+        if (grown_parents) parent_names = grown_parents;
+        if (!grown || !grown_parents) {
+            failed = 1;
+            break;
+        }
+        
+        catalog_category_t *category = &snapshot->categories[snapshot->category_count];
+        category->id = sqlite3_column_int(stmt, 0);
+        category->name = catalog_intern(snapshot, interner, sqlite3_column_text(stmt, 1), &failed);
+        category->icon = catalog_intern(snapshot, interner, sqlite3_column_text(stmt, 2), &failed);
+        category->json = catalog_intern(snapshot, interner, sqlite3_column_text(stmt, 4), &failed);
+        parent_names[snapshot->category_count] = catalog_intern(snapshot, interner, sqlite3_column_text(stmt, 3), &failed);
+        if (failed || !category->name) {
+            failed = 1;
+            break;
+        }
+        snapshot->category_count++;
+    }
+    release_cached_statement(db, stmt);
+    
+    for (int i = 0; !failed && i < snapshot->category_count; i++) {
+        snapshot->categories[i].parent = parent_names[i] ? catalog_find_category(snapshot, parent_names[i]) : -1;
+    }
+    free(parent_names);
+    if (failed || rc != SQLITE_DONE) {
+        return -1;
+    }
+    
+    // Id order index, for the categories of templates
+    snapshot->categories_by_id = malloc(((size_t)snapshot->category_count + 1) * sizeof(int));
+    stmt = prepare_cached_statement(db, "SELECT name FROM categories ORDER BY id;");
+    if (!snapshot->categories_by_id || !stmt) {
+        if (stmt) release_cached_statement(db, stmt);
+        return -1;
+    }
+    int count = 0;
+    while (count < snapshot->category_count && (rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        int index = catalog_find_category(snapshot, (const char *)sqlite3_column_text(stmt, 0));
+        if (index < 0) {
+            break;
+        }
+        snapshot->categories_by_id[count++] = index;
+    }
+    release_cached_statement(db, stmt);
+    return count == snapshot->category_count ? 0 : -1;
+}
+
+int catalog_load_users(sqlite3 *db, catalog_t *snapshot, catalog_interner_t *interner) {
+    sqlite3_stmt *stmt = prepare_cached_statement(db, "SELECT id, name, username, bio, verified, " VALID_JSON("links") ", avatar FROM users ORDER BY id;");
+    if (!stmt) {
+        return -1;
+    }
+    
+    int capacity = 0, failed = 0, rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        catalog_user_t *grown = catalog_grow(snapshot->users, &capacity, snapshot->user_count, sizeof(catalog_user_t));
+        if (!grown) {
+            failed = 1;
+            break;
+        }
+        snapshot->users = grown;
+        
+        catalog_user_t *user = &snapshot->users[snapshot->user_count++];
+        user->id = sqlite3_column_int(stmt, 0);
+        user->name = catalog_intern(snapshot, interner, sqlite3_column_text(stmt, 1), &failed);
+        user->username = catalog_intern(snapshot, interner, sqlite3_column_text(stmt, 2), &failed);
+        user->bio = catalog_intern(snapshot, interner, sqlite3_column_text(stmt, 3), &failed);
+        user->verified = sqlite3_column_int(stmt, 4);
+        user->links = catalog_intern(snapshot, interner, sqlite3_column_text(stmt, 5), &failed);
+        user->avatar = catalog_intern(snapshot, interner, sqlite3_column_text(stmt, 6), &failed);
+        if (failed) {
+            break;
+        }
+    }
+    release_cached_statement(db, stmt);
+    return !failed && rc == SQLITE_DONE ? 0 : -1;
+}
+
+// Read collections in listing order, with their workflow and category ids
+int catalog_load_collections(sqlite3 *db, catalog_t *snapshot, catalog_interner_t *interner) {
+    int *workflow_owners = NULL, workflow_count = 0;
+    int *category_owners = NULL, category_count = 0;
+    int rc = catalog_load_pairs(db, "SELECT collection_id, template_id FROM collection_workflows ORDER BY collection_id, template_id;",
+                                &workflow_owners, &snapshot->collection_workflows, &workflow_count);
+    if (rc == 0) {
+        rc = catalog_load_pairs(db, "SELECT collection_id, category_id FROM collection_categories ORDER BY collection_id, category_id;",
+                                &category_owners, &snapshot->collection_categories, &category_count);
+    }
+    
+    sqlite3_stmt *stmt = rc == 0 ? prepare_cached_statement(db, "SELECT id, rank, total_views, name, created_at, description FROM collections ORDER BY rank, name, id;") : NULL;
+    int capacity = 0, failed = !stmt;
+    while (!failed && (rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        catalog_collection_t *grown = catalog_grow(snapshot->collections, &capacity, snapshot->collection_count, sizeof(catalog_collection_t));
+        if (!grown) {
+            failed = 1;
+            break;
+        }
+        snapshot->collections = grown;
+        
+        catalog_collection_t *collection = &snapshot->collections[snapshot->collection_count++];
+        collection->id = sqlite3_column_int(stmt, 0);
+        collection->rank = sqlite3_column_int(stmt, 1);
+        collection->has_total_views = sqlite3_column_type(stmt, 2) != SQLITE_NULL;
+        collection->total_views = sqlite3_column_int(stmt, 2);
+        collection->name = catalog_intern(snapshot, interner, sqlite3_column_text(stmt, 3), &failed);
+        collection->created_at = catalog_intern(snapshot, interner, sqlite3_column_text(stmt, 4), &failed);
+        collection->description = catalog_intern(snapshot, interner, sqlite3_column_text(stmt, 5), &failed);
+        collection->first_workflow = catalog_find_range(workflow_owners, workflow_count, collection->id, &collection->workflow_count);
+        collection->first_category = catalog_find_range(category_owners, category_count, collection->id, &collection->category_count);
+    }
+    if (stmt) release_cached_statement(db, stmt);
+    free(workflow_owners);
+    free(category_owners);
+    return !failed && rc == SQLITE_DONE ? 0 : -1;
+}
+
+// Template ids of every category. Bitmaps of previous are shared unless a changed template (sorted,
+// unique) is in or was in the category; the others are rebuilt in one pass over the templates.
+int catalog_build_bitmaps(catalog_t *snapshot, const catalog_t *previous, const int *changed, int changed_count) {
+    snapshot->category_templates = calloc((size_t)snapshot->category_count + 1, sizeof(catalog_bitmap_t *));
+    char *rebuilt = calloc((size_t)snapshot->category_count + 1, 1);
+    if (!snapshot->category_templates || !rebuilt) {
+        free(rebuilt);
+        return -1;
+    }
+    
+    // Categories a changed template left or joined
+    for (int i = 0; previous && i < changed_count; i++) {
+        const catalog_t *versions[] = { previous, snapshot };
+        for (int v = 0; v < 2; v++) {
+            int position = catalog_find_template(versions[v], changed[i]);
+            if (position == versions[v]->template_count || versions[v]->templates[position]->id != changed[i]) {
+                continue;
+            }
+            const catalog_template_t *template = versions[v]->templates[position];
+            for (int j = 0; j < template->category_count; j++) {
+                const catalog_category_t *category = catalog_category_by_id(snapshot, template->category_ids[j]);
+                if (category) {
+                    rebuilt[category - snapshot->categories] = 1;
+                }
+            }
+        }
+    }
+    
+    int rebuilt_count = 0;
+    for (int i = 0; i < snapshot->category_count; i++) {
+        const catalog_category_t *known = previous ? catalog_category_by_id(previous, snapshot->categories[i].id) : NULL;
+        if (known && !rebuilt[i]) {
+            snapshot->category_templates[i] = previous->category_templates[known - previous->categories];
+            snapshot->category_templates[i]->refs++;
+        } else {
+            rebuilt[i] = 1;
+            rebuilt_count++;
+            snapshot->category_templates[i] = catalog_new_bitmap();
+            if (!snapshot->category_templates[i]) {
+                free(rebuilt);
+                return -1;
+            }
+        }
+    }
+    
+    int failed = 0;
+    for (int i = 0; rebuilt_count > 0 && i < snapshot->template_count && !failed; i++) {
+        const catalog_template_t *template = snapshot->templates[i];
+        for (int j = 0; j < template->category_count && !failed; j++) {
+            const catalog_category_t *category = catalog_category_by_id(snapshot, template->category_ids[j]);
+            int index = category ? (int)(category - snapshot->categories) : -1;
+            if (index >= 0 && rebuilt[index]) {
+                failed = catalog_bitmap_append(snapshot->category_templates[index], template->id) != 0;
+            }
+        }
+    }
+    free(rebuilt);
+    if (previous && !failed) {
+        atomic_fetch_add(&catalog.rebuilt_bitmaps, rebuilt_count);
+    }
+    return failed ? -1 : 0;
+}
+
+// Copy text and its terminator with ASCII letters in lower case, NULL as "". Returns the bytes written.
+size_t catalog_fold(char *out, const char *text) {
+    size_t length = 0;
+    for (; text && text[length]; length++) {
+        char c = text[length];
+        out[length] = c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+    }
+    out[length] = '\0';
+    return length + 1;
+}
+
+// Bytes of a text segment's columns, which follow the segment in its allocation
+size_t catalog_text_segment_size(int count, size_t text_size) {
+    return ((size_t)count + 1) * sizeof(size_t) + (size_t)count * (sizeof(int) + 1) + text_size;
+}
+
+// Allocate a text segment of count rows and text_size bytes of text, columns left unset
+catalog_text_segment_t *catalog_new_text_segment(int key, int count, size_t text_size) {
+    catalog_text_segment_t *segment = malloc(sizeof(catalog_text_segment_t) + catalog_text_segment_size(count, text_size));
+    if (!segment) {
+        return NULL;
+    }
+    segment->refs = 1;
+    segment->key = key;
+    segment->count = count;
+    segment->offsets = (size_t *)(segment + 1);
+    segment->ids = (int *)(segment->offsets + count + 1);
+    segment->nulls = (unsigned char *)(segment->ids + count);
+    segment->text = (char *)(segment->nulls + count);
+    return segment;
+}
+
+// Text segment of count templates (in id order, all of one key) in a single allocation
+catalog_text_segment_t *catalog_make_text_segment(catalog_template_t *const *templates, int count) {
+    size_t text_size = 0;
+    for (int i = 0; i < count; i++) {
+        text_size += (templates[i]->name ? strlen(templates[i]->name) : 0) + 1;
+        text_size += (templates[i]->description ? strlen(templates[i]->description) : 0) + 1;
+    }
+    
+    catalog_text_segment_t *segment = catalog_new_text_segment(templates[0]->id >> CATALOG_TEXT_SEGMENT_BITS, count, text_size);
+    if (!segment) {
+        return NULL;
+    }
+    
+    size_t used = 0;
+    for (int i = 0; i < count; i++) {
+        segment->offsets[i] = used;
+        segment->ids[i] = templates[i]->id;
+        segment->nulls[i] = (templates[i]->name ? 0 : CATALOG_NULL_NAME) | (templates[i]->description ? 0 : CATALOG_NULL_DESCRIPTION);
+        used += catalog_fold(segment->text + used, templates[i]->name);
+        used += catalog_fold(segment->text + used, templates[i]->description);
+    }
+    segment->offsets[count] = used;
+    return segment;
+}
+
+// Text segment of previous for key, NULL if it has none
+catalog_text_segment_t *catalog_find_text_segment(const catalog_t *previous, int key) {
+    int low = 0, high = previous->text_segment_count;
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        if (previous->text_segments[middle]->key == key) {
+            return previous->text_segments[middle];
+        }
+        if (previous->text_segments[middle]->key < key) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return NULL;
+}
+
+// Folded text columns of the templates, sharing the segments of previous no changed template (sorted, unique) falls in
+int catalog_build_text(catalog_t *snapshot, const catalog_t *previous, const int *changed, int changed_count) {
+    int capacity = 0, next_changed = 0;
+    for (int first = 0; first < snapshot->template_count;) {
+        int key = snapshot->templates[first]->id >> CATALOG_TEXT_SEGMENT_BITS;
+        int end = first;
+        while (end < snapshot->template_count && snapshot->templates[end]->id >> CATALOG_TEXT_SEGMENT_BITS == key) {
+            end++;
+        }
+        while (next_changed < changed_count && changed[next_changed] >> CATALOG_TEXT_SEGMENT_BITS < key) {
+            next_changed++;
+        }
+        int touched = next_changed < changed_count && changed[next_changed] >> CATALOG_TEXT_SEGMENT_BITS == key;
+        
+        catalog_text_segment_t *segment = previous && !touched ? catalog_find_text_segment(previous, key) : NULL;
+        if (segment) {
+            segment->refs++;
+        } else {
+            segment = catalog_make_text_segment(snapshot->templates + first, end - first);
+        }
+        catalog_text_segment_t **grown = catalog_grow(snapshot->text_segments, &capacity, snapshot->text_segment_count, sizeof(catalog_text_segment_t *));
+        if (!segment || !grown) {
+            if (segment && --segment->refs == 0) free(segment);
+            return -1;
+        }
+        snapshot->text_segments = grown;
+        snapshot->text_segments[snapshot->text_segment_count++] = segment;
+        snapshot->text_bytes += segment->offsets[segment->count];
+        first = end;
+    }
+    return 0;
+}
+
+// First occurrence of needle (at least one byte) in text, NULL if there is none. With SSE2, 16 start
+// positions are tested at once against the first and last byte of needle before comparing the rest.
+const char *catalog_find_bytes(const char *text, size_t length, const char *needle, size_t needle_length) {
+    if (needle_length > length) {
+        return NULL;
+    }
+    size_t last = length - needle_length;
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i first_bytes = _mm_set1_epi8(needle[0]);
+    const __m128i last_bytes = _mm_set1_epi8(needle[needle_length - 1]);
+    for (; i + 16 <= last + 1; i += 16) {
+        __m128i starts = _mm_loadu_si128((const __m128i *)(text + i));
+        __m128i ends = _mm_loadu_si128((const __m128i *)(text + i + needle_length - 1));
+        unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(starts, first_bytes), _mm_cmpeq_epi8(ends, last_bytes)));
+        for (; mask; mask &= mask - 1) {
+            size_t position = i + __builtin_ctz(mask);
+            if (memcmp(text + position, needle, needle_length) == 0) {
+                return text + position;
+            }
+        }
+    }
+#endif
+    for (; i <= last; i++) {
+        if (text[i] == needle[0] && memcmp(text + i, needle, needle_length) == 0) {
+            return text + i;
+        }
+    }
+    return NULL;
+}
+
+// One thread's share of a substring search: a run of text segments and the ids found in them
+typedef struct catalog_scan {
+    const struct catalog_scan *group;    // first part of the same search
+    struct catalog_scan *next;           // in the scan pool queue
+    int done;
+    const catalog_t *snapshot;
+    int first_segment;
+    int end_segment;
+    const char *pattern;
+    const char *literal;
+    size_t literal_length;
+    int *ids;
+    int count;
+    int capacity;
+    int failed;
+} catalog_scan_t;
+
+// Collect the ids of the rows whose name or description is LIKE the pattern. A pattern that is one
+// literal between % signs is found with catalog_find_bytes() over whole segments, others row by row.
+void *catalog_scan_segments(void *arg) {
+    catalog_scan_t *scan = arg;
+    for (int s = scan->first_segment; s < scan->end_segment && !scan->failed; s++) {
+        const catalog_text_segment_t *segment = scan->snapshot->text_segments[s];
+        size_t end = segment->offsets[segment->count];
+        size_t position = 0;
+        int row = 0;
+        while (row < segment->count) {
+            if (scan->literal) {
+                const char *found = catalog_find_bytes(segment->text + position, end - position, scan->literal, scan->literal_length);
+                if (!found) {
+                    break;
+                }
+                // The row the match is in, the first with an offset past it, less one
+                size_t at = found - segment->text;
+                int low = row, high = segment->count;
+                while (low < high) {
+                    int middle = low + (high - low) / 2;
+                    if (segment->offsets[middle + 1] <= at) {
+                        low = middle + 1;
+                    } else {
+                        high = middle;
+                    }
+                }
+                row = low;
+            } else {
+                const char *name = segment->text + segment->offsets[row];
+                const char *description = name + strlen(name) + 1;
+                int matched = (!(segment->nulls[row] & CATALOG_NULL_NAME) && like_match(scan->pattern, name)) ||
+                              (!(segment->nulls[row] & CATALOG_NULL_DESCRIPTION) && like_match(scan->pattern, description));
+                if (!matched) {
+                    row++;
+                    continue;
+                }
+            }
+            
+            int *grown = catalog_grow(scan->ids, &scan->capacity, scan->count, sizeof(int));
+            if (!grown) {
+                scan->failed = 1;
+                break;
+            }
+            scan->ids = grown;
+            scan->ids[scan->count++] = segment->ids[row];
+            position = segment->offsets[++row];
+        }
+    }
+    return NULL;
+}
+
+// Unlink the first queued part, of group only unless it is NULL. Call with scan_pool.mutex held.
+catalog_scan_t *take_scan_part(const catalog_scan_t *group) {
+    for (catalog_scan_t **link = &scan_pool.head; *link; link = &(*link)->next) {
+        catalog_scan_t *scan = *link;
+        if (!group || scan->group == group) {
+            *link = scan->next;
+            if (scan_pool.tail == &scan->next) {
+                scan_pool.tail = link;
+            }
+            scan->next = NULL;
+            return scan;
+        }
+    }
+    return NULL;
+}
+
+// Scan pool worker: runs queued parts until stopped
+void *scan_pool_thread(void *arg) {
+    UNUSED(arg);
+    
+    pthread_mutex_lock(&scan_pool.mutex);
+    while (scan_pool.running) {
+        catalog_scan_t *scan = take_scan_part(NULL);
+        if (!scan) {
+            pthread_cond_wait(&scan_pool.work_cond, &scan_pool.mutex);
+            continue;
+        }
+        pthread_mutex_unlock(&scan_pool.mutex);
+        catalog_scan_segments(scan);
+        pthread_mutex_lock(&scan_pool.mutex);
+        scan->done = 1;
+        pthread_cond_broadcast(&scan_pool.done_cond);
+    }
+    pthread_mutex_unlock(&scan_pool.mutex);
+    
+    return NULL;
+}
+
+// Start the scan workers, scans run on the requesting thread alone if none start
+void start_scan_pool() {
+    pthread_mutex_lock(&scan_pool.mutex);
+    scan_pool.running = 1;
+    pthread_mutex_unlock(&scan_pool.mutex);
+    for (int i = 0; i < SCAN_THREADS - 1; i++) {
+        if (pthread_create(&scan_pool.threads[scan_pool.thread_count], NULL, &scan_pool_thread, NULL) != 0) {
+            fprintf(stderr, "Failed to start scan thread, %d running\n", scan_pool.thread_count);
+            break;
+        }
+        scan_pool.thread_count++;
+    }
+}
+
+void stop_scan_pool() {
+    pthread_mutex_lock(&scan_pool.mutex);
+    scan_pool.running = 0;
+    pthread_cond_broadcast(&scan_pool.work_cond);
+    pthread_mutex_unlock(&scan_pool.mutex);
+    for (int i = 0; i < scan_pool.thread_count; i++) {
+        pthread_join(scan_pool.threads[i], NULL);
+    }
+    scan_pool.thread_count = 0;
+}
+
+// Ids of the templates whose name or description is LIKE the pattern, exactly as SQLite matches it, as
+// a new bitmap (NULL when out of memory). Large snapshots are split by size between the requesting
+// thread and the scan pool.
+catalog_bitmap_t *catalog_scan_text(const catalog_t *snapshot, const char *pattern) {
+    // %literal% without wildcards inside is a plain substring search on the folded text
+    char literal[SEARCH_PATTERN_BUFFER_SIZE];
+    size_t pattern_length = strlen(pattern);
+    int plain = pattern_length > 2 && pattern_length < sizeof(literal) && pattern[0] == '%' && pattern[pattern_length - 1] == '%' &&
+                strcspn(pattern + 1, "%_") == pattern_length - 2;
+    if (plain) {
+        char inner[SEARCH_PATTERN_BUFFER_SIZE];
+        memcpy(inner, pattern + 1, pattern_length - 2);
+        inner[pattern_length - 2] = '\0';
+        catalog_fold(literal, inner);
+    }
+    
+    catalog_scan_t scans[SCAN_THREADS > 1 ? SCAN_THREADS : 1];
+    int parts = snapshot->text_bytes >= SCAN_PARALLEL_BYTES ? scan_pool.thread_count + 1 : 1;
+    if (parts > snapshot->text_segment_count) {
+        parts = snapshot->text_segment_count > 0 ? snapshot->text_segment_count : 1;
+    }
+    int segment = 0;
+    size_t bytes = 0;
+    for (int i = 0; i < parts; i++) {
+        memset(&scans[i], 0, sizeof(catalog_scan_t));
+        scans[i].group = scans;
+        scans[i].snapshot = snapshot;
+        scans[i].pattern = pattern;
+        scans[i].literal = plain ? literal : NULL;
+        scans[i].literal_length = plain ? pattern_length - 2 : 0;
+        scans[i].first_segment = segment;
+        // An equal share of the text each, the last part takes what is left
+        while (segment < snapshot->text_segment_count && (i == parts - 1 || bytes < snapshot->text_bytes / parts * (i + 1))) {
+            const catalog_text_segment_t *taken = snapshot->text_segments[segment++];
+            bytes += taken->offsets[taken->count];
+        }
+        scans[i].end_segment = segment;
+    }
+    
+    if (parts > 1) {
+        pthread_mutex_lock(&scan_pool.mutex);
+        for (int i = 1; i < parts; i++) {
+            *scan_pool.tail = &scans[i];
+            scan_pool.tail = &scans[i].next;
+        }
+        pthread_cond_broadcast(&scan_pool.work_cond);
+        pthread_mutex_unlock(&scan_pool.mutex);
+    }
+    catalog_scan_segments(&scans[0]);
+    if (parts > 1) {
+        pthread_mutex_lock(&scan_pool.mutex);
+        for (;;) {
+            catalog_scan_t *own = take_scan_part(scans);
+            if (own) {
+                pthread_mutex_unlock(&scan_pool.mutex);
+                catalog_scan_segments(own);
+                pthread_mutex_lock(&scan_pool.mutex);
+                own->done = 1;
+                continue;
+            }
+            int pending = 0;
+            for (int i = 1; i < parts; i++) {
+                pending += !scans[i].done;
+            }
+            if (pending == 0) {
+                break;
+            }
+            pthread_cond_wait(&scan_pool.done_cond, &scan_pool.mutex);
+        }
+        pthread_mutex_unlock(&scan_pool.mutex);
+    }
+    
+    // Parts cover ascending id ranges, so their ids append in order
+    catalog_bitmap_t *found = catalog_new_bitmap();
+    for (int i = 0; i < parts; i++) {
+        for (int j = 0; found && j < scans[i].count; j++) {
+            if (scans[i].failed || catalog_bitmap_append(found, scans[i].ids[j]) != 0) {
+                free_catalog_bitmap(found);
+                found = NULL;
+            }
+        }
+        if (found && scans[i].failed) {
+            free_catalog_bitmap(found);
+            found = NULL;
+        }
+        free(scans[i].ids);
+    }
+    atomic_fetch_add(&catalog.scans, 1);
+    if (parts > 1) {
+        atomic_fetch_add(&catalog.parallel_scans, 1);
+    }
+    return found;
+}
+
+// The data version of the database state a snapshot is read from
+int catalog_load_version(sqlite3 *db, catalog_t *snapshot) {
+    sqlite3_stmt *stmt = prepare_cached_statement(db, "SELECT value FROM counters WHERE name = 'data_version';");
+    if (!stmt) {
+        return -1;
+    }
+    int rc = sqlite3_step(stmt);
+    if (rc == SQLITE_ROW) {
+        snapshot->version = (unsigned long)sqlite3_column_int64(stmt, 0);
+    }
+    release_cached_statement(db, stmt);
+    return rc == SQLITE_ROW ? 0 : -1;
+}
+
+// Build a snapshot: every template when previous is NULL, otherwise only the changed ones (sorted,
+// unique) are read and the rest are shared with previous. The small tables are always read whole.
+catalog_t *build_catalog(sqlite3 *db, catalog_t *previous, const int *changed, int changed_count) {
+    catalog_t *snapshot = calloc(1, sizeof(catalog_t));
+    if (!snapshot) {
+        return NULL;
+    }
+    
+    catalog_interner_t interner = {0};
+    int rc = catalog_load_version(db, snapshot);
+    if (rc == 0) rc = previous ? catalog_merge_templates(db, snapshot, previous, changed, changed_count) : catalog_load_templates(db, snapshot);
+    if (rc == 0) rc = catalog_load_categories(db, snapshot, &interner);
+    if (rc == 0) rc = catalog_load_users(db, snapshot, &interner);
+    if (rc == 0) rc = catalog_load_collections(db, snapshot, &interner);
+    if (rc == 0) rc = catalog_build_bitmaps(snapshot, previous, changed, changed_count);
+    if (rc == 0) rc = catalog_build_text(snapshot, previous, changed, changed_count);
+    free(interner.slots);
+    
+    if (rc != 0) {
+        free_catalog(snapshot);
+        return NULL;
+    }
+    return snapshot;
+}
+
+// Sequential output of CATALOG_FILE, failed is set by the first write that fails
+typedef struct {
+    FILE *file;
+    uint64_t size;
+    int failed;
+} catalog_file_writer_t;
+
+void catalog_file_put(catalog_file_writer_t *out, const void *data, size_t size) {
+    if (!out->failed && size > 0 && fwrite(data, 1, size, out->file) != size) {
+        out->failed = 1;
+    }
+    out->size += size;
+}
+
+void catalog_file_put_int(catalog_file_writer_t *out, int value) {
+    int32_t stored = value;
+    catalog_file_put(out, &stored, sizeof(stored));
+}
+
+void catalog_file_put_u64(catalog_file_writer_t *out, uint64_t value) {
+    catalog_file_put(out, &value, sizeof(value));
+}
+
+// Offset of an arena string in the arena section, the blocks written one after the other
+void catalog_file_put_string(catalog_file_writer_t *out, const catalog_t *snapshot, const char *text) {
+    uint64_t offset = CATALOG_FILE_NULL, base = 0;
+    for (const catalog_block_t *block = snapshot->strings; text && block; block = block->next) {
+        if (text >= block->data && text < block->data + block->used) {
+            offset = base + (uint64_t)(text - block->data);
+            break;
+        }
+        base += block->used;
+    }
+    catalog_file_put_u64(out, offset);
+}
+
+// Ids in collection_workflows (or collection_categories), up to the end of the last collection's run
+uint32_t catalog_file_array_count(const catalog_t *snapshot, int workflows) {
+    uint32_t count = 0;
+    for (int i = 0; i < snapshot->collection_count; i++) {
+        const catalog_collection_t *collection = &snapshot->collections[i];
+        uint32_t end = workflows ? collection->first_workflow + collection->workflow_count : collection->first_category + collection->category_count;
+        count = end > count ? end : count;
+    }
+    return count;
+}
+
+// Checksum of a file's sections, in four independent lanes of 8 bytes so checking it costs little
+// next to copying them
+uint64_t catalog_file_checksum(const unsigned char *data, size_t size) {
+    uint64_t lanes[4] = { 0xcbf29ce484222325ULL ^ size, 0x9e3779b97f4a7c15ULL, 0xc2b2ae3d27d4eb4fULL, 0x165667b19e3779f9ULL };
+    size_t i = 0;
+    for (; i + sizeof(lanes) <= size; i += sizeof(lanes)) {
+        for (int lane = 0; lane < 4; lane++) {
+            uint64_t word;
+            memcpy(&word, data + i + lane * sizeof(word), sizeof(word));
+            lanes[lane] = (lanes[lane] ^ word) * 0x100000001b3ULL;
+            lanes[lane] ^= lanes[lane] >> 29;
+        }
+    }
+    uint64_t hash = lanes[0] ^ (lanes[1] * 3) ^ (lanes[2] * 5) ^ (lanes[3] * 7);
+    for (; i < size; i++) {
+        hash = (hash ^ data[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// Write a snapshot to CATALOG_FILE. It goes to a temporary file first, which is synced and renamed
+// over the old one, so a crash leaves either the old or the new file whole.
+int save_catalog_file(const catalog_t *snapshot) {
+    const char *temporary = CATALOG_FILE ".tmp";
+    catalog_file_writer_t out = { fopen(temporary, "w+b"), 0, 0 };
+    if (!out.file) {
+        fprintf(stderr, "Can't write catalog file %s: %s\n", temporary, strerror(errno));
+        return -1;
+    }
+    
+    catalog_file_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CATALOG_FILE_MAGIC, sizeof(header.magic));
+    header.format = CATALOG_FILE_FORMAT;
+    header.byte_order = CATALOG_FILE_BYTE_ORDER;
+    header.word_size = sizeof(size_t);
+    header.database_id = database_id;
+    header.data_version = snapshot->version;
+    for (const catalog_block_t *block = snapshot->strings; block; block = block->next) {
+        header.strings_size += block->used;
+    }
+    header.template_count = snapshot->template_count;
+    header.category_count = snapshot->category_count;
+    header.user_count = snapshot->user_count;
+    header.collection_count = snapshot->collection_count;
+    header.collection_workflow_count = catalog_file_array_count(snapshot, 1);
+    header.collection_category_count = catalog_file_array_count(snapshot, 0);
+    header.text_segment_count = snapshot->text_segment_count;
+    header.text_segment_bits = CATALOG_TEXT_SEGMENT_BITS;
+    catalog_file_put(&out, &header, sizeof(header));
+    
+    for (const catalog_block_t *block = snapshot->strings; block; block = block->next) {
+        catalog_file_put(&out, block->data, block->used);
+    }
+    
+    // Templates keep their strings, stored as offsets into their own text
+    for (int i = 0; i < snapshot->template_count; i++) {
+        const catalog_template_t *template = snapshot->templates[i];
+        const char *fields[] = { template->name, template->purchase_url, template->description, template->created_at, template->nodes };
+        const char *text = (const char *)(template->category_ids + template->category_count);
+        uint64_t text_size = 0;
+        for (size_t f = 0; f < sizeof(fields) / sizeof(fields[0]); f++) {
+            text_size += fields[f] ? strlen(fields[f]) + 1 : 0;
+        }
+        catalog_file_put_int(&out, template->id);
+        catalog_file_put_int(&out, template->user_id);
+        catalog_file_put_int(&out, template->total_views);
+        catalog_file_put_int(&out, template->has_price);
+        catalog_file_put(&out, &template->price, sizeof(template->price));
+        catalog_file_put_int(&out, template->category_count);
+        catalog_file_put_u64(&out, text_size);
+        for (size_t f = 0; f < sizeof(fields) / sizeof(fields[0]); f++) {
+            catalog_file_put_u64(&out, fields[f] ? (uint64_t)(fields[f] - text) : CATALOG_FILE_NULL);
+        }
+        catalog_file_put(&out, template->category_ids, template->category_count * sizeof(int));
+        catalog_file_put(&out, text, text_size);
+    }
+    
+    for (int i = 0; i < snapshot->category_count; i++) {
+        const catalog_category_t *category = &snapshot->categories[i];
+        catalog_file_put_int(&out, category->id);
+        catalog_file_put_int(&out, category->parent);
+        catalog_file_put_string(&out, snapshot, category->name);
+        catalog_file_put_string(&out, snapshot, category->icon);
+        catalog_file_put_string(&out, snapshot, category->json);
+    }
+    catalog_file_put(&out, snapshot->categories_by_id, snapshot->category_count * sizeof(int));
+    
+    for (int i = 0; i < snapshot->user_count; i++) {
+        const catalog_user_t *user = &snapshot->users[i];
+        catalog_file_put_int(&out, user->id);
+        catalog_file_put_int(&out, user->verified);
+        catalog_file_put_string(&out, snapshot, user->name);
+        catalog_file_put_string(&out, snapshot, user->username);
+        catalog_file_put_string(&out, snapshot, user->bio);
+        catalog_file_put_string(&out, snapshot, user->links);
+        catalog_file_put_string(&out, snapshot, user->avatar);
+    }
+    
+    for (int i = 0; i < snapshot->collection_count; i++) {
+        const catalog_collection_t *collection = &snapshot->collections[i];
+        catalog_file_put_int(&out, collection->id);
+        catalog_file_put_int(&out, collection->rank);
+        catalog_file_put_int(&out, collection->has_total_views);
+        catalog_file_put_int(&out, collection->total_views);
+        catalog_file_put_string(&out, snapshot, collection->name);
+        catalog_file_put_string(&out, snapshot, collection->created_at);
+        catalog_file_put_string(&out, snapshot, collection->description);
+        catalog_file_put_int(&out, collection->first_workflow);
+        catalog_file_put_int(&out, collection->workflow_count);
+        catalog_file_put_int(&out, collection->first_category);
+        catalog_file_put_int(&out, collection->category_count);
+    }
+    catalog_file_put(&out, snapshot->collection_workflows, header.collection_workflow_count * sizeof(int));
+    catalog_file_put(&out, snapshot->collection_categories, header.collection_category_count * sizeof(int));
+    
+    for (int i = 0; i < snapshot->category_count; i++) {
+        const catalog_bitmap_t *bitmap = snapshot->category_templates[i];
+        catalog_file_put_int(&out, bitmap->container_count);
+        for (int c = 0; c < bitmap->container_count; c++) {
+            const catalog_container_t *container = &bitmap->containers[c];
+            catalog_file_put_int(&out, container->key);
+            catalog_file_put_int(&out, container->cardinality);
+            catalog_file_put_int(&out, container->words != NULL);
+            if (container->words) {
+                catalog_file_put(&out, container->words, CATALOG_BITMAP_WORDS * sizeof(uint64_t));
+            } else {
+                catalog_file_put(&out, container->values, container->cardinality * sizeof(uint16_t));
+            }
+        }
+    }
+    
+    // Text segments as laid out in memory after the segment itself
+    for (int i = 0; i < snapshot->text_segment_count; i++) {
+        const catalog_text_segment_t *segment = snapshot->text_segments[i];
+        size_t text_size = segment->offsets[segment->count];
+        catalog_file_put_int(&out, segment->key);
+        catalog_file_put_int(&out, segment->count);
+        catalog_file_put_u64(&out, text_size);
+        catalog_file_put(&out, segment + 1, catalog_text_segment_size(segment->count, text_size));
+    }
+    
+    // The checksum is taken from the written file, then the header is written again with it
+    header.size = out.size;
+    if (fflush(out.file) != 0) {
+        out.failed = 1;
+    }
+    void *map = out.failed ? MAP_FAILED : mmap(NULL, out.size, PROT_READ, MAP_SHARED, fileno(out.file), 0);
+    if (map != MAP_FAILED) {
+        header.checksum = catalog_file_checksum((const unsigned char *)map + sizeof(header), out.size - sizeof(header));
+        munmap(map, out.size);
+    } else {
+        out.failed = 1;
+    }
+    if (!out.failed && (fseek(out.file, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, out.file) != 1)) {
+        out.failed = 1;
+    }
+    if (fflush(out.file) != 0 || fsync(fileno(out.file)) != 0) {
+        out.failed = 1;
+    }
+    if (fclose(out.file) != 0) {
+        out.failed = 1;
+    }
+    if (out.failed || rename(temporary, CATALOG_FILE) != 0) {
+        fprintf(stderr, "Can't write catalog file %s: %s\n", CATALOG_FILE, strerror(errno));
+        unlink(temporary);
+        return -1;
+    }
+    atomic_fetch_add(&catalog.saves, 1);
+    return 0;
+}
+
+// Bounds checked input from a mapped CATALOG_FILE, failed is set by the first read past its end
+typedef struct {
+    const unsigned char *data;
+    size_t size;
+    size_t position;
+    int failed;
+} catalog_file_reader_t;
+
+// The next size bytes, NULL once the file runs short
+const void *catalog_file_take(catalog_file_reader_t *in, uint64_t size) {
+    if (in->failed || size > in->size - in->position) {
+        in->failed = 1;
+        return NULL;
+    }
+    const void *data = in->data + in->position;
+    in->position += size;
+    return data;
+}
+
+int catalog_file_int(catalog_file_reader_t *in) {
+    int32_t value = 0;
+    const void *data = catalog_file_take(in, sizeof(value));
+    if (data) memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+uint64_t catalog_file_u64(catalog_file_reader_t *in) {
+    uint64_t value = 0;
+    const void *data = catalog_file_take(in, sizeof(value));
+    if (data) memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+// String of the snapshot's arena at the next offset, an offset outside of it fails the read
+const char *catalog_file_string(catalog_file_reader_t *in, const catalog_t *snapshot) {
+    uint64_t offset = catalog_file_u64(in);
+    if (offset == CATALOG_FILE_NULL) {
+        return NULL;
+    }
+    if (offset >= snapshot->strings->used) {
+        in->failed = 1;
+        return NULL;
+    }
+    return snapshot->strings->data + offset;
+}
+
+catalog_template_t *catalog_file_template(catalog_file_reader_t *in) {
+    int id = catalog_file_int(in);
+    int user_id = catalog_file_int(in);
+    int total_views = catalog_file_int(in);
+    int has_price = catalog_file_int(in);
+    double price = 0;
+    const void *price_data = catalog_file_take(in, sizeof(price));
+    if (price_data) memcpy(&price, price_data, sizeof(price));
+    int category_count = catalog_file_int(in);
+    uint64_t text_size = catalog_file_u64(in);
+    uint64_t offsets[5];
+    for (int f = 0; f < 5; f++) {
+        offsets[f] = catalog_file_u64(in);
+        if (offsets[f] != CATALOG_FILE_NULL && offsets[f] >= text_size) {
+            in->failed = 1;
+        }
+    }
+    const void *category_ids = category_count >= 0 ? catalog_file_take(in, (uint64_t)category_count * sizeof(int)) : NULL;
+    const char *text = catalog_file_take(in, text_size);
+    if (in->failed || category_count < 0 || (text_size > 0 && text[text_size - 1] != '\0')) {
+        in->failed = 1;
+        return NULL;
+    }
+    
+    catalog_template_t *template = malloc(sizeof(catalog_template_t) + category_count * sizeof(int) + text_size);
+    if (!template) {
+        return NULL;
+    }
+    template->refs = 1;
+    template->id = id;
+    template->user_id = user_id;
+    template->total_views = total_views;
+    template->has_price = has_price;
+    template->price = price;
+    template->category_count = category_count;
+    memcpy(template->category_ids, category_ids, category_count * sizeof(int));
+    char *copy = (char *)(template->category_ids + category_count);
+    memcpy(copy, text, text_size);
+    const char **fields[] = { &template->name, &template->purchase_url, &template->description, &template->created_at, &template->nodes };
+    for (int f = 0; f < 5; f++) {
+        *fields[f] = offsets[f] == CATALOG_FILE_NULL ? NULL : copy + offsets[f];
+    }
+    return template;
+}
+
+catalog_bitmap_t *catalog_file_bitmap(catalog_file_reader_t *in) {
+    int container_count = catalog_file_int(in);
+    if (in->failed || container_count < 0 || container_count > 0x8000) {
+        in->failed = 1;
+        return NULL;
+    }
+    catalog_bitmap_t *bitmap = catalog_new_bitmap();
+    if (!bitmap || (container_count > 0 && !(bitmap->containers = calloc(container_count, sizeof(catalog_container_t))))) {
+        free_catalog_bitmap(bitmap);
+        return NULL;
+    }
+    bitmap->container_capacity = container_count;
+    
+    while (bitmap->container_count < container_count) {
+        catalog_container_t *container = &bitmap->containers[bitmap->container_count];
+        container->key = catalog_file_int(in);
+        container->cardinality = catalog_file_int(in);
+        int words = catalog_file_int(in);
+        if (container->cardinality < 1 || container->cardinality > 0x10000 || (!words && container->cardinality > CATALOG_ARRAY_CONTAINER_MAX)) {
+            in->failed = 1;
+        }
+        size_t size = words ? CATALOG_BITMAP_WORDS * sizeof(uint64_t) : container->cardinality * sizeof(uint16_t);
+        const void *data = in->failed ? NULL : catalog_file_take(in, size);
+        void *copy = data ? malloc(size) : NULL;
+        if (!copy) {
+            free_catalog_bitmap(bitmap);
+            return NULL;
+        }
+        memcpy(copy, data, size);
+        if (words) {
+            container->words = copy;
+        } else {
+            container->values = copy;
+            container->capacity = container->cardinality;
+        }
+        bitmap->cardinality += container->cardinality;
+        bitmap->container_count++;
+    }
+    return bitmap;
+}
+
+catalog_text_segment_t *catalog_file_text_segment(catalog_file_reader_t *in) {
+    int key = catalog_file_int(in);
+    int count = catalog_file_int(in);
+    uint64_t text_size = catalog_file_u64(in);
+    if (in->failed || count < 1 || text_size > in->size) {
+        in->failed = 1;
+        return NULL;
+    }
+    const void *data = catalog_file_take(in, catalog_text_segment_size(count, text_size));
+    catalog_text_segment_t *segment = data ? catalog_new_text_segment(key, count, text_size) : NULL;
+    if (!segment) {
+        return NULL;
+    }
+    memcpy(segment + 1, data, catalog_text_segment_size(count, text_size));
+    
+    // Rows are scanned up to their offsets and read as strings, so each must end in its own NUL
+    int valid = segment->offsets[0] == 0 && segment->offsets[count] == text_size;
+    for (int i = 0; valid && i < count; i++) {
+        valid = segment->offsets[i + 1] > segment->offsets[i] && segment->text[segment->offsets[i + 1] - 1] == '\0';
+    }
+    if (!valid) {
+        in->failed = 1;
+        free(segment);
+        return NULL;
+    }
+    return segment;
+}
+
+// Rebuild a snapshot from the sections following header, copied into blocks of its own so it is
+// freed and shared like one read from the database. NULL if the file is damaged or memory runs out.
+catalog_t *catalog_read_file(catalog_file_reader_t *in, const catalog_file_header_t *header) {
+    catalog_t *snapshot = calloc(1, sizeof(catalog_t));
+    if (!snapshot) {
+        return NULL;
+    }
+    snapshot->version = header->data_version;
+    
+    // Every record takes at least one byte, larger counts can only come from a damaged header
+    const char *strings = catalog_file_take(in, header->strings_size);
+    int valid = !in->failed && header->template_count <= in->size && header->category_count <= in->size &&
+                header->user_count <= in->size && header->collection_count <= in->size &&
+                header->collection_workflow_count <= in->size && header->collection_category_count <= in->size &&
+                header->text_segment_count <= in->size && (header->strings_size == 0 || strings[header->strings_size - 1] == '\0');
+    snapshot->strings = valid ? malloc(sizeof(catalog_block_t) + header->strings_size) : NULL;
+    if (!snapshot->strings) {
+        free_catalog(snapshot);
+        return NULL;
+    }
+    snapshot->strings->next = NULL;
+    snapshot->strings->used = header->strings_size;
+    snapshot->strings->size = header->strings_size;
+    memcpy(snapshot->strings->data, strings, header->strings_size);
+    
+    snapshot->templates = malloc((header->template_count + 1) * sizeof(catalog_template_t *));
+    while (snapshot->templates && snapshot->template_count < (int)header->template_count) {
+        catalog_template_t *template = catalog_file_template(in);
+        if (!template) break;
+        snapshot->templates[snapshot->template_count++] = template;
+    }
+    
+    int category_count = header->category_count;
+    snapshot->categories = calloc(category_count + 1, sizeof(catalog_category_t));
+    snapshot->categories_by_id = malloc((category_count + 1) * sizeof(int));
+    snapshot->category_templates = calloc(category_count + 1, sizeof(catalog_bitmap_t *));
+    valid = snapshot->templates && snapshot->template_count == (int)header->template_count &&
+            snapshot->categories && snapshot->categories_by_id && snapshot->category_templates;
+    if (valid) {
+        snapshot->category_count = category_count;
+        for (int i = 0; i < category_count; i++) {
+            catalog_category_t *category = &snapshot->categories[i];
+            category->id = catalog_file_int(in);
+            category->parent = catalog_file_int(in);
+            category->name = catalog_file_string(in, snapshot);
+            category->icon = catalog_file_string(in, snapshot);
+            category->json = catalog_file_string(in, snapshot);
+            if (category->parent < -1 || category->parent >= category_count) {
+                in->failed = 1;
+            }
+        }
+        const void *by_id = catalog_file_take(in, (uint64_t)category_count * sizeof(int));
+        if (by_id) memcpy(snapshot->categories_by_id, by_id, category_count * sizeof(int));
+        for (int i = 0; by_id && i < category_count; i++) {
+            if (snapshot->categories_by_id[i] < 0 || snapshot->categories_by_id[i] >= category_count) {
+                in->failed = 1;
+            }
+        }
+    }
+    
+    snapshot->users = calloc(header->user_count + 1, sizeof(catalog_user_t));
+    valid = valid && snapshot->users;
+    if (valid) {
+        snapshot->user_count = header->user_count;
+        for (int i = 0; i < snapshot->user_count; i++) {
+            catalog_user_t *user = &snapshot->users[i];
+            user->id = catalog_file_int(in);
+            user->verified = catalog_file_int(in);
+            user->name = catalog_file_string(in, snapshot);
+            user->username = catalog_file_string(in, snapshot);
+            user->bio = catalog_file_string(in, snapshot);
+            user->links = catalog_file_string(in, snapshot);
+            user->avatar = catalog_file_string(in, snapshot);
+        }
+    }
+    
+    uint32_t workflow_count = header->collection_workflow_count, collection_category_count = header->collection_category_count;
+    snapshot->collections = calloc(header->collection_count + 1, sizeof(catalog_collection_t));
+    snapshot->collection_workflows = malloc((workflow_count + 1) * sizeof(int));
+    snapshot->collection_categories = malloc((collection_category_count + 1) * sizeof(int));
+    valid = valid && snapshot->collections && snapshot->collection_workflows && snapshot->collection_categories;
+    if (valid) {
+        snapshot->collection_count = header->collection_count;
+        for (int i = 0; i < snapshot->collection_count; i++) {
+            catalog_collection_t *collection = &snapshot->collections[i];
+            collection->id = catalog_file_int(in);
+            collection->rank = catalog_file_int(in);
+            collection->has_total_views = catalog_file_int(in);
+            collection->total_views = catalog_file_int(in);
+            collection->name = catalog_file_string(in, snapshot);
+            collection->created_at = catalog_file_string(in, snapshot);
+            collection->description = catalog_file_string(in, snapshot);
+            collection->first_workflow = catalog_file_int(in);
+            collection->workflow_count = catalog_file_int(in);
+            collection->first_category = catalog_file_int(in);
+            collection->category_count = catalog_file_int(in);
+            if (collection->first_workflow < 0 || collection->workflow_count < 0 ||
+                (uint32_t)collection->first_workflow + (uint32_t)collection->workflow_count > workflow_count ||
+                collection->first_category < 0 || collection->category_count < 0 ||
+                (uint32_t)collection->first_category + (uint32_t)collection->category_count > collection_category_count) {
+                in->failed = 1;
+            }
+        }
+        const void *workflows = catalog_file_take(in, (uint64_t)workflow_count * sizeof(int));
+        if (workflows) memcpy(snapshot->collection_workflows, workflows, workflow_count * sizeof(int));
+        const void *categories = catalog_file_take(in, (uint64_t)collection_category_count * sizeof(int));
+        if (categories) memcpy(snapshot->collection_categories, categories, collection_category_count * sizeof(int));
+    }
+    
+    for (int i = 0; valid && !in->failed && i < snapshot->category_count; i++) {
+        snapshot->category_templates[i] = catalog_file_bitmap(in);
+        valid = snapshot->category_templates[i] != NULL;
+    }
+    
+    snapshot->text_segments = malloc((header->text_segment_count + 1) * sizeof(catalog_text_segment_t *));
+    valid = valid && snapshot->text_segments;
+    while (valid && !in->failed && snapshot->text_segment_count < (int)header->text_segment_count) {
+        catalog_text_segment_t *segment = catalog_file_text_segment(in);
+        if (!segment) break;
+        snapshot->text_segments[snapshot->text_segment_count++] = segment;
+        snapshot->text_bytes += segment->offsets[segment->count];
+    }
+    
+    if (!valid || in->failed || snapshot->text_segment_count != (int)header->text_segment_count || in->position != in->size) {
+        free_catalog(snapshot);
+        return NULL;
+    }
+    return snapshot;
+}
+
+// Snapshot of CATALOG_FILE if it was saved from this database at data version version, NULL when
+// there is no such file or it is of another database, version or format
+catalog_t *load_catalog_file(unsigned long version) {
+    int fd = open(CATALOG_FILE, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat info;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && (size_t)info.st_size >= sizeof(catalog_file_header_t)) {
+        map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    madvise(map, info.st_size, MADV_SEQUENTIAL);
+    
+    catalog_file_header_t header;
+    memcpy(&header, map, sizeof(header));
+    catalog_t *snapshot = NULL;
+    if (memcmp(header.magic, CATALOG_FILE_MAGIC, sizeof(header.magic)) != 0 || header.format != CATALOG_FILE_FORMAT ||
+        header.byte_order != CATALOG_FILE_BYTE_ORDER || header.word_size != sizeof(size_t) ||
+        header.text_segment_bits != CATALOG_TEXT_SEGMENT_BITS || header.size != (uint64_t)info.st_size) {
+        fprintf(stderr, "Catalog file %s is not readable by this build, reading the catalog from the database\n", CATALOG_FILE);
+    } else if (header.database_id != database_id || header.data_version != version) {
+        printf("Catalog file %s is out of date, reading the catalog from the database\n", CATALOG_FILE);
+    } else {
+        catalog_file_reader_t in = { map, info.st_size, sizeof(header), 0 };
+        if (catalog_file_checksum(in.data + sizeof(header), in.size - sizeof(header)) == header.checksum) {
+            snapshot = catalog_read_file(&in, &header);
+        }
+        if (!snapshot) {
+            fprintf(stderr, "Catalog file %s is damaged, reading the catalog from the database\n", CATALOG_FILE);
+        }
+    }
+    munmap(map, info.st_size);
+    return snapshot;
+}
+
+// Save the current snapshot if writes published one since the last save, from the writer thread
+void save_pending_catalog() {
+    catalog_t *snapshot = atomic_load(&catalog.current);
+    if (catalog.unsaved && snapshot) {
+        save_catalog_file(snapshot);
+    }
+    catalog.unsaved = 0;
+}
+
+// Publish next (or turn the snapshot off with NULL) and free the snapshot it replaces once
+// no reader can still be using it. Readers only hold a snapshot while writing one response.
+void swap_catalog(catalog_t *next) {
+    catalog_t *previous = atomic_exchange(&catalog.current, next);
+    if (!previous) {
+        return;
+    }
+    unsigned int parity = atomic_fetch_add(&catalog.epoch, 1) & 1;
+    while (atomic_load(&catalog.readers[parity]) > 0) {
+        sched_yield();
+    }
+    free_catalog(previous);
+}
+
+// Pin the current snapshot for one response, NULL when reads go to SQLite.
+// *parity is handed back to catalog_release().
+catalog_t *catalog_acquire(unsigned int *parity) {
+    if (!atomic_load(&catalog.current)) {
+        return NULL;
+    }
+    for (;;) {
+        unsigned int epoch = atomic_load(&catalog.epoch);
+        atomic_fetch_add(&catalog.readers[epoch & 1], 1);
+        // Registered under an epoch the writer has already moved past: it may not wait for us
+        if (atomic_load(&catalog.epoch) == epoch) {
+            *parity = epoch & 1;
+            break;
+        }
+        atomic_fetch_sub(&catalog.readers[epoch & 1], 1);
+    }
+    
+    catalog_t *snapshot = atomic_load(&catalog.current);
+    if (!snapshot) {
+        atomic_fetch_sub(&catalog.readers[*parity], 1);
+    }
+    return snapshot;
+}
+
+void catalog_release(unsigned int parity) {
+    atomic_fetch_sub(&catalog.readers[parity], 1);
+}
+
+// Remember templates the write batch being committed touched, called as the render queue drains
+void catalog_note_changed(const int *template_ids, int count) {
+    if (!atomic_load(&catalog.current)) {
+        return;
+    }
+    for (int i = 0; i < count; i++) {
+        int *grown = catalog_grow(catalog.changed, &catalog.changed_capacity, catalog.changed_count, sizeof(int));
+        if (!grown) {
+            return;
+        }
+        catalog.changed = grown;
+        catalog.changed[catalog.changed_count++] = template_ids[i];
+    }
+}
+
+void discard_catalog_changes() {
+    catalog.changed_count = 0;
+}
+
+// Swap in a snapshot of the batch the writer just committed, before its data version is published.
+// On failure the snapshot is dropped and reads go to SQLite from then on.
+void publish_catalog(sqlite3 *db) {
+    catalog_t *previous = atomic_load(&catalog.current);
+    if (!previous) {
+        discard_catalog_changes();
+        return;
+    }
+    
+    qsort(catalog.changed, catalog.changed_count, sizeof(int), compare_ints);
+    int unique_count = 0;
+    for (int i = 0; i < catalog.changed_count; i++) {
+        if (unique_count == 0 || catalog.changed[unique_count - 1] != catalog.changed[i]) {
+            catalog.changed[unique_count++] = catalog.changed[i];
+        }
+    }
+    
+    catalog_t *next = build_catalog(db, previous, catalog.changed, unique_count);
+    discard_catalog_changes();
+    if (next) {
+        atomic_fetch_add(&catalog.publishes, 1);
+        atomic_fetch_add(&catalog.reloaded_templates, unique_count);
+        catalog.unsaved = 1;
+    } else {
+        fprintf(stderr, "Catalog snapshot update failed, reading from SQLite until restart: %s\n", sqlite3_errmsg(db));
+        atomic_fetch_add(&catalog.failures, 1);
+    }
+    swap_catalog(next);
+}
+
+// Load the first snapshot before the server takes requests: from CATALOG_FILE when it was saved at the
+// database's current data version, otherwise from a pooled connection, saving it for the next start
+int load_catalog() {
+    struct timespec started, finished;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    catalog_t *snapshot = load_catalog_file(atomic_load(&data_version));
+    catalog.mapped = snapshot != NULL;
+    if (!snapshot) {
+        sqlite3 *db = get_db_connection();
+        if (!db) {
+            return -1;
+        }
+        // One read transaction, so the tables are read at the same version
+        sqlite3_exec(db, "BEGIN;", NULL, NULL, NULL);
+        snapshot = build_catalog(db, NULL, NULL, 0);
+        sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL);
+        if (!snapshot) {
+            fprintf(stderr, "Can't load catalog snapshot, reading from SQLite: %s\n", sqlite3_errmsg(db));
+            return_db_connection(db);
+            return -1;
+        }
+        return_db_connection(db);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    catalog.load_ms = (finished.tv_sec - started.tv_sec) * 1000.0 + (finished.tv_nsec - started.tv_nsec) / 1e6;
+    
+    printf("Loaded catalog snapshot with %d templates and %d collections from %s in %.1f ms\n", snapshot->template_count,
+           snapshot->collection_count, catalog.mapped ? CATALOG_FILE : "the database", catalog.load_ms);
+    if (!catalog.mapped) {
+        save_catalog_file(snapshot);
+    }
+    start_scan_pool();
+    swap_catalog(snapshot);
+    return 0;
+}
+
+void unload_catalog() {
+    stop_scan_pool();
+    swap_catalog(NULL);
+    free(catalog.changed);
+    catalog.changed = NULL;
+    catalog.changed_capacity = 0;
+    catalog.changed_count = 0;
+}
+
+// SQLite's LIKE without ESCAPE: % matches any run of characters and _ exactly one UTF-8 character,
+// ASCII letters match regardless of case
+int like_match(const char *pattern, const char *text) {
+    const unsigned char *p = (const unsigned char *)pattern;
+    const unsigned char *s = (const unsigned char *)text;
+    while (*p) {
+        if (*p == '%') {
+            // Collapse a run of wildcards, each _ in it still takes one character
+            while (*p == '%' || *p == '_') {
+                if (*p == '_') {
+                    if (!*s) return 0;
+                    s++;
+                    while ((*s & 0xC0) == 0x80) s++;
+                }
+                p++;
+            }
+            if (!*p) {
+                return 1;
+            }
+            for (; *s; s++) {
+                if ((*s & 0xC0) != 0x80 && like_match((const char *)p, (const char *)s)) {
+                    return 1;
+                }
+            }
+            return 0;
+        }
+        if (!*s) {
+            return 0;
+        }
+        if (*p == '_') {
+            p++;
+            s++;
+            while ((*s & 0xC0) == 0x80) s++;
+            continue;
+        }
+        unsigned char a = *p++, b = *s++;
+        if (a >= 'A' && a <= 'Z') a += 'a' - 'A';
+        if (b >= 'A' && b <= 'Z') b += 'a' - 'A';
+        if (a != b) {
+            return 0;
+        }
+    }
+    return !*s;
+}
+
+// GET /templates/categories from a snapshot, the same body callback_get_categories() builds
+void send_catalog_categories(const catalog_t *snapshot, struct _u_response *response) {
+    json_writer_t writer;
+    jw_init(&writer);
+    jw_begin_object(&writer, NULL);
+    jw_begin_array(&writer, "categories");
+    for (int i = 0; i < snapshot->category_count; i++) {
+        const catalog_category_t *category = &snapshot->categories[i];
+        jw_begin_object(&writer, NULL);
+        jw_int(&writer, "id", category->id);
+        jw_string(&writer, "name", category->name);
+        jw_string(&writer, "icon", category->icon);
+        if (category->parent >= 0) {
+            const catalog_category_t *parent = &snapshot->categories[category->parent];
+            jw_begin_object(&writer, "parent");
+            jw_int(&writer, "id", parent->id);
+            jw_string(&writer, "name", parent->name);
+            jw_string(&writer, "icon", parent->icon);
+            jw_end_object(&writer);
+        } else {
+            jw_null(&writer, "parent");
+        }
+        jw_end_object(&writer);
+    }
+    jw_end_array(&writer);
+    jw_end_object(&writer);
+    jw_send(&writer, response, 200);
+    jw_free(&writer);
+    atomic_fetch_add(&catalog.reads, 1);
+}
+
+// GET /templates/collections from a snapshot. search_pattern is the LIKE pattern of the SQL query, "" for none.
+void send_catalog_collections(const catalog_t *snapshot, const int *category_ids, int category_count,
+                              const char *search_pattern, struct _u_response *response) {
+    json_writer_t writer;
+    jw_init(&writer);
+    jw_begin_object(&writer, NULL);
+    jw_begin_array(&writer, "collections");
+    for (int i = 0; i < snapshot->collection_count; i++) {
+        const catalog_collection_t *collection = &snapshot->collections[i];
+        if (category_count > 0) {
+            int listed = 0;
+            const int *categories = snapshot->collection_categories + collection->first_category;
+            for (int j = 0; j < collection->category_count && !listed; j++) {
+                for (int k = 0; k < category_count && !listed; k++) {
+                    listed = categories[j] == category_ids[k];
+                }
+            }
+            if (!listed) {
+                continue;
+            }
+        }
+        if (search_pattern[0] != '\0' && !like_match(search_pattern, collection->name)) {
+            continue;
+        }
+        
+        jw_begin_object(&writer, NULL);
+        jw_int(&writer, "id", collection->id);
+        jw_int(&writer, "rank", collection->rank);
+        jw_string(&writer, "name", collection->name);
+        if (collection->has_total_views) {
+            jw_int(&writer, "totalViews", collection->total_views);
+        } else {
+            jw_null(&writer, "totalViews");
+        }
+        jw_string(&writer, "createdAt", collection->created_at);
+        jw_begin_array(&writer, "workflows");
+        for (int j = 0; j < collection->workflow_count; j++) {
+            jw_begin_object(&writer, NULL);
+            jw_int(&writer, "id", snapshot->collection_workflows[collection->first_workflow + j]);
+            jw_end_object(&writer);
+        }
+        jw_end_array(&writer);
+        jw_raw(&writer, "nodes", NULL, "[]");
+        jw_end_object(&writer);
+    }
+    jw_end_array(&writer);
+    jw_end_object(&writer);
+    jw_send(&writer, response, 200);
+    jw_free(&writer);
+    atomic_fetch_add(&catalog.reads, 1);
+}
+
+// Facet rows of GET /templates/search, most templates first and by name (the order of categories) after that
+int compare_catalog_facets(const void *a, const void *b) {
+    const catalog_facet_t *x = a, *y = b;
+    if (x->count != y->count) {
+        return x->count < y->count ? 1 : -1;
+    }
+    return x->index - y->index;
+}
+
+// The facets array of GET /templates/search: for every category, how many of the matching templates
+// (all of them when matches is NULL) are in it
+int write_catalog_facets(const catalog_t *snapshot, const catalog_bitmap_t *matches, json_writer_t *writer) {
+    catalog_facet_t *facets = malloc(((size_t)snapshot->category_count + 1) * sizeof(catalog_facet_t));
+    if (!facets) {
+        return -1;
+    }
+    int facet_count = 0;
+    for (int i = 0; i < snapshot->category_count; i++) {
+        const catalog_bitmap_t *templates = snapshot->category_templates[i];
+        int count = matches ? catalog_bitmap_and_count(matches, templates) : templates->cardinality;
+        if (count > 0) {
+            facets[facet_count].index = i;
+            facets[facet_count++].count = count;
+        }
+    }
+    qsort(facets, facet_count, sizeof(catalog_facet_t), compare_catalog_facets);
+    
+    jw_begin_array(writer, "facets");
+    for (int i = 0; i < facet_count; i++) {
+        const catalog_category_t *category = &snapshot->categories[facets[i].index];
+        jw_begin_object(writer, NULL);
+        jw_int(writer, "id", category->id);
+        jw_string(writer, "name", category->name);
+        jw_int(writer, "count", facets[i].count);
+        jw_end_object(writer);
+    }
+    jw_end_array(writer);
+    free(facets);
+    return 0;
+}
+
+// GET /templates/search from a snapshot when the search text, if any, is matched with LIKE: newest first,
+// filtered by any (or with match_all, every one) of the category names and by search_pattern unless it
+// is NULL, starting below cursor_id when has_cursor is set
+void send_catalog_search(const catalog_t *snapshot, char **category_names, int category_count, int match_all, const char *search_pattern,
+                         int has_cursor, int cursor_id, int limit, int offset, int include_categories, int include_facets,
+                         struct _u_response *response) {
+    // The matching templates as a union or intersection of category bitmaps, NULL for all of them
+    catalog_bitmap_t *filters[MAX_CATEGORIES];
+    int filter_count = 0, unknown = 0;
+    for (int i = 0; i < category_count; i++) {
+        int index = catalog_find_category(snapshot, category_names[i]);
+        if (index >= 0) {
+            filters[filter_count++] = snapshot->category_templates[index];
+        } else {
+            unknown = 1;
+        }
+    }
+    catalog_bitmap_t *matches = NULL;
+    if (category_count > 0) {
+        // A category that does not exist matches no template, which empties an intersection
+        matches = catalog_combine_bitmaps(filters, match_all && unknown ? 0 : filter_count, match_all);
+        if (!matches) {
+            ulfius_set_string_body_response(response, 500, "Out of memory");
+            return;
+        }
+    }
+    if (search_pattern) {
+        catalog_bitmap_t *found = catalog_scan_text(snapshot, search_pattern);
+        if (found && matches) {
+            catalog_bitmap_t *both[] = { matches, found };
+            catalog_bitmap_t *filtered = catalog_combine_bitmaps(both, 2, 1);
+            free_catalog_bitmap(found);
+            found = filtered;
+        }
+        free_catalog_bitmap(matches);
+        matches = found;
+        if (!matches) {
+            ulfius_set_string_body_response(response, 500, "Out of memory");
+            return;
+        }
+    }
+    int total_workflows = matches ? matches->cardinality : snapshot->template_count;
+    
+    json_writer_t writer;
+    jw_init(&writer);
+    jw_begin_object(&writer, NULL);
+    jw_int(&writer, "totalWorkflows", total_workflows);
+    jw_begin_array(&writer, "workflows");
+    
+    // Newest first, from the last template below the cursor
+    int rows = 0, last_id = 0;
+    int position = has_cursor ? catalog_find_template(snapshot, cursor_id) : snapshot->template_count;
+    long long below = has_cursor ? cursor_id : (long long)INT_MAX + 1;
+    while (rows < limit) {
+        if (matches) {
+            int id = catalog_bitmap_previous(matches, below);
+            if (id < 0) {
+                break;
+            }
+            below = id;
+            position = catalog_find_template(snapshot, id);
+        } else if (--position < 0) {
+            break;
+        }
+        const catalog_template_t *template = snapshot->templates[position];
+        const catalog_user_t *user = catalog_user_by_id(snapshot, template->user_id);
+        if (!user) {
+            continue;
+        }
+        if (offset > 0) {
+            offset--;
+            continue;
+        }
+        
+        rows++;
+        last_id = template->id;
+        jw_begin_object(&writer, NULL);
+        jw_int(&writer, "id", template->id);
+        jw_string(&writer, "name", template->name);
+        jw_int(&writer, "totalViews", template->total_views);
+        jw_string_or_null(&writer, "purchaseUrl", template->purchase_url);
+        
+        jw_begin_object(&writer, "user");
+        jw_int(&writer, "id", user->id);
+        jw_string(&writer, "name", user->name);
+        jw_string(&writer, "username", user->username);
+        jw_string(&writer, "bio", user->bio);
+        jw_bool(&writer, "verified", user->verified);
+        jw_raw(&writer, "links", user->links, "[]");
+        jw_string(&writer, "avatar", user->avatar);
+        jw_end_object(&writer);
+        
+        jw_string(&writer, "description", template->description);
+        jw_string(&writer, "createdAt", template->created_at);
+        jw_raw(&writer, "nodes", template->nodes, "[]");
+        if (template->has_price) {
+            jw_real(&writer, "price", template->price);
+        } else {
+            jw_int(&writer, "price", 0);
+        }
+        
+        if (include_categories) {
+            // The same text as TEMPLATE_CATEGORIES_JSON, categories in id order
+            jw_prefix(&writer, "categories");
+            jw_append(&writer, "[", 1);
+            int listed = 0;
+            for (int j = 0; j < template->category_count; j++) {
+                const catalog_category_t *category = catalog_category_by_id(snapshot, template->category_ids[j]);
+                if (category) {
+                    if (listed++ > 0) jw_append(&writer, ",", 1);
+                    jw_append(&writer, category->json, strlen(category->json));
+                }
+            }
+            jw_append(&writer, "]", 1);
+        }
+        jw_end_object(&writer);
+    }
+    
+    if (rows == limit) {
+        char next_cursor[CURSOR_BUFFER_SIZE];
+        encode_cursor(last_id, 0, 0, next_cursor, sizeof(next_cursor));
+        u_map_put(response->map_header, "X-Next-Cursor", next_cursor);
+    }
+    jw_end_array(&writer);
+    int failed = include_facets && write_catalog_facets(snapshot, matches, &writer) != 0;
+    free_catalog_bitmap(matches);
+    jw_end_object(&writer);
+    if (failed) {
+        ulfius_set_string_body_response(response, 500, "Out of memory");
+    } else {
+        jw_send(&writer, response, 200);
+    }
+    jw_free(&writer);
+    atomic_fetch_add(&catalog.reads, 1);
+}
+
+// GET /templates/workflows from a snapshot, paged ones start after cursor_id
+void send_catalog_workflows(const catalog_t *snapshot, int paged, int cursor_id, int limit, struct _u_response *response) {
+    int start = 0;
+    if (paged) {
+        int low = 0, high = snapshot->template_count;
+        while (low < high) {
+            int middle = low + (high - low) / 2;
+            if (snapshot->templates[middle]->id <= cursor_id) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        start = low;
+    }
+    
+    json_writer_t writer;
+    jw_init(&writer);
+    jw_begin_array(&writer, NULL);
+    int rows = 0, last_id = 0;
+    for (int i = start; i < snapshot->template_count && (!paged || rows < limit); i++) {
+        const catalog_template_t *template = snapshot->templates[i];
+        rows++;
+        last_id = template->id;
+        jw_begin_object(&writer, NULL);
+        jw_int(&writer, "id", template->id);
+        jw_string(&writer, "name", template->name);
+        jw_int(&writer, "totalViews", template->total_views);
+        jw_end_object(&writer);
+    }
+    jw_end_array(&writer);
+    
+    if (paged && rows == limit) {
+        char next_cursor[CURSOR_BUFFER_SIZE];
+        encode_cursor(last_id, 0, 0, next_cursor, sizeof(next_cursor));
+        u_map_put(response->map_header, "X-Next-Cursor", next_cursor);
+    }
+    jw_send(&writer, response, 200);
+    jw_free(&writer);
+    atomic_fetch_add(&catalog.reads, 1);
+}
+
+// Get or create user if user does not exist
+int get_or_create_user(sqlite3 *db, json_t *user_json) {
+    if (!db) {
+        fprintf(stderr, "get_or_create_user ERROR: Invalid database.\n");
+        return 0;
+    }
+
+    if (!json_is_object(user_json)) {
+        fprintf(stderr, "get_or_create_user ERROR: Invalid input.\n");
+        return 0;
+    }
+
+    /*
+    const char *username = json_string_value(json_object_get(user_json, "username"));
+    if (!username || strlen(username) == 0) {
+        fprintf(stderr, "get_or_create_user ERROR: 'username' is a required field in the user object.\n");
+        return 0; // Username is mandatory for lookup or creation
+    }
+    */
+
+   const char *username = "Default API User";
+
+    int user_id = lookup_name(db, &user_dictionary, username, NULL);
+    if (user_id > 0) {
+        return user_id;
+    }
+    user_id = 1;
+
+    // Check if user already exists
+    const char *user_check_sql = "SELECT id FROM users WHERE username = ?;";
+    sqlite3_stmt *user_stmt = prepare_cached_statement(db, user_check_sql);
+    if (!user_stmt) {
+        fprintf(stderr, "get_or_create_user ERROR: Failed to prepare user check statement: %s\n", sqlite3_errmsg(db));
+        return 0;
+    }
+
+    sqlite3_bind_text(user_stmt, 1, username, -1, SQLITE_STATIC);
+    int step_result = sqlite3_step(user_stmt);
+
+    if (step_result == SQLITE_ROW) {
+        user_id = sqlite3_column_int(user_stmt, 0);
+        release_cached_statement(db, user_stmt); // Clean up immediately
+    } else if (step_result == SQLITE_DONE) {
+        // User does not exist, so create them
+        release_cached_statement(db, user_stmt); // Clean up check statement
+
+        const char *user_name = json_string_value(json_object_get(user_json, "name"));
+        const char *user_bio = json_string_value(json_object_get(user_json, "bio"));
+        json_t *verified_json = json_object_get(user_json, "verified");
+        json_t *links_json = json_object_get(user_json, "links");
+        const char *avatar = json_string_value(json_object_get(user_json, "avatar"));
+
+        const char *create_user_sql = "INSERT INTO users (name, username, bio, verified, links, avatar) VALUES (?, ?, ?, ?, ?, ?);";
+        sqlite3_stmt *create_stmt = prepare_cached_statement(db, create_user_sql);
+        if (create_stmt) {
+            sqlite3_bind_text(create_stmt, 1, user_name ? user_name : username, -1, SQLITE_STATIC);
+            sqlite3_bind_text(create_stmt, 2, username, -1, SQLITE_STATIC);
+            sqlite3_bind_text(create_stmt, 3, user_bio ? user_bio : "", -1, SQLITE_STATIC);
+            sqlite3_bind_int(create_stmt, 4, json_is_true(verified_json) ? 1 : 0);
+            
+            char *links_str = links_json ? json_dumps(links_json, JSON_COMPACT) : NULL;
+            sqlite3_bind_text(create_stmt, 5, links_str ? links_str : "[]", -1, SQLITE_TRANSIENT);
+            
+            sqlite3_bind_text(create_stmt, 6, avatar ? avatar : "", -1, SQLITE_STATIC);
+            
+            if (sqlite3_step(create_stmt) == SQLITE_DONE) {
+                user_id = sqlite3_last_insert_rowid(db);
+                remember_name(&user_dictionary, username, user_id, 0);
+            } else {
+                 fprintf(stderr, "get_or_create_user ERROR: Failed to insert new user: %s\n", sqlite3_errmsg(db));
+            }
+            
+            release_cached_statement(db, create_stmt);
+            if (links_str) free(links_str);
+        } else {
+             fprintf(stderr, "get_or_create_user ERROR: Failed to prepare create user statement: %s\n", sqlite3_errmsg(db));
+        }
+    } else {
+        // An actual error occurred during the SELECT step
+        fprintf(stderr, "get_or_create_user ERROR: Failed to step on user check statement: %s\n", sqlite3_errmsg(db));
+        release_cached_statement(db, user_stmt);
+    }
+    
+    return user_id;
+}
+
+// Get or create category if user does not exist
+int get_or_create_category(sqlite3 *db, json_t *category_json) {
+    if (!db || !json_is_object(category_json)) {
+        return 0;
+    }
+
+    const char *name = json_string_value(json_object_get(category_json, "name"));
+    if (!name || strlen(name) == 0) {
+        fprintf(stderr, "get_or_create_category: Category name is missing or empty.\n");
+        return 0; // Name is a required field
+    }
+
+    // Known categories never reach the database
+    int category_id = lookup_name(db, &category_dictionary, name, NULL);
+    if (category_id > 0) {
+        return category_id;
+    }
+
+    // Check if a category with this name already exists.
+    const char *sql_select = "SELECT id FROM categories WHERE name = ?;";
+    sqlite3_stmt *stmt = prepare_cached_statement(db, sql_select);
+    if (!stmt) {
+        fprintf(stderr, "get_or_create_category: Failed to prepare select category statement: %s\n", sqlite3_errmsg(db));
+        return 0;
+    }
+    sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        category_id = sqlite3_column_int(stmt, 0);
+    }
+    release_cached_statement(db, stmt);
+
+    if (category_id > 0) {
+        return category_id; // Category already exists, return its ID.
+    }
+
+    // Category does not exist, so we need to create it.
+    // First, resolve the parent category if one is specified.
+    int parent_id = 0;
+    json_t *parent_json = json_object_get(category_json, "parent");
+    if (json_is_object(parent_json)) {
+        // Recursively call this function to get or create the parent.
+        parent_id = get_or_create_category(db, parent_json);
+    }
+
+    const char *icon = json_string_value(json_object_get(category_json, "icon"));
+
+    // Prepare to insert the new category. We let the database handle the ID.
+    const char *sql_insert = "INSERT INTO categories (name, icon, parent_id) VALUES (?, ?, ?);";
+    stmt = prepare_cached_statement(db, sql_insert);
+    if (!stmt) {
+        fprintf(stderr, "get_or_create_category: Failed to prepare insert category statement: %s\n", sqlite3_errmsg(db));
+        return 0;
+    }
+
+    sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, icon ? icon : "🏷️", -1, SQLITE_STATIC); // Provide a default icon
+    if (parent_id > 0) {
+        sqlite3_bind_int(stmt, 3, parent_id);
+    } else {
+        sqlite3_bind_null(stmt, 3);
+    }
+
+    if (sqlite3_step(stmt) == SQLITE_DONE) {
+        category_id = sqlite3_last_insert_rowid(db);
+        remember_name(&category_dictionary, name, category_id, parent_id);
+    } else {
+        // This could fail due to a race condition (another request inserted it).
+        // The UNIQUE constraint on 'name' would be violated. We can try selecting again.
+        fprintf(stderr, "get_or_create_category: Insert failed for '%s', retrying select. Error: %s\n", name, sqlite3_errmsg(db));
+        
+        const char *sql_reselect = "SELECT id FROM categories WHERE name = ?;";
+        sqlite3_stmt *reselect_stmt = prepare_cached_statement(db, sql_reselect);
+        if (reselect_stmt) {
+            sqlite3_bind_text(reselect_stmt, 1, name, -1, SQLITE_STATIC);
+            if (sqlite3_step(reselect_stmt) == SQLITE_ROW) {
+                category_id = sqlite3_column_int(reselect_stmt, 0);
+            }
+            release_cached_statement(db, reselect_stmt);
+        }
+    }
+    release_cached_statement(db, stmt);
+
+    return category_id;
+}
+
+// Get categories for a template
+json_t* get_template_categories(sqlite3 *db, int template_id) {
+    const char *sql = "SELECT c.id, c.name FROM categories c "
+                      "JOIN template_categories tc ON c.id = tc.category_id "
+                      "WHERE tc.template_id = ?;";
+    sqlite3_stmt *stmt = prepare_cached_statement(db, sql);
+    json_t *categories_array = json_array();
+
+    if (stmt) {
+        sqlite3_bind_int(stmt, 1, template_id);
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            json_t *category_obj = json_object();
+            json_object_set_new(category_obj, "id", json_integer(sqlite3_column_int(stmt, 0)));
+            json_object_set_new(category_obj, "name", json_string((const char*)sqlite3_column_text(stmt, 1)));
+            json_array_append_new(categories_array, category_obj);
+        }
+        release_cached_statement(db, stmt);
+    }
+    return categories_array;
+}
+
+// Runs ahead of every cached GET and HEAD endpoint: answers from the response cache when it can, 304
+// included, otherwise records the key, data version and modification time for
+// callback_response_cache_store. Only URLs last answered with a 200 get a 304: a validator that
+// matches the data version says nothing about whether a :id exists, so the handler's 404 stays.
+// user_data is the view_kind_t of the endpoint, views answered from the cache are counted here.
+int callback_response_cache_lookup(const struct _u_request *request, struct _u_response *response, void *user_data) {
+    view_kind_t view_kind = (view_kind_t)(intptr_t)user_data;
+
+    // Read before the handler touches the database: data_version is published after the commit,
+    // so whatever the handler reads is at least this recent and the entry can never be stale.
+    // The modification time is published after the version, read first it can only lag behind it.
+    long long modified = atomic_load(&data_modified_at);
+    unsigned long version = atomic_load(&data_version);
+
+    // Caches in between must not hand one client's coding to another
+    if (RESPONSE_COMPRESSION) {
+        u_map_put(response->map_header, "Vary", "Accept-Encoding");
+    }
+
+    char key[RESPONSE_CACHE_KEY_SIZE] = "";
+    unsigned long hash = 0;
+    if (RESPONSE_CACHE_BYTES > 0 && build_response_cache_key(request, key, sizeof(key)) == 0) {
+        hash = hash_string(key);
+        if (response_cache_get(key, hash, version, negotiate_encoding(request), response)) {
+            atomic_fetch_add(&response_cache.hits, 1);
+            // Nothing was written since the client's copy, or the rendered body is the same: no query
+            if (request_not_modified(request, u_map_get(response->map_header, "ETag"), modified)) {
+                send_not_modified(response);
+            }
+            count_view(request, view_kind);
+            return U_CALLBACK_COMPLETE;
+        }
+        atomic_fetch_add(&response_cache.misses, 1);
+    } else {
+        key[0] = '\0';
+    }
+
+    // Also needed when the response is not cached, the store callback sets the validators from it
+    size_t key_length = strlen(key);
+    response_cache_pending_t *pending = malloc(sizeof(response_cache_pending_t) + key_length + 1);
+    if (pending) {
+        pending->hash = hash;
+        pending->version = version;
+        pending->modified = modified;
+        memcpy(pending->key, key, key_length + 1);
+        ulfius_set_response_shared_data(response, pending, &free);
+    }
+    return U_CALLBACK_CONTINUE;
+}
+
+// Runs after every cached GET and HEAD endpoint: adds ETag and Last-Modified to successful responses,
+// keeps them unless a write committed meanwhile, then answers 304 if the client's copy is still current.
+// Counts the view of a successful response, so unknown ids are never counted.
+int callback_response_cache_store(const struct _u_request *request, struct _u_response *response, void *user_data) {
+    if (response->status == 200) {
+        count_view(request, (view_kind_t)(intptr_t)user_data);
+    }
+
+    const response_cache_pending_t *pending = response->shared_data;
+    if (!pending || response->status != 200) {
+        return U_CALLBACK_CONTINUE;
+    }
+
+    // Handlers serving a body with its own content hash set their ETag, the rest get the data version's
+    if (!u_map_get(response->map_header, "ETag")) {
+        char etag[ETAG_BUFFER_SIZE];
+        format_version_etag(pending->version, etag, sizeof(etag));
+        u_map_put(response->map_header, "ETag", etag);
+    }
+    char last_modified[HTTP_DATE_BUFFER_SIZE];
+    format_http_date(pending->modified / 2, last_modified, sizeof(last_modified));
+    u_map_put(response->map_header, "Last-Modified", last_modified);
+
+    int not_modified = request_not_modified(request, u_map_get(response->map_header, "ETag"), pending->modified);
+
+    // Compress only what gets cached, so each body is compressed once per data version.
+    // Bodies that cannot be cached go out as they are rather than being compressed on every request.
+    if (pending->key[0] != '\0' && pending->version == atomic_load(&data_version)) {
+        encoded_bodies_t encoded;
+        encode_body(response->binary_body, response->binary_body_length, &encoded);
+        response_cache_put(pending, response, &encoded);
+        if (!not_modified) {
+            send_encoded_body(response, &encoded, negotiate_encoding(request));
+        }
+        free_encoded_bodies(&encoded);
+    }
+    if (not_modified) {
+        send_not_modified(response);
+    }
+    return U_CALLBACK_CONTINUE;
+}
+
+// GET /health
+int callback_get_health(const struct _u_request *request, struct _u_response *response, void *user_data) {
+    UNUSED(request);
+    UNUSED(user_data);
+
+    sqlite3 *db = get_db_connection();
+    if (!db) {
+        ulfius_set_string_body_response(response, 500, "Database connection failed");
+        return U_CALLBACK_CONTINUE;
+    }
+
+    json_t *health_object = json_object();
+    json_object_set_new(health_object, "status", json_string("OK"));
+    
+    return_db_connection(db);
+    
+    ulfius_set_json_body_response(response, 200, health_object);
+    json_decref(health_object);
+    
+    return U_CALLBACK_CONTINUE;
+}
+
+// GET /metrics
+int callback_get_metrics(const struct _u_request *request, struct _u_response *response, void *user_data) {
+    UNUSED(request);
+    UNUSED(user_data);
+
+    unsigned long hits = atomic_load(&stmt_cache_stats.hits);
+    unsigned long misses = atomic_load(&stmt_cache_stats.misses);
+
+    json_t *stmt_cache_obj = json_object();
+    json_object_set_new(stmt_cache_obj, "hits", json_integer(hits));
+    json_object_set_new(stmt_cache_obj, "misses", json_integer(misses));
+    json_object_set_new(stmt_cache_obj, "evictions", json_integer(atomic_load(&stmt_cache_stats.evictions)));
+    json_object_set_new(stmt_cache_obj, "hitRatio", json_real(hits + misses > 0 ? (double)hits / (hits + misses) : 0.0));
+
+    long in_use = atomic_load(&pool_stats.in_use);
+
+    json_t *pool_obj = json_object();
+    json_object_set_new(pool_obj, "size", json_integer(pool.pool_size));
+    json_object_set_new(pool_obj, "inUse", json_integer(in_use));
+    json_object_set_new(pool_obj, "peakInUse", json_integer(atomic_load(&pool_stats.peak_in_use)));
+    json_object_set_new(pool_obj, "utilization", json_real(pool.pool_size > 0 ? (double)in_use / pool.pool_size : 0.0));
+    json_object_set_new(pool_obj, "acquisitions", json_integer(atomic_load(&pool_stats.acquisitions)));
+    json_object_set_new(pool_obj, "waits", json_integer(atomic_load(&pool_stats.waits)));
+    json_object_set_new(pool_obj, "timeouts", json_integer(atomic_load(&pool_stats.timeouts)));
+
+    json_t *metrics_object = json_object();
+    json_object_set_new(metrics_object, "statementCache", stmt_cache_obj);
+    json_object_set_new(metrics_object, "connectionPool", pool_obj);
+
+    json_t *writer_obj = json_object();
+    json_object_set_new(writer_obj, "jobs", json_integer(atomic_load(&writer_stats.jobs)));
+    json_object_set_new(writer_obj, "failedJobs", json_integer(atomic_load(&writer_stats.failed_jobs)));
+    json_object_set_new(writer_obj, "commits", json_integer(atomic_load(&writer_stats.commits)));
+    json_object_set_new(writer_obj, "failedCommits", json_integer(atomic_load(&writer_stats.failed_commits)));
+    json_object_set_new(writer_obj, "rolledBackJobs", json_integer(atomic_load(&writer_stats.rolled_back_jobs)));
+    json_object_set_new(writer_obj, "largestBatch", json_integer(atomic_load(&writer_stats.largest_batch)));
+    // Below 1 when concurrent writes share commits, every PUT/PATCH is one job
+    unsigned long writer_jobs = atomic_load(&writer_stats.jobs);
+    json_object_set_new(writer_obj, "commitsPerJob", json_real(writer_jobs > 0 ? (double)atomic_load(&writer_stats.commits) / writer_jobs : 0.0));
+    json_object_set_new(metrics_object, "writer", writer_obj);
+
+    json_t *ingest_obj = json_object();
+    json_object_set_new(ingest_obj, "requests", json_integer(atomic_load(&ingest_stats.requests)));
+    json_object_set_new(ingest_obj, "items", json_integer(atomic_load(&ingest_stats.items)));
+    json_object_set_new(ingest_obj, "failedItems", json_integer(atomic_load(&ingest_stats.failed_items)));
+    json_object_set_new(metrics_object, "bulkIngest", ingest_obj);
+
+    json_t *template_writes_obj = json_object();
+    json_object_set_new(template_writes_obj, "inserted", json_integer(atomic_load(&template_write_stats.inserted)));
+    json_object_set_new(template_writes_obj, "updated", json_integer(atomic_load(&template_write_stats.updated)));
+    json_object_set_new(template_writes_obj, "unchanged", json_integer(atomic_load(&template_write_stats.unchanged)));
+    json_object_set_new(metrics_object, "templateWrites", template_writes_obj);
+
+    json_t *dictionaries_obj = json_object();
+    name_dictionary_t *dictionaries[] = { &category_dictionary, &user_dictionary };
+    const char *dictionary_names[] = { "categories", "users" };
+    for (int i = 0; i < 2; i++) {
+        json_t *dictionary_obj = json_object();
+        pthread_rwlock_rdlock(&dictionaries[i]->lock);
+        json_object_set_new(dictionary_obj, "entries", json_integer(dictionaries[i]->entries));
+        pthread_rwlock_unlock(&dictionaries[i]->lock);
+        json_object_set_new(dictionary_obj, "hits", json_integer(atomic_load(&dictionaries[i]->hits)));
+        json_object_set_new(dictionary_obj, "misses", json_integer(atomic_load(&dictionaries[i]->misses)));
+        json_object_set_new(dictionaries_obj, dictionary_names[i], dictionary_obj);
+    }
+    json_object_set_new(metrics_object, "nameDictionaries", dictionaries_obj);
+
+    json_t *count_cache_obj = json_object();
+    json_object_set_new(count_cache_obj, "hits", json_integer(atomic_load(&count_cache.hits)));
+    json_object_set_new(count_cache_obj, "misses", json_integer(atomic_load(&count_cache.misses)));
+    json_object_set_new(count_cache_obj, "dataVersion", json_integer(atomic_load(&data_version)));
+    json_object_set_new(metrics_object, "countCache", count_cache_obj);
+
+    json_t *render_obj = json_object();
+    json_object_set_new(render_obj, "hits", json_integer(atomic_load(&render_stats.hits)));
+    json_object_set_new(render_obj, "misses", json_integer(atomic_load(&render_stats.misses)));
+    json_object_set_new(render_obj, "renders", json_integer(atomic_load(&render_stats.renders)));
+    json_object_set_new(metrics_object, "renderedTemplates", render_obj);
+
+    unsigned long response_hits = atomic_load(&response_cache.hits);
+    unsigned long response_misses = atomic_load(&response_cache.misses);
+    size_t response_bytes = 0;
+    size_t response_entries = 0;
+    for (int i = 0; i < RESPONSE_CACHE_SHARDS; i++) {
+        pthread_mutex_lock(&response_cache.shards[i].mutex);
+        response_bytes += response_cache.shards[i].bytes;
+        response_entries += response_cache.shards[i].entries;
+        pthread_mutex_unlock(&response_cache.shards[i].mutex);
+    }
+
+    json_t *response_cache_obj = json_object();
+    json_object_set_new(response_cache_obj, "hits", json_integer(response_hits));
+    json_object_set_new(response_cache_obj, "misses", json_integer(response_misses));
+    json_object_set_new(response_cache_obj, "hitRatio", json_real(response_hits + response_misses > 0 ? (double)response_hits / (response_hits + response_misses) : 0.0));
+    json_object_set_new(response_cache_obj, "entries", json_integer(response_entries));
+    json_object_set_new(response_cache_obj, "bytes", json_integer(response_bytes));
+    json_object_set_new(response_cache_obj, "budgetBytes", json_integer(RESPONSE_CACHE_BYTES));
+    json_object_set_new(response_cache_obj, "stores", json_integer(atomic_load(&response_cache.stores)));
+    json_object_set_new(response_cache_obj, "evictions", json_integer(atomic_load(&response_cache.evictions)));
+    json_object_set_new(response_cache_obj, "notModified", json_integer(atomic_load(&response_cache.not_modified)));
+    json_object_set_new(response_cache_obj, "compressed", json_integer(atomic_load(&response_cache.compressed)));
+    json_object_set_new(metrics_object, "responseCache", response_cache_obj);
+
+    json_t *storage_obj = json_object();
+    json_object_set_new(storage_obj, "compression", json_boolean(atomic_load(&storage.enabled)));
+    json_object_set_new(storage_obj, "dictionaryId", json_integer(atomic_load(&storage.active_id)));
+    json_object_set_new(storage_obj, "compressedValues", json_integer(atomic_load(&storage.compressed)));
+    json_object_set_new(storage_obj, "inflatedValues", json_integer(atomic_load(&storage.inflated)));
+    json_object_set_new(storage_obj, "failures", json_integer(atomic_load(&storage.failures)));
+    json_object_set_new(metrics_object, "storage", storage_obj);
+
+    json_t *catalog_obj = json_object();
+    unsigned int catalog_parity;
+    catalog_t *snapshot = catalog_acquire(&catalog_parity);
+    json_object_set_new(catalog_obj, "enabled", json_boolean(snapshot != NULL));
+    json_object_set_new(catalog_obj, "templates", json_integer(snapshot ? snapshot->template_count : 0));
+    json_object_set_new(catalog_obj, "collections", json_integer(snapshot ? snapshot->collection_count : 0));
+    json_object_set_new(catalog_obj, "textBytes", json_integer(snapshot ? (json_int_t)snapshot->text_bytes : 0));
+    if (snapshot) {
+        catalog_release(catalog_parity);
+    }
+    json_object_set_new(catalog_obj, "reads", json_integer(atomic_load(&catalog.reads)));
+    json_object_set_new(catalog_obj, "publishes", json_integer(atomic_load(&catalog.publishes)));
+    json_object_set_new(catalog_obj, "reloadedTemplates", json_integer(atomic_load(&catalog.reloaded_templates)));
+    json_object_set_new(catalog_obj, "rebuiltBitmaps", json_integer(atomic_load(&catalog.rebuilt_bitmaps)));
+    json_object_set_new(catalog_obj, "substringScans", json_integer(atomic_load(&catalog.scans)));
+    json_object_set_new(catalog_obj, "parallelScans", json_integer(atomic_load(&catalog.parallel_scans)));
+    json_object_set_new(catalog_obj, "scanThreads", json_integer(scan_pool.thread_count));
+    json_object_set_new(catalog_obj, "failures", json_integer(atomic_load(&catalog.failures)));
+    json_object_set_new(catalog_obj, "source", json_string(catalog.mapped ? "file" : "database"));
+    json_object_set_new(catalog_obj, "loadMs", json_real(catalog.load_ms));
+    json_object_set_new(catalog_obj, "fileSaves", json_integer(atomic_load(&catalog.saves)));
+    json_object_set_new(metrics_object, "catalog", catalog_obj);
+
+    json_t *views_obj = json_object();
+    unsigned long recorded_views = 0, dropped_views = 0;
+    for (int i = 0; i < VIEW_COUNTER_SHARDS; i++) {
+        recorded_views += atomic_load(&view_shards[i].recorded);
+        dropped_views += atomic_load(&view_shards[i].dropped);
+    }
+    json_object_set_new(views_obj, "enabled", json_boolean(VIEW_FLUSH_SECONDS > 0));
+    json_object_set_new(views_obj, "flushSeconds", json_integer(VIEW_FLUSH_SECONDS));
+    json_object_set_new(views_obj, "recorded", json_integer(recorded_views));
+    json_object_set_new(views_obj, "dropped", json_integer(dropped_views));
+    json_object_set_new(views_obj, "flushed", json_integer(atomic_load(&view_counters.flushed)));
+    json_object_set_new(views_obj, "flushes", json_integer(atomic_load(&view_counters.flushes)));
+    json_object_set_new(views_obj, "failedFlushes", json_integer(atomic_load(&view_counters.failed_flushes)));
+    json_object_set_new(metrics_object, "views", views_obj);
+
+    ulfius_set_json_body_response(response, 200, metrics_object);
+    json_decref(metrics_object);
+
+    return U_CALLBACK_CONTINUE;
+}
+
+// GET /templates/categories
+int callback_get_categories(const struct _u_request *request, struct _u_response *response, void *user_data) {
+    UNUSED(request);
+    UNUSED(user_data);
+
+    unsigned int catalog_parity;
+    catalog_t *snapshot = catalog_acquire(&catalog_parity);
+    if (snapshot) {
+        send_catalog_categories(snapshot, response);
+        catalog_release(catalog_parity);
+        return U_CALLBACK_CONTINUE;
+    }
+
+    sqlite3 *db = get_db_connection();
+    if (!db) {
+        ulfius_set_string_body_response(response, 500, "Database connection failed");
+        return U_CALLBACK_CONTINUE;
+    }
+
+    const char *sql = 
+        "SELECT c.id, c.name, c.icon, p.id AS parent_id, p.name AS parent_name, p.icon AS parent_icon "
+        "FROM categories c "
+        "LEFT JOIN categories p ON c.parent_id = p.id "
+        "ORDER BY c.name;";
+    sqlite3_stmt *stmt = prepare_cached_statement(db, sql);
+    int rc;
+    
+    if (!stmt) {
+        return_db_connection(db);
+        ulfius_set_string_body_response(response, 500, "Database error");
+        return U_CALLBACK_CONTINUE;
+    }
+    
+    json_t *categories_array = json_array();
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        json_t *category = json_object();
+        json_object_set_new(category, "id", json_integer(sqlite3_column_int(stmt, 0)));
+        json_object_set_new(category, "name", json_string((const char*)sqlite3_column_text(stmt, 1)));
+        json_object_set_new(category, "icon", json_string((const char*)sqlite3_column_text(stmt, 2)));
+
+        if (sqlite3_column_type(stmt, 3) != SQLITE_NULL) {
+            json_t *parent_obj = json_object();
+            json_object_set_new(parent_obj, "id", json_integer(sqlite3_column_int(stmt, 3)));
+            json_object_set_new(parent_obj, "name", json_string((const char*)sqlite3_column_text(stmt, 4)));
+            json_object_set_new(parent_obj, "icon", json_string((const char*)sqlite3_column_text(stmt, 5)));
+            json_object_set_new(category, "parent", parent_obj);
+        } else {
+            json_object_set_new(category, "parent", json_null());
+        }
+        
+        json_array_append_new(categories_array, category);
+    }
+    
+    release_cached_statement(db, stmt);
+    return_db_connection(db);
+
+    json_t *response_json = json_object();
+    json_object_set_new(response_json, "categories", categories_array);
+    
+    ulfius_set_json_body_response(response, 200, response_json);
+    json_decref(response_json);
+    
+    return U_CALLBACK_CONTINUE;
+}
+
+// Bind the category[] and search filters of GET /templates/collections, in query order
+void bind_collection_filters(sqlite3_stmt *stmt, const int *category_ids, int category_count, const char *search_pattern) {
+    int param_idx = 1;
+    for (int i = 0; i < category_count; i++) {
+        sqlite3_bind_int(stmt, param_idx++, category_ids[i]);
+    }
+    if (search_pattern[0] != '\0') {
+        sqlite3_bind_text(stmt, param_idx++, search_pattern, -1, SQLITE_STATIC);
+    }
+}
+
+// GET /templates/collections
+int callback_get_collections(const struct _u_request *request, struct _u_response *response, void *user_data) {
+    UNUSED(user_data);
+
+    const char *search_query = u_map_get(request->map_url, "search");
+    
+    // Parse category parameters (category[] array)
+    int category_ids[MAX_CATEGORIES];
+    int category_count = 0;
+    char param_name[PARAM_NAME_BUFFER_SIZE];
+    for (int i = 0; i < MAX_CATEGORIES; i++) {
+        snprintf(param_name, sizeof(param_name), "category[%d]", i);
+        const char *value = u_map_get(request->map_url, param_name);
+        if (value) {
+            category_ids[category_count++] = atoi(value);
+        }
+    }
+    
+    char search_pattern[SEARCH_PATTERN_BUFFER_SIZE] = "";
+    if (search_query && strlen(search_query) > 0) {
+        snprintf(search_pattern, sizeof(search_pattern), "%%%s%%", search_query);
+    }
+    
+    unsigned int catalog_parity;
+    catalog_t *snapshot = catalog_acquire(&catalog_parity);
+    if (snapshot) {
+        send_catalog_collections(snapshot, category_ids, category_count, search_pattern, response);
+        catalog_release(catalog_parity);
+        return U_CALLBACK_CONTINUE;
+    }
+    
+    sqlite3 *db = get_db_connection();
+    if (!db) {
+        ulfius_set_string_body_response(response, 500, "Database connection failed");
+        return U_CALLBACK_CONTINUE;
+    }
+    
+    // Build dynamic SQL query
+    char main_sql[SMALL_SQL_BUFFER_SIZE];
+    strcpy(main_sql, "SELECT DISTINCT c.id, c.rank, c.name, c.description, c.total_views, c.created_at FROM collections c");
+    
+    int where_added = 0;
+    
+    // Add category join if needed
+    if (category_count > 0) {
+        strcat(main_sql, " JOIN collection_categories cc ON c.id = cc.collection_id");
+        strcat(main_sql, " WHERE cc.category_id IN (");
+        for (int i = 0; i < category_count; i++) {
+            if (i > 0) strcat(main_sql, ",");
+            strcat(main_sql, "?");
+        }
+        strcat(main_sql, ")");
+        where_added = 1;
+    }
+    
+    // Add search condition
+    if (search_query && strlen(search_query) > 0) {
+        if (where_added) {
+            strcat(main_sql, " AND ");
+        } else {
+            strcat(main_sql, " WHERE ");
+        }
+        strcat(main_sql, "c.name LIKE ?");
+    }
+    
+    // Workflow references of every listed collection in one index-ordered pass, kept as an
+    // adjacency list sorted by collection id. Sorting only the collections below keeps the
+    // ORDER BY off the (collection, workflow) product.
+    char links_sql[MEDIUM_SQL_BUFFER_SIZE];
+    snprintf(links_sql, sizeof(links_sql),
+             "SELECT collection_id, template_id FROM collection_workflows "
+             "WHERE collection_id IN (SELECT id FROM (%s)) ORDER BY collection_id, template_id;", main_sql);
+    sqlite3_stmt *links_stmt = prepare_cached_statement(db, links_sql);
+    if (!links_stmt) {
+        return_db_connection(db);
+        ulfius_set_string_body_response(response, 500, "Database error on prepare");
+        return U_CALLBACK_CONTINUE;
+    }
+    bind_collection_filters(links_stmt, category_ids, category_count, search_pattern);
+    
+    int (*links)[2] = NULL;
+    int link_count = 0, link_capacity = 0;
+    while (sqlite3_step(links_stmt) == SQLITE_ROW) {
+        if (link_count == link_capacity) {
+            link_capacity = link_capacity ? link_capacity * 2 : 256;
+            int (*grown)[2] = realloc(links, link_capacity * sizeof(*links));
+            if (!grown) break;
+            links = grown;
+        }
+        links[link_count][0] = sqlite3_column_int(links_stmt, 0);
+        links[link_count][1] = sqlite3_column_int(links_stmt, 1);
+        link_count++;
+    }
+    release_cached_statement(db, links_stmt);
+    
+    strcat(main_sql, " ORDER BY c.rank, c.name;");
+    sqlite3_stmt *main_stmt = prepare_cached_statement(db, main_sql);
+    if (!main_stmt) {
+        free(links);
+        return_db_connection(db);
+        ulfius_set_string_body_response(response, 500, "Database error on prepare");
+        return U_CALLBACK_CONTINUE;
+    }
+    bind_collection_filters(main_stmt, category_ids, category_count, search_pattern);
+
+    // Wrapped in a root object with "collections" key to match the expected structure
+    json_writer_t writer;
+    jw_init(&writer);
+    jw_begin_object(&writer, NULL);
+    jw_begin_array(&writer, "collections");
+    while (sqlite3_step(main_stmt) == SQLITE_ROW) {
+        int collection_id = sqlite3_column_int(main_stmt, 0);
+        
+        jw_begin_object(&writer, NULL);
+        jw_int(&writer, "id", collection_id);
+        jw_int(&writer, "rank", sqlite3_column_int(main_stmt, 1));
+        jw_string(&writer, "name", (const char *)sqlite3_column_text(main_stmt, 2));
+        
+        // Handle nullable totalViews
+        if (sqlite3_column_type(main_stmt, 4) != SQLITE_NULL) {
+            jw_int(&writer, "totalViews", sqlite3_column_int(main_stmt, 4));
+        } else {
+            jw_null(&writer, "totalViews");
+        }
+        
+        jw_string(&writer, "createdAt", (const char *)sqlite3_column_text(main_stmt, 5));
+        
+        // First link of this collection by binary search, its workflows follow contiguously
+        int low = 0, high = link_count;
+        while (low < high) {
+            int middle = low + (high - low) / 2;
+            if (links[middle][0] < collection_id) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        jw_begin_array(&writer, "workflows");
+        for (int i = low; i < link_count && links[i][0] == collection_id; i++) {
+            jw_begin_object(&writer, NULL);
+            jw_int(&writer, "id", links[i][1]);
+            jw_end_object(&writer);
+        }
+        jw_end_array(&writer);
+        
+        // Add empty nodes array to match the expected structure
+        jw_raw(&writer, "nodes", NULL, "[]");
+        jw_end_object(&writer);
+    }
+    release_cached_statement(db, main_stmt);
+    return_db_connection(db);
+    free(links);
+    
+    jw_end_array(&writer);
+    jw_end_object(&writer);
+    jw_send(&writer, response, 200);
+    jw_free(&writer);
+    return U_CALLBACK_CONTINUE;
+}
+
+// Columns of a workflow in the "workflows" of GET /templates/collections/<id>, read by jw_collection_workflow()
+#define COLLECTION_WORKFLOWS_SELECT "SELECT t.id, t.name, t.total_views, t.recent_views, t.created_at, t.description, " \
+                                    VALID_JSON("t.workflow_data") ", t.last_updated_by, " \
+                                    "u.id, u.name, u.username, u.bio, u.verified, " VALID_JSON("u.links") ", u.avatar, " \
+                                    VALID_JSON("t.nodes_data") ", " VALID_JSON("t.workflow_info") ", " VALID_JSON("t.image_data") ", " \
+                                    TEMPLATE_CATEGORIES_JSON " " \
+                                    "FROM templates t JOIN users u ON t.user_id = u.id "
+
+// Write one workflow of a collection detail from a row of COLLECTION_WORKFLOWS_SELECT
+void jw_collection_workflow(json_writer_t *writer, sqlite3_stmt *stmt) {
+    jw_begin_object(writer, NULL);
+    
+    int views = sqlite3_column_int(stmt, 2);
+    jw_int(writer, "id", sqlite3_column_int(stmt, 0));
+    jw_string(writer, "name", (const char*)sqlite3_column_text(stmt, 1));
+    jw_int(writer, "views", views);
+    jw_int(writer, "recentViews", sqlite3_column_int(stmt, 3));
+    jw_int(writer, "totalViews", views);
+    jw_string(writer, "createdAt", (const char*)sqlite3_column_text(stmt, 4));
+    jw_string(writer, "description", (const char*)sqlite3_column_text(stmt, 5));
+    jw_raw(writer, "workflow", (const char*)sqlite3_column_text(stmt, 6), "{}");
+    
+    // lastUpdatedBy falls back to the owner
+    if (sqlite3_column_type(stmt, 7) != SQLITE_NULL) {
+        jw_int(writer, "lastUpdatedBy", sqlite3_column_int(stmt, 7));
+    } else {
+        jw_int(writer, "lastUpdatedBy", sqlite3_column_int(stmt, 8));
+    }
+    
+    jw_raw(writer, "workflowInfo", (const char*)sqlite3_column_text(stmt, 16), "{}");
+    
+    // Build user object
+    jw_begin_object(writer, "user");
+    jw_string(writer, "name", (const char*)sqlite3_column_text(stmt, 9));
+    jw_string(writer, "username", (const char*)sqlite3_column_text(stmt, 10));
+    jw_string_or_null(writer, "bio", (const char*)sqlite3_column_text(stmt, 11));
+    jw_bool(writer, "verified", sqlite3_column_int(stmt, 12));
+    jw_raw(writer, "links", (const char*)sqlite3_column_text(stmt, 13), "[]");
+    jw_string(writer, "avatar", (const char*)sqlite3_column_text(stmt, 14));
+    jw_end_object(writer);
+    
+    jw_raw(writer, "nodes", (const char*)sqlite3_column_text(stmt, 15), "[]");
+    jw_raw(writer, "categories", (const char*)sqlite3_column_text(stmt, 18), "[]");
+    jw_raw(writer, "image", (const char*)sqlite3_column_text(stmt, 17), "[]");
+    
+    jw_end_object(writer);
+}
+
+// Write the collection detail entry of a template, returns -1 on a database error. A missing
+// template writes nothing and sets *rc to SQLITE_DONE.
+int jw_collection_workflow_by_id(json_writer_t *writer, sqlite3 *db, int template_id, int *rc) {
+    sqlite3_stmt *stmt = prepare_cached_statement(db, COLLECTION_WORKFLOWS_SELECT "WHERE t.id = ?;");
+    if (!stmt) {
+        *rc = SQLITE_ERROR;
+        return -1;
+    }
+    sqlite3_bind_int(stmt, 1, template_id);
+    *rc = sqlite3_step(stmt);
+    if (*rc == SQLITE_ROW) {
+        jw_collection_workflow(writer, stmt);
+    }
+    release_cached_statement(db, stmt);
+    return *rc == SQLITE_ROW || *rc == SQLITE_DONE ? 0 : -1;
+}
+
+// GET /templates/collections/<id> from a snapshot: the collection, its categories and workflow ids
+// come from the snapshot, each workflow entry is the one rendered when its template was last written.
+// Entries not rendered yet are built from a pooled connection. Returns 0 when sent.
+int send_catalog_collection(const catalog_t *snapshot, sqlite3 *db, int collection_id, struct _u_response *response) {
+    // Collections are few, a scan beats keeping a second index of them
+    const catalog_collection_t *collection = NULL;
+    for (int i = 0; i < snapshot->collection_count && !collection; i++) {
+        if (snapshot->collections[i].id == collection_id) {
+            collection = &snapshot->collections[i];
+        }
+    }
+    if (!collection) {
+        ulfius_set_string_body_response(response, 404, "Collection not found");
+        atomic_fetch_add(&catalog.reads, 1);
+        return 0;
+    }
+    
+    json_writer_t writer;
+    jw_init(&writer);
+    jw_begin_object(&writer, NULL);
+    jw_begin_object(&writer, "collection");
+    jw_int(&writer, "id", collection->id);
+    jw_string(&writer, "name", collection->name);
+    jw_string(&writer, "description", collection->description ? collection->description : "");
+    jw_int(&writer, "totalViews", collection->total_views);
+    jw_string(&writer, "createdAt", collection->created_at);
+    
+    jw_begin_array(&writer, "workflows");
+    int failed = 0;
+    for (int i = 0; i < collection->workflow_count && !failed; i++) {
+        int template_id = snapshot->collection_workflows[collection->first_workflow + i];
+        int position = catalog_find_template(snapshot, template_id);
+        if (position == snapshot->template_count || snapshot->templates[position]->id != template_id ||
+            !catalog_user_by_id(snapshot, snapshot->templates[position]->user_id)) {
+            continue;
+        }
+        
+        sqlite3_stmt *stmt = prepare_cached_statement(db, "SELECT collection_item FROM template_renders WHERE template_id = ?1 "
+                                                          "AND NOT EXISTS (SELECT 1 FROM render_queue WHERE template_id = ?1);");
+        if (!stmt) {
+            failed = 1;
+            break;
+        }
+        sqlite3_bind_int(stmt, 1, template_id);
+        const char *rendered = sqlite3_step(stmt) == SQLITE_ROW ? (const char *)sqlite3_column_text(stmt, 0) : NULL;
+        if (rendered) {
+            jw_raw(&writer, NULL, rendered, "{}");
+            atomic_fetch_add(&render_stats.hits, 1);
+        } else {
+            int rc;
+            failed = jw_collection_workflow_by_id(&writer, db, template_id, &rc) != 0;
+            atomic_fetch_add(&render_stats.misses, 1);
+        }
+        release_cached_statement(db, stmt);
+    }
+    jw_end_array(&writer);
+    
+    jw_raw(&writer, "nodes", NULL, "[]");
+    jw_begin_array(&writer, "categories");
+    for (int i = 0; i < collection->category_count; i++) {
+        const catalog_category_t *category = catalog_category_by_id(snapshot, snapshot->collection_categories[collection->first_category + i]);
+        if (category) {
+            jw_begin_object(&writer, NULL);
+            jw_int(&writer, "id", category->id);
+            jw_string(&writer, "name", category->name);
+            jw_end_object(&writer);
+        }
+    }
+    jw_end_array(&writer);
+    jw_raw(&writer, "image", NULL, "[]");
+    jw_end_object(&writer);
+    jw_end_object(&writer);
+    
+    if (failed) {
+        jw_free(&writer);
+        return -1;
+    }
+    jw_send(&writer, response, 200);
+    jw_free(&writer);
+    atomic_fetch_add(&catalog.reads, 1);
+    return 0;
+}
+
+// GET /templates/collections/<id>
+int callback_get_collection_by_id(const struct _u_request *request, struct _u_response *response, void *user_data) {
+    UNUSED(user_data);
 
     sqlite3 *db = get_db_connection();
     if (!db) {
@@ -618,182 +6209,935 @@ int callback_get_collection_by_id(const struct _u_request *request, struct _u_re
     
     int collection_id = atoi(id_str);
     
-    // Get collection basic info with description
-    const char *sql = "SELECT id, name, description, total_views, created_at, rank FROM collections WHERE id = ?;";
-    sqlite3_stmt *stmt;
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, 0) != SQLITE_OK) {
+    unsigned int catalog_parity;
+    catalog_t *snapshot = catalog_acquire(&catalog_parity);
+    if (snapshot) {
+        int sent = send_catalog_collection(snapshot, db, collection_id, response);
+        catalog_release(catalog_parity);
+        if (sent == 0) {
+            return_db_connection(db);
+            return U_CALLBACK_CONTINUE;
+        }
+    }
+    
+    // Get collection basic info with description and its categories as JSON text
+    const char *sql = "SELECT c.id, c.name, c.description, c.total_views, c.created_at, c.rank, "
+                      "(SELECT json_group_array(json(category)) FROM (SELECT json_object('id', cat.id, 'name', cat.name) AS category "
+                      "FROM collection_categories cc JOIN categories cat ON cat.id = cc.category_id "
+                      "WHERE cc.collection_id = c.id ORDER BY cc.category_id)) "
+                      "FROM collections c WHERE c.id = ?;";
+    sqlite3_stmt *stmt = prepare_cached_statement(db, sql);
+    if (!stmt) {
+        return_db_connection(db);
+        ulfius_set_string_body_response(response, 500, "Database error");
+        return U_CALLBACK_CONTINUE;
+    }
+    
+    sqlite3_bind_int(stmt, 1, collection_id);
+    
+    if (sqlite3_step(stmt) != SQLITE_ROW) {
+        ulfius_set_string_body_response(response, 404, "Collection not found");
+        release_cached_statement(db, stmt);
+        return_db_connection(db);
+        return U_CALLBACK_CONTINUE;
+    }
+    
+    json_writer_t writer;
+    jw_init(&writer);
+    jw_begin_object(&writer, NULL);
+    jw_begin_object(&writer, "collection");
+    jw_int(&writer, "id", sqlite3_column_int(stmt, 0));
+    jw_string(&writer, "name", (const char*)sqlite3_column_text(stmt, 1));
+    
+    // Nullable description and totalViews default to "" and 0
+    const char *description = (const char*)sqlite3_column_text(stmt, 2);
+    jw_string(&writer, "description", description ? description : "");
+    jw_int(&writer, "totalViews", sqlite3_column_int(stmt, 3));
+    jw_string(&writer, "createdAt", (const char*)sqlite3_column_text(stmt, 4));
+    
+    // Workflows with full details, stored JSON columns are copied through unparsed
+    jw_begin_array(&writer, "workflows");
+    sqlite3_stmt *workflow_stmt = prepare_cached_statement(db, COLLECTION_WORKFLOWS_SELECT
+        "JOIN collection_workflows cw ON t.id = cw.template_id WHERE cw.collection_id = ? ORDER BY t.id;");
+    if (workflow_stmt) {
+        sqlite3_bind_int(workflow_stmt, 1, collection_id);
+        while (sqlite3_step(workflow_stmt) == SQLITE_ROW) {
+            jw_collection_workflow(&writer, workflow_stmt);
+        }
+        release_cached_statement(db, workflow_stmt);
+    }
+    jw_end_array(&writer);
+    
+    jw_raw(&writer, "nodes", NULL, "[]");
+    jw_raw(&writer, "categories", (const char*)sqlite3_column_text(stmt, 6), "[]");
+    jw_raw(&writer, "image", NULL, "[]");
+    release_cached_statement(db, stmt);
+    return_db_connection(db);
+    
+    jw_end_object(&writer);
+    jw_end_object(&writer);
+    jw_send(&writer, response, 200);
+    jw_free(&writer);
+    return U_CALLBACK_CONTINUE;
+}
+
+// GET /templates/search
+int callback_search_templates(const struct _u_request *request, struct _u_response *response, void *user_data) {
+    UNUSED(user_data);
+
+    const char *search_query_str = u_map_get(request->map_url, "search");
+    const char *category_str = u_map_get(request->map_url, "category");
+    const int default_page_size = 20;
+    const int max_page_size = 100;
+    int page = get_int_param(request, "page", 1);
+    int limit = get_int_param(request, "limit", default_page_size);
+    if (limit > max_page_size) limit = max_page_size;
+    int offset = (page - 1) * limit;
+
+    // A cursor replaces page: the page starts right after the row it points to
+    const char *cursor_str = u_map_get(request->map_url, "cursor");
+    int has_cursor = cursor_str && strlen(cursor_str) > 0;
+    int cursor_id = 0, cursor_has_score = 0;
+    double cursor_score = 0;
+    if (has_cursor) {
+        if (decode_cursor(cursor_str, &cursor_id, &cursor_has_score, &cursor_score) != 0) {
+            ulfius_set_string_body_response(response, 400, "Invalid cursor");
+            return U_CALLBACK_CONTINUE;
+        }
+        offset = 0;
+    }
+
+    int total_workflows = 0;
+    sqlite3_stmt *count_stmt;
+    sqlite3_stmt *main_stmt;
+
+    // Base queries with category joins when needed
+    char count_sql_base[] = "SELECT COUNT(DISTINCT t.id) FROM templates t";
+    char main_sql_base[] = "SELECT DISTINCT t.id, t.name, t.total_views, t.purchase_url, "
+                           "u.id, u.name, u.username, u.bio, u.verified, " VALID_JSON("u.links") ", u.avatar, "
+                           "t.description, t.created_at, " VALID_JSON("t.nodes_data") ", t.price";
+    char main_sql_from[] = " FROM templates t JOIN users u ON t.user_id = u.id";
+    
+    // Build WHERE clause and JOIN clause dynamically
+    char join_clause[CATEGORY_BUFFER_SIZE] = "";
+    char where_clause[XSMALL_SQL_BUFFER_SIZE] = "";
+    int where_conditions = 0;
+    
+    // Parse and prepare category conditions, templates match any of the categories unless categoryMatch=all
+    const char *category_match_str = u_map_get(request->map_url, "categoryMatch");
+    int match_all = category_match_str && strcmp(category_match_str, "all") == 0;
+    char *categories[MAX_CATEGORIES]; // Max 50 categories, just to be sure
+    int category_count = 0;
+    char category_buffer[CATEGORY_BUFFER_SIZE];
+    
+    if (category_str && strlen(category_str) > 0) {
+        // Create a copy of category_str for tokenization
+        strncpy(category_buffer, category_str, sizeof(category_buffer) - 1);
+        category_buffer[sizeof(category_buffer) - 1] = '\0';
+        
+        // Split by comma
+        char *saveptr = NULL;
+        char *token = strtok_r(category_buffer, ",", &saveptr);
+        while (token != NULL && category_count < MAX_CATEGORIES) {
+            // Trim whitespace
+            while (*token == ' ') token++;
+            char *end = token + strlen(token) - 1;
+            while (end > token && *end == ' ') end--;
+            *(end + 1) = '\0';
+            
+            categories[category_count++] = token;
+            token = strtok_r(NULL, ",", &saveptr);
+        }
+        
+        // Sort and drop duplicates so equivalent filters share one cached count
+        qsort(categories, category_count, sizeof(categories[0]), compare_strings);
+        int unique_count = 0;
+        for (int i = 0; i < category_count; i++) {
+            if (unique_count == 0 || strcmp(categories[unique_count - 1], categories[i]) != 0) {
+                categories[unique_count++] = categories[i];
+            }
+        }
+        category_count = unique_count;
+        
+        if (category_count > 0 && match_all) {
+            // Templates in every one of the categories
+            strcat(where_clause, " WHERE t.id IN (SELECT tc.template_id FROM template_categories tc "
+                                 "JOIN categories c ON tc.category_id = c.id WHERE c.name IN (");
+            for (int i = 0; i < category_count; i++) {
+                strcat(where_clause, i > 0 ? ", ?" : "?");
+            }
+            size_t length = strlen(where_clause);
+            snprintf(where_clause + length, sizeof(where_clause) - length, ") GROUP BY tc.template_id HAVING COUNT(*) = %d)", category_count);
+            where_conditions++;
+        } else if (category_count > 0) {
+            // Add joins for category filtering
+            strcat(join_clause, " JOIN template_categories tc ON t.id = tc.template_id");
+            strcat(join_clause, " JOIN categories c ON tc.category_id = c.id");
+            
+            if (where_conditions == 0) {
+                strcat(where_clause, " WHERE ");
+            } else {
+                strcat(where_clause, " AND ");
+            }
+            
+            strcat(where_clause, "(");
+            for (int i = 0; i < category_count; i++) {
+                if (i > 0) {
+                    strcat(where_clause, " OR ");
+                }
+                strcat(where_clause, "c.name = ?");
+            }
+            strcat(where_clause, ")");
+            where_conditions++;
+        }
+    }
+    
+    // Add search condition, through the full-text index when it can express the query
+    int has_search = search_query_str && strlen(search_query_str) > 0;
+    int use_search_index = 0;
+    char search_pattern[SEARCH_PATTERN_BUFFER_SIZE];
+    if (has_search) {
+        if (where_conditions == 0) {
+            strcat(where_clause, " WHERE ");
+        } else {
+            strcat(where_clause, " AND ");
+        }
+        
+        // match=substring asks for the LIKE semantics of the upstream API even when the index could answer
+        const char *match_str = u_map_get(request->map_url, "match");
+        int substring = match_str && strcmp(match_str, "substring") == 0;
+        use_search_index = !substring && atomic_load(&search_index_available) &&
+                           build_fts_query(search_query_str, search_pattern, sizeof(search_pattern)) > 0;
+        if (use_search_index) {
+            strcat(join_clause, " JOIN templates_fts ON templates_fts.rowid = t.id");
+            strcat(where_clause, "templates_fts MATCH ?");
+        } else {
+            snprintf(search_pattern, sizeof(search_pattern), "%%%s%%", search_query_str);
+            strcat(where_clause, "(t.name LIKE ? OR t.description LIKE ?)");
+        }
+        where_conditions++;
+    }
+    
+    // Relevance ordering needs a full-text match to rank against
+    const char *sort_str = u_map_get(request->map_url, "sort");
+    int by_relevance = use_search_index && sort_str && strcmp(sort_str, "relevance") == 0;
+    const char *score_column = by_relevance ? ", " SEARCH_SCORE_EXPR : ", 0";
+    const char *order_clause = by_relevance ? " ORDER BY " SEARCH_SCORE_EXPR ", t.id DESC" : " ORDER BY t.id DESC";
+    
+    // Categories are opt-in on search rows, upstream does not send them there
+    const char *include_categories_str = u_map_get(request->map_url, "includeCategories");
+    int include_categories = include_categories_str && strcmp(include_categories_str, "true") == 0;
+    const char *categories_column = include_categories ? ", " TEMPLATE_CATEGORIES_JSON : "";
+    const char *facets_str = u_map_get(request->map_url, "facets");
+    int include_facets = facets_str && strcmp(facets_str, "true") == 0;
+    if (has_cursor && by_relevance != cursor_has_score) {
+        ulfius_set_string_body_response(response, 400, "Cursor does not match the requested sort");
+        return U_CALLBACK_CONTINUE;
+    }
+    
+    // Anything but a full-text match is answered from the catalog snapshot, LIKE by scanning its text columns
+    unsigned int catalog_parity;
+    catalog_t *snapshot = use_search_index ? NULL : catalog_acquire(&catalog_parity);
+    if (snapshot) {
+        send_catalog_search(snapshot, categories, category_count, match_all, has_search ? search_pattern : NULL, has_cursor, cursor_id,
+                            limit, offset, include_categories, include_facets, response);
+        catalog_release(catalog_parity);
+        return U_CALLBACK_CONTINUE;
+    }
+    
+    sqlite3 *db = get_db_connection();
+    if (!db) {
+        ulfius_set_string_body_response(response, 500, "Database connection failed");
+        return U_CALLBACK_CONTINUE;
+    }
+    
+    // Keyset condition, kept out of the count so totalWorkflows stays the full match count
+    char keyset_clause[XSMALL_SQL_BUFFER_SIZE] = "";
+    if (has_cursor) {
+        snprintf(keyset_clause, sizeof(keyset_clause), "%s%s", where_conditions == 0 ? " WHERE " : " AND ",
+                 by_relevance ? "(" SEARCH_SCORE_EXPR " > ? OR (" SEARCH_SCORE_EXPR " = ? AND t.id < ?))" : "t.id < ?");
+    }
+
+    char full_count_sql[MEDIUM_SQL_BUFFER_SIZE];
+    snprintf(full_count_sql, sizeof(full_count_sql), "%s%s%s;", count_sql_base, join_clause, where_clause);
+    
+    char full_main_sql[MAX_SQL_BUFFER_SIZE];
+    snprintf(full_main_sql, sizeof(full_main_sql), "%s%s%s%s%s%s%s%s LIMIT ? OFFSET ?;",
+             main_sql_base, score_column, categories_column, main_sql_from, join_clause, where_clause, keyset_clause, order_clause);
+    
+    // Get total count, page changes reuse the count cached for the same filter until the next write.
+    // The version is read before querying so a count racing a commit is filed under the old version.
+    unsigned long version = atomic_load(&data_version);
+    char count_key[COUNT_CACHE_KEY_SIZE];
+    size_t key_length = snprintf(count_key, sizeof(count_key), "%c%s|", use_search_index ? 'f' : 'l', match_all ? "&" : "");
+    for (int i = 0; i < category_count && key_length < sizeof(count_key); i++) {
+        key_length += snprintf(count_key + key_length, sizeof(count_key) - key_length, "%s,", categories[i]);
+    }
+    if (key_length < sizeof(count_key)) {
+        key_length += snprintf(count_key + key_length, sizeof(count_key) - key_length, "|%s", has_search ? search_pattern : "");
+    }
+    int count_cacheable = key_length < sizeof(count_key);
+    
+    total_workflows = -1;
+    if (APPROXIMATE_TOTAL_COUNT && category_count == 0 && !has_search) {
+        total_workflows = get_counter(db, "templates");
+    }
+    if (total_workflows < 0 && count_cacheable) {
+        total_workflows = count_cache_get(count_key, version);
+    }
+    
+    if (total_workflows < 0) {
+        count_stmt = prepare_cached_statement(db, full_count_sql);
+        if (!count_stmt) {
+            return_db_connection(db);
+            ulfius_set_string_body_response(response, 500, "Database error on count query");
+            return U_CALLBACK_CONTINUE;
+        }
+        
+        int param_index = 1;
+        
+        // Bind category parameters first (if any)
+        for (int i = 0; i < category_count; i++) {
+            sqlite3_bind_text(count_stmt, param_index++, categories[i], -1, SQLITE_STATIC);
+        }
+        
+        // Bind search parameters
+        if (has_search) {
+            sqlite3_bind_text(count_stmt, param_index++, search_pattern, -1, SQLITE_STATIC);
+            if (!use_search_index) {
+                sqlite3_bind_text(count_stmt, param_index++, search_pattern, -1, SQLITE_STATIC);
+            }
+        }
+        
+        total_workflows = 0;
+        if (sqlite3_step(count_stmt) == SQLITE_ROW) {
+            total_workflows = sqlite3_column_int(count_stmt, 0);
+            if (count_cacheable) {
+                count_cache_put(count_key, version, total_workflows);
+            }
+        }
+        release_cached_statement(db, count_stmt);
+    }
+
+    // Get paginated results
+    main_stmt = prepare_cached_statement(db, full_main_sql);
+    if (!main_stmt) {
+        return_db_connection(db);
+        ulfius_set_string_body_response(response, 500, "Database error on main query");
+        return U_CALLBACK_CONTINUE;
+    }
+    
+    int param_index = 1;
+    
+    // Bind category parameters first (if any)
+    for (int i = 0; i < category_count; i++) {
+        sqlite3_bind_text(main_stmt, param_index++, categories[i], -1, SQLITE_STATIC);
+    }
+    
+    // Bind search parameters
+    if (has_search) {
+        sqlite3_bind_text(main_stmt, param_index++, search_pattern, -1, SQLITE_STATIC);
+        if (!use_search_index) {
+            sqlite3_bind_text(main_stmt, param_index++, search_pattern, -1, SQLITE_STATIC);
+        }
+    }
+    
+    // Bind keyset parameters
+    if (has_cursor) {
+        if (by_relevance) {
+            sqlite3_bind_double(main_stmt, param_index++, cursor_score);
+            sqlite3_bind_double(main_stmt, param_index++, cursor_score);
+        }
+        sqlite3_bind_int(main_stmt, param_index++, cursor_id);
+    }
+    
+    // Bind pagination parameters
+    sqlite3_bind_int(main_stmt, param_index++, limit);
+    sqlite3_bind_int(main_stmt, param_index++, offset);
+
+    json_writer_t writer;
+    jw_init(&writer);
+    jw_begin_object(&writer, NULL);
+    jw_int(&writer, "totalWorkflows", total_workflows);
+    jw_begin_array(&writer, "workflows");
+    int rows = 0, last_id = 0;
+    double last_score = 0;
+
+    while (sqlite3_step(main_stmt) == SQLITE_ROW) {
+        rows++;
+        last_id = sqlite3_column_int(main_stmt, 0);
+        last_score = sqlite3_column_double(main_stmt, 15);
+        jw_begin_object(&writer, NULL);
+
+        // Workflow fields
+        jw_int(&writer, "id", last_id);
+        jw_string(&writer, "name", (const char*)sqlite3_column_text(main_stmt, 1));
+        jw_int(&writer, "totalViews", sqlite3_column_int(main_stmt, 2));
+        jw_string_or_null(&writer, "purchaseUrl", (const char*)sqlite3_column_text(main_stmt, 3));
+
+        // User object
+        jw_begin_object(&writer, "user");
+        jw_int(&writer, "id", sqlite3_column_int(main_stmt, 4));
+        jw_string(&writer, "name", (const char*)sqlite3_column_text(main_stmt, 5));
+        jw_string(&writer, "username", (const char*)sqlite3_column_text(main_stmt, 6));
+        jw_string(&writer, "bio", (const char*)sqlite3_column_text(main_stmt, 7));
+        jw_bool(&writer, "verified", sqlite3_column_int(main_stmt, 8));
+        jw_raw(&writer, "links", (const char*)sqlite3_column_text(main_stmt, 9), "[]");
+        jw_string(&writer, "avatar", (const char*)sqlite3_column_text(main_stmt, 10));
+        jw_end_object(&writer);
+
+        // Other workflow fields
+        jw_string(&writer, "description", (const char*)sqlite3_column_text(main_stmt, 11));
+        jw_string(&writer, "createdAt", (const char*)sqlite3_column_text(main_stmt, 12));
+        jw_raw(&writer, "nodes", (const char*)sqlite3_column_text(main_stmt, 13), "[]");
+        
+        // Handle nullable price
+        if (sqlite3_column_type(main_stmt, 14) != SQLITE_NULL) {
+            jw_real(&writer, "price", sqlite3_column_double(main_stmt, 14));
+        } else {
+             // Official API uses 0 for null price in lists
+            jw_int(&writer, "price", 0);
+        }
+        
+        if (include_categories) {
+            jw_raw(&writer, "categories", (const char*)sqlite3_column_text(main_stmt, 16), "[]");
+        }
+
+        jw_end_object(&writer);
+    }
+
+    release_cached_statement(db, main_stmt);
+    jw_end_array(&writer);
+
+    // Facets count the categories of every matching template, not just of this page
+    int facets_failed = 0;
+    if (include_facets) {
+        char facets_sql[MAX_SQL_BUFFER_SIZE];
+        snprintf(facets_sql, sizeof(facets_sql), "SELECT fc.id, fc.name, COUNT(*) FROM template_categories ft "
+                 "JOIN categories fc ON ft.category_id = fc.id WHERE ft.template_id IN (SELECT t.id FROM templates t%s%s) "
+                 "GROUP BY fc.id ORDER BY COUNT(*) DESC, fc.name;", join_clause, where_clause);
+        sqlite3_stmt *facets_stmt = prepare_cached_statement(db, facets_sql);
+        facets_failed = !facets_stmt;
+        if (facets_stmt) {
+            param_index = 1;
+            for (int i = 0; i < category_count; i++) {
+                sqlite3_bind_text(facets_stmt, param_index++, categories[i], -1, SQLITE_STATIC);
+            }
+            if (has_search) {
+                sqlite3_bind_text(facets_stmt, param_index++, search_pattern, -1, SQLITE_STATIC);
+                if (!use_search_index) {
+                    sqlite3_bind_text(facets_stmt, param_index++, search_pattern, -1, SQLITE_STATIC);
+                }
+            }
+            
+            jw_begin_array(&writer, "facets");
+            while (sqlite3_step(facets_stmt) == SQLITE_ROW) {
+                jw_begin_object(&writer, NULL);
+                jw_int(&writer, "id", sqlite3_column_int(facets_stmt, 0));
+                jw_string(&writer, "name", (const char*)sqlite3_column_text(facets_stmt, 1));
+                jw_int(&writer, "count", sqlite3_column_int(facets_stmt, 2));
+                jw_end_object(&writer);
+            }
+            jw_end_array(&writer);
+            release_cached_statement(db, facets_stmt);
+        }
+    }
+    return_db_connection(db);
+
+    // A full page may have more behind it
+    if (rows == limit) {
+        char next_cursor[CURSOR_BUFFER_SIZE];
+        encode_cursor(last_id, by_relevance, last_score, next_cursor, sizeof(next_cursor));
+        u_map_put(response->map_header, "X-Next-Cursor", next_cursor);
+    }
+
+    jw_end_object(&writer);
+    if (facets_failed) {
+        ulfius_set_string_body_response(response, 500, "Database error on facets query");
+    } else {
+        jw_send(&writer, response, 200);
+    }
+    jw_free(&writer);
+
+    return U_CALLBACK_CONTINUE;
+}
+
+// GET /templates/workflows
+int callback_get_all_workflows(const struct _u_request *request, struct _u_response *response, void *user_data) {
+    UNUSED(user_data);
+
+    // Unpaged by default, limit and cursor page through the list in id order
+    const char *limit_str = u_map_get(request->map_url, "limit");
+    const char *cursor_str = u_map_get(request->map_url, "cursor");
+    int paged = (limit_str && strlen(limit_str) > 0) || (cursor_str && strlen(cursor_str) > 0);
+    int limit = get_int_param(request, "limit", 100);
+    if (limit > 1000) limit = 1000;
+    int cursor_id = 0, cursor_has_score = 0;
+    double cursor_score = 0;
+    if (cursor_str && strlen(cursor_str) > 0 &&
+        (decode_cursor(cursor_str, &cursor_id, &cursor_has_score, &cursor_score) != 0 || cursor_has_score)) {
+        ulfius_set_string_body_response(response, 400, "Invalid cursor");
+        return U_CALLBACK_CONTINUE;
+    }
+
+    unsigned int catalog_parity;
+    catalog_t *snapshot = catalog_acquire(&catalog_parity);
+    if (snapshot) {
+        send_catalog_workflows(snapshot, paged, cursor_id, limit, response);
+        catalog_release(catalog_parity);
+        return U_CALLBACK_CONTINUE;
+    }
+
+    sqlite3 *db = get_db_connection();
+    if (!db) {
+        ulfius_set_string_body_response(response, 500, "Database connection failed");
+        return U_CALLBACK_CONTINUE;
+    }
+
+    const char *sql = paged ? "SELECT id, name, total_views FROM templates WHERE id > ? ORDER BY id LIMIT ?;"
+                            : "SELECT id, name, total_views FROM templates;";
+    sqlite3_stmt *stmt = prepare_cached_statement(db, sql);
+
+    if (!stmt) {
         return_db_connection(db);
         ulfius_set_string_body_response(response, 500, "Database error");
         return U_CALLBACK_CONTINUE;
     }
+    if (paged) {
+        sqlite3_bind_int(stmt, 1, cursor_id);
+        sqlite3_bind_int(stmt, 2, limit);
+    }
+
+    json_t *workflows_array = json_array();
+    int rows = 0, last_id = 0;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        json_t *workflow_obj = json_object();
+        rows++;
+        last_id = sqlite3_column_int(stmt, 0);
+        json_object_set_new(workflow_obj, "id", json_integer(sqlite3_column_int(stmt, 0)));
+        json_object_set_new(workflow_obj, "name", json_string((const char*)sqlite3_column_text(stmt, 1)));
+        json_object_set_new(workflow_obj, "totalViews", json_integer(sqlite3_column_int(stmt, 2)));
+        json_array_append_new(workflows_array, workflow_obj);
+    }
+    release_cached_statement(db, stmt);
+    return_db_connection(db);
+
+    if (paged && rows == limit) {
+        char next_cursor[CURSOR_BUFFER_SIZE];
+        encode_cursor(last_id, 0, 0, next_cursor, sizeof(next_cursor));
+        u_map_put(response->map_header, "X-Next-Cursor", next_cursor);
+    }
+
+    ulfius_set_json_body_response(response, 200, workflows_array);
+    json_decref(workflows_array);
+
+    return U_CALLBACK_CONTINUE;
+}
+
+// Build the GET /templates/workflows/:id body. Returns NULL when the template is missing
+// (*rc == SQLITE_DONE) or on a database error.
+json_t* build_workflow_detail(sqlite3 *db, int template_id, int *rc) {
+    const char *sql = "SELECT t.id, t.name, t.total_views, t.price, t.purchase_url, t.recent_views, "
+                     "t.created_at, t.description, stored_json(t.workflow_data), stored_json(t.workflow_info), "
+                     "stored_json(t.nodes_data), stored_json(t.image_data), "
+                     "t.last_updated_by, "
+                     "u.id, u.name, u.username, u.bio, u.verified, u.links, u.avatar "
+                     "FROM templates t "
+                     "JOIN users u ON t.user_id = u.id "
+                     "WHERE t.id = ?;";
+    sqlite3_stmt *stmt = prepare_cached_statement(db, sql);
+    if (!stmt) {
+        *rc = SQLITE_ERROR;
+        return NULL;
+    }
     
-    sqlite3_bind_int(stmt, 1, collection_id);
+    sqlite3_bind_int(stmt, 1, template_id);
     
+    *rc = sqlite3_step(stmt);
     json_t *root_obj = NULL;
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
+
+    if (*rc == SQLITE_ROW) {
         root_obj = json_object();
-        json_t *collection_obj = json_object();
         json_error_t error;
         
-        json_object_set_new(collection_obj, "id", json_integer(sqlite3_column_int(stmt, 0)));
-        json_object_set_new(collection_obj, "name", json_string((const char*)sqlite3_column_text(stmt, 1)));
+        // Build the nested "workflow" object exactly like the API
+        json_t *workflow_obj = json_object();
+        int views = sqlite3_column_int(stmt, 2);
+        
+        json_object_set_new(workflow_obj, "id", json_integer(sqlite3_column_int(stmt, 0)));
+        json_object_set_new(workflow_obj, "name", json_string((const char*)sqlite3_column_text(stmt, 1)));
+        json_object_set_new(workflow_obj, "views", json_integer(views));
+        json_object_set_new(workflow_obj, "recentViews", json_integer(sqlite3_column_int(stmt, 5)));
+        json_object_set_new(workflow_obj, "totalViews", json_integer(views));
+        json_object_set_new(workflow_obj, "createdAt", json_string((const char*)sqlite3_column_text(stmt, 6)));
+        json_object_set_new(workflow_obj, "description", json_string((const char*)sqlite3_column_text(stmt, 7)));
         
-        // Add description
-        if (sqlite3_column_type(stmt, 2) != SQLITE_NULL) {
-            json_object_set_new(collection_obj, "description", json_string((const char*)sqlite3_column_text(stmt, 2)));
+        // Handle price and purchaseUrl
+        if (sqlite3_column_type(stmt, 3) == SQLITE_NULL) {
+            json_object_set_new(workflow_obj, "price", json_null());
         } else {
-            json_object_set_new(collection_obj, "description", json_string(""));
+            json_object_set_new(workflow_obj, "price", json_real(sqlite3_column_double(stmt, 3)));
         }
         
-        if (sqlite3_column_type(stmt, 3) != SQLITE_NULL) {
-            json_object_set_new(collection_obj, "totalViews", json_integer(sqlite3_column_int(stmt, 3)));
+        if (sqlite3_column_type(stmt, 4) == SQLITE_NULL) {
+            json_object_set_new(workflow_obj, "purchaseUrl", json_null());
         } else {
-            json_object_set_new(collection_obj, "totalViews", json_integer(0));
+            json_object_set_new(workflow_obj, "purchaseUrl", json_string((const char*)sqlite3_column_text(stmt, 4)));
         }
+
+        // Add the nested workflow data
+        const char *workflow_data_str = (const char*)sqlite3_column_text(stmt, 8);
+        if (workflow_data_str) {
+            json_t *nested_workflow_json = json_loads(workflow_data_str, 0, &error);
+            if (nested_workflow_json) {
+                json_object_set_new(workflow_obj, "workflow", nested_workflow_json);
+            } else {
+                json_object_set_new(workflow_obj, "workflow", json_object());
+            }
+        } else {
+            json_object_set_new(workflow_obj, "workflow", json_object());
+        }
+
+        json_object_set_new(root_obj, "workflow", workflow_obj);
         
-        json_object_set_new(collection_obj, "createdAt", json_string((const char*)sqlite3_column_text(stmt, 4)));
-        
-        sqlite3_finalize(stmt);
+        // Add lastUpdatedBy
+        if (sqlite3_column_type(stmt, 12) != SQLITE_NULL) {
+            json_object_set_new(root_obj, "lastUpdatedBy", json_integer(sqlite3_column_int(stmt, 12)));
+        } else {
+            json_object_set_new(root_obj, "lastUpdatedBy", json_integer(sqlite3_column_int(stmt, 13))); // Use user_id as fallback
+        }
         
-        // Get workflows with full details
-        json_t *workflows_array = json_array();
-        const char *workflow_sql = 
-            "SELECT t.id, t.name, t.total_views, t.recent_views, t.created_at, t.description, "
-            "t.workflow_data, t.last_updated_by, "
-            "u.id, u.name, u.username, u.bio, u.verified, u.links, u.avatar, "
-            "t.nodes_data, t.workflow_info, t.image_data "
-            "FROM templates t "
-            "JOIN collection_workflows cw ON t.id = cw.template_id "
-            "JOIN users u ON t.user_id = u.id "
-            "WHERE cw.collection_id = ? "
-            "ORDER BY t.id;";
+        // Build the "user" object
+        json_t *user_obj = json_object();
+        json_object_set_new(user_obj, "name", json_string((const char*)sqlite3_column_text(stmt, 14)));
+        json_object_set_new(user_obj, "username", json_string((const char*)sqlite3_column_text(stmt, 15)));
+        json_object_set_new(user_obj, "bio", json_string((const char*)sqlite3_column_text(stmt, 16)));
+        json_object_set_new(user_obj, "verified", json_boolean(sqlite3_column_int(stmt, 17)));
+        json_object_set_new(user_obj, "avatar", json_string((const char*)sqlite3_column_text(stmt, 19)));
         
-        sqlite3_stmt *workflow_stmt;
-        if (sqlite3_prepare_v2(db, workflow_sql, -1, &workflow_stmt, 0) == SQLITE_OK) {
-            sqlite3_bind_int(workflow_stmt, 1, collection_id);
-            
-            while (sqlite3_step(workflow_stmt) == SQLITE_ROW) {
-                json_t *workflow_obj = json_object();
-                
-                int template_id = sqlite3_column_int(workflow_stmt, 0);
-                json_object_set_new(workflow_obj, "id", json_integer(template_id));
-                json_object_set_new(workflow_obj, "name", json_string((const char*)sqlite3_column_text(workflow_stmt, 1)));
-                
-                int views = sqlite3_column_int(workflow_stmt, 2);
-                json_object_set_new(workflow_obj, "views", json_integer(views));
-                json_object_set_new(workflow_obj, "recentViews", json_integer(sqlite3_column_int(workflow_stmt, 3)));
-                json_object_set_new(workflow_obj, "totalViews", json_integer(views));
-                json_object_set_new(workflow_obj, "createdAt", json_string((const char*)sqlite3_column_text(workflow_stmt, 4)));
-                json_object_set_new(workflow_obj, "description", json_string((const char*)sqlite3_column_text(workflow_stmt, 5)));
-                
-                // Add nested workflow object
-                const char *workflow_data_str = (const char*)sqlite3_column_text(workflow_stmt, 6);
-                if (workflow_data_str) {
-                    json_t *nested_workflow = json_loads(workflow_data_str, 0, &error);
-                    if (nested_workflow) {
-                        json_object_set_new(workflow_obj, "workflow", nested_workflow);
-                    } else {
-                        json_object_set_new(workflow_obj, "workflow", json_object());
-                    }
-                } else {
-                    json_object_set_new(workflow_obj, "workflow", json_object());
-                }
-                
-                // Add lastUpdatedBy
-                if (sqlite3_column_type(workflow_stmt, 7) != SQLITE_NULL) {
-                    json_object_set_new(workflow_obj, "lastUpdatedBy", json_integer(sqlite3_column_int(workflow_stmt, 7)));
-                } else {
-                    json_object_set_new(workflow_obj, "lastUpdatedBy", json_integer(sqlite3_column_int(workflow_stmt, 8)));
-                }
-                
-                // Add workflowInfo
-                const char *workflow_info_str = (const char*)sqlite3_column_text(workflow_stmt, 16);
-                if (workflow_info_str) {
-                    json_t *workflow_info = json_loads(workflow_info_str, 0, &error);
-                    if (workflow_info) {
-                        json_object_set_new(workflow_obj, "workflowInfo", workflow_info);
-                    } else {
-                        json_object_set_new(workflow_obj, "workflowInfo", json_object());
-                    }
-                } else {
-                    json_object_set_new(workflow_obj, "workflowInfo", json_object());
-                }
-                
-                // Build user object
-                json_t *user_obj = json_object();
-                json_object_set_new(user_obj, "name", json_string((const char*)sqlite3_column_text(workflow_stmt, 9)));
-                json_object_set_new(user_obj, "username", json_string((const char*)sqlite3_column_text(workflow_stmt, 10)));
-                
-                if (sqlite3_column_type(workflow_stmt, 11) != SQLITE_NULL) {
-                    json_object_set_new(user_obj, "bio", json_string((const char*)sqlite3_column_text(workflow_stmt, 11)));
-                } else {
-                    json_object_set_new(user_obj, "bio", json_null());
-                }
-                
-                json_object_set_new(user_obj, "verified", json_boolean(sqlite3_column_int(workflow_stmt, 12)));
-                
-                const char *links_str = (const char*)sqlite3_column_text(workflow_stmt, 13);
-                if (links_str) {
-                    json_t *links_json = json_loads(links_str, 0, &error);
-                    json_object_set_new(user_obj, "links", links_json ? links_json : json_array());
-                } else {
-                    json_object_set_new(user_obj, "links", json_array());
-                }
-                
-                json_object_set_new(user_obj, "avatar", json_string((const char*)sqlite3_column_text(workflow_stmt, 14)));
-                json_object_set_new(workflow_obj, "user", user_obj);
-                
-                // Add nodes
-                const char *nodes_str = (const char*)sqlite3_column_text(workflow_stmt, 15);
-                if (nodes_str) {
-                    json_t *nodes_json = json_loads(nodes_str, 0, &error);
-                    json_object_set_new(workflow_obj, "nodes", nodes_json ? nodes_json : json_array());
-                } else {
-                    json_object_set_new(workflow_obj, "nodes", json_array());
-                }
-                
-                // Get categories for this workflow
-                json_object_set_new(workflow_obj, "categories", get_template_categories(db, template_id));
-                
-                // Add image array
-                const char *image_str = (const char*)sqlite3_column_text(workflow_stmt, 17);
-                if (image_str) {
-                    json_t *image_json = json_loads(image_str, 0, &error);
-                    json_object_set_new(workflow_obj, "image", image_json ? image_json : json_array());
-                } else {
-                    json_object_set_new(workflow_obj, "image", json_array());
-                }
-                
-                json_array_append_new(workflows_array, workflow_obj);
+        // Parse links JSON
+        const char *links_str = (const char*)sqlite3_column_text(stmt, 18);
+        if (links_str) {
+            json_t *links_json = json_loads(links_str, 0, &error);
+            if (links_json) {
+                json_object_set_new(user_obj, "links", links_json);
+            } else {
+                json_object_set_new(user_obj, "links", json_array());
             }
-            sqlite3_finalize(workflow_stmt);
+        } else {
+            json_object_set_new(user_obj, "links", json_array());
         }
+        json_object_set_new(root_obj, "user", user_obj);
         
-        json_object_set_new(collection_obj, "workflows", workflows_array);
-        json_object_set_new(collection_obj, "nodes", json_array());
+        // Get categories
+        json_object_set_new(root_obj, "categories", get_template_categories(db, template_id));
         
-        // Get categories for the collection
-        json_object_set_new(collection_obj, "categories", get_collection_categories(db, collection_id));
+        // Add workflowInfo from stored JSON
+        const char *workflow_info_str = (const char*)sqlite3_column_text(stmt, 9);
+        if (workflow_info_str) {
+            json_t *workflow_info_json = json_loads(workflow_info_str, 0, &error);
+            if (workflow_info_json) {
+                json_object_set_new(root_obj, "workflowInfo", workflow_info_json);
+            } else {
+                json_object_set_new(root_obj, "workflowInfo", json_object());
+            }
+        } else {
+            json_object_set_new(root_obj, "workflowInfo", json_object());
+        }
         
-        // Add empty image array for collection
-        json_object_set_new(collection_obj, "image", json_array());
+        // Add nodes from stored JSON
+        const char *nodes_data_str = (const char*)sqlite3_column_text(stmt, 10);
+        if (nodes_data_str) {
+            json_t *nodes_json = json_loads(nodes_data_str, 0, &error);
+            if (nodes_json && json_is_array(nodes_json)) {
+                json_object_set_new(root_obj, "nodes", nodes_json);
+            } else {
+                json_object_set_new(root_obj, "nodes", json_array());
+            }
+        } else {
+            json_object_set_new(root_obj, "nodes", json_array());
+        }
         
-        // Wrap in root object
-        json_object_set_new(root_obj, "collection", collection_obj);
+        // Add image array from stored JSON
+        const char *image_data_str = (const char*)sqlite3_column_text(stmt, 11);
+        if (image_data_str) {
+            json_t *image_json = json_loads(image_data_str, 0, &error);
+            if (image_json && json_is_array(image_json)) {
+                json_object_set_new(root_obj, "image", image_json);
+            } else {
+                json_object_set_new(root_obj, "image", json_array());
+            }
+        } else {
+            json_object_set_new(root_obj, "image", json_array());
+        }
         
+    } else if (*rc != SQLITE_DONE) {
+        fprintf(stderr, "Error executing step: %s\n", sqlite3_errmsg(db));
+    }
+    
+    release_cached_statement(db, stmt);
+    return root_obj;
+}
+
+// Build the GET /workflows/templates/:id body, same contract as build_workflow_detail()
+json_t* build_workflow_import(sqlite3 *db, int template_id, int *rc) {
+    const char *sql = "SELECT id, name, stored_json(workflow_data) FROM templates WHERE id = ?;";
+    sqlite3_stmt *stmt = prepare_cached_statement(db, sql);
+    if (!stmt) {
+        *rc = SQLITE_ERROR;
+        return NULL;
+    }
+
+    sqlite3_bind_int(stmt, 1, template_id);
+
+    *rc = sqlite3_step(stmt);
+    json_t *root_obj = NULL;
+
+    if (*rc == SQLITE_ROW) {
+        root_obj = json_object();
+        json_error_t error;
+
+        // Set top-level id and name
+        json_object_set_new(root_obj, "id", json_integer(sqlite3_column_int(stmt, 0)));
+        json_object_set_new(root_obj, "name", json_string((const char*)sqlite3_column_text(stmt, 1)));
+
+        // Get the nested workflow data
+        const char *workflow_data_str = (const char*)sqlite3_column_text(stmt, 2);
+        if (workflow_data_str) {
+            json_t *nested_workflow_json = json_loads(workflow_data_str, 0, &error);
+            if (nested_workflow_json) {
+                json_object_set_new(root_obj, "workflow", nested_workflow_json);
+            } else {
+                // If parsing fails, add an empty object to avoid breaking the client
+                fprintf(stderr, "Failed to parse workflow_data for template %d: %s\n", template_id, error.text);
+                json_object_set_new(root_obj, "workflow", json_object());
+            }
+        } else {
+            // If data is NULL, add an empty object
+            json_object_set_new(root_obj, "workflow", json_object());
+        }
+
+    } else if (*rc != SQLITE_DONE) {
+        fprintf(stderr, "Error executing step for import: %s\n", sqlite3_errmsg(db));
+    }
+
+    release_cached_statement(db, stmt);
+    return root_obj;
+}
+
+// Migration: create the rendered body store and the triggers feeding its queue. A fresh store gets
+// every existing template queued so the first drain renders them.
+int migrate_render_store(sqlite3 *db) {
+    int exists = table_exists(db, "template_renders");
+    if (sqlite3_exec(db, RENDER_STORE_SCHEMA, NULL, NULL, NULL) != SQLITE_OK) {
+        return -1;
+    }
+    if (!exists && sqlite3_exec(db, "INSERT OR IGNORE INTO render_queue (template_id) SELECT id FROM templates;", NULL, NULL, NULL) != SQLITE_OK) {
+        return -1;
+    }
+    return 0;
+}
+
+// Migration: add the rendered collection detail entries, queueing every rendered template without one
+int migrate_collection_items(sqlite3 *db) {
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(db, "SELECT 1 FROM pragma_table_info('template_renders') WHERE name = 'collection_item';", -1, &stmt, 0) != SQLITE_OK) {
+        return -1;
+    }
+    int present = sqlite3_step(stmt) == SQLITE_ROW;
+    sqlite3_finalize(stmt);
+    if (!present && sqlite3_exec(db, "ALTER TABLE template_renders ADD COLUMN collection_item TEXT;", NULL, NULL, NULL) != SQLITE_OK) {
+        return -1;
+    }
+    return sqlite3_exec(db, "INSERT OR IGNORE INTO render_queue SELECT template_id FROM template_renders WHERE collection_item IS NULL;", NULL, NULL, NULL) == SQLITE_OK ? 0 : -1;
+}
+
+// Render whatever is queued at startup, including edits made while the server was down
+int render_queued_templates(sqlite3 *db) {
+    if (sqlite3_exec(db, "BEGIN IMMEDIATE;", NULL, NULL, NULL) != SQLITE_OK) {
+        return -1;
+    }
+    int rendered = drain_render_queue(db);
+    if (rendered < 0 || sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL) != SQLITE_OK) {
+        fprintf(stderr, "Can't render queued templates: %s\n", sqlite3_errmsg(db));
+        sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+        return -1;
+    }
+    if (rendered > 0) {
+        printf("Rendered %d workflow templates\n", rendered);
+    }
+    return 0;
+}
+
+// Which stored body serve_rendered_template() sends
+typedef enum {
+    RENDERED_DETAIL,
+    RENDERED_IMPORT
+} rendered_body_t;
+
+// Send the body rendered at write time. Returns 1 when served, 0 when the caller has to build it
+// (not rendered yet, or queued for re-rendering after an edit made outside the writer).
+int serve_rendered_template(sqlite3 *db, int template_id, rendered_body_t body, struct _u_response *response) {
+    const char *sql = body == RENDERED_DETAIL
+        ? "SELECT detail FROM template_renders WHERE template_id = ?1 "
+          "AND NOT EXISTS (SELECT 1 FROM render_queue WHERE template_id = ?1);"
+        : "SELECT import FROM template_renders WHERE template_id = ?1 "
+          "AND NOT EXISTS (SELECT 1 FROM render_queue WHERE template_id = ?1);";
+    sqlite3_stmt *stmt = prepare_cached_statement(db, sql);
+    if (!stmt) {
+        return 0;
+    }
+    
+    int served = 0;
+    sqlite3_bind_int(stmt, 1, template_id);
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        const char *body_text = (const char*)sqlite3_column_blob(stmt, 0);
+        size_t body_length = sqlite3_column_bytes(stmt, 0);
+        // Tagged by content, so writes to other templates do not invalidate clients' copies
+        char etag[ETAG_BUFFER_SIZE];
+        format_content_etag(body_text, body_length, etag, sizeof(etag));
+        ulfius_set_binary_body_response(response, 200, body_text, body_length);
+        u_map_put(response->map_header, "Content-Type", "application/json");
+        u_map_put(response->map_header, "ETag", etag);
+        served = 1;
+    }
+    release_cached_statement(db, stmt);
+    
+    atomic_fetch_add(served ? &render_stats.hits : &render_stats.misses, 1);
+    return served;
+}
+
+// Forget the stored bodies of a template so GETs build it live
+int drop_rendered_template(sqlite3 *db, int template_id) {
+    sqlite3_stmt *stmt = prepare_cached_statement(db, "DELETE FROM template_renders WHERE template_id = ?;");
+    if (!stmt) {
+        return -1;
+    }
+    sqlite3_bind_int(stmt, 1, template_id);
+    int rc = sqlite3_step(stmt);
+    release_cached_statement(db, stmt);
+    return rc == SQLITE_DONE ? 0 : -1;
+}
+
+// Render and store both GET bodies of a template and its entry in collection details, or drop
+// them if the template is gone. Runs on the writer thread inside the current transaction.
+int render_template(sqlite3 *db, int template_id) {
+    int detail_rc, import_rc, item_rc;
+    json_t *detail_json = build_workflow_detail(db, template_id, &detail_rc);
+    json_t *import_json = build_workflow_import(db, template_id, &import_rc);
+    json_writer_t item;
+    jw_init(&item);
+    jw_collection_workflow_by_id(&item, db, template_id, &item_rc);
+    
+    int result = -1;
+    if (detail_json && import_json && item_rc == SQLITE_ROW && !item.failed) {
+        // Same serialization ulfius_set_json_body_response() uses, so stored and live bodies match
+        char *detail_str = json_dumps(detail_json, JSON_COMPACT);
+        char *import_str = json_dumps(import_json, JSON_COMPACT);
+        sqlite3_stmt *stmt = prepare_cached_statement(db, "INSERT OR REPLACE INTO template_renders (template_id, detail, import, collection_item) VALUES (?, ?, ?, ?);");
+        if (stmt && detail_str && import_str) {
+            sqlite3_bind_int(stmt, 1, template_id);
+            sqlite3_bind_text(stmt, 2, detail_str, -1, SQLITE_STATIC);
+            sqlite3_bind_text(stmt, 3, import_str, -1, SQLITE_STATIC);
+            sqlite3_bind_text(stmt, 4, item.data, (int)item.length, SQLITE_STATIC);
+            result = sqlite3_step(stmt) == SQLITE_DONE ? 0 : -1;
+        }
+        if (stmt) release_cached_statement(db, stmt);
+        free(detail_str);
+        free(import_str);
+        atomic_fetch_add(&render_stats.renders, 1);
+    } else if (detail_rc == SQLITE_DONE || import_rc == SQLITE_DONE || item_rc == SQLITE_DONE) {
+        result = drop_rendered_template(db, template_id);
+    }
+    
+    json_decref(detail_json);
+    json_decref(import_json);
+    jw_free(&item);
+    return result;
+}
+
+// Re-render every template the triggers queued since the last drain, returns how many were rendered or -1
+int drain_render_queue(sqlite3 *db) {
+    sqlite3_stmt *stmt = prepare_cached_statement(db, "SELECT template_id FROM render_queue;");
+    if (!stmt) {
+        return -1;
+    }
+    
+    // Collect first, rendering writes to the tables the queue is fed from
+    int *template_ids = NULL;
+    int count = 0, capacity = 0;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            int *grown = realloc(template_ids, capacity * sizeof(int));
+            if (!grown) break;
+            template_ids = grown;
+        }
+        template_ids[count++] = sqlite3_column_int(stmt, 0);
+    }
+    release_cached_statement(db, stmt);
+    catalog_note_changed(template_ids, count);
+    
+    int rendered = 0;
+    for (int i = 0; i < count; i++) {
+        if (render_template(db, template_ids[i]) == 0) {
+            rendered++;
+        } else {
+            // Never leave an outdated body behind, GETs build this one live instead
+            fprintf(stderr, "Failed to render workflow %d: %s\n", template_ids[i], sqlite3_errmsg(db));
+            drop_rendered_template(db, template_ids[i]);
+        }
+    }
+    free(template_ids);
+    
+    if (sqlite3_exec(db, "DELETE FROM render_queue;", NULL, NULL, NULL) != SQLITE_OK) {
+        return -1;
+    }
+    return rendered;
+}
+
+// GET /templates/workflows/<id>
+int callback_get_workflow_by_id(const struct _u_request *request, struct _u_response *response, void *user_data) {
+    UNUSED(user_data);
+
+    sqlite3 *db = get_db_connection();
+    if (!db) {
+        ulfius_set_string_body_response(response, 500, "Database connection failed");
+        return U_CALLBACK_CONTINUE;
+    }
+
+    const char *id_str = u_map_get(request->map_url, "id");
+    if (id_str == NULL) {
+        return_db_connection(db);
+        ulfius_set_string_body_response(response, 400, "Missing workflow ID");
+        return U_CALLBACK_CONTINUE;
+    }
+    
+    int template_id = atoi(id_str);
+    if (serve_rendered_template(db, template_id, RENDERED_DETAIL, response)) {
+        return_db_connection(db);
+        return U_CALLBACK_CONTINUE;
+    }
+    
+    // Not rendered yet (or stale after an external edit), build it live
+    int rc;
+    json_t *root_obj = build_workflow_detail(db, template_id, &rc);
+    if (root_obj) {
         ulfius_set_json_body_response(response, 200, root_obj);
         json_decref(root_obj);
+    } else if (rc == SQLITE_DONE) {
+        ulfius_set_string_body_response(response, 404, "Workflow not found");
     } else {
-        ulfius_set_string_body_response(response, 404, "Collection not found");
-        sqlite3_finalize(stmt);
+        ulfius_set_string_body_response(response, 500, "Database error executing step");
     }
-
+    
     return_db_connection(db);
     return U_CALLBACK_CONTINUE;
 }
 
-// GET /templates/search
-int callback_search_templates(const struct _u_request *request, struct _u_response *response, void *user_data) {
+// GET /workflows/templates/:id
+// Needed when importing a workflow from a template
+int callback_get_workflow_for_import(const struct _u_request *request, struct _u_response *response, void *user_data) {
     UNUSED(user_data);
 
     sqlite3 *db = get_db_connection();
@@ -802,891 +7146,1570 @@ int callback_search_templates(const struct _u_request *request, struct _u_respon
         return U_CALLBACK_CONTINUE;
     }
 
-    const char *search_query_str = u_map_get(request->map_url, "search");
-    const char *category_str = u_map_get(request->map_url, "category");
-    const int default_page_size = 20;
-    const int max_page_size = 100;
-    int page = get_int_param(request, "page", 1);
-    int limit = get_int_param(request, "limit", default_page_size);
-    if (limit > max_page_size) limit = max_page_size;
-    int offset = (page - 1) * limit;
+    const char *id_str = u_map_get(request->map_url, "id");
+    if (id_str == NULL) {
+        return_db_connection(db);
+        ulfius_set_string_body_response(response, 400, "Missing workflow ID");
+        return U_CALLBACK_CONTINUE;
+    }
 
-    int total_workflows = 0;
-    sqlite3_stmt *count_stmt;
-    sqlite3_stmt *main_stmt;
+    int template_id = atoi(id_str);
+    if (serve_rendered_template(db, template_id, RENDERED_IMPORT, response)) {
+        return_db_connection(db);
+        return U_CALLBACK_CONTINUE;
+    }
 
-    // Base queries with category joins when needed
-    char count_sql_base[] = "SELECT COUNT(DISTINCT t.id) FROM templates t";
-    char main_sql_base[] = "SELECT DISTINCT t.id, t.name, t.total_views, t.purchase_url, "
-                           "u.id, u.name, u.username, u.bio, u.verified, u.links, u.avatar, "
-                           "t.description, t.created_at, t.nodes_data, t.price "
-                           "FROM templates t JOIN users u ON t.user_id = u.id";
-    
-    // Build WHERE clause and JOIN clause dynamically
-    char join_clause[CATEGORY_BUFFER_SIZE] = "";
-    char where_clause[XSMALL_SQL_BUFFER_SIZE] = "";
-    int where_conditions = 0;
+    int rc;
+    json_t *root_obj = build_workflow_import(db, template_id, &rc);
+    if (root_obj) {
+        ulfius_set_json_body_response(response, 200, root_obj);
+        json_decref(root_obj);
+    } else if (rc == SQLITE_DONE) {
+        ulfius_set_string_body_response(response, 404, "Workflow not found");
+    } else {
+        ulfius_set_string_body_response(response, 500, "Database error executing step");
+    }
+
+    return_db_connection(db);
+    return U_CALLBACK_CONTINUE;
+}
+
+int compare_ints(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+// Make the template's category links exactly category_ids (sorted, distinct), touching only the
+// links that differ. Returns the number of links added or removed, -1 on error.
+int sync_template_categories(sqlite3 *db, int template_id, const int *category_ids, int category_count) {
+    int existing[MAX_CATEGORIES];
+    int existing_count = 0;
+    int changes = 0;
+
+    sqlite3_stmt *stmt = prepare_cached_statement(db, "SELECT category_id FROM template_categories WHERE template_id = ? ORDER BY category_id;");
+    if (!stmt) {
+        return -1;
+    }
+    sqlite3_bind_int(stmt, 1, template_id);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        int category_id = sqlite3_column_int(stmt, 0);
+        if (existing_count < MAX_CATEGORIES) {
+            existing[existing_count++] = category_id;
+        } else if (!bsearch(&category_id, category_ids, category_count, sizeof(int), compare_ints)) {
+            // More links than we keep track of, drop the extra ones right away
+            sqlite3_stmt *delete_stmt = prepare_cached_statement(db, "DELETE FROM template_categories WHERE template_id = ? AND category_id = ?;");
+            if (delete_stmt) {
+                sqlite3_bind_int(delete_stmt, 1, template_id);
+                sqlite3_bind_int(delete_stmt, 2, category_id);
+                changes += sqlite3_step(delete_stmt) == SQLITE_DONE;
+                release_cached_statement(db, delete_stmt);
+            }
+        }
+    }
+    release_cached_statement(db, stmt);
+
+    // Walk both sorted lists, deleting links that are gone and adding new ones
+    int i = 0, j = 0;
+    while (i < existing_count || j < category_count) {
+        const char *sql;
+        int category_id;
+        if (j >= category_count || (i < existing_count && existing[i] < category_ids[j])) {
+            sql = "DELETE FROM template_categories WHERE template_id = ? AND category_id = ?;";
+            category_id = existing[i++];
+        } else if (i >= existing_count || category_ids[j] < existing[i]) {
+            sql = "INSERT OR IGNORE INTO template_categories (template_id, category_id) VALUES (?, ?);";
+            category_id = category_ids[j++];
+        } else {
+            i++;
+            j++;
+            continue;
+        }
+
+        stmt = prepare_cached_statement(db, sql);
+        if (!stmt) {
+            return -1;
+        }
+        sqlite3_bind_int(stmt, 1, template_id);
+        sqlite3_bind_int(stmt, 2, category_id);
+        int rc = sqlite3_step(stmt);
+        release_cached_statement(db, stmt);
+        if (rc != SQLITE_DONE) {
+            return -1;
+        }
+        changes++;
+    }
+    return changes;
+}
+
+// Write job for PUT /templates/workflows
+typedef struct {
+    json_t *workflow_json;
+    int template_id;
+    int unchanged;
+    int status;
+    char error[INGEST_ERROR_SIZE];
+} create_workflow_job_t;
+
+// Check a PUT /templates/workflows body and point the job at its workflow.
+// Returns NULL when it can be written, otherwise why not (a 400).
+const char* prepare_workflow_job(json_t *body, create_workflow_job_t *job) {
+    json_t *workflow_json = json_object_get(body, "workflow");
+    json_t *user_json = json_object_get(workflow_json, "user");
+
+    if (!json_is_object(workflow_json) || !json_is_object(user_json)) {
+        return "Missing 'workflow' or 'user' object in request body";
+    }
+
+    const char *name = json_string_value(json_object_get(workflow_json, "name"));
+    const char *description = json_string_value(json_object_get(workflow_json, "description"));
+    const char *created_at = json_string_value(json_object_get(workflow_json, "createdAt"));
+    json_t *nested_workflow = json_object_get(workflow_json, "workflow");
+
+    if (!name || !description || !created_at || !nested_workflow) {
+        return "Missing required fields in workflow object";
+    }
+
+    memset(job, 0, sizeof(*job));
+    job->workflow_json = workflow_json;
+    return NULL;
+}
+
+// Insert or replace a template with its user and categories, runs on the writer thread
+int job_create_workflow(sqlite3 *db, void *arg) {
+    create_workflow_job_t *job = (create_workflow_job_t *)arg;
+    json_t *workflow_json = job->workflow_json;
+    json_t *user_json = json_object_get(workflow_json, "user");
+    json_t *categories_json = json_object_get(workflow_json, "categories");
+    json_t *workflow_info_json = json_object_get(workflow_json, "workflowInfo");
+    json_t *nodes_json = json_object_get(workflow_json, "nodes");
+    json_t *image_json = json_object_get(workflow_json, "image");
+
+    // Extract workflow fields
+    const char *name = json_string_value(json_object_get(workflow_json, "name"));
+    const char *description = json_string_value(json_object_get(workflow_json, "description"));
+    const char *created_at = json_string_value(json_object_get(workflow_json, "createdAt"));
+    int total_views = json_integer_value(json_object_get(workflow_json, "totalViews"));
+    int recent_views = json_integer_value(json_object_get(workflow_json, "recentViews"));
+    json_t *nested_workflow = json_object_get(workflow_json, "workflow");
     
-    // Parse and prepare category conditions
-    char *categories[MAX_CATEGORIES]; // Max 50 categories, just to be sure
-    int category_count = 0;
-    char category_buffer[CATEGORY_BUFFER_SIZE];
+    // Optional fields
+    json_t *price_json = json_object_get(workflow_json, "price");
+    json_t *purchase_url_json = json_object_get(workflow_json, "purchaseUrl");
+
+    // Handle user creation or lookup
+    int user_id = get_or_create_user(db, user_json);
+    if (user_id == 0) {
+        job->status = 400;
+        snprintf(job->error, sizeof(job->error), "Invalid or incomplete user object provided. 'username' is required.");
+        return -1;
+    }
+
+    // Convert JSON objects to strings for storage
+    char* workflow_data_str = json_dumps(nested_workflow, JSON_COMPACT);
+    char* workflow_info_str = workflow_info_json ? json_dumps(workflow_info_json, JSON_COMPACT) : NULL;
+    char* nodes_data_str = nodes_json ? json_dumps(nodes_json, JSON_COMPACT) : NULL;
+    char* image_data_str = image_json ? json_dumps(image_json, JSON_COMPACT) : NULL;
     
-    if (category_str && strlen(category_str) > 0) {
-        // Create a copy of category_str for tokenization
-        strncpy(category_buffer, category_str, sizeof(category_buffer) - 1);
-        category_buffer[sizeof(category_buffer) - 1] = '\0';
-        
-        // Split by comma
-        char *token = strtok(category_buffer, ",");
-        while (token != NULL && category_count < MAX_CATEGORIES) {
-            // Trim whitespace
-            while (*token == ' ') token++;
-            char *end = token + strlen(token) - 1;
-            while (end > token && *end == ' ') end--;
-            *(end + 1) = '\0';
-            
-            categories[category_count++] = token;
-            token = strtok(NULL, ",");
+    // Get lastUpdatedBy value
+    int last_updated_by = user_id;
+
+    int template_id = json_integer_value(json_object_get(workflow_json, "id"));
+    if (template_id <= 0) {
+        template_id = 0; // Let SQLite auto-increment if ID is not provided
+    }
+
+    int has_price = price_json && !json_is_null(price_json);
+    double price = has_price ? json_number_value(price_json) : 0.0;
+    const char *purchase_url = purchase_url_json && !json_is_null(purchase_url_json) ? json_string_value(purchase_url_json) : NULL;
+
+    // data_hash covers the large JSON columns, content_hash everything the row is written from
+    uint64_t data_hash = 0xcbf29ce484222325ULL;
+    data_hash = hash_text_field(data_hash, workflow_data_str);
+    data_hash = hash_text_field(data_hash, workflow_info_str);
+    data_hash = hash_text_field(data_hash, nodes_data_str);
+    data_hash = hash_text_field(data_hash, image_data_str);
+    uint64_t content_hash = hash_field(data_hash, NULL, 0);
+    content_hash = hash_text_field(content_hash, name);
+    content_hash = hash_text_field(content_hash, description);
+    content_hash = hash_text_field(content_hash, created_at);
+    content_hash = hash_field(content_hash, has_price ? &price : NULL, sizeof(price));
+    content_hash = hash_text_field(content_hash, purchase_url);
+    content_hash = hash_field(content_hash, &user_id, sizeof(user_id));
+    content_hash = hash_field(content_hash, &last_updated_by, sizeof(last_updated_by));
+
+    // What is stored now, if anything
+    int exists = 0, same_text = 0;
+    sqlite3_int64 stored_content_hash = 0, stored_data_hash = 0;
+    if (template_id > 0) {
+        sqlite3_stmt *stored_stmt = prepare_cached_statement(db, "SELECT content_hash, data_hash, name IS ? AND description IS ? FROM templates WHERE id = ?;");
+        if (stored_stmt) {
+            sqlite3_bind_text(stored_stmt, 1, name, -1, SQLITE_STATIC);
+            sqlite3_bind_text(stored_stmt, 2, description, -1, SQLITE_STATIC);
+            sqlite3_bind_int(stored_stmt, 3, template_id);
+            if (sqlite3_step(stored_stmt) == SQLITE_ROW) {
+                exists = 1;
+                stored_content_hash = sqlite3_column_type(stored_stmt, 0) == SQLITE_NULL ? 0 : sqlite3_column_int64(stored_stmt, 0);
+                stored_data_hash = sqlite3_column_type(stored_stmt, 1) == SQLITE_NULL ? 0 : sqlite3_column_int64(stored_stmt, 1);
+                same_text = sqlite3_column_int(stored_stmt, 2);
+            }
+            release_cached_statement(db, stored_stmt);
         }
-        
-        if (category_count > 0) {
-            // Add joins for category filtering
-            strcat(join_clause, " JOIN template_categories tc ON t.id = tc.template_id");
-            strcat(join_clause, " JOIN categories c ON tc.category_id = c.id");
-            
-            if (where_conditions == 0) {
-                strcat(where_clause, " WHERE ");
+    }
+
+    int result = 0;
+    int row_written = 0;
+    if (exists && stored_content_hash == (sqlite3_int64)content_hash) {
+        // Identical row, nothing to write
+    } else {
+        // Existing rows are updated in place (never deleted and re-inserted, which would cascade to their links),
+        // the JSON columns are left alone when only the small fields changed. View counts are only taken from
+        // the payload for new rows, after that they are the server's own and neither written nor hashed.
+        const char *sql = exists && stored_data_hash == (sqlite3_int64)data_hash
+            ? "UPDATE templates SET name = ?2, description = ?3, created_at = ?4, price = ?7, "
+              "purchase_url = ?8, user_id = ?9, last_updated_by = ?10, content_hash = ?15, data_hash = ?16 WHERE id = ?1;"
+            : "INSERT INTO templates (id, name, description, created_at, total_views, recent_views, price, purchase_url, user_id, last_updated_by, "
+              "workflow_data, workflow_info, nodes_data, image_data, content_hash, data_hash) "
+              "VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10, store_json(?11), store_json(?12), store_json(?13), store_json(?14), ?15, ?16) "
+              "ON CONFLICT(id) DO UPDATE SET name = excluded.name, description = excluded.description, created_at = excluded.created_at, "
+              "price = excluded.price, purchase_url = excluded.purchase_url, "
+              "user_id = excluded.user_id, last_updated_by = excluded.last_updated_by, workflow_data = excluded.workflow_data, "
+              "workflow_info = excluded.workflow_info, nodes_data = excluded.nodes_data, image_data = excluded.image_data, "
+              "content_hash = excluded.content_hash, data_hash = excluded.data_hash;";
+        sqlite3_stmt *stmt = prepare_cached_statement(db, sql);
+        if (!stmt) {
+            job->status = 500;
+            snprintf(job->error, sizeof(job->error), "Database error on prepare");
+            result = -1;
+        } else {
+            if (template_id > 0) {
+                sqlite3_bind_int(stmt, 1, template_id);
             } else {
-                strcat(where_clause, " AND ");
+                sqlite3_bind_null(stmt, 1);
             }
-            
-            strcat(where_clause, "(");
-            for (int i = 0; i < category_count; i++) {
-                if (i > 0) {
-                    strcat(where_clause, " OR ");
+            sqlite3_bind_text(stmt, 2, name, -1, SQLITE_STATIC);
+            sqlite3_bind_text(stmt, 3, description, -1, SQLITE_STATIC);
+            sqlite3_bind_text(stmt, 4, created_at, -1, SQLITE_STATIC);
+            sqlite3_bind_int(stmt, 5, total_views);
+            sqlite3_bind_int(stmt, 6, recent_views);
+            if (has_price) {
+                sqlite3_bind_double(stmt, 7, price);
+            } else {
+                sqlite3_bind_null(stmt, 7);
+            }
+            if (purchase_url) {
+                sqlite3_bind_text(stmt, 8, purchase_url, -1, SQLITE_STATIC);
+            } else {
+                sqlite3_bind_null(stmt, 8);
+            }
+            sqlite3_bind_int(stmt, 9, user_id);
+            sqlite3_bind_int(stmt, 10, last_updated_by);
+            sqlite3_bind_text(stmt, 11, workflow_data_str, -1, SQLITE_STATIC);
+            sqlite3_bind_text(stmt, 12, workflow_info_str, -1, SQLITE_STATIC);
+            sqlite3_bind_text(stmt, 13, nodes_data_str, -1, SQLITE_STATIC);
+            sqlite3_bind_text(stmt, 14, image_data_str, -1, SQLITE_STATIC);
+            sqlite3_bind_int64(stmt, 15, (sqlite3_int64)content_hash);
+            sqlite3_bind_int64(stmt, 16, (sqlite3_int64)data_hash);
+
+            if (sqlite3_step(stmt) == SQLITE_DONE) {
+                if (template_id == 0) {
+                    template_id = sqlite3_last_insert_rowid(db);
                 }
-                strcat(where_clause, "c.name = ?");
+                row_written = 1;
+            } else {
+                const char *db_error_msg = sqlite3_errmsg(db);
+                fprintf(stderr, "Failed to create workflow: %s\n", db_error_msg);
+                job->status = 500;
+                snprintf(job->error, sizeof(job->error), "%s", db_error_msg);
+                result = -1;
             }
-            strcat(where_clause, ")");
-            where_conditions++;
+            release_cached_statement(db, stmt);
         }
     }
-    
-    // Add search condition
-    if (search_query_str && strlen(search_query_str) > 0) {
-        if (where_conditions == 0) {
-            strcat(where_clause, " WHERE ");
-        } else {
-            strcat(where_clause, " AND ");
+
+    if (result == 0 && row_written && !(exists && same_text)) {
+        if (index_template_for_search(db, template_id, name, description) != 0) {
+            fprintf(stderr, "Failed to index workflow %d for search: %s\n", template_id, sqlite3_errmsg(db));
         }
-        strcat(where_clause, "(t.name LIKE ? OR t.description LIKE ?)");
-        where_conditions++;
     }
 
-    char full_count_sql[MEDIUM_SQL_BUFFER_SIZE];
-    snprintf(full_count_sql, sizeof(full_count_sql), "%s%s%s;", count_sql_base, join_clause, where_clause);
-    
-    char full_main_sql[MAX_SQL_BUFFER_SIZE];
-    snprintf(full_main_sql, sizeof(full_main_sql), "%s%s%s ORDER BY t.id DESC LIMIT ? OFFSET ?;", main_sql_base, join_clause, where_clause);
-    
-    // Get total count
-    if (sqlite3_prepare_v2(db, full_count_sql, -1, &count_stmt, 0) == SQLITE_OK) {
-        int param_index = 1;
-        
-        // Bind category parameters first (if any)
-        for (int i = 0; i < category_count; i++) {
-            sqlite3_bind_text(count_stmt, param_index++, categories[i], -1, SQLITE_STATIC);
+    // The categories of the request replace the stored ones
+    int link_changes = 0;
+    if (result == 0) {
+        int category_ids[MAX_CATEGORIES];
+        int category_count = 0;
+        if (json_is_array(categories_json)) {
+            size_t index;
+            json_t *category_json_obj;
+            json_array_foreach(categories_json, index, category_json_obj) {
+                int category_id = get_or_create_category(db, category_json_obj);
+                if (category_id > 0 && category_count < MAX_CATEGORIES) {
+                    category_ids[category_count++] = category_id;
+                }
+            }
         }
-        
-        // Bind search parameters
-        if (search_query_str && strlen(search_query_str) > 0) {
-            char search_pattern[SEARCH_PATTERN_BUFFER_SIZE];
-            snprintf(search_pattern, sizeof(search_pattern), "%%%s%%", search_query_str);
-            sqlite3_bind_text(count_stmt, param_index++, search_pattern, -1, SQLITE_STATIC);
-            sqlite3_bind_text(count_stmt, param_index++, search_pattern, -1, SQLITE_STATIC);
+        qsort(category_ids, category_count, sizeof(int), compare_ints);
+        int distinct = 0;
+        for (int i = 0; i < category_count; i++) {
+            if (distinct == 0 || category_ids[distinct - 1] != category_ids[i]) {
+                category_ids[distinct++] = category_ids[i];
+            }
         }
-        
-        if (sqlite3_step(count_stmt) == SQLITE_ROW) {
-            total_workflows = sqlite3_column_int(count_stmt, 0);
+
+        link_changes = sync_template_categories(db, template_id, category_ids, distinct);
+        if (link_changes < 0) {
+            fprintf(stderr, "Failed to link categories of workflow %d: %s\n", template_id, sqlite3_errmsg(db));
+            job->status = 500;
+            snprintf(job->error, sizeof(job->error), "%s", sqlite3_errmsg(db));
+            result = -1;
         }
-        sqlite3_finalize(count_stmt);
-    } else {
-        return_db_connection(db);
-        ulfius_set_string_body_response(response, 500, "Database error on count query");
-        return U_CALLBACK_CONTINUE;
     }
 
-    // Get paginated results
-    if (sqlite3_prepare_v2(db, full_main_sql, -1, &main_stmt, 0) != SQLITE_OK) {
-        return_db_connection(db);
-        ulfius_set_string_body_response(response, 500, "Database error on main query");
-        return U_CALLBACK_CONTINUE;
-    }
-    
-    int param_index = 1;
-    
-    // Bind category parameters first (if any)
-    for (int i = 0; i < category_count; i++) {
-        sqlite3_bind_text(main_stmt, param_index++, categories[i], -1, SQLITE_STATIC);
-    }
-    
-    // Bind search parameters
-    if (search_query_str && strlen(search_query_str) > 0) {
-        char search_pattern[SEARCH_PATTERN_BUFFER_SIZE];
-        snprintf(search_pattern, sizeof(search_pattern), "%%%s%%", search_query_str);
-        sqlite3_bind_text(main_stmt, param_index++, search_pattern, -1, SQLITE_STATIC);
-        sqlite3_bind_text(main_stmt, param_index++, search_pattern, -1, SQLITE_STATIC);
+    if (result == 0) {
+        job->template_id = template_id;
+        job->unchanged = !row_written && link_changes == 0;
+        job->status = job->unchanged ? 200 : 201;
+        atomic_fetch_add(job->unchanged ? &template_write_stats.unchanged : exists ? &template_write_stats.updated : &template_write_stats.inserted, 1);
     }
+
+    if (workflow_data_str) free(workflow_data_str);
+    if (workflow_info_str) free(workflow_info_str);
+    if (nodes_data_str) free(nodes_data_str);
+    if (image_data_str) free(image_data_str);
     
-    // Bind pagination parameters
-    sqlite3_bind_int(main_stmt, param_index++, limit);
-    sqlite3_bind_int(main_stmt, param_index++, offset);
+    return result;
+}
+
+// PUT /templates/workflows
+int callback_create_workflow(const struct _u_request *request, struct _u_response *response, void *user_data) {
+    UNUSED(user_data);
 
-    json_t *response_json = json_object();
-    json_object_set_new(response_json, "totalWorkflows", json_integer(total_workflows));
-    json_t *workflows_array = json_array();
+    json_t *json_body = ulfius_get_json_body_request(request, NULL);
+    if (json_body == NULL) {
+        ulfius_set_string_body_response(response, 400, "Invalid JSON");
+        return U_CALLBACK_CONTINUE;
+    }
 
-    while (sqlite3_step(main_stmt) == SQLITE_ROW) {
-        json_t *workflow_obj = json_object();
-        json_error_t error;
+    create_workflow_job_t job;
+    const char *invalid = prepare_workflow_job(json_body, &job);
+    if (invalid) {
+        json_decref(json_body);
+        ulfius_set_string_body_response(response, 400, invalid);
+        return U_CALLBACK_CONTINUE;
+    }
 
-        // Workflow fields
-        json_object_set_new(workflow_obj, "id", json_integer(sqlite3_column_int(main_stmt, 0)));
-        json_object_set_new(workflow_obj, "name", json_string((const char*)sqlite3_column_text(main_stmt, 1)));
-        json_object_set_new(workflow_obj, "totalViews", json_integer(sqlite3_column_int(main_stmt, 2)));
-        
-        // Handle nullable purchaseUrl
-        if (sqlite3_column_type(main_stmt, 3) != SQLITE_NULL) {
-            json_object_set_new(workflow_obj, "purchaseUrl", json_string((const char*)sqlite3_column_text(main_stmt, 3)));
-        } else {
-            json_object_set_new(workflow_obj, "purchaseUrl", json_null());
+    if (submit_write_job(&job_create_workflow, &job) == 0) {
+        json_t *response_json = json_object();
+        json_object_set_new(response_json, "id", json_integer(job.template_id));
+        // json_object_set_new(response_json, "message", "Workflow created/updated successfully");
+        // A re-PUT of what is already stored writes nothing
+        if (job.unchanged) {
+            json_object_set_new(response_json, "unchanged", json_true());
         }
+        ulfius_set_json_body_response(response, job.status, response_json);
+        json_decref(response_json);
+    } else {
+        ulfius_set_string_body_response(response, job.status >= 400 ? job.status : 500, job.error[0] ? job.error : "Database write failed");
+    }
 
-        // User object
-        json_t *user_obj = json_object();
-        json_object_set_new(user_obj, "id", json_integer(sqlite3_column_int(main_stmt, 4)));
-        json_object_set_new(user_obj, "name", json_string((const char*)sqlite3_column_text(main_stmt, 5)));
-        json_object_set_new(user_obj, "username", json_string((const char*)sqlite3_column_text(main_stmt, 6)));
-        json_object_set_new(user_obj, "bio", json_string((const char*)sqlite3_column_text(main_stmt, 7)));
-        json_object_set_new(user_obj, "verified", json_boolean(sqlite3_column_int(main_stmt, 8)));
-        
-        const char *links_str = (const char*)sqlite3_column_text(main_stmt, 9);
-        json_t *links_json = json_loads(links_str ? links_str : "[]", 0, &error);
-        json_object_set_new(user_obj, "links", links_json ? links_json : json_array());
-
-        json_object_set_new(user_obj, "avatar", json_string((const char*)sqlite3_column_text(main_stmt, 10)));
-        json_object_set_new(workflow_obj, "user", user_obj);
+    json_decref(json_body);
+    return U_CALLBACK_CONTINUE;
+}
 
-        // Other workflow fields
-        json_object_set_new(workflow_obj, "description", json_string((const char*)sqlite3_column_text(main_stmt, 11)));
-        json_object_set_new(workflow_obj, "createdAt", json_string((const char*)sqlite3_column_text(main_stmt, 12)));
+// Write job for DELETE /templates/workflows/:id
+typedef struct {
+    int template_id;
+    int status;
+    const char *message;
+} delete_workflow_job_t;
+
+// Delete a template, runs on the writer thread. Its category and collection links and its rendered
+// bodies go with it through the foreign keys; the search entry is removed here and the id is queued
+// so the drain drops it from the catalog snapshot.
+int job_delete_workflow(sqlite3 *db, void *arg) {
+    delete_workflow_job_t *job = (delete_workflow_job_t *)arg;
+
+    sqlite3_stmt *stmt = prepare_cached_statement(db, "DELETE FROM templates WHERE id = ?;");
+    if (!stmt) {
+        job->status = 500;
+        job->message = "Database error on prepare";
+        return -1;
+    }
+    sqlite3_bind_int(stmt, 1, job->template_id);
+    int rc = sqlite3_step(stmt);
+    release_cached_statement(db, stmt);
+    if (rc != SQLITE_DONE) {
+        fprintf(stderr, "callback_delete_workflow ERROR: Failed to delete workflow %d: %s\n", job->template_id, sqlite3_errmsg(db));
+        job->status = 500;
+        job->message = "Failed to delete workflow";
+        return -1;
+    }
+    if (sqlite3_changes(db) == 0) {
+        job->status = 404;
+        job->message = "Workflow not found";
+        return -1;
+    }
 
-        // Nodes
-        const char *nodes_data_str = (const char*)sqlite3_column_text(main_stmt, 13);
-        json_t *nodes_json = json_loads(nodes_data_str ? nodes_data_str : "[]", 0, &error);
-        json_object_set_new(workflow_obj, "nodes", nodes_json ? nodes_json : json_array());
-        
-        // Handle nullable price
-        if (sqlite3_column_type(main_stmt, 14) != SQLITE_NULL) {
-            json_object_set_new(workflow_obj, "price", json_real(sqlite3_column_double(main_stmt, 14)));
-        } else {
-             // Official API uses 0 for null price in lists
-            json_object_set_new(workflow_obj, "price", json_integer(0));
+    if (atomic_load(&search_index_available)) {
+        stmt = prepare_cached_statement(db, "DELETE FROM templates_fts WHERE rowid = ?;");
+        rc = SQLITE_ERROR;
+        if (stmt) {
+            sqlite3_bind_int(stmt, 1, job->template_id);
+            rc = sqlite3_step(stmt);
+            release_cached_statement(db, stmt);
+        }
+        if (rc != SQLITE_DONE) {
+            job->status = 500;
+            job->message = "Failed to update search index";
+            return -1;
         }
-
-        json_array_append_new(workflows_array, workflow_obj);
     }
 
-    sqlite3_finalize(main_stmt);
-    return_db_connection(db);
-
-    json_object_set_new(response_json, "workflows", workflows_array);
-    ulfius_set_json_body_response(response, 200, response_json);
-    json_decref(response_json);
+    stmt = prepare_cached_statement(db, "INSERT OR IGNORE INTO render_queue VALUES (?);");
+    rc = SQLITE_ERROR;
+    if (stmt) {
+        sqlite3_bind_int(stmt, 1, job->template_id);
+        rc = sqlite3_step(stmt);
+        release_cached_statement(db, stmt);
+    }
+    if (rc != SQLITE_DONE) {
+        job->status = 500;
+        job->message = "Failed to delete workflow";
+        return -1;
+    }
 
-    return U_CALLBACK_CONTINUE;
+    job->status = 200;
+    return 0;
 }
 
-// GET /templates/workflows
-int callback_get_all_workflows(const struct _u_request *request, struct _u_response *response, void *user_data) {
-    UNUSED(request);
+// DELETE /templates/workflows/:id
+int callback_delete_workflow(const struct _u_request *request, struct _u_response *response, void *user_data) {
     UNUSED(user_data);
 
-    sqlite3 *db = get_db_connection();
-    if (!db) {
-        ulfius_set_string_body_response(response, 500, "Database connection failed");
+    const char *id_str = u_map_get(request->map_url, "id");
+    if (id_str == NULL) {
+        ulfius_set_string_body_response(response, 400, "Missing workflow ID");
         return U_CALLBACK_CONTINUE;
     }
 
-    const char *sql = "SELECT id, name, total_views FROM templates;";
-    sqlite3_stmt *stmt;
+    delete_workflow_job_t job = {0};
+    job.template_id = atoi(id_str);
 
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, 0) != SQLITE_OK) {
-        return_db_connection(db);
-        ulfius_set_string_body_response(response, 500, "Database error");
-        return U_CALLBACK_CONTINUE;
+    if (submit_write_job(&job_delete_workflow, &job) == 0) {
+        json_t *response_json = json_object();
+        json_object_set_new(response_json, "message", json_string("Workflow deleted successfully"));
+        json_object_set_new(response_json, "id", json_integer(job.template_id));
+        ulfius_set_json_body_response(response, 200, response_json);
+        json_decref(response_json);
+    } else {
+        ulfius_set_string_body_response(response, job.status >= 400 ? job.status : 500, job.message ? job.message : "Failed to delete workflow");
     }
 
-    json_t *workflows_array = json_array();
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
-        json_t *workflow_obj = json_object();
-        json_object_set_new(workflow_obj, "id", json_integer(sqlite3_column_int(stmt, 0)));
-        json_object_set_new(workflow_obj, "name", json_string((const char*)sqlite3_column_text(stmt, 1)));
-        json_object_set_new(workflow_obj, "totalViews", json_integer(sqlite3_column_int(stmt, 2)));
-        json_array_append_new(workflows_array, workflow_obj);
+    return U_CALLBACK_CONTINUE;
+}
+
+// Write job for PUT /templates/collections
+typedef struct {
+    const char *name;
+    const char *created_at;
+    json_t *rank_json;
+    json_t *total_views_json;
+    json_t *workflows_json;
+    int collection_id;                   // from the body when it has one, the written row's afterwards
+    int status;                          // 201 created, 200 updated
+} create_collection_job_t;
+
+// Check a PUT /templates/collections body and fill the job from it.
+// Returns NULL when it can be written, otherwise why not (a 400).
+const char* prepare_collection_job(json_t *body, create_collection_job_t *job) {
+    const char *name = json_string_value(json_object_get(body, "name"));
+    if (!name || strlen(name) == 0) {
+        return "Missing required field: name";
     }
-    sqlite3_finalize(stmt);
-    return_db_connection(db);
 
-    ulfius_set_json_body_response(response, 200, workflows_array);
-    json_decref(workflows_array);
+    const char *created_at = json_string_value(json_object_get(body, "createdAt"));
+    if (!created_at) {
+        return "Missing required field: createdAt";
+    }
 
-    return U_CALLBACK_CONTINUE;
+    memset(job, 0, sizeof(*job));
+    job->name = name;
+    job->created_at = created_at;
+    job->rank_json = json_object_get(body, "rank");
+    job->total_views_json = json_object_get(body, "totalViews");
+    job->workflows_json = json_object_get(body, "workflows");
+    json_int_t collection_id = json_integer_value(json_object_get(body, "id"));
+    job->collection_id = collection_id > 0 && collection_id <= INT_MAX ? (int)collection_id : 0;
+    return NULL;
 }
 
-// GET /templates/workflows/<id>
-int callback_get_workflow_by_id(const struct _u_request *request, struct _u_response *response, void *user_data) {
-    UNUSED(user_data);
+// Insert or update a collection and link its workflows, runs on the writer thread. A collection
+// with an id is updated in place like a template, so exports and get-mocks files load back under
+// the same ids; its workflow links become the ones given. View counts are only taken from the
+// payload for new rows.
+int job_create_collection(sqlite3 *db, void *arg) {
+    create_collection_job_t *job = (create_collection_job_t *)arg;
+
+    int exists = 0;
+    if (job->collection_id > 0) {
+        sqlite3_stmt *check_stmt = prepare_cached_statement(db, "SELECT 1 FROM collections WHERE id = ?;");
+        if (!check_stmt) {
+            return -1;
+        }
+        sqlite3_bind_int(check_stmt, 1, job->collection_id);
+        exists = sqlite3_step(check_stmt) == SQLITE_ROW;
+        release_cached_statement(db, check_stmt);
+    }
 
-    sqlite3 *db = get_db_connection();
-    if (!db) {
-        ulfius_set_string_body_response(response, 500, "Database connection failed");
-        return U_CALLBACK_CONTINUE;
+    const char *sql = "INSERT INTO collections (id, rank, name, total_views, created_at) VALUES (?, ?, ?, ?, ?) "
+                      "ON CONFLICT(id) DO UPDATE SET rank = excluded.rank, name = excluded.name, created_at = excluded.created_at;";
+    sqlite3_stmt *stmt = prepare_cached_statement(db, sql);
+    if (!stmt) {
+        return -1;
+    }
+    
+    // Bind parameters
+    if (job->collection_id > 0) {
+        sqlite3_bind_int(stmt, 1, job->collection_id);
+    } else {
+        sqlite3_bind_null(stmt, 1);
     }
 
-    const char *id_str = u_map_get(request->map_url, "id");
-    if (id_str == NULL) {
-        return_db_connection(db);
-        ulfius_set_string_body_response(response, 400, "Missing workflow ID");
-        return U_CALLBACK_CONTINUE;
+    if (job->rank_json && json_is_integer(job->rank_json)) {
+        sqlite3_bind_int(stmt, 2, json_integer_value(job->rank_json));
+    } else {
+        sqlite3_bind_int(stmt, 2, 0);
     }
     
-    int template_id = atoi(id_str);
-    const char *sql = "SELECT t.id, t.name, t.total_views, t.price, t.purchase_url, t.recent_views, "
-                     "t.created_at, t.description, t.workflow_data, t.workflow_info, t.nodes_data, t.image_data, "
-                     "t.last_updated_by, "
-                     "u.id, u.name, u.username, u.bio, u.verified, u.links, u.avatar "
-                     "FROM templates t "
-                     "JOIN users u ON t.user_id = u.id "
-                     "WHERE t.id = ?;";
-    sqlite3_stmt *stmt;
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
-    if (rc != SQLITE_OK) {
-        return_db_connection(db);
-        ulfius_set_string_body_response(response, 500, "Database error preparing statement");
-        return U_CALLBACK_CONTINUE;
+    sqlite3_bind_text(stmt, 3, job->name, -1, SQLITE_STATIC);
+    
+    if (job->total_views_json && json_is_integer(job->total_views_json)) {
+        sqlite3_bind_int(stmt, 4, json_integer_value(job->total_views_json));
+    } else {
+        sqlite3_bind_null(stmt, 4);
     }
     
-    sqlite3_bind_int(stmt, 1, template_id);
+    sqlite3_bind_text(stmt, 5, job->created_at, -1, SQLITE_STATIC);
     
-    rc = sqlite3_step(stmt);
-    json_t *root_obj = NULL;
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+        release_cached_statement(db, stmt);
+        return -1;
+    }
 
-    if (rc == SQLITE_ROW) {
-        root_obj = json_object();
-        json_error_t error;
-        
-        // Build the nested "workflow" object exactly like the API
-        json_t *workflow_obj = json_object();
-        int views = sqlite3_column_int(stmt, 2);
-        
-        json_object_set_new(workflow_obj, "id", json_integer(sqlite3_column_int(stmt, 0)));
-        json_object_set_new(workflow_obj, "name", json_string((const char*)sqlite3_column_text(stmt, 1)));
-        json_object_set_new(workflow_obj, "views", json_integer(views));
-        json_object_set_new(workflow_obj, "recentViews", json_integer(sqlite3_column_int(stmt, 5)));
-        json_object_set_new(workflow_obj, "totalViews", json_integer(views));
-        json_object_set_new(workflow_obj, "createdAt", json_string((const char*)sqlite3_column_text(stmt, 6)));
-        json_object_set_new(workflow_obj, "description", json_string((const char*)sqlite3_column_text(stmt, 7)));
-        
-        // Handle price and purchaseUrl
-        if (sqlite3_column_type(stmt, 3) == SQLITE_NULL) {
-            json_object_set_new(workflow_obj, "price", json_null());
-        } else {
-            json_object_set_new(workflow_obj, "price", json_real(sqlite3_column_double(stmt, 3)));
-        }
-        
-        if (sqlite3_column_type(stmt, 4) == SQLITE_NULL) {
-            json_object_set_new(workflow_obj, "purchaseUrl", json_null());
-        } else {
-            json_object_set_new(workflow_obj, "purchaseUrl", json_string((const char*)sqlite3_column_text(stmt, 4)));
+    int collection_id = exists ? job->collection_id : (int)sqlite3_last_insert_rowid(db);
+    release_cached_statement(db, stmt);
+    
+    // Replace the links of an existing collection when the body lists its workflows
+    if (exists && json_is_array(job->workflows_json)) {
+        sqlite3_stmt *unlink_stmt = prepare_cached_statement(db, "DELETE FROM collection_workflows WHERE collection_id = ?;");
+        if (!unlink_stmt) {
+            return -1;
         }
-
-        // Add the nested workflow data
-        const char *workflow_data_str = (const char*)sqlite3_column_text(stmt, 8);
-        if (workflow_data_str) {
-            json_t *nested_workflow_json = json_loads(workflow_data_str, 0, &error);
-            if (nested_workflow_json) {
-                json_object_set_new(workflow_obj, "workflow", nested_workflow_json);
-            } else {
-                json_object_set_new(workflow_obj, "workflow", json_object());
-            }
-        } else {
-            json_object_set_new(workflow_obj, "workflow", json_object());
+        sqlite3_bind_int(unlink_stmt, 1, collection_id);
+        int rc = sqlite3_step(unlink_stmt);
+        release_cached_statement(db, unlink_stmt);
+        if (rc != SQLITE_DONE) {
+            return -1;
         }
+    }
 
-        json_object_set_new(root_obj, "workflow", workflow_obj);
-        
-        // Add lastUpdatedBy
-        if (sqlite3_column_type(stmt, 12) != SQLITE_NULL) {
-            json_object_set_new(root_obj, "lastUpdatedBy", json_integer(sqlite3_column_int(stmt, 12)));
-        } else {
-            json_object_set_new(root_obj, "lastUpdatedBy", json_integer(sqlite3_column_int(stmt, 13))); // Use user_id as fallback
-        }
-        
-        // Build the "user" object
-        json_t *user_obj = json_object();
-        json_object_set_new(user_obj, "name", json_string((const char*)sqlite3_column_text(stmt, 14)));
-        json_object_set_new(user_obj, "username", json_string((const char*)sqlite3_column_text(stmt, 15)));
-        json_object_set_new(user_obj, "bio", json_string((const char*)sqlite3_column_text(stmt, 16)));
-        json_object_set_new(user_obj, "verified", json_boolean(sqlite3_column_int(stmt, 17)));
-        json_object_set_new(user_obj, "avatar", json_string((const char*)sqlite3_column_text(stmt, 19)));
-        
-        // Parse links JSON
-        const char *links_str = (const char*)sqlite3_column_text(stmt, 18);
-        if (links_str) {
-            json_t *links_json = json_loads(links_str, 0, &error);
-            if (links_json) {
-                json_object_set_new(user_obj, "links", links_json);
-            } else {
-                json_object_set_new(user_obj, "links", json_array());
-            }
-        } else {
-            json_object_set_new(user_obj, "links", json_array());
-        }
-        json_object_set_new(root_obj, "user", user_obj);
-        
-        // Get categories
-        json_object_set_new(root_obj, "categories", get_template_categories(db, template_id));
-        
-        // Add workflowInfo from stored JSON
-        const char *workflow_info_str = (const char*)sqlite3_column_text(stmt, 9);
-        if (workflow_info_str) {
-            json_t *workflow_info_json = json_loads(workflow_info_str, 0, &error);
-            if (workflow_info_json) {
-                json_object_set_new(root_obj, "workflowInfo", workflow_info_json);
-            } else {
-                json_object_set_new(root_obj, "workflowInfo", json_object());
-            }
-        } else {
-            json_object_set_new(root_obj, "workflowInfo", json_object());
-        }
-        
-        // Add nodes from stored JSON
-        const char *nodes_data_str = (const char*)sqlite3_column_text(stmt, 10);
-        if (nodes_data_str) {
-            json_t *nodes_json = json_loads(nodes_data_str, 0, &error);
-            if (nodes_json && json_is_array(nodes_json)) {
-                json_object_set_new(root_obj, "nodes", nodes_json);
-            } else {
-                json_object_set_new(root_obj, "nodes", json_array());
-            }
-        } else {
-            json_object_set_new(root_obj, "nodes", json_array());
-        }
-        
-        // Add image array from stored JSON
-        const char *image_data_str = (const char*)sqlite3_column_text(stmt, 11);
-        if (image_data_str) {
-            json_t *image_json = json_loads(image_data_str, 0, &error);
-            if (image_json && json_is_array(image_json)) {
-                json_object_set_new(root_obj, "image", image_json);
-            } else {
-                json_object_set_new(root_obj, "image", json_array());
+    // Add workflows if provided
+    if (json_is_array(job->workflows_json)) {
+        size_t index;
+        json_t *workflow;
+        json_array_foreach(job->workflows_json, index, workflow) {
+            int workflow_id = json_integer_value(json_object_get(workflow, "id"));
+            if (workflow_id > 0) {
+                const char *link_sql = "INSERT OR IGNORE INTO collection_workflows (collection_id, template_id) VALUES (?, ?);";
+                sqlite3_stmt *link_stmt = prepare_cached_statement(db, link_sql);
+                if (link_stmt) {
+                    sqlite3_bind_int(link_stmt, 1, collection_id);
+                    sqlite3_bind_int(link_stmt, 2, workflow_id);
+                    sqlite3_step(link_stmt);
+                    release_cached_statement(db, link_stmt);
+                }
             }
-        } else {
-            json_object_set_new(root_obj, "image", json_array());
         }
-        
-        ulfius_set_json_body_response(response, 200, root_obj);
-        json_decref(root_obj);
-    } else if (rc == SQLITE_DONE) {
-        ulfius_set_string_body_response(response, 404, "Workflow not found");
-    } else {
-        fprintf(stderr, "Error executing step: %s\n", sqlite3_errmsg(db));
-        ulfius_set_string_body_response(response, 500, "Database error executing step");
     }
-    
-    sqlite3_finalize(stmt);
-    return_db_connection(db);
-    return U_CALLBACK_CONTINUE;
+
+    job->collection_id = collection_id;
+    job->status = exists ? 200 : 201;
+    return 0;
 }
 
-// GET /workflows/templates/:id
-// Needed when importing a workflow from a template
-int callback_get_workflow_for_import(const struct _u_request *request, struct _u_response *response, void *user_data) {
+// PUT /templates/collections
+int callback_create_collection(const struct _u_request *request, struct _u_response *response, void *user_data) {
     UNUSED(user_data);
 
-    sqlite3 *db = get_db_connection();
-    if (!db) {
-        ulfius_set_string_body_response(response, 500, "Database connection failed");
+    json_t *json_body = ulfius_get_json_body_request(request, NULL);
+    if (json_body == NULL) {
+        ulfius_set_string_body_response(response, 400, "Invalid JSON");
         return U_CALLBACK_CONTINUE;
     }
 
-    const char *id_str = u_map_get(request->map_url, "id");
-    if (id_str == NULL) {
-        return_db_connection(db);
-        ulfius_set_string_body_response(response, 400, "Missing workflow ID");
+    create_collection_job_t job;
+    const char *invalid = prepare_collection_job(json_body, &job);
+    if (invalid) {
+        json_decref(json_body);
+        ulfius_set_string_body_response(response, 400, invalid);
         return U_CALLBACK_CONTINUE;
     }
+    const char *name = job.name;
+    const char *created_at = job.created_at;
+    json_t *rank_json = job.rank_json;
+    json_t *total_views_json = job.total_views_json;
+    json_t *workflows_json = job.workflows_json;
 
-    int template_id = atoi(id_str);
-    const char *sql = "SELECT id, name, workflow_data FROM templates WHERE id = ?;";
-    sqlite3_stmt *stmt;
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
-    if (rc != SQLITE_OK) {
-        return_db_connection(db);
-        ulfius_set_string_body_response(response, 500, "Database error preparing statement");
-        return U_CALLBACK_CONTINUE;
+    if (submit_write_job(&job_create_collection, &job) == 0) {
+        // Return the created collection
+        json_t *response_json = json_object();
+        json_object_set_new(response_json, "id", json_integer(job.collection_id));
+        json_object_set_new(response_json, "name", json_string(name));
+        json_object_set_new(response_json, "rank", json_integer(rank_json ? json_integer_value(rank_json) : 0));
+        json_object_set_new(response_json, "totalViews", total_views_json ? json_integer(json_integer_value(total_views_json)) : json_null());
+        json_object_set_new(response_json, "createdAt", json_string(created_at));
+        json_object_set_new(response_json, "workflows", workflows_json ? json_incref(workflows_json) : json_array());
+        json_object_set_new(response_json, "nodes", json_array());
+        json_object_set_new(response_json, "message", json_string(job.status == 200 ? "Collection updated successfully" : "Collection created successfully"));
+        
+        ulfius_set_json_body_response(response, job.status, response_json);
+        json_decref(response_json);
+    } else {
+        ulfius_set_string_body_response(response, 500, "Failed to create collection");
     }
+    
+    json_decref(json_body);
+    return U_CALLBACK_CONTINUE;
+}
 
-    sqlite3_bind_int(stmt, 1, template_id);
-
-    rc = sqlite3_step(stmt);
-    json_t *root_obj = NULL;
+// Write job for PATCH /templates/collections
+typedef struct {
+    int collection_id;
+    int template_id;
+    int changes;
+    int status;
+    const char *message;
+} add_workflow_to_collection_job_t;
 
-    if (rc == SQLITE_ROW) {
-        root_obj = json_object();
-        json_error_t error;
+// Link an existing template to an existing collection, runs on the writer thread
+int job_add_workflow_to_collection(sqlite3 *db, void *arg) {
+    add_workflow_to_collection_job_t *job = (add_workflow_to_collection_job_t *)arg;
 
-        // Set top-level id and name
-        json_object_set_new(root_obj, "id", json_integer(sqlite3_column_int(stmt, 0)));
-        json_object_set_new(root_obj, "name", json_string((const char*)sqlite3_column_text(stmt, 1)));
+    // Verify collection exists
+    const char *check_collection_sql = "SELECT id FROM collections WHERE id = ?;";
+    sqlite3_stmt *check_stmt = prepare_cached_statement(db, check_collection_sql);
+    if (check_stmt) {
+        sqlite3_bind_int(check_stmt, 1, job->collection_id);
+        if (sqlite3_step(check_stmt) != SQLITE_ROW) {
+            release_cached_statement(db, check_stmt);
+            job->status = 404;
+            job->message = "Collection not found";
+            return -1;
+        }
+        release_cached_statement(db, check_stmt);
+    }
 
-        // Get the nested workflow data
-        const char *workflow_data_str = (const char*)sqlite3_column_text(stmt, 2);
-        if (workflow_data_str) {
-            json_t *nested_workflow_json = json_loads(workflow_data_str, 0, &error);
-            if (nested_workflow_json) {
-                json_object_set_new(root_obj, "workflow", nested_workflow_json);
-            } else {
-                // If parsing fails, add an empty object to avoid breaking the client
-                fprintf(stderr, "Failed to parse workflow_data for template %d: %s\n", template_id, error.text);
-                json_object_set_new(root_obj, "workflow", json_object());
-            }
-        } else {
-            // If data is NULL, add an empty object
-            json_object_set_new(root_obj, "workflow", json_object());
+    // Verify template exists
+    const char *check_template_sql = "SELECT id FROM templates WHERE id = ?;";
+    check_stmt = prepare_cached_statement(db, check_template_sql);
+    if (check_stmt) {
+        sqlite3_bind_int(check_stmt, 1, job->template_id);
+        if (sqlite3_step(check_stmt) != SQLITE_ROW) {
+            release_cached_statement(db, check_stmt);
+            job->status = 404;
+            job->message = "Template not found";
+            return -1;
         }
+        release_cached_statement(db, check_stmt);
+    }
 
-        ulfius_set_json_body_response(response, 200, root_obj);
-        json_decref(root_obj);
-    } else if (rc == SQLITE_DONE) {
-        ulfius_set_string_body_response(response, 404, "Workflow not found");
+    // Insert the relationship
+    const char *sql = "INSERT OR IGNORE INTO collection_workflows (collection_id, template_id) VALUES (?, ?);";
+    sqlite3_stmt *stmt = prepare_cached_statement(db, sql);
+    if (!stmt) {
+        job->status = 500;
+        job->message = "Database error on prepare";
+        return -1;
+    }
+    
+    sqlite3_bind_int(stmt, 1, job->collection_id);
+    sqlite3_bind_int(stmt, 2, job->template_id);
+    
+    int result = 0;
+    if (sqlite3_step(stmt) == SQLITE_DONE) {
+        job->changes = sqlite3_changes(db);
+        job->status = 200;
     } else {
-        fprintf(stderr, "Error executing step for import: %s\n", sqlite3_errmsg(db));
-        ulfius_set_string_body_response(response, 500, "Database error executing step");
+        fprintf(stderr, "callback_add_workflow_to_collection ERROR: Failed to add workflow to collection: %s\n", sqlite3_errmsg(db));
+        job->status = 500;
+        job->message = "Failed to add workflow to collection";
+        result = -1;
     }
+    release_cached_statement(db, stmt);
 
-    sqlite3_finalize(stmt);
-    return_db_connection(db);
-    return U_CALLBACK_CONTINUE;
+    return result;
 }
 
-// PUT /templates/workflows
-int callback_create_workflow(const struct _u_request *request, struct _u_response *response, void *user_data) {
+// PATCH /templates/collections
+int callback_add_workflow_to_collection(const struct _u_request *request, struct _u_response *response, void *user_data) {
     UNUSED(user_data);
 
-    sqlite3 *db = get_db_connection();
-    if (!db) {
-        ulfius_set_string_body_response(response, 500, "Database connection failed");
-        return U_CALLBACK_CONTINUE;
-    }
-
     json_t *json_body = ulfius_get_json_body_request(request, NULL);
     if (json_body == NULL) {
-        return_db_connection(db);
         ulfius_set_string_body_response(response, 400, "Invalid JSON");
         return U_CALLBACK_CONTINUE;
     }
 
-    json_t *workflow_json = json_object_get(json_body, "workflow");
-    json_t *user_json = json_object_get(workflow_json, "user");
-    json_t *categories_json = json_object_get(workflow_json, "categories");
-    json_t *workflow_info_json = json_object_get(workflow_json, "workflowInfo");
-    json_t *nodes_json = json_object_get(workflow_json, "nodes");
-    json_t *image_json = json_object_get(workflow_json, "image");
+    json_t *collection_id_json = json_object_get(json_body, "collectionId");
+    json_t *template_id_json = json_object_get(json_body, "templateId");
 
-    if (!json_is_object(workflow_json) || !json_is_object(user_json)) {
+    if (!json_is_integer(collection_id_json) || !json_is_integer(template_id_json)) {
         json_decref(json_body);
-        return_db_connection(db);
-        ulfius_set_string_body_response(response, 400, "Missing 'workflow' or 'user' object in request body");
+        ulfius_set_string_body_response(response, 400, "Missing required fields: collectionId and templateId must be integers");
         return U_CALLBACK_CONTINUE;
     }
 
-    // Extract workflow fields
-    const char *name = json_string_value(json_object_get(workflow_json, "name"));
-    const char *description = json_string_value(json_object_get(workflow_json, "description"));
-    const char *created_at = json_string_value(json_object_get(workflow_json, "createdAt"));
-    int total_views = json_integer_value(json_object_get(workflow_json, "totalViews"));
-    int recent_views = json_integer_value(json_object_get(workflow_json, "recentViews"));
-    json_t *nested_workflow = json_object_get(workflow_json, "workflow");
+    add_workflow_to_collection_job_t job = {0};
+    job.collection_id = json_integer_value(collection_id_json);
+    job.template_id = json_integer_value(template_id_json);
+    json_decref(json_body);
+
+    if (submit_write_job(&job_add_workflow_to_collection, &job) == 0) {
+        json_t *response_json = json_object();
+        if (job.changes > 0) {
+            json_object_set_new(response_json, "message", json_string("Workflow added to collection successfully"));
+        } else {
+            json_object_set_new(response_json, "message", json_string("Workflow already exists in collection"));
+        }
+        json_object_set_new(response_json, "collectionId", json_integer(job.collection_id));
+        json_object_set_new(response_json, "templateId", json_integer(job.template_id));
+        ulfius_set_json_body_response(response, 200, response_json);
+        json_decref(response_json);
+    } else {
+        ulfius_set_string_body_response(response, job.status >= 400 ? job.status : 500, job.message ? job.message : "Failed to add workflow to collection");
+    }
     
-    // Optional fields
-    json_t *price_json = json_object_get(workflow_json, "price");
-    json_t *purchase_url_json = json_object_get(workflow_json, "purchaseUrl");
+    return U_CALLBACK_CONTINUE;
+}
 
-    if (!name || !description || !created_at || !nested_workflow) {
-        json_decref(json_body);
-        return_db_connection(db);
-        ulfius_set_string_body_response(response, 400, "Missing required fields in workflow object");
+// What one NDJSON line of a bulk ingest asks for
+typedef enum {
+    INGEST_INVALID,
+    INGEST_WORKFLOW,
+    INGEST_COLLECTION
+} ingest_kind_t;
+
+// One NDJSON line and its outcome. The body holds the same object as the single-item endpoint:
+// {"workflow": {...}} like PUT /templates/workflows, or {"collection": {...}} with a PUT /templates/collections body.
+typedef struct {
+    json_t *body;
+    long line;
+    ingest_kind_t kind;
+    union {
+        create_workflow_job_t workflow;
+        create_collection_job_t collection;
+    } job;
+    int id;
+    int status;
+    char error[INGEST_ERROR_SIZE];
+} ingest_item_t;
+
+// Write job for a chunk of bulk ingest items
+typedef struct {
+    ingest_item_t *items;
+    int count;
+} ingest_chunk_t;
+
+// Validate a parsed item body, leaving the item ready for job_ingest_chunk (takes the body reference)
+void init_ingest_item(json_t *body, long line, ingest_item_t *item) {
+    memset(item, 0, sizeof(*item));
+    item->body = body;
+    item->line = line;
+    item->status = 400;
+
+    const char *invalid;
+    json_t *collection_json = json_object_get(item->body, "collection");
+    if (json_is_object(json_object_get(item->body, "workflow"))) {
+        item->kind = INGEST_WORKFLOW;
+        invalid = prepare_workflow_job(item->body, &item->job.workflow);
+    } else if (json_is_object(collection_json)) {
+        item->kind = INGEST_COLLECTION;
+        invalid = prepare_collection_job(collection_json, &item->job.collection);
+    } else {
+        invalid = "Expected a 'workflow' or 'collection' object";
+    }
+
+    if (invalid) {
+        item->kind = INGEST_INVALID;
+        snprintf(item->error, sizeof(item->error), "%s", invalid);
+    }
+}
+
+// Parse one NDJSON line into an item
+void parse_ingest_item(const char *text, size_t length, long line, ingest_item_t *item) {
+    json_error_t error;
+    json_t *body = json_loadb(text, length, 0, &error);
+    init_ingest_item(body, line, item);
+    if (!body) {
+        snprintf(item->error, sizeof(item->error), "Invalid JSON: %s", error.text);
+    }
+}
+
+// Apply one validated item inside the current transaction. A savepoint keeps a failing item
+// (and the user or categories it created on the way) from touching the rest of the chunk.
+void ingest_item(sqlite3 *db, ingest_item_t *item) {
+    if (item->kind == INGEST_INVALID) {
+        return;
+    }
+    if (exec_cached_statement(db, "SAVEPOINT ingest_item;") != 0) {
+        item->status = 500;
+        snprintf(item->error, sizeof(item->error), "%s", sqlite3_errmsg(db));
+        return;
+    }
+
+    int rc;
+    if (item->kind == INGEST_WORKFLOW) {
+        rc = job_create_workflow(db, &item->job.workflow);
+        item->id = item->job.workflow.template_id;
+        item->status = item->job.workflow.status >= 200 ? item->job.workflow.status : (rc == 0 ? 201 : 500);
+        if (rc != 0) {
+            snprintf(item->error, sizeof(item->error), "%s", item->job.workflow.error[0] ? item->job.workflow.error : "Database write failed");
+        }
+    } else {
+        rc = job_create_collection(db, &item->job.collection);
+        item->id = item->job.collection.collection_id;
+        item->status = rc == 0 ? item->job.collection.status : 500;
+        if (rc != 0) {
+            snprintf(item->error, sizeof(item->error), "Failed to create collection");
+        }
+    }
+
+    if (rc != 0) {
+        item->id = 0;
+        exec_cached_statement(db, "ROLLBACK TO ingest_item;");
+        invalidate_name_dictionaries();
+    }
+    exec_cached_statement(db, "RELEASE ingest_item;");
+}
+
+// Apply a chunk of items, runs on the writer thread. Item failures are reported per item,
+// the chunk itself only fails when its transaction does.
+int job_ingest_chunk(sqlite3 *db, void *arg) {
+    ingest_chunk_t *chunk = (ingest_chunk_t *)arg;
+    for (int i = 0; i < chunk->count; i++) {
+        ingest_item(db, &chunk->items[i]);
+    }
+    return 0;
+}
+
+// Commit a chunk through the writer, append its results and free the parsed lines
+void flush_ingest_chunk(ingest_chunk_t *chunk, json_writer_t *out, long *created, long *failed) {
+    if (submit_write_job(&job_ingest_chunk, chunk) != 0) {
+        // Nothing of the chunk was committed
+        for (int i = 0; i < chunk->count; i++) {
+            ingest_item_t *item = &chunk->items[i];
+            if (item->status < 400) {
+                item->id = 0;
+                item->status = 500;
+                snprintf(item->error, sizeof(item->error), "Database write failed");
+            }
+        }
+    }
+
+    for (int i = 0; i < chunk->count; i++) {
+        ingest_item_t *item = &chunk->items[i];
+        jw_begin_object(out, NULL);
+        jw_int(out, "line", item->line);
+        if (item->kind != INGEST_INVALID) {
+            jw_string(out, "type", item->kind == INGEST_WORKFLOW ? "workflow" : "collection");
+        }
+        jw_int(out, "status", item->status);
+        if (item->status < 400) {
+            jw_int(out, "id", item->id);
+            if (item->kind == INGEST_WORKFLOW && item->job.workflow.unchanged) {
+                jw_bool(out, "unchanged", 1);
+            }
+            (*created)++;
+        } else {
+            jw_string(out, "error", item->error);
+            (*failed)++;
+        }
+        jw_end_object(out);
+        json_decref(item->body);
+    }
+
+    atomic_fetch_add(&ingest_stats.items, chunk->count);
+    chunk->count = 0;
+}
+
+// PUT /templates/bulk
+// Body is NDJSON, one workflow or collection per line. Lines are parsed one at a time and applied
+// INGEST_CHUNK_ITEMS per writer transaction; the response lists the outcome of every line in order.
+int callback_bulk_ingest(const struct _u_request *request, struct _u_response *response, void *user_data) {
+    UNUSED(user_data);
+
+    const char *body = (const char *)request->binary_body;
+    size_t body_length = request->binary_body_length;
+    if (!body || body_length == 0) {
+        ulfius_set_string_body_response(response, 400, "Empty NDJSON body");
         return U_CALLBACK_CONTINUE;
     }
 
-    // Handle user creation or lookup
-    int user_id = get_or_create_user(db, user_json);
-    if (user_id == 0) {
-        json_decref(json_body);
-        return_db_connection(db);
-        ulfius_set_string_body_response(response, 400, "Invalid or incomplete user object provided. 'username' is required.");
+    ingest_chunk_t chunk = {0};
+    chunk.items = malloc(INGEST_CHUNK_ITEMS * sizeof(ingest_item_t));
+    if (!chunk.items) {
+        ulfius_set_string_body_response(response, 500, "Out of memory");
         return U_CALLBACK_CONTINUE;
     }
+    atomic_fetch_add(&ingest_stats.requests, 1);
+
+    json_writer_t out;
+    jw_init(&out);
+    jw_begin_object(&out, NULL);
+    jw_begin_array(&out, "results");
+
+    long created = 0, failed = 0, line = 0;
+    const char *end = body + body_length;
+    for (const char *start = body; start < end; ) {
+        const char *newline = memchr(start, '\n', end - start);
+        const char *stop = newline ? newline : end;
+        line++;
+
+        // Blank lines (and CRLF endings) are allowed between items
+        const char *last = stop;
+        while (last > start && (last[-1] == '\r' || last[-1] == ' ' || last[-1] == '\t')) {
+            last--;
+        }
+        if (last > start) {
+            parse_ingest_item(start, last - start, line, &chunk.items[chunk.count++]);
+            if (chunk.count == INGEST_CHUNK_ITEMS) {
+                flush_ingest_chunk(&chunk, &out, &created, &failed);
+            }
+        }
+        start = stop + 1;
+    }
+    if (chunk.count > 0) {
+        flush_ingest_chunk(&chunk, &out, &created, &failed);
+    }
+    free(chunk.items);
+    atomic_fetch_add(&ingest_stats.failed_items, failed);
 
-    // Convert JSON objects to strings for storage
-    char* workflow_data_str = json_dumps(nested_workflow, JSON_COMPACT);
-    char* workflow_info_str = workflow_info_json ? json_dumps(workflow_info_json, JSON_COMPACT) : NULL;
-    char* nodes_data_str = nodes_json ? json_dumps(nodes_json, JSON_COMPACT) : NULL;
-    char* image_data_str = image_json ? json_dumps(image_json, JSON_COMPACT) : NULL;
+    jw_end_array(&out);
+    jw_int(&out, "created", created);
+    jw_int(&out, "failed", failed);
+    jw_end_object(&out);
+    jw_send(&out, response, created + failed > 0 ? 200 : 400);
+    jw_free(&out);
+
+    return U_CALLBACK_CONTINUE;
+}
+
+// Callback to handle OPTIONS requests for CORS and Allow header
+int callback_options(const struct _u_request *request, struct _u_response *response, void *user_data) {
+    UNUSED(request);
+    UNUSED(user_data);
+
+    u_map_put(response->map_header, "Allow", "GET, HEAD");
+    ulfius_set_empty_body_response(response, 200);
+    return U_CALLBACK_CONTINUE;
+}
+
+// Print command line usage
+void print_usage(const char *program) {
+    printf("Usage: %s [--rebuild-search-index | --compress-storage | --import <dir> | --export <file>]\n", program);
+    printf("Options:\n");
+    printf("  --rebuild-search-index  Rebuild the full-text search index from the templates table and exit\n");
+    printf("  --compress-storage      Train a new storage dictionary, recompress the template JSON columns with it and exit\n");
+    printf("  --import <dir>          Load the .json and .ndjson files of a directory in one transaction and exit\n");
+    printf("  --export <file>         Write all templates and collections as NDJSON (- for stdout) and exit\n");
+}
+
+// --rebuild-search-index: one-shot rebuild for existing databases, no HTTP server
+int run_rebuild_search_index() {
+    sqlite3 *db;
+    if (sqlite3_open(DATABASE_FILE, &db) != SQLITE_OK) {
+        fprintf(stderr, "Can't open database %s: %s\n", DATABASE_FILE, sqlite3_errmsg(db));
+        sqlite3_close(db);
+        return 1;
+    }
+    sqlite3_busy_timeout(db, DB_BUSY_TIMEOUT_MS);
     
-    // Get lastUpdatedBy value
-    int last_updated_by = user_id;
+    if (sqlite3_exec(db, SEARCH_INDEX_SCHEMA, NULL, NULL, NULL) != SQLITE_OK) {
+        fprintf(stderr, "Can't create search index: %s\n", sqlite3_errmsg(db));
+        sqlite3_close(db);
+        return 1;
+    }
+    
+    int indexed = rebuild_search_index(db);
+    sqlite3_close(db);
+    if (indexed < 0) {
+        return 1;
+    }
+    
+    printf("Search index rebuilt with %d templates\n", indexed);
+    return 0;
+}
 
-    // Insert or replace the template
-    const char *sql = "INSERT OR REPLACE INTO templates (id, name, description, created_at, total_views, recent_views, price, purchase_url, user_id, last_updated_by, workflow_data, workflow_info, nodes_data, image_data) "
-                     "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);";
+// Register a GET and HEAD endpoint behind the response cache. Ulfius runs the callbacks in priority
+// order and stops at the lookup when it answers from the cache or with 304. GETs of an endpoint with
+// a view_kind other than VIEW_NONE count a view of the :id in their URL.
+void add_cached_endpoint(struct _u_instance *instance, const char *prefix, const char *format,
+                         int (*callback)(const struct _u_request *, struct _u_response *, void *), view_kind_t view_kind) {
+    const char *methods[] = { "GET", "HEAD" };
+    void *kind = (void *)(intptr_t)view_kind;
+    for (size_t i = 0; i < sizeof(methods) / sizeof(methods[0]); i++) {
+        ulfius_add_endpoint_by_val(instance, methods[i], prefix, format, 0, &callback_response_cache_lookup, kind);
+        ulfius_add_endpoint_by_val(instance, methods[i], prefix, format, 1, callback, NULL);
+        ulfius_add_endpoint_by_val(instance, methods[i], prefix, format, 2, &callback_response_cache_store, kind);
+    }
+}
+
+// Page count times page size of an open database
+long long database_size(sqlite3 *db) {
+    long long size = -1;
     sqlite3_stmt *stmt;
-    
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, 0) != SQLITE_OK) {
-        json_decref(json_body);
-        if (workflow_data_str) free(workflow_data_str);
-        if (workflow_info_str) free(workflow_info_str);
-        if (nodes_data_str) free(nodes_data_str);
-        if (image_data_str) free(image_data_str);
-        return_db_connection(db);
-        ulfius_set_string_body_response(response, 500, "Database error on prepare");
-        return U_CALLBACK_CONTINUE;
+    if (sqlite3_prepare_v2(db, "SELECT page_count * page_size FROM pragma_page_count(), pragma_page_size();", -1, &stmt, 0) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            size = sqlite3_column_int64(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
+    }
+    return size;
+}
+
+// --compress-storage: migrate an existing database to compressed template columns, no HTTP server.
+// Running it again trains a fresh dictionary and recompresses everything with it.
+int run_compress_storage() {
+    sqlite3 *db;
+    if (sqlite3_open(DATABASE_FILE, &db) != SQLITE_OK) {
+        fprintf(stderr, "Can't open database %s: %s\n", DATABASE_FILE, sqlite3_errmsg(db));
+        sqlite3_close(db);
+        return 1;
+    }
+    sqlite3_busy_timeout(db, DB_BUSY_TIMEOUT_MS);
+    register_storage_functions(db);
+    atomic_store(&storage.enabled, 1);
+    long long size_before = database_size(db);
+
+    if (migrate_schema(db) != 0 || load_storage(db) != 0 || sqlite3_exec(db, "BEGIN IMMEDIATE;", NULL, NULL, NULL) != SQLITE_OK) {
+        fprintf(stderr, "Can't prepare storage compression: %s\n", sqlite3_errmsg(db));
+        sqlite3_close(db);
+        return 1;
+    }
+
+    // Legacy values that are not valid JSON are left as they are, responses keep replacing them
+    int dictionary_id = create_storage_dictionary(db);
+    int rc = dictionary_id >= 0 ? sqlite3_exec(db,
+        "UPDATE templates SET "
+        "workflow_data = CASE WHEN typeof(workflow_data) = 'blob' OR json_valid(workflow_data) THEN store_json(stored_json(workflow_data)) ELSE workflow_data END, "
+        "workflow_info = CASE WHEN typeof(workflow_info) = 'blob' OR json_valid(workflow_info) THEN store_json(stored_json(workflow_info)) ELSE workflow_info END, "
+        "nodes_data = CASE WHEN typeof(nodes_data) = 'blob' OR json_valid(nodes_data) THEN store_json(stored_json(nodes_data)) ELSE nodes_data END, "
+        "image_data = CASE WHEN typeof(image_data) = 'blob' OR json_valid(image_data) THEN store_json(stored_json(image_data)) ELSE image_data END;",
+        NULL, NULL, NULL) : SQLITE_ERROR;
+    int rewritten = sqlite3_changes(db);
+
+    // The update queued every template for rendering, the bodies are unchanged but must not be left queued
+    if (rc != SQLITE_OK || drain_render_queue(db) < 0 || sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL) != SQLITE_OK) {
+        fprintf(stderr, "Can't compress template columns: %s\n", sqlite3_errmsg(db));
+        sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+        sqlite3_close(db);
+        cleanup_storage();
+        return 1;
+    }
+
+    // Give the freed pages back to the file system
+    sqlite3_exec(db, "VACUUM;", NULL, NULL, NULL);
+    printf("Compressed %d templates with dictionary %d, database went from %lld to %lld bytes\n",
+           rewritten, dictionary_id, size_before, database_size(db));
+    sqlite3_close(db);
+    cleanup_storage();
+    return 0;
+}
+
+// A file of the --import directory and the items parsed from it
+typedef struct {
+    char *path;
+    ingest_item_t *items;
+    int count;
+    int parsed;
+} import_file_t;
+
+// Files handed from the parsing threads to the writer, strictly in file order
+typedef struct {
+    import_file_t *files;
+    int file_count;
+    int next_file;
+    int applied_files;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} import_queue_t;
+
+// Append an item for body, growing the file's item array as needed
+void add_import_item(import_file_t *file, int *capacity, json_t *body, long line, const char *error_text) {
+    if (file->count == *capacity) {
+        int grown = *capacity ? *capacity * 2 : 16;
+        ingest_item_t *items = realloc(file->items, grown * sizeof(ingest_item_t));
+        if (!items) {
+            json_decref(body);
+            return;
+        }
+        file->items = items;
+        *capacity = grown;
     }
-    
-    int template_id = json_integer_value(json_object_get(workflow_json, "id"));
-    if (template_id <= 0) {
-        template_id = 0; // Let SQLite auto-increment if ID is not provided
+
+    ingest_item_t *item = &file->items[file->count++];
+    init_ingest_item(body, line, item);
+    if (!body) {
+        snprintf(item->error, sizeof(item->error), "Invalid JSON: %s", error_text);
     }
-    
-    sqlite3_bind_int(stmt, 1, template_id);
-    sqlite3_bind_text(stmt, 2, name, -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 3, description, -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 4, created_at, -1, SQLITE_STATIC);
-    sqlite3_bind_int(stmt, 5, total_views);
-    sqlite3_bind_int(stmt, 6, recent_views);
-    
-    if (price_json && !json_is_null(price_json)) {
-        sqlite3_bind_double(stmt, 7, json_real_value(price_json));
-    } else {
-        sqlite3_bind_null(stmt, 7);
+}
+
+// Parse every item of a file. .ndjson files hold one item per line like PUT /templates/bulk,
+// .json files one PUT /templates/workflows body, or a GET /templates/collections response whose
+// collections are imported one by one (as saved by scripts/get-mocks.sh).
+void parse_import_file(import_file_t *file) {
+    FILE *fp = fopen(file->path, "rb");
+    char *text = NULL;
+    long length = -1;
+    if (fp && fseek(fp, 0, SEEK_END) == 0 && (length = ftell(fp)) >= 0 && fseek(fp, 0, SEEK_SET) == 0 &&
+        (text = malloc(length + 1)) && fread(text, 1, length, fp) != (size_t)length) {
+        length = -1;
     }
-    
-    if (purchase_url_json && !json_is_null(purchase_url_json)) {
-        sqlite3_bind_text(stmt, 8, json_string_value(purchase_url_json), -1, SQLITE_STATIC);
-    } else {
-        sqlite3_bind_null(stmt, 8);
+    if (fp) {
+        fclose(fp);
     }
-    
-    sqlite3_bind_int(stmt, 9, user_id);
-    sqlite3_bind_int(stmt, 10, last_updated_by);
-    sqlite3_bind_text(stmt, 11, workflow_data_str, -1, SQLITE_TRANSIENT);
-    
-    if (workflow_info_str) sqlite3_bind_text(stmt, 12, workflow_info_str, -1, SQLITE_TRANSIENT);
-    else sqlite3_bind_null(stmt, 12);
-    
-    if (nodes_data_str) sqlite3_bind_text(stmt, 13, nodes_data_str, -1, SQLITE_TRANSIENT);
-    else sqlite3_bind_null(stmt, 13);
-    
-    if (image_data_str) sqlite3_bind_text(stmt, 14, image_data_str, -1, SQLITE_TRANSIENT);
-    else sqlite3_bind_null(stmt, 14);
-    
-    if (sqlite3_step(stmt) == SQLITE_DONE) {
-        if (template_id == 0) {
-            template_id = sqlite3_last_insert_rowid(db);
+
+    int capacity = 0;
+    json_error_t error;
+    if (!text || length < 0) {
+        add_import_item(file, &capacity, NULL, 0, NULL);
+        if (file->count > 0) {
+            snprintf(file->items[0].error, sizeof(file->items[0].error), "Can't read file: %s", strerror(errno));
         }
-        
-        // Add category if it does not already exist
-        /*
-        const char *delete_cat_sql = "DELETE FROM template_categories WHERE template_id = ?;";
-        sqlite3_stmt *delete_stmt;
-        if (sqlite3_prepare_v2(db, delete_cat_sql, -1, &delete_stmt, 0) == SQLITE_OK) {
-            sqlite3_bind_int(delete_stmt, 1, template_id);
-            sqlite3_step(delete_stmt);
-            sqlite3_finalize(delete_stmt);
+    } else if (strlen(file->path) > 7 && strcmp(file->path + strlen(file->path) - 7, ".ndjson") == 0) {
+        long line = 0;
+        const char *end = text + length;
+        for (const char *start = text; start < end; ) {
+            const char *newline = memchr(start, '\n', end - start);
+            const char *stop = newline ? newline : end;
+            const char *last = stop;
+            line++;
+            while (last > start && (last[-1] == '\r' || last[-1] == ' ' || last[-1] == '\t')) {
+                last--;
+            }
+            if (last > start) {
+                add_import_item(file, &capacity, json_loadb(start, last - start, 0, &error), line, error.text);
+            }
+            start = stop + 1;
         }
-        */
-
-        if (json_is_array(categories_json)) {
+    } else {
+        json_t *body = json_loadb(text, length, 0, &error);
+        json_t *collections_json = json_object_get(body, "collections");
+        if (json_is_array(collections_json)) {
             size_t index;
-            json_t *category_json_obj;
-            json_array_foreach(categories_json, index, category_json_obj) {
-                int category_id = get_or_create_category(db, category_json_obj);
-                if (category_id > 0) {
-                    const char *link_sql = "INSERT OR IGNORE INTO template_categories (template_id, category_id) VALUES (?, ?);";
-                    sqlite3_stmt *link_stmt;
-                    if (sqlite3_prepare_v2(db, link_sql, -1, &link_stmt, 0) == SQLITE_OK) {
-                        sqlite3_bind_int(link_stmt, 1, template_id);
-                        sqlite3_bind_int(link_stmt, 2, category_id);
-                        sqlite3_step(link_stmt);
-                        sqlite3_finalize(link_stmt);
-                    }
-                }
+            json_t *collection_json;
+            json_array_foreach(collections_json, index, collection_json) {
+                json_t *item_body = json_object();
+                json_object_set(item_body, "collection", collection_json);
+                add_import_item(file, &capacity, item_body, index + 1, NULL);
             }
+            json_decref(body);
+        } else {
+            add_import_item(file, &capacity, body, 1, error.text);
         }
+    }
+    free(text);
+}
 
-        json_t *response_json = json_object();
-        json_object_set_new(response_json, "id", json_integer(template_id));
-        // json_object_set_new(response_json, "message", "Workflow created/updated successfully");
-        ulfius_set_json_body_response(response, 201, response_json);
-        json_decref(response_json);
-    } else {
-        const char *db_error_msg = sqlite3_errmsg(db);
-        fprintf(stderr, "Failed to create workflow: %s\n", db_error_msg);
-        ulfius_set_string_body_response(response, 500, db_error_msg);
+// Parsing thread: takes the next file once the writer is close enough behind
+void* import_parser_thread(void *arg) {
+    import_queue_t *queue = (import_queue_t *)arg;
+
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->next_file < queue->file_count) {
+        if (queue->next_file >= queue->applied_files + IMPORT_LOOKAHEAD_FILES) {
+            pthread_cond_wait(&queue->cond, &queue->mutex);
+            continue;
+        }
+        import_file_t *file = &queue->files[queue->next_file++];
+        pthread_mutex_unlock(&queue->mutex);
+
+        parse_import_file(file);
+
+        pthread_mutex_lock(&queue->mutex);
+        file->parsed = 1;
+        pthread_cond_broadcast(&queue->cond);
     }
+    pthread_mutex_unlock(&queue->mutex);
 
-    sqlite3_finalize(stmt);
-    json_decref(json_body);
-    
-    if (workflow_data_str) free(workflow_data_str);
-    if (workflow_info_str) free(workflow_info_str);
-    if (nodes_data_str) free(nodes_data_str);
-    if (image_data_str) free(image_data_str);
-    
-    return_db_connection(db);
-    return U_CALLBACK_CONTINUE;
+    return NULL;
 }
 
-// PUT /templates/collections
-int callback_create_collection(const struct _u_request *request, struct _u_response *response, void *user_data) {
-    UNUSED(user_data);
-
-    sqlite3 *db = get_db_connection();
-    if (!db) {
-        ulfius_set_string_body_response(response, 500, "Database connection failed");
-        return U_CALLBACK_CONTINUE;
+// Sorted paths of the .json and .ndjson files of a directory, NULL if it can't be read
+char** list_import_files(const char *directory, int *count) {
+    DIR *dir = opendir(directory);
+    if (!dir) {
+        return NULL;
     }
 
-    json_t *json_body = ulfius_get_json_body_request(request, NULL);
-    if (json_body == NULL) {
-        return_db_connection(db);
-        ulfius_set_string_body_response(response, 400, "Invalid JSON");
-        return U_CALLBACK_CONTINUE;
+    char **paths = NULL;
+    int capacity = 0;
+    *count = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        const char *dot = strrchr(entry->d_name, '.');
+        if (entry->d_name[0] == '.' || !dot || (strcmp(dot, ".json") != 0 && strcmp(dot, ".ndjson") != 0)) {
+            continue;
+        }
+        if (*count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            char **grown = realloc(paths, capacity * sizeof(char *));
+            if (!grown) {
+                break;
+            }
+            paths = grown;
+        }
+        size_t size = strlen(directory) + strlen(entry->d_name) + 2;
+        if ((paths[*count] = malloc(size)) != NULL) {
+            snprintf(paths[(*count)++], size, "%s/%s", directory, entry->d_name);
+        }
     }
+    closedir(dir);
 
-    const char *name = json_string_value(json_object_get(json_body, "name"));
-    json_t *rank_json = json_object_get(json_body, "rank");
-    json_t *total_views_json = json_object_get(json_body, "totalViews");
-    json_t *workflows_json = json_object_get(json_body, "workflows");
+    if (*count > 0) {
+        qsort(paths, *count, sizeof(char *), compare_strings);
+    }
+    return paths ? paths : calloc(1, sizeof(char *));
+}
 
-    if (!name || strlen(name) == 0) {
-        json_decref(json_body);
-        return_db_connection(db);
-        ulfius_set_string_body_response(response, 400, "Missing required field: name");
-        return U_CALLBACK_CONTINUE;
+// --import <dir>: load a directory of mock files in one transaction, no HTTP server.
+// Items go through the same validation and write path as PUT /templates/bulk.
+int run_import(const char *directory) {
+    int file_count = 0;
+    char **paths = list_import_files(directory, &file_count);
+    if (!paths) {
+        fprintf(stderr, "Can't read import directory %s: %s\n", directory, strerror(errno));
+        return 1;
     }
 
-    const char *created_at = json_string_value(json_object_get(json_body, "createdAt"));
-    if (!created_at) {
-        json_decref(json_body);
-        return_db_connection(db);
-        ulfius_set_string_body_response(response, 400, "Missing required field: createdAt");
-        return U_CALLBACK_CONTINUE;
+    import_queue_t queue = {0};
+    queue.files = calloc(file_count > 0 ? file_count : 1, sizeof(import_file_t));
+    queue.file_count = file_count;
+    pthread_mutex_init(&queue.mutex, NULL);
+    pthread_cond_init(&queue.cond, NULL);
+    for (int i = 0; i < file_count && queue.files; i++) {
+        queue.files[i].path = paths[i];
     }
 
-    // Insert collection
-    const char *sql = "INSERT INTO collections (rank, name, total_views, created_at) VALUES (?, ?, ?, ?);";
-    sqlite3_stmt *stmt;
-    
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, 0) != SQLITE_OK) {
-        json_decref(json_body);
-        return_db_connection(db);
-        ulfius_set_string_body_response(response, 500, "Database error on prepare");
-        return U_CALLBACK_CONTINUE;
+    if (!queue.files || open_writer_connection() != 0 || sqlite3_exec(writer.db, "BEGIN IMMEDIATE;", NULL, NULL, NULL) != SQLITE_OK) {
+        fprintf(stderr, "Can't start import: %s\n", writer.db ? sqlite3_errmsg(writer.db) : "out of memory");
+        if (writer.db) {
+            close_writer_connection();
+        }
+        for (int i = 0; i < file_count; i++) {
+            free(paths[i]);
+        }
+        free(paths);
+        free(queue.files);
+        return 1;
     }
-    
-    // Bind parameters
-    if (rank_json && json_is_integer(rank_json)) {
-        sqlite3_bind_int(stmt, 1, json_integer_value(rank_json));
-    } else {
-        sqlite3_bind_int(stmt, 1, 0);
+
+    pthread_t threads[IMPORT_THREADS];
+    int thread_count = 0;
+    while (thread_count < IMPORT_THREADS &&
+           pthread_create(&threads[thread_count], NULL, &import_parser_thread, &queue) == 0) {
+        thread_count++;
     }
-    
-    sqlite3_bind_text(stmt, 2, name, -1, SQLITE_STATIC);
-    
-    if (total_views_json && json_is_integer(total_views_json)) {
-        sqlite3_bind_int(stmt, 3, json_integer_value(total_views_json));
-    } else {
-        sqlite3_bind_null(stmt, 3);
+    if (thread_count == 0) {
+        // Parse on this thread as the writer gets to each file
+        queue.next_file = file_count;
     }
-    
-    sqlite3_bind_text(stmt, 4, created_at, -1, SQLITE_STATIC);
-    
-    if (sqlite3_step(stmt) == SQLITE_DONE) {
-        int collection_id = sqlite3_last_insert_rowid(db);
-        sqlite3_finalize(stmt);
-        
-        // Add workflows if provided
-        if (json_is_array(workflows_json)) {
-            size_t index;
-            json_t *workflow;
-            json_array_foreach(workflows_json, index, workflow) {
-                int workflow_id = json_integer_value(json_object_get(workflow, "id"));
-                if (workflow_id > 0) {
-                    const char *link_sql = "INSERT OR IGNORE INTO collection_workflows (collection_id, template_id) VALUES (?, ?);";
-                    sqlite3_stmt *link_stmt;
-                    if (sqlite3_prepare_v2(db, link_sql, -1, &link_stmt, 0) == SQLITE_OK) {
-                        sqlite3_bind_int(link_stmt, 1, collection_id);
-                        sqlite3_bind_int(link_stmt, 2, workflow_id);
-                        sqlite3_step(link_stmt);
-                        sqlite3_finalize(link_stmt);
-                    }
-                }
+
+    long created = 0, failed = 0;
+    for (int i = 0; i < file_count; i++) {
+        import_file_t *file = &queue.files[i];
+        if (thread_count > 0) {
+            pthread_mutex_lock(&queue.mutex);
+            while (!file->parsed) {
+                pthread_cond_wait(&queue.cond, &queue.mutex);
             }
+            pthread_mutex_unlock(&queue.mutex);
+        } else {
+            parse_import_file(file);
         }
-        
-        // Return the created collection
-        json_t *response_json = json_object();
-        json_object_set_new(response_json, "id", json_integer(collection_id));
-        json_object_set_new(response_json, "name", json_string(name));
-        json_object_set_new(response_json, "rank", json_integer(rank_json ? json_integer_value(rank_json) : 0));
-        json_object_set_new(response_json, "totalViews", total_views_json ? json_integer(json_integer_value(total_views_json)) : json_null());
-        json_object_set_new(response_json, "createdAt", json_string(created_at));
-        json_object_set_new(response_json, "workflows", workflows_json ? workflows_json : json_array());
-        json_object_set_new(response_json, "nodes", json_array());
-        json_object_set_new(response_json, "message", json_string("Collection created successfully"));
-        
-        ulfius_set_json_body_response(response, 201, response_json);
-        json_decref(response_json);
+
+        for (int j = 0; j < file->count; j++) {
+            ingest_item_t *item = &file->items[j];
+            ingest_item(writer.db, item);
+            if (item->status < 400) {
+                created++;
+            } else {
+                fprintf(stderr, "%s:%ld: %d %s\n", file->path, item->line, item->status, item->error);
+                failed++;
+            }
+            json_decref(item->body);
+        }
+        free(file->items);
+        file->items = NULL;
+
+        pthread_mutex_lock(&queue.mutex);
+        queue.applied_files++;
+        pthread_cond_broadcast(&queue.cond);
+        pthread_mutex_unlock(&queue.mutex);
+    }
+
+    for (int i = 0; i < thread_count; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    // Same end of transaction as a writer batch
+    int rc = drain_render_queue(writer.db) < 0 ? -1 : 0;
+    bump_data_version(writer.db);
+    if (rc != 0 || sqlite3_exec(writer.db, "COMMIT;", NULL, NULL, NULL) != SQLITE_OK) {
+        fprintf(stderr, "Can't commit import: %s\n", sqlite3_errmsg(writer.db));
+        sqlite3_exec(writer.db, "ROLLBACK;", NULL, NULL, NULL);
+        invalidate_name_dictionaries();
+        rc = -1;
     } else {
-        sqlite3_finalize(stmt);
-        ulfius_set_string_body_response(response, 500, "Failed to create collection");
+        printf("Imported %ld items from %d files in %s, %ld failed\n", created, file_count, directory, failed);
     }
-    
-    json_decref(json_body);
-    return_db_connection(db);
-    return U_CALLBACK_CONTINUE;
-}
 
-// PATCH /templates/collections
-int callback_add_workflow_to_collection(const struct _u_request *request, struct _u_response *response, void *user_data) {
-    UNUSED(user_data);
+    close_writer_connection();
+    cleanup_storage();
+    pthread_cond_destroy(&queue.cond);
+    pthread_mutex_destroy(&queue.mutex);
+    for (int i = 0; i < file_count; i++) {
+        free(paths[i]);
+    }
+    free(paths);
+    free(queue.files);
+    return rc == 0 ? 0 : 1;
+}
 
-    sqlite3 *db = get_db_connection();
-    if (!db) {
-        ulfius_set_string_body_response(response, 500, "Database connection failed");
-        return U_CALLBACK_CONTINUE;
+// Category as accepted by get_or_create_category, with its parents
+json_t* export_category(sqlite3 *db, int category_id, int depth) {
+    sqlite3_stmt *stmt = prepare_cached_statement(db, "SELECT name, icon, parent_id FROM categories WHERE id = ?;");
+    if (!stmt) {
+        return NULL;
     }
+    sqlite3_bind_int(stmt, 1, category_id);
 
-    json_t *json_body = ulfius_get_json_body_request(request, NULL);
-    if (json_body == NULL) {
-        return_db_connection(db);
-        ulfius_set_string_body_response(response, 400, "Invalid JSON");
-        return U_CALLBACK_CONTINUE;
+    json_t *category_json = NULL;
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        category_json = json_object();
+        json_object_set_new(category_json, "id", json_integer(category_id));
+        json_object_set_new(category_json, "name", json_string((const char *)sqlite3_column_text(stmt, 0)));
+        if (sqlite3_column_type(stmt, 1) != SQLITE_NULL) {
+            json_object_set_new(category_json, "icon", json_string((const char *)sqlite3_column_text(stmt, 1)));
+        }
+        int parent_id = sqlite3_column_int(stmt, 2);
+        release_cached_statement(db, stmt);
+
+        // Bounded in case parent links loop
+        json_t *parent_json = parent_id > 0 && depth < EXPORT_CATEGORY_DEPTH ? export_category(db, parent_id, depth + 1) : NULL;
+        if (parent_json) {
+            json_object_set_new(category_json, "parent", parent_json);
+        }
+        return category_json;
     }
 
-    json_t *collection_id_json = json_object_get(json_body, "collectionId");
-    json_t *template_id_json = json_object_get(json_body, "templateId");
+    release_cached_statement(db, stmt);
+    return category_json;
+}
 
-    if (!json_is_integer(collection_id_json) || !json_is_integer(template_id_json)) {
-        json_decref(json_body);
-        return_db_connection(db);
-        ulfius_set_string_body_response(response, 400, "Missing required fields: collectionId and templateId must be integers");
-        return U_CALLBACK_CONTINUE;
+// Set key to the parsed stored JSON text, leaving it out when there is none
+void export_stored_json(json_t *object, const char *key, const char *text) {
+    json_t *value = text ? json_loads(text, JSON_DECODE_ANY, NULL) : NULL;
+    if (value) {
+        json_object_set_new(object, key, value);
     }
+}
 
-    int collection_id = json_integer_value(collection_id_json);
-    int template_id = json_integer_value(template_id_json);
+// Write one NDJSON line, returns 0 on success
+int export_line(FILE *out, json_t *line_json) {
+    char *text = json_dumps(line_json, JSON_COMPACT);
+    json_decref(line_json);
+    if (!text) {
+        return -1;
+    }
+    int rc = fputs(text, out) < 0 || fputc('\n', out) == EOF ? -1 : 0;
+    free(text);
+    return rc;
+}
 
-    // Verify collection exists
-    const char *check_collection_sql = "SELECT id FROM collections WHERE id = ?;";
-    sqlite3_stmt *check_stmt;
-    if (sqlite3_prepare_v2(db, check_collection_sql, -1, &check_stmt, 0) == SQLITE_OK) {
-        sqlite3_bind_int(check_stmt, 1, collection_id);
-        if (sqlite3_step(check_stmt) != SQLITE_ROW) {
-            sqlite3_finalize(check_stmt);
-            json_decref(json_body);
-            return_db_connection(db);
-            ulfius_set_string_body_response(response, 404, "Collection not found");
-            return U_CALLBACK_CONTINUE;
-        }
-        sqlite3_finalize(check_stmt);
+// Write every template and collection as PUT /templates/bulk lines, from one read transaction
+int export_catalog(sqlite3 *db, FILE *out, long *templates, long *collections) {
+    const char *templates_sql = "SELECT t.id, t.name, t.description, t.created_at, t.total_views, t.recent_views, t.price, t.purchase_url, "
+                                VALID_JSON("t.workflow_data") ", " VALID_JSON("t.workflow_info") ", "
+                                VALID_JSON("t.nodes_data") ", " VALID_JSON("t.image_data") ", "
+                                "u.name, u.username, u.bio, u.verified, u.links, u.avatar "
+                                "FROM templates t JOIN users u ON u.id = t.user_id ORDER BY t.id;";
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(db, templates_sql, -1, &stmt, 0) != SQLITE_OK) {
+        return -1;
     }
 
-    // Verify template exists
-    const char *check_template_sql = "SELECT id FROM templates WHERE id = ?;";
-    if (sqlite3_prepare_v2(db, check_template_sql, -1, &check_stmt, 0) == SQLITE_OK) {
-        sqlite3_bind_int(check_stmt, 1, template_id);
-        if (sqlite3_step(check_stmt) != SQLITE_ROW) {
-            sqlite3_finalize(check_stmt);
-            json_decref(json_body);
-            return_db_connection(db);
-            ulfius_set_string_body_response(response, 404, "Template not found");
-            return U_CALLBACK_CONTINUE;
+    int rc = 0;
+    while (rc == 0 && sqlite3_step(stmt) == SQLITE_ROW) {
+        int template_id = sqlite3_column_int(stmt, 0);
+        json_t *workflow_obj = json_object();
+        json_object_set_new(workflow_obj, "id", json_integer(template_id));
+        json_object_set_new(workflow_obj, "name", json_string((const char *)sqlite3_column_text(stmt, 1)));
+        json_object_set_new(workflow_obj, "description", json_string((const char *)sqlite3_column_text(stmt, 2)));
+        json_object_set_new(workflow_obj, "createdAt", json_string((const char *)sqlite3_column_text(stmt, 3)));
+        json_object_set_new(workflow_obj, "totalViews", json_integer(sqlite3_column_int(stmt, 4)));
+        json_object_set_new(workflow_obj, "recentViews", json_integer(sqlite3_column_int(stmt, 5)));
+        if (sqlite3_column_type(stmt, 6) != SQLITE_NULL) {
+            json_object_set_new(workflow_obj, "price", json_real(sqlite3_column_double(stmt, 6)));
+        }
+        if (sqlite3_column_type(stmt, 7) != SQLITE_NULL) {
+            json_object_set_new(workflow_obj, "purchaseUrl", json_string((const char *)sqlite3_column_text(stmt, 7)));
         }
-        sqlite3_finalize(check_stmt);
+
+        json_t *user_obj = json_object();
+        json_object_set_new(user_obj, "name", json_string((const char *)sqlite3_column_text(stmt, 12)));
+        json_object_set_new(user_obj, "username", json_string((const char *)sqlite3_column_text(stmt, 13)));
+        json_object_set_new(user_obj, "bio", json_string((const char *)sqlite3_column_text(stmt, 14)));
+        json_object_set_new(user_obj, "verified", json_boolean(sqlite3_column_int(stmt, 15)));
+        export_stored_json(user_obj, "links", (const char *)sqlite3_column_text(stmt, 16));
+        json_object_set_new(user_obj, "avatar", json_string((const char *)sqlite3_column_text(stmt, 17)));
+        json_object_set_new(workflow_obj, "user", user_obj);
+
+        json_t *categories_json = json_array();
+        sqlite3_stmt *category_stmt = prepare_cached_statement(db, "SELECT category_id FROM template_categories WHERE template_id = ? ORDER BY category_id;");
+        if (category_stmt) {
+            sqlite3_bind_int(category_stmt, 1, template_id);
+            while (sqlite3_step(category_stmt) == SQLITE_ROW) {
+                json_t *category_json = export_category(db, sqlite3_column_int(category_stmt, 0), 0);
+                if (category_json) {
+                    json_array_append_new(categories_json, category_json);
+                }
+            }
+            release_cached_statement(db, category_stmt);
+        }
+        json_object_set_new(workflow_obj, "categories", categories_json);
+
+        // Always present, PUT requires it
+        const char *workflow_data = (const char *)sqlite3_column_text(stmt, 8);
+        export_stored_json(workflow_obj, "workflow", workflow_data ? workflow_data : "{}");
+        export_stored_json(workflow_obj, "workflowInfo", (const char *)sqlite3_column_text(stmt, 9));
+        export_stored_json(workflow_obj, "nodes", (const char *)sqlite3_column_text(stmt, 10));
+        export_stored_json(workflow_obj, "image", (const char *)sqlite3_column_text(stmt, 11));
+
+        json_t *line_json = json_object();
+        json_object_set_new(line_json, "workflow", workflow_obj);
+        rc = export_line(out, line_json);
+        (*templates)++;
+    }
+    sqlite3_finalize(stmt);
+    if (rc != 0) {
+        return rc;
     }
 
-    // Insert the relationship
-    const char *sql = "INSERT OR IGNORE INTO collection_workflows (collection_id, template_id) VALUES (?, ?);";
-    sqlite3_stmt *stmt;
-    
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, 0) != SQLITE_OK) {
-        json_decref(json_body);
-        return_db_connection(db);
-        ulfius_set_string_body_response(response, 500, "Database error on prepare");
-        return U_CALLBACK_CONTINUE;
+    const char *collections_sql = "SELECT c.id, c.name, c.rank, c.total_views, c.created_at, "
+                                  "(SELECT json_group_array(json_object('id', cw.template_id)) FROM "
+                                  "(SELECT template_id FROM collection_workflows WHERE collection_id = c.id ORDER BY template_id) cw) "
+                                  "FROM collections c ORDER BY c.id;";
+    if (sqlite3_prepare_v2(db, collections_sql, -1, &stmt, 0) != SQLITE_OK) {
+        return -1;
     }
-    
-    sqlite3_bind_int(stmt, 1, collection_id);
-    sqlite3_bind_int(stmt, 2, template_id);
-    
-    if (sqlite3_step(stmt) == SQLITE_DONE) {
-        int changes = sqlite3_changes(db);
-        sqlite3_finalize(stmt);
-        
-        json_t *response_json = json_object();
-        if (changes > 0) {
-            json_object_set_new(response_json, "message", json_string("Workflow added to collection successfully"));
-        } else {
-            json_object_set_new(response_json, "message", json_string("Workflow already exists in collection"));
+    while (rc == 0 && sqlite3_step(stmt) == SQLITE_ROW) {
+        json_t *collection_obj = json_object();
+        json_object_set_new(collection_obj, "id", json_integer(sqlite3_column_int(stmt, 0)));
+        json_object_set_new(collection_obj, "name", json_string((const char *)sqlite3_column_text(stmt, 1)));
+        json_object_set_new(collection_obj, "rank", json_integer(sqlite3_column_int(stmt, 2)));
+        if (sqlite3_column_type(stmt, 3) != SQLITE_NULL) {
+            json_object_set_new(collection_obj, "totalViews", json_integer(sqlite3_column_int(stmt, 3)));
         }
-        json_object_set_new(response_json, "collectionId", json_integer(collection_id));
-        json_object_set_new(response_json, "templateId", json_integer(template_id));
-        ulfius_set_json_body_response(response, 200, response_json);
-        json_decref(response_json);
-    } else {
-        sqlite3_finalize(stmt);
-        fprintf(stderr, "callback_add_workflow_to_collection ERROR: Failed to add workflow to collection: %s\n", sqlite3_errmsg(db));
-        ulfius_set_string_body_response(response, 500, "Failed to add workflow to collection");
+        json_object_set_new(collection_obj, "createdAt", json_string((const char *)sqlite3_column_text(stmt, 4)));
+        export_stored_json(collection_obj, "workflows", (const char *)sqlite3_column_text(stmt, 5));
+
+        json_t *line_json = json_object();
+        json_object_set_new(line_json, "collection", collection_obj);
+        rc = export_line(out, line_json);
+        (*collections)++;
     }
-    
-    json_decref(json_body);
-    return_db_connection(db);
-    return U_CALLBACK_CONTINUE;
+    sqlite3_finalize(stmt);
+    return rc;
 }
 
-// Callback to handle OPTIONS requests for CORS and Allow header
-int callback_options(const struct _u_request *request, struct _u_response *response, void *user_data) {
-    UNUSED(request);
-    UNUSED(user_data);
+// --export <file>: write the whole catalog as NDJSON ("-" for stdout), no HTTP server.
+// The output can be loaded again with --import or PUT /templates/bulk.
+int run_export(const char *path) {
+    sqlite3 *db;
+    if (sqlite3_open_v2(DATABASE_FILE, &db, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK) {
+        fprintf(stderr, "Can't open database %s: %s\n", DATABASE_FILE, sqlite3_errmsg(db));
+        sqlite3_close(db);
+        return 1;
+    }
+    sqlite3_busy_timeout(db, DB_BUSY_TIMEOUT_MS);
+    register_storage_functions(db);
 
-    u_map_put(response->map_header, "Allow", "GET, HEAD");
-    ulfius_set_empty_body_response(response, 200);
-    return U_CALLBACK_CONTINUE;
+    int to_stdout = strcmp(path, "-") == 0;
+    FILE *out = to_stdout ? stdout : fopen(path, "w");
+    if (!out) {
+        fprintf(stderr, "Can't open export file %s: %s\n", path, strerror(errno));
+        sqlite3_close(db);
+        return 1;
+    }
+
+    // A single read transaction keeps templates and collections consistent with each other
+    long templates = 0, collections = 0;
+    int rc = sqlite3_exec(db, "BEGIN;", NULL, NULL, NULL) == SQLITE_OK ? export_catalog(db, out, &templates, &collections) : -1;
+    if (rc != 0) {
+        fprintf(stderr, "Export failed: %s\n", sqlite3_errmsg(db));
+    }
+    sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL);
+    sqlite3_close(db);
+    cleanup_storage();
+
+    if ((to_stdout ? fflush(out) : fclose(out)) != 0) {
+        rc = -1;
+    }
+    if (rc == 0) {
+        fprintf(to_stdout ? stderr : stdout, "Exported %ld templates and %ld collections\n", templates, collections);
+    }
+    return rc == 0 ? 0 : 1;
 }
 
-int main(void) {
+int main(int argc, char *argv[]) {
     struct _u_instance instance;
 
+    if (argc > 1) {
+        if (strcmp(argv[1], "--rebuild-search-index") == 0) {
+            return run_rebuild_search_index();
+        }
+        if (strcmp(argv[1], "--compress-storage") == 0) {
+            return run_compress_storage();
+        }
+        if (strcmp(argv[1], "--import") == 0 && argc > 2) {
+            return run_import(argv[2]);
+        }
+        if (strcmp(argv[1], "--export") == 0 && argc > 2) {
+            return run_export(argv[2]);
+        }
+        print_usage(argv[0]);
+        return strcmp(argv[1], "--help") == 0 ? 0 : 1;
+    }
+
+    // Every thread started from here on inherits SIGINT and SIGTERM blocked, main takes them with
+    // sigwait() so the shutdown below runs and writes the pending views and catalog snapshot
+    sigset_t stop_signals;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, NULL);
+
     if (init_database() != 0) {
         fprintf(stderr, "Failed to initialize database connection pool\n");
         return 1;
     }
+    init_response_cache();
+    if (CATALOG_SNAPSHOT) {
+        load_catalog();
+    }
+    if (VIEW_FLUSH_SECONDS > 0) {
+        start_view_flusher();
+    }
     
     if (ulfius_init_instance(&instance, PORT, NULL, NULL) != U_OK) {
         fprintf(stderr, "Error initializing instance\n");
@@ -1696,15 +8719,16 @@ int main(void) {
     
     // Add most basic endpoints. See: https://ai-rockstars.com/create-your-own-n8n-templates-step-by-step-guide
     ulfius_add_endpoint_by_val(&instance, "GET", "/health", NULL, 0, &callback_get_health, NULL);
-    ulfius_add_endpoint_by_val(&instance, "GET", "/templates", "/categories", 0, &callback_get_categories, NULL);
-    ulfius_add_endpoint_by_val(&instance, "GET", "/templates", "/collections", 0, &callback_get_collections, NULL);
-    ulfius_add_endpoint_by_val(&instance, "GET", "/templates/collections", "/:id", 0, &callback_get_collection_by_id, NULL);
-    ulfius_add_endpoint_by_val(&instance, "GET", "/templates", "/search", 0, &callback_search_templates, NULL);
-    ulfius_add_endpoint_by_val(&instance, "GET", "/templates/workflows", "/:id", 0, &callback_get_workflow_by_id, NULL);
-    ulfius_add_endpoint_by_val(&instance, "GET", "/templates", "/workflows", 0, &callback_get_all_workflows, NULL);
+    ulfius_add_endpoint_by_val(&instance, "GET", "/metrics", NULL, 0, &callback_get_metrics, NULL);
+    add_cached_endpoint(&instance, "/templates", "/categories", &callback_get_categories, VIEW_NONE);
+    add_cached_endpoint(&instance, "/templates", "/collections", &callback_get_collections, VIEW_NONE);
+    add_cached_endpoint(&instance, "/templates/collections", "/:id", &callback_get_collection_by_id, VIEW_COLLECTION);
+    add_cached_endpoint(&instance, "/templates", "/search", &callback_search_templates, VIEW_NONE);
+    add_cached_endpoint(&instance, "/templates/workflows", "/:id", &callback_get_workflow_by_id, VIEW_TEMPLATE);
+    add_cached_endpoint(&instance, "/templates", "/workflows", &callback_get_all_workflows, VIEW_NONE);
 
     // When importing a template workflow it seems to swap the root url directories.
-    ulfius_add_endpoint_by_val(&instance, "GET", "/workflows/templates", "/:id", 0, &callback_get_workflow_for_import, NULL);
+    add_cached_endpoint(&instance, "/workflows/templates", "/:id", &callback_get_workflow_for_import, VIEW_TEMPLATE);
 
     ulfius_add_endpoint_by_val(&instance, "OPTIONS", "/templates", "/categories", 0, &callback_options, NULL);
     ulfius_add_endpoint_by_val(&instance, "OPTIONS", "/templates", "/collections", 0, &callback_options, NULL);
@@ -1715,16 +8739,21 @@ int main(void) {
 
     // Custom endpoint to insert a template
     ulfius_add_endpoint_by_val(&instance, "PUT", "/templates", "/workflows", 0, &callback_create_workflow, NULL);
+    // Custom endpoint to delete a template
+    ulfius_add_endpoint_by_val(&instance, "DELETE", "/templates/workflows", "/:id", 0, &callback_delete_workflow, NULL);
     // Custom endpoint to insert a collection of workflows
     ulfius_add_endpoint_by_val(&instance, "PUT", "/templates", "/collections", 0, &callback_create_collection, NULL);
     // Custom endpoint to insert a workflow into a collection
     ulfius_add_endpoint_by_val(&instance, "PATCH", "/templates", "/collections", 0, &callback_add_workflow_to_collection, NULL);
+    // Custom endpoint to insert many workflows and collections at once
+    ulfius_add_endpoint_by_val(&instance, "PUT", "/templates", "/bulk", 0, &callback_bulk_ingest, NULL);
     
     if (ulfius_start_framework(&instance) == U_OK) {
         printf("n8n Templates API server started on port %d\n", PORT);
-        printf("Using database file %s with connection pool of %d connections\n", DATABASE_FILE, MAX_CONNECTIONS);
+        printf("Using database file %s with connection pool of %d connections\n", DATABASE_FILE, POOL_SIZE);
         printf("Available endpoints:\n");
         printf("  GET    /health                         - API health status\n");
+        printf("  GET    /metrics                        - Internal performance counters\n");
         printf("  GET    /templates/categories           - Get all categories\n");
         printf("  GET    /templates/collections          - Get collections with optional filters\n");
         printf("  GET    /templates/collections/:id      - Get specific collection by ID\n");
@@ -1732,12 +8761,15 @@ int main(void) {
         printf("  GET    /templates/workflows            - Get all workflows\n");
         printf("  GET    /templates/workflows/:id        - Get specific workflow by ID\n");
         printf("  PUT    /templates/workflows            - Create new workflow\n");
+        printf("  DELETE /templates/workflows/:id        - Delete a workflow\n");
         printf("  PUT    /templates/collections          - Create new collection of workflows\n");
         printf("  PATCH  /templates/collections          - Insert new template workflow into a collection\n");
+        printf("  PUT    /templates/bulk                 - Create workflows and collections from NDJSON\n");
         printf("Press Ctrl+C to quit...\n");
 
-        // Wait forever until signal (SIGINT/SIGTERM)
-        pause();
+        // Wait until SIGINT/SIGTERM
+        int received;
+        sigwait(&stop_signals, &received);
     } else {
         fprintf(stderr, "Error starting framework\n");
     }
@@ -1745,7 +8777,12 @@ int main(void) {
     printf("Shutting down...\n");
     ulfius_stop_framework(&instance);
     ulfius_clean_instance(&instance);
+    stop_view_flusher();
     cleanup_db_pool();
+    cleanup_response_cache();
+    cleanup_storage();
+    invalidate_name_dictionaries();
+    unload_catalog();
 
     return 0;
 }
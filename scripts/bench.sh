@@ -0,0 +1,56 @@
+#!/bin/sh
+# Measure average and worst latency of GET endpoints on a running server.
+# Usage: PORT=8080 REQUESTS=200 SEED_COLLECTIONS=300 ./bench.sh [path ...]
+set -eu
+
+# Get script directory and change to it
+SCRIPT_DIR=$(dirname "$0")
+cd "$SCRIPT_DIR"
+
+# Configuration
+PORT=${PORT:-8080}
+API_BASE="http://localhost:${PORT}"
+REQUESTS=${REQUESTS:-200}
+SEED_COLLECTIONS=${SEED_COLLECTIONS:-0}
+
+# Create N collections referencing the mock workflows (run setup-mocks first)
+seed_collections() {
+    count="$1"
+    echo "Seeding ${count} collections..."
+    i=1
+    while [ "$i" -le "$count" ]; do
+        curl -s -o /dev/null -X PUT "${API_BASE}/templates/collections" -H "Content-Type: application/json" \
+            -d "{\"name\": \"Bench collection ${i}\", \"rank\": $((i % 7)), \"createdAt\": \"2024-12-18T15:30:00.000Z\",
+                 \"workflows\": [{\"id\": 6270}, {\"id\": 6271}, {\"id\": 6272}]}"
+        i=$((i + 1))
+    done
+}
+
+bench_path() {
+    path="$1"
+    i=0
+    while [ "$i" -lt "$REQUESTS" ]; do
+        curl -s -o /dev/null -w '%{time_total}\n' "${API_BASE}${path}"
+        i=$((i + 1))
+    done | awk -v path="$path" '
+        { sum += $1; if ($1 > max) max = $1 }
+        END { printf "%-45s %8.3f ms avg %8.3f ms max (%d requests)\n", path, sum / NR * 1000, max * 1000, NR }'
+}
+
+# Main execution
+main() {
+    if [ "$SEED_COLLECTIONS" -gt 0 ]; then
+        seed_collections "$SEED_COLLECTIONS"
+    fi
+
+    if [ "$#" -eq 0 ]; then
+        set -- "/templates/collections" "/templates/search?page=1&limit=20" "/templates/workflows"
+    fi
+
+    for path in "$@"; do
+        bench_path "$path"
+    done
+}
+
+# Run main function
+main "$@"
@@ -2,6 +2,11 @@
 PRAGMA foreign_keys = ON;
 
 -- Drop tables if they exist (in proper order to handle foreign keys)
+DROP TABLE IF EXISTS storage_dictionaries;
+DROP TABLE IF EXISTS templates_fts;
+DROP TABLE IF EXISTS counters;
+DROP TABLE IF EXISTS render_queue;
+DROP TABLE IF EXISTS template_renders;
 DROP TABLE IF EXISTS collection_categories;
 DROP TABLE IF EXISTS template_categories;
 DROP TABLE IF EXISTS workflow_nodes;
@@ -51,12 +56,14 @@ CREATE TABLE templates (
     purchase_url TEXT,
     created_at TEXT NOT NULL,
     description TEXT,
-    workflow_data TEXT, -- Full workflow object
+    workflow_data TEXT, -- Full workflow object (JSON columns may hold compressed BLOBs, see storage_dictionaries)
     workflow_info TEXT, -- WorkflowInfo object as JSON
     nodes_data TEXT, -- Nodes array as JSON
     image_data TEXT, -- Image array as JSON
     user_id INTEGER NOT NULL,
     last_updated_by INTEGER, -- Add lastUpdatedBy field
+    content_hash INTEGER, -- Hash of every field the row was last written from but the view counts, an identical PUT writes nothing
+    data_hash INTEGER, -- Hash of the four JSON columns alone, left untouched when only other fields change
     FOREIGN KEY (user_id) REFERENCES users(id) ON DELETE RESTRICT,
     FOREIGN KEY (last_updated_by) REFERENCES users(id) ON DELETE SET NULL
 );
@@ -88,6 +95,87 @@ CREATE TABLE collection_categories (
     FOREIGN KEY (category_id) REFERENCES categories(id) ON DELETE CASCADE
 );
 
+-- Create secondary indexes of category filters, render triggers, collection order and the category tree
+CREATE INDEX template_categories_category ON template_categories(category_id);
+CREATE INDEX collection_categories_category ON collection_categories(category_id);
+CREATE INDEX templates_user ON templates(user_id);
+CREATE INDEX collections_rank_name ON collections(rank, name);
+CREATE INDEX categories_parent ON categories(parent_id);
+
+-- Create counters table (row counts kept by triggers, data_version bumped on every write, database_id tells recreated databases apart in ETags)
+CREATE TABLE counters (
+    name TEXT PRIMARY KEY,
+    value INTEGER NOT NULL
+);
+
+INSERT INTO counters (name, value) VALUES ('templates', 0), ('data_version', 0), ('database_id', random() & 0xFFFFFFFF);
+
+CREATE TRIGGER templates_count_insert AFTER INSERT ON templates BEGIN
+    UPDATE counters SET value = value + 1 WHERE name = 'templates';
+END;
+
+CREATE TRIGGER templates_count_delete AFTER DELETE ON templates BEGIN
+    UPDATE counters SET value = value - 1 WHERE name = 'templates';
+END;
+
+-- Create rendered response bodies of the workflow GET endpoints (refreshed by the server on write)
+CREATE TABLE template_renders (
+    template_id INTEGER PRIMARY KEY,
+    detail TEXT NOT NULL, -- GET /templates/workflows/:id body
+    import TEXT NOT NULL, -- GET /workflows/templates/:id body
+    collection_item TEXT, -- Entry of the template in GET /templates/collections/:id bodies
+    FOREIGN KEY (template_id) REFERENCES templates(id) ON DELETE CASCADE
+);
+
+-- Templates whose rendered bodies are outdated, filled by the triggers below
+CREATE TABLE render_queue (
+    template_id INTEGER PRIMARY KEY
+);
+
+CREATE TRIGGER render_template_insert AFTER INSERT ON templates BEGIN
+    INSERT OR IGNORE INTO render_queue VALUES (NEW.id);
+END;
+
+-- Only columns a PUT writes, view counts flushed by the server leave rendered bodies as they are
+CREATE TRIGGER render_template_update AFTER UPDATE OF name, price, purchase_url, created_at, description, workflow_data,
+    workflow_info, nodes_data, image_data, user_id, last_updated_by ON templates BEGIN
+    INSERT OR IGNORE INTO render_queue VALUES (NEW.id);
+END;
+
+CREATE TRIGGER render_user_update AFTER UPDATE ON users BEGIN
+    INSERT OR IGNORE INTO render_queue SELECT id FROM templates WHERE user_id = NEW.id;
+END;
+
+CREATE TRIGGER render_category_update AFTER UPDATE ON categories BEGIN
+    INSERT OR IGNORE INTO render_queue SELECT template_id FROM template_categories WHERE category_id = NEW.id;
+END;
+
+CREATE TRIGGER render_template_category_insert AFTER INSERT ON template_categories BEGIN
+    INSERT OR IGNORE INTO render_queue VALUES (NEW.template_id);
+END;
+
+CREATE TRIGGER render_template_category_delete AFTER DELETE ON template_categories BEGIN
+    INSERT OR IGNORE INTO render_queue VALUES (OLD.template_id);
+END;
+
+-- Create full-text index over template names and descriptions (rowid = template id)
+CREATE VIRTUAL TABLE templates_fts USING fts5(
+    name,
+    description,
+    prefix = '2 3',
+    tokenize = 'unicode61 remove_diacritics 2'
+);
+
+-- Create preset dictionaries of compressed template JSON columns (trained by the server, never deleted)
+CREATE TABLE storage_dictionaries (
+    id INTEGER PRIMARY KEY,
+    data BLOB NOT NULL,
+    created_at TEXT DEFAULT CURRENT_TIMESTAMP
+);
+
+-- Schema version, the number of migrations in nrest-api.c this file already includes
+PRAGMA user_version = 8;
+
 -- Enable foreign key constraints (again to ensure it's active)
 PRAGMA foreign_keys = ON;
 
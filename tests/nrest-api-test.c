@@ -29,10 +29,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <strings.h>
 #include <stdbool.h>
 #include <time.h>
 #include <curl/curl.h>
 #include <jansson.h>
+#include <sqlite3.h>
 #include <pthread.h>
 #include <unistd.h>
 #include <unity.h>
@@ -42,6 +45,10 @@
 #define PORT 8080
 #endif
 
+#ifndef DATABASE_FILE
+#define DATABASE_FILE "workflow_templates.db"
+#endif
+
 // Configuration constants
 #define UPSTREAM_BASE_URL "https://api.n8n.io"
 #define MAX_RESPONSE_SIZE 1048576  // 1MB
@@ -51,23 +58,38 @@
 #define MAX_PATH_LENGTH 512
 #define MAX_URL_LENGTH 512
 #define DIFF_BUFFER_SIZE 1024
+#define QUERY_PLAN_BUFFER_SIZE 2048
 #define DEFAULT_PAGE_SIZE 20
 #define SINGLE_RESULT_LIMIT 1
+#define MISSING_WORKFLOW_ID 999999999
+#define TEST_USERNAME "nrest-api-test"
+#define MAX_HEADER_LENGTH 256
+#define FLUSH_POLL_SECONDS 1
+#define CURSOR_PAGE_SIZE 3
+#define MAX_TEST_WORKFLOWS 16
 
 // HTTP status codes
 #define HTTP_OK 200
+#define HTTP_CREATED 201
+#define HTTP_NOT_MODIFIED 304
+#define HTTP_BAD_REQUEST 400
+#define HTTP_NOT_FOUND 404
 
 // Endpoint paths
 #define ENDPOINT_HEALTH "/health"
+#define ENDPOINT_METRICS "/metrics"
 #define ENDPOINT_CATEGORIES "/templates/categories"
 #define ENDPOINT_COLLECTIONS "/templates/collections"
 #define ENDPOINT_SEARCH "/templates/search"
 #define ENDPOINT_WORKFLOWS "/templates/workflows"
+#define ENDPOINT_BULK "/templates/bulk"
 
 // JSON field names
 #define FIELD_CATEGORIES "categories"
 #define FIELD_COLLECTIONS "collections"
+#define FIELD_COLLECTION "collection"
 #define FIELD_WORKFLOWS "workflows"
+#define FIELD_WORKFLOW "workflow"
 #define FIELD_TOTAL_WORKFLOWS "totalWorkflows"
 #define FIELD_ID "id"
 #define FIELD_NAME "name"
@@ -78,6 +100,20 @@
 #define FIELD_USER "user"
 #define FIELD_USERNAME "username"
 #define FIELD_VERIFIED "verified"
+#define FIELD_FACETS "facets"
+#define FIELD_COUNT "count"
+#define FIELD_RESULTS "results"
+#define FIELD_UNCHANGED "unchanged"
+#define FIELD_LINE "line"
+#define FIELD_STATUS "status"
+#define FIELD_ERROR "error"
+#define FIELD_CREATED "created"
+#define FIELD_FAILED "failed"
+#define FIELD_VIEWS "views"
+#define FIELD_ENABLED "enabled"
+#define FIELD_RECORDED "recorded"
+#define FIELD_FLUSHES "flushes"
+#define FIELD_FLUSH_SECONDS "flushSeconds"
 
 // Global configuration
 typedef struct {
@@ -88,12 +124,29 @@ typedef struct {
 
 static test_config_t g_config = {0};
 
+// Workflows written by the running test, deleted again by tearDown even when an assertion fails
+static int g_test_workflows[MAX_TEST_WORKFLOWS];
+static int g_test_workflow_count = 0;
+
 // Response buffer structure
 typedef struct {
     char *data;
     size_t size;
 } response_buffer_t;
 
+// Status, body and one header of interest of an HTTP response
+typedef struct {
+    long status;
+    json_t *json;                    // NULL unless the body is JSON
+    char header[MAX_HEADER_LENGTH];  // Value of the header asked for, empty when absent
+} http_response_t;
+
+// Header a response is searched for
+typedef struct {
+    const char *name;
+    char *value;
+} header_capture_t;
+
 // Test endpoint structure
 typedef struct {
     const char *path;
@@ -206,6 +259,127 @@ static json_t* http_get(const char *url) {
     return json;
 }
 
+// Header callback for CURL, keeps the value of the header asked for
+static size_t header_callback(char *buffer, size_t size, size_t nitems, void *userp) {
+    size_t length = size * nitems;
+    header_capture_t *capture = (header_capture_t *)userp;
+    size_t name_length = strlen(capture->name);
+    
+    if (name_length > 0 && length > name_length && strncasecmp(buffer, capture->name, name_length) == 0 && buffer[name_length] == ':') {
+        const char *value = buffer + name_length + 1;
+        size_t value_length = length - name_length - 1;
+        while (value_length > 0 && isspace((unsigned char)*value)) {
+            value++;
+            value_length--;
+        }
+        while (value_length > 0 && isspace((unsigned char)value[value_length - 1])) {
+            value_length--;
+        }
+        if (value_length >= MAX_HEADER_LENGTH) {
+            value_length = MAX_HEADER_LENGTH - 1;
+        }
+        memcpy(capture->value, value, value_length);
+        capture->value[value_length] = '\0';
+    }
+    
+    return length;
+}
+
+// Perform an HTTP request with an optional body and extra request header, keeping the status, the JSON
+// body and the value of response_header. Uses its own handle, so it can be mixed with http_get.
+static http_response_t http_request(const char *method, const char *url, const char *body,
+                                    const char *request_header, const char *response_header) {
+    http_response_t result = {0};
+    response_buffer_t response;
+    init_response_buffer(&response);
+    
+    CURL *curl = curl_easy_init();
+    TEST_ASSERT_NOT_NULL(curl);
+    
+    // Bodies are JSON unless the extra header says otherwise
+    struct curl_slist *headers = NULL;
+    if (body && !(request_header && strncasecmp(request_header, "Content-Type:", strlen("Content-Type:")) == 0)) {
+        headers = curl_slist_append(headers, "Content-Type: application/json");
+    }
+    if (request_header) {
+        headers = curl_slist_append(headers, request_header);
+    }
+    header_capture_t capture = { response_header ? response_header : "", result.header };
+    
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, method);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&response);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_callback);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, (void *)&capture);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT, HTTP_TIMEOUT_SECONDS);
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    if (body) {
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body);
+    }
+    
+    CURLcode res = curl_easy_perform(curl);
+    if (res == CURLE_OK) {
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &result.status);
+        if (response.data) {
+            result.json = json_loads(response.data, 0, NULL);
+        }
+    } else if (g_config.verbose_mode) {
+        fprintf(stderr, "curl_easy_perform() failed: %s\n", curl_easy_strerror(res));
+    }
+    
+    curl_slist_free_all(headers);
+    curl_easy_cleanup(curl);
+    free_response_buffer(&response);
+    return result;
+}
+
+// Body of a PUT /templates/workflows for a minimal workflow, an update when id is positive
+static json_t* test_workflow_body(int id, const char *name) {
+    json_t *user = json_pack("{s:s, s:s}", "name", "NRest API Test", "username", TEST_USERNAME);
+    json_t *workflow = json_pack("{s:s, s:s, s:s, s:o, s:{s:[], s:{}}}",
+                                 "name", name, "description", "Written by the test suite", "createdAt", "2025-01-01T00:00:00.000Z",
+                                 "user", user, "workflow", "nodes", "connections");
+    if (id > 0) {
+        json_object_set_new(workflow, FIELD_ID, json_integer(id));
+    }
+    return json_pack("{s:o}", "workflow", workflow);
+}
+
+// PUT /templates/workflows a minimal workflow, as an update when id is positive
+static http_response_t put_test_workflow(int id, const char *name) {
+    json_t *body = test_workflow_body(id, name);
+    char *text = json_dumps(body, JSON_COMPACT);
+    char url[MAX_URL_LENGTH];
+    snprintf(url, sizeof(url), "%s%s", get_local_base_url(), ENDPOINT_WORKFLOWS);
+    
+    http_response_t result = http_request("PUT", url, text, NULL, NULL);
+    free(text);
+    json_decref(body);
+    return result;
+}
+
+// Have tearDown delete a workflow the running test wrote
+static void delete_after_test(int workflow_id) {
+    if (workflow_id > 0 && g_test_workflow_count < MAX_TEST_WORKFLOWS) {
+        g_test_workflows[g_test_workflow_count++] = workflow_id;
+    }
+}
+
+// DELETE the workflows the last test wrote, so the suite leaves the database as it found it
+static void delete_test_workflows(void) {
+    char url[MAX_URL_LENGTH];
+    for (int i = 0; i < g_test_workflow_count; i++) {
+        snprintf(url, sizeof(url), "%s%s/%d", get_local_base_url(), ENDPOINT_WORKFLOWS, g_test_workflows[i]);
+        http_response_t deleted = http_request("DELETE", url, NULL, NULL, NULL);
+        json_decref(deleted.json);
+        if (deleted.status != HTTP_OK && g_config.verbose_mode) {
+            fprintf(stderr, "Could not delete test workflow %d: HTTP %ld\n", g_test_workflows[i], deleted.status);
+        }
+    }
+    g_test_workflow_count = 0;
+}
+
 // Get JSON type name as string
 static const char* json_typeof_name(json_t *json) {
     switch(json_typeof(json)) {
@@ -456,6 +630,585 @@ void test_workflow_field_types(void) {
     json_decref(result);
 }
 
+// Total of a search filtered by the given categories (a comma separated, URL escaped list)
+static int search_total(const char *escaped_categories, const char *category_match) {
+    char url[MAX_URL_LENGTH];
+    snprintf(url, sizeof(url), "%s%s?limit=%d&category=%s&categoryMatch=%s", get_local_base_url(), ENDPOINT_SEARCH,
+             SINGLE_RESULT_LIMIT, escaped_categories, category_match);
+    json_t *result = http_get(url);
+    TEST_ASSERT_NOT_NULL(result);
+    int total = json_integer_value(json_object_get(result, FIELD_TOTAL_WORKFLOWS));
+    json_decref(result);
+    return total;
+}
+
+// Every facet counts the templates its category alone would find, and requiring two categories
+// finds no more templates than either of them
+void test_search_facets(void) {
+    char url[MAX_URL_LENGTH];
+    snprintf(url, sizeof(url), "%s%s?limit=%d&facets=true", get_local_base_url(), ENDPOINT_SEARCH, SINGLE_RESULT_LIMIT);
+    json_t *result = http_get(url);
+    TEST_ASSERT_NOT_NULL(result);
+    assert_field_type(result, FIELD_FACETS, JSON_ARRAY, "search");
+    
+    json_t *facets = json_object_get(result, FIELD_FACETS);
+    if (json_array_size(facets) < 2) {
+        json_decref(result);
+        TEST_IGNORE_MESSAGE("Fewer than two categories with workflows - skipping facet checks");
+    }
+    
+    CURL *curl = curl_easy_init();
+    TEST_ASSERT_NOT_NULL(curl);
+    char *names[2];
+    int counts[2];
+    for (int i = 0; i < 2; i++) {
+        json_t *facet = json_array_get(facets, i);
+        assert_field_type(facet, FIELD_NAME, JSON_STRING, "facet");
+        assert_field_type(facet, FIELD_COUNT, JSON_INTEGER, "facet");
+        names[i] = curl_easy_escape(curl, json_string_value(json_object_get(facet, FIELD_NAME)), 0);
+        counts[i] = json_integer_value(json_object_get(facet, FIELD_COUNT));
+        TEST_ASSERT_EQUAL_INT(counts[i], search_total(names[i], "any"));
+    }
+    TEST_ASSERT_TRUE(counts[0] >= counts[1]);
+    
+    char both[MAX_URL_LENGTH];
+    snprintf(both, sizeof(both), "%s,%s", names[0], names[1]);
+    int all_total = search_total(both, "all");
+    int any_total = search_total(both, "any");
+    TEST_ASSERT_TRUE(all_total <= counts[1]);
+    TEST_ASSERT_EQUAL_INT(counts[0] + counts[1] - all_total, any_total);
+    
+    curl_free(names[0]);
+    curl_free(names[1]);
+    curl_easy_cleanup(curl);
+    json_decref(result);
+}
+
+// Validators of a GET answer 304 until the next write, and never stand in for a 404
+void test_conditional_get(void) {
+    char url[MAX_URL_LENGTH], missing_url[MAX_URL_LENGTH], header[MAX_HEADER_LENGTH + 32];
+    snprintf(url, sizeof(url), "%s%s", get_local_base_url(), ENDPOINT_CATEGORIES);
+    snprintf(missing_url, sizeof(missing_url), "%s%s/%d", get_local_base_url(), ENDPOINT_WORKFLOWS, MISSING_WORKFLOW_ID);
+    
+    http_response_t first = http_request("GET", url, NULL, NULL, "ETag");
+    json_decref(first.json);
+    TEST_ASSERT_EQUAL_INT(HTTP_OK, first.status);
+    TEST_ASSERT_TRUE(strlen(first.header) > 0);
+    http_response_t dated = http_request("GET", url, NULL, NULL, "Last-Modified");
+    json_decref(dated.json);
+    TEST_ASSERT_TRUE(strlen(dated.header) > 0);
+    
+    snprintf(header, sizeof(header), "If-None-Match: %s", first.header);
+    http_response_t revalidated = http_request("GET", url, NULL, header, "ETag");
+    TEST_ASSERT_EQUAL_INT(HTTP_NOT_MODIFIED, revalidated.status);
+    TEST_ASSERT_NULL(revalidated.json);
+    TEST_ASSERT_EQUAL_STRING(first.header, revalidated.header);
+    
+    // The same validators on an id that does not exist
+    http_response_t missing = http_request("GET", missing_url, NULL, header, NULL);
+    json_decref(missing.json);
+    TEST_ASSERT_EQUAL_INT(HTTP_NOT_FOUND, missing.status);
+    snprintf(header, sizeof(header), "If-Modified-Since: %s", dated.header);
+    missing = http_request("GET", missing_url, NULL, header, NULL);
+    json_decref(missing.json);
+    TEST_ASSERT_EQUAL_INT(HTTP_NOT_FOUND, missing.status);
+    
+    // A copy older than the last write is sent again
+    http_response_t outdated = http_request("GET", url, NULL, "If-Modified-Since: Sun, 06 Nov 1994 08:49:37 GMT", NULL);
+    json_decref(outdated.json);
+    TEST_ASSERT_EQUAL_INT(HTTP_OK, outdated.status);
+    
+    http_response_t created = put_test_workflow(0, "Conditional GET test");
+    delete_after_test(json_integer_value(json_object_get(created.json, FIELD_ID)));
+    json_decref(created.json);
+    TEST_ASSERT_EQUAL_INT(HTTP_CREATED, created.status);
+    
+    snprintf(header, sizeof(header), "If-None-Match: %s", first.header);
+    http_response_t changed = http_request("GET", url, NULL, header, "ETag");
+    json_decref(changed.json);
+    TEST_ASSERT_EQUAL_INT(HTTP_OK, changed.status);
+    TEST_ASSERT_FALSE(strcmp(first.header, changed.header) == 0);
+}
+
+// A PUT of exactly what is stored writes nothing and says so, an edited one is written
+void test_unchanged_reput(void) {
+    http_response_t created = put_test_workflow(0, "Re-PUT test");
+    int workflow_id = json_integer_value(json_object_get(created.json, FIELD_ID));
+    delete_after_test(workflow_id);
+    json_decref(created.json);
+    TEST_ASSERT_EQUAL_INT(HTTP_CREATED, created.status);
+    TEST_ASSERT_TRUE(workflow_id > 0);
+    
+    http_response_t same = put_test_workflow(workflow_id, "Re-PUT test");
+    TEST_ASSERT_EQUAL_INT(HTTP_OK, same.status);
+    TEST_ASSERT_EQUAL_INT(workflow_id, json_integer_value(json_object_get(same.json, FIELD_ID)));
+    TEST_ASSERT_TRUE(json_is_true(json_object_get(same.json, FIELD_UNCHANGED)));
+    json_decref(same.json);
+    
+    http_response_t edited = put_test_workflow(workflow_id, "Re-PUT test edited");
+    TEST_ASSERT_EQUAL_INT(HTTP_CREATED, edited.status);
+    TEST_ASSERT_EQUAL_INT(workflow_id, json_integer_value(json_object_get(edited.json, FIELD_ID)));
+    TEST_ASSERT_NULL(json_object_get(edited.json, FIELD_UNCHANGED));
+    json_decref(edited.json);
+    
+    char url[MAX_URL_LENGTH];
+    snprintf(url, sizeof(url), "%s%s/%d", get_local_base_url(), ENDPOINT_WORKFLOWS, workflow_id);
+    json_t *workflow = http_get(url);
+    TEST_ASSERT_NOT_NULL(workflow);
+    TEST_ASSERT_EQUAL_STRING("Re-PUT test edited", json_string_value(json_object_get(json_object_get(workflow, FIELD_WORKFLOW), FIELD_NAME)));
+    json_decref(workflow);
+}
+
+// Every NDJSON line gets its own result: bad lines are reported and the good ones around them still written
+void test_bulk_ingest(void) {
+    json_t *first_body = test_workflow_body(0, "Bulk test first");
+    json_t *last_body = test_workflow_body(0, "Bulk test last");
+    char *first = json_dumps(first_body, JSON_COMPACT);
+    char *last = json_dumps(last_body, JSON_COMPACT);
+    // Line 2 is not JSON, line 3 misses required fields and line 4 is blank
+    size_t length = strlen(first) + strlen(last) + 128;
+    char *body = malloc(length);
+    TEST_ASSERT_NOT_NULL(body);
+    snprintf(body, length, "%s\nnot json\n{\"workflow\": {\"name\": \"Bulk test incomplete\"}}\n\n%s\n", first, last);
+    free(first);
+    free(last);
+    json_decref(first_body);
+    json_decref(last_body);
+    
+    char url[MAX_URL_LENGTH];
+    snprintf(url, sizeof(url), "%s%s", get_local_base_url(), ENDPOINT_BULK);
+    http_response_t response = http_request("PUT", url, body, "Content-Type: application/x-ndjson", NULL);
+    free(body);
+    TEST_ASSERT_EQUAL_INT(HTTP_OK, response.status);
+    TEST_ASSERT_NOT_NULL(response.json);
+    
+    json_t *results = json_object_get(response.json, FIELD_RESULTS);
+    for (size_t i = 0; i < json_array_size(results); i++) {
+        delete_after_test(json_integer_value(json_object_get(json_array_get(results, i), FIELD_ID)));
+    }
+    TEST_ASSERT_EQUAL_INT(4, json_array_size(results));
+    const int lines[] = { 1, 2, 3, 5 };
+    const bool written[] = { true, false, false, true };
+    for (size_t i = 0; i < json_array_size(results); i++) {
+        json_t *result = json_array_get(results, i);
+        TEST_ASSERT_EQUAL_INT(lines[i], json_integer_value(json_object_get(result, FIELD_LINE)));
+        int status = json_integer_value(json_object_get(result, FIELD_STATUS));
+        if (written[i]) {
+            TEST_ASSERT_EQUAL_INT(HTTP_CREATED, status);
+            TEST_ASSERT_TRUE(json_integer_value(json_object_get(result, FIELD_ID)) > 0);
+        } else {
+            TEST_ASSERT_EQUAL_INT(HTTP_BAD_REQUEST, status);
+            TEST_ASSERT_TRUE(json_is_string(json_object_get(result, FIELD_ERROR)));
+        }
+    }
+    TEST_ASSERT_EQUAL_INT(2, json_integer_value(json_object_get(response.json, FIELD_CREATED)));
+    TEST_ASSERT_EQUAL_INT(2, json_integer_value(json_object_get(response.json, FIELD_FAILED)));
+    
+    // The line after the bad ones was written
+    int last_id = json_integer_value(json_object_get(json_array_get(results, 3), FIELD_ID));
+    snprintf(url, sizeof(url), "%s%s/%d", get_local_base_url(), ENDPOINT_WORKFLOWS, last_id);
+    json_t *workflow = http_get(url);
+    TEST_ASSERT_NOT_NULL(workflow);
+    json_decref(workflow);
+    json_decref(response.json);
+}
+
+// Copy the workflow ids of a search page into ids, returns how many there are
+static size_t page_ids(json_t *page, int *ids, size_t capacity) {
+    json_t *workflows = json_object_get(page, FIELD_WORKFLOWS);
+    size_t count = json_array_size(workflows) < capacity ? json_array_size(workflows) : capacity;
+    for (size_t i = 0; i < count; i++) {
+        ids[i] = json_integer_value(json_object_get(json_array_get(workflows, i), FIELD_ID));
+    }
+    return count;
+}
+
+// The cursor of a full page leads to the same rows as the next page number, none of them repeated
+void test_search_cursor(void) {
+    char url[MAX_URL_LENGTH];
+    snprintf(url, sizeof(url), "%s%s?limit=%d&page=1", get_local_base_url(), ENDPOINT_SEARCH, CURSOR_PAGE_SIZE);
+    http_response_t first = http_request("GET", url, NULL, NULL, "X-Next-Cursor");
+    TEST_ASSERT_EQUAL_INT(HTTP_OK, first.status);
+    if (json_integer_value(json_object_get(first.json, FIELD_TOTAL_WORKFLOWS)) < 2 * CURSOR_PAGE_SIZE) {
+        json_decref(first.json);
+        TEST_IGNORE_MESSAGE("Fewer than two pages of workflows - skipping cursor checks");
+    }
+    int first_ids[CURSOR_PAGE_SIZE], cursor_ids[CURSOR_PAGE_SIZE], numbered_ids[CURSOR_PAGE_SIZE];
+    TEST_ASSERT_EQUAL_INT(CURSOR_PAGE_SIZE, page_ids(first.json, first_ids, CURSOR_PAGE_SIZE));
+    json_decref(first.json);
+    TEST_ASSERT_TRUE_MESSAGE(strlen(first.header) > 0, "A full page has no X-Next-Cursor");
+    
+    CURL *curl = curl_easy_init();
+    char *cursor = curl_easy_escape(curl, first.header, 0);
+    snprintf(url, sizeof(url), "%s%s?limit=%d&cursor=%s", get_local_base_url(), ENDPOINT_SEARCH, CURSOR_PAGE_SIZE, cursor);
+    curl_free(cursor);
+    curl_easy_cleanup(curl);
+    json_t *by_cursor = http_get(url);
+    TEST_ASSERT_NOT_NULL(by_cursor);
+    size_t cursor_count = page_ids(by_cursor, cursor_ids, CURSOR_PAGE_SIZE);
+    json_decref(by_cursor);
+    
+    snprintf(url, sizeof(url), "%s%s?limit=%d&page=2", get_local_base_url(), ENDPOINT_SEARCH, CURSOR_PAGE_SIZE);
+    json_t *by_number = http_get(url);
+    TEST_ASSERT_NOT_NULL(by_number);
+    size_t numbered_count = page_ids(by_number, numbered_ids, CURSOR_PAGE_SIZE);
+    json_decref(by_number);
+    
+    TEST_ASSERT_EQUAL_INT(CURSOR_PAGE_SIZE, cursor_count);
+    TEST_ASSERT_EQUAL_INT(numbered_count, cursor_count);
+    TEST_ASSERT_EQUAL_INT_ARRAY(numbered_ids, cursor_ids, cursor_count);
+    for (size_t i = 0; i < cursor_count; i++) {
+        for (size_t j = 0; j < CURSOR_PAGE_SIZE; j++) {
+            TEST_ASSERT_NOT_EQUAL(first_ids[j], cursor_ids[i]);
+        }
+    }
+}
+
+// Id of the first workflow search returns, 0 when there is none
+static int first_workflow_id(void) {
+    char url[MAX_URL_LENGTH];
+    snprintf(url, sizeof(url), "%s%s?limit=%d", get_local_base_url(), ENDPOINT_SEARCH, SINGLE_RESULT_LIMIT);
+    json_t *result = http_get(url);
+    TEST_ASSERT_NOT_NULL(result);
+    json_t *first = json_array_get(json_object_get(result, FIELD_WORKFLOWS), 0);
+    int workflow_id = json_integer_value(json_object_get(first, FIELD_ID));
+    json_decref(result);
+    return workflow_id;
+}
+
+// A view counter from /metrics, -1 when the server was built not to count views
+static long long view_metric(const char *field) {
+    char url[MAX_URL_LENGTH];
+    snprintf(url, sizeof(url), "%s%s", get_local_base_url(), ENDPOINT_METRICS);
+    json_t *metrics = http_get(url);
+    TEST_ASSERT_NOT_NULL(metrics);
+    json_t *views = json_object_get(metrics, FIELD_VIEWS);
+    long long value = json_is_true(json_object_get(views, FIELD_ENABLED)) ? json_integer_value(json_object_get(views, field)) : -1;
+    json_decref(metrics);
+    return value;
+}
+
+// Every GET of a workflow counts a view, cached responses included, before any flush has written it
+void test_workflow_views_recorded(void) {
+    long long before = view_metric(FIELD_RECORDED);
+    if (before < 0) {
+        TEST_IGNORE_MESSAGE("Server does not count views (VIEW_FLUSH_SECONDS=0) - skipping view checks");
+    }
+    
+    int workflow_id = first_workflow_id();
+    if (workflow_id <= 0) {
+        TEST_IGNORE_MESSAGE("No workflows found - skipping view checks");
+    }
+    
+    char url[MAX_URL_LENGTH];
+    snprintf(url, sizeof(url), "%s%s/%d", get_local_base_url(), ENDPOINT_WORKFLOWS, workflow_id);
+    for (int i = 0; i < 3; i++) {
+        json_t *workflow = http_get(url);
+        TEST_ASSERT_NOT_NULL(workflow);
+        json_decref(workflow);
+    }
+    TEST_ASSERT_TRUE(view_metric(FIELD_RECORDED) >= before + 3);
+}
+
+// totalViews of a workflow detail, with its ETag copied to etag
+static long long detail_views(const char *url, char *etag) {
+    http_response_t response = http_request("GET", url, NULL, NULL, "ETag");
+    TEST_ASSERT_EQUAL_INT(HTTP_OK, response.status);
+    json_t *workflow = json_object_get(response.json, FIELD_WORKFLOW);
+    long long views = json_integer_value(json_object_get(workflow, FIELD_TOTAL_VIEWS));
+    strcpy(etag, response.header);
+    json_decref(response.json);
+    return views;
+}
+
+// A view flush reaches the workflow detail: it serves the higher totalViews under a new ETag
+void test_views_reach_detail_after_flush(void) {
+    long long flush_seconds = view_metric(FIELD_FLUSH_SECONDS);
+    if (flush_seconds <= 0) {
+        TEST_IGNORE_MESSAGE("Server does not count views (VIEW_FLUSH_SECONDS=0) - skipping view flush checks");
+    }
+    int workflow_id = first_workflow_id();
+    if (workflow_id <= 0) {
+        TEST_IGNORE_MESSAGE("No workflows found - skipping view flush checks");
+    }
+    
+    char url[MAX_URL_LENGTH];
+    snprintf(url, sizeof(url), "%s%s/%d", get_local_base_url(), ENDPOINT_WORKFLOWS, workflow_id);
+    
+    // Wait for a flush after the first GET, which recorded a view for it to write
+    char etag[MAX_HEADER_LENGTH], flushed_etag[MAX_HEADER_LENGTH];
+    long long flushes = view_metric(FIELD_FLUSHES);
+    long long views = detail_views(url, etag);
+    TEST_ASSERT_TRUE(strlen(etag) > 0);
+    for (long long waited = 0; view_metric(FIELD_FLUSHES) == flushes; waited += FLUSH_POLL_SECONDS) {
+        TEST_ASSERT_TRUE_MESSAGE(waited <= flush_seconds + SERVER_WAIT_TIMEOUT, "No view flush happened");
+        sleep(FLUSH_POLL_SECONDS);
+    }
+    
+    TEST_ASSERT_GREATER_THAN(views, detail_views(url, flushed_etag));
+    TEST_ASSERT_NOT_EQUAL(0, strcmp(etag, flushed_etag));
+    
+    char if_none_match[MAX_HEADER_LENGTH + 16];
+    snprintf(if_none_match, sizeof(if_none_match), "If-None-Match: %s", etag);
+    http_response_t revalidated = http_request("GET", url, NULL, if_none_match, NULL);
+    json_decref(revalidated.json);
+    TEST_ASSERT_EQUAL_INT(HTTP_OK, revalidated.status);
+}
+
+// Whether needle occurs in text with ASCII letters compared regardless of case, as LIKE does
+static bool contains_ignoring_case(const char *text, const char *needle) {
+    size_t needle_length = strlen(needle);
+    for (; *text; text++) {
+        size_t i = 0;
+        while (i < needle_length && text[i] && tolower((unsigned char)text[i]) == tolower((unsigned char)needle[i])) {
+            i++;
+        }
+        if (i == needle_length) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// A substring search finds the workflow it was cut from, and only workflows containing it in either field
+void test_search_substring(void) {
+    char url[MAX_URL_LENGTH];
+    snprintf(url, sizeof(url), "%s%s?limit=%d", get_local_base_url(), ENDPOINT_SEARCH, SINGLE_RESULT_LIMIT);
+    json_t *result = http_get(url);
+    TEST_ASSERT_NOT_NULL(result);
+    json_t *first = json_array_get(json_object_get(result, FIELD_WORKFLOWS), 0);
+    const char *name = json_string_value(json_object_get(first, FIELD_NAME));
+    if (!name || strlen(name) < 4 || !isalnum((unsigned char)name[1]) || !isalnum((unsigned char)name[2]) || !isalnum((unsigned char)name[3])) {
+        json_decref(result);
+        TEST_IGNORE_MESSAGE("No workflow with an ASCII name to search for - skipping substring search");
+    }
+    
+    // The middle of the name, in upper case: LIKE ignores ASCII case
+    char needle[4] = { (char)toupper((unsigned char)name[1]), (char)toupper((unsigned char)name[2]), (char)toupper((unsigned char)name[3]), '\0' };
+    CURL *curl = curl_easy_init();
+    TEST_ASSERT_NOT_NULL(curl);
+    char *escaped = curl_easy_escape(curl, needle, 0);
+    snprintf(url, sizeof(url), "%s%s?limit=100&match=substring&search=%s", get_local_base_url(), ENDPOINT_SEARCH, escaped);
+    curl_free(escaped);
+    curl_easy_cleanup(curl);
+    json_t *found = http_get(url);
+    TEST_ASSERT_NOT_NULL(found);
+    
+    json_t *workflows = json_object_get(found, FIELD_WORKFLOWS);
+    TEST_ASSERT_TRUE(json_array_size(workflows) > 0);
+    for (size_t i = 0; i < json_array_size(workflows); i++) {
+        json_t *workflow = json_array_get(workflows, i);
+        const char *fields[] = { json_string_value(json_object_get(workflow, FIELD_NAME)),
+                                 json_string_value(json_object_get(workflow, FIELD_DESCRIPTION)) };
+        bool contains = false;
+        for (int f = 0; f < 2 && !contains; f++) {
+            contains = fields[f] && contains_ignoring_case(fields[f], needle);
+        }
+        TEST_ASSERT_TRUE_MESSAGE(contains, needle);
+    }
+    
+    json_decref(found);
+    json_decref(result);
+}
+
+static int compare_ids(const void *a, const void *b) {
+    return (*(const int *)a > *(const int *)b) - (*(const int *)a < *(const int *)b);
+}
+
+// Assert that the "id"s of a JSON array of objects are, in any order, the ids the query returns
+// (in id order) from the database the server runs on. bind_id is bound to its ? when positive.
+static void assert_same_ids(json_t *array, const char *sql, int bind_id) {
+    TEST_ASSERT_TRUE_MESSAGE(json_is_array(array), sql);
+    size_t count = json_array_size(array);
+    int *served = malloc((count + 1) * sizeof(int));
+    TEST_ASSERT_NOT_NULL(served);
+    for (size_t i = 0; i < count; i++) {
+        served[i] = json_integer_value(json_object_get(json_array_get(array, i), FIELD_ID));
+    }
+    qsort(served, count, sizeof(int), compare_ids);
+    
+    sqlite3 *db = NULL;
+    sqlite3_stmt *stmt = NULL;
+    bool same = sqlite3_open_v2(DATABASE_FILE, &db, SQLITE_OPEN_READONLY, NULL) == SQLITE_OK &&
+                sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) == SQLITE_OK;
+    if (same && bind_id > 0) {
+        sqlite3_bind_int(stmt, 1, bind_id);
+    }
+    size_t stored = 0;
+    while (same && sqlite3_step(stmt) == SQLITE_ROW) {
+        same = stored < count && served[stored] == sqlite3_column_int(stmt, 0);
+        stored++;
+    }
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+    free(served);
+    TEST_ASSERT_TRUE_MESSAGE(same && stored == count, sql);
+}
+
+// A count query on the database the server runs on, text bound to its ? when given
+static long long database_count(const char *sql, const char *text) {
+    sqlite3 *db = NULL;
+    sqlite3_stmt *stmt = NULL;
+    long long count = -1;
+    if (sqlite3_open_v2(DATABASE_FILE, &db, SQLITE_OPEN_READONLY, NULL) == SQLITE_OK &&
+        sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) == SQLITE_OK) {
+        if (text) {
+            sqlite3_bind_text(stmt, 1, text, -1, SQLITE_TRANSIENT);
+        }
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            count = sqlite3_column_int64(stmt, 0);
+        }
+    }
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+    return count;
+}
+
+// Listings are served from the in-memory catalog snapshot, which has to hold what SQLite holds
+void test_snapshot_categories_match_database(void) {
+    char url[MAX_URL_LENGTH];
+    snprintf(url, sizeof(url), "%s%s", get_local_base_url(), ENDPOINT_CATEGORIES);
+    json_t *result = http_get(url);
+    TEST_ASSERT_NOT_NULL(result);
+    assert_same_ids(json_object_get(result, FIELD_CATEGORIES), "SELECT id FROM categories ORDER BY id;", 0);
+    json_decref(result);
+}
+
+void test_snapshot_collections_match_database(void) {
+    char url[MAX_URL_LENGTH];
+    snprintf(url, sizeof(url), "%s%s", get_local_base_url(), ENDPOINT_COLLECTIONS);
+    json_t *result = http_get(url);
+    TEST_ASSERT_NOT_NULL(result);
+    json_t *collections = json_object_get(result, FIELD_COLLECTIONS);
+    assert_same_ids(collections, "SELECT id FROM collections ORDER BY id;", 0);
+    
+    for (size_t i = 0; i < json_array_size(collections); i++) {
+        json_t *collection = json_array_get(collections, i);
+        int collection_id = json_integer_value(json_object_get(collection, FIELD_ID));
+        assert_same_ids(json_object_get(collection, FIELD_WORKFLOWS),
+                        "SELECT template_id FROM collection_workflows WHERE collection_id = ? ORDER BY template_id;", collection_id);
+        
+        // The detail lists the linked workflows that exist, with their full entries
+        snprintf(url, sizeof(url), "%s%s/%d", get_local_base_url(), ENDPOINT_COLLECTIONS, collection_id);
+        json_t *detail = http_get(url);
+        TEST_ASSERT_NOT_NULL(detail);
+        json_t *detail_collection = json_object_get(detail, FIELD_COLLECTION);
+        TEST_ASSERT_EQUAL_INT(collection_id, json_integer_value(json_object_get(detail_collection, FIELD_ID)));
+        assert_same_ids(json_object_get(detail_collection, FIELD_WORKFLOWS),
+                        "SELECT t.id FROM templates t JOIN collection_workflows cw ON t.id = cw.template_id "
+                        "JOIN users u ON t.user_id = u.id WHERE cw.collection_id = ? ORDER BY t.id;", collection_id);
+        assert_same_ids(json_object_get(detail_collection, FIELD_CATEGORIES),
+                        "SELECT c.id FROM collection_categories cc JOIN categories c ON c.id = cc.category_id "
+                        "WHERE cc.collection_id = ? ORDER BY c.id;", collection_id);
+        json_decref(detail);
+    }
+    json_decref(result);
+}
+
+void test_snapshot_search_matches_database(void) {
+    char url[MAX_URL_LENGTH];
+    snprintf(url, sizeof(url), "%s%s?limit=%d", get_local_base_url(), ENDPOINT_SEARCH, SINGLE_RESULT_LIMIT);
+    json_t *result = http_get(url);
+    TEST_ASSERT_NOT_NULL(result);
+    TEST_ASSERT_EQUAL_INT64(database_count("SELECT COUNT(*) FROM templates t JOIN users u ON t.user_id = u.id;", NULL),
+                            json_integer_value(json_object_get(result, FIELD_TOTAL_WORKFLOWS)));
+    json_decref(result);
+    
+    // Every category filter matches the templates linked to it
+    snprintf(url, sizeof(url), "%s%s", get_local_base_url(), ENDPOINT_CATEGORIES);
+    json_t *categories = http_get(url);
+    TEST_ASSERT_NOT_NULL(categories);
+    json_t *category;
+    size_t index;
+    json_array_foreach(json_object_get(categories, FIELD_CATEGORIES), index, category) {
+        const char *name = json_string_value(json_object_get(category, FIELD_NAME));
+        CURL *curl = curl_easy_init();
+        char *escaped = curl_easy_escape(curl, name, 0);
+        snprintf(url, sizeof(url), "%s%s?limit=%d&category=%s", get_local_base_url(), ENDPOINT_SEARCH, SINGLE_RESULT_LIMIT, escaped);
+        curl_free(escaped);
+        curl_easy_cleanup(curl);
+        result = http_get(url);
+        TEST_ASSERT_NOT_NULL(result);
+        TEST_ASSERT_EQUAL_INT64(database_count("SELECT COUNT(DISTINCT t.id) FROM templates t JOIN users u ON t.user_id = u.id "
+                                               "JOIN template_categories tc ON t.id = tc.template_id "
+                                               "JOIN categories c ON c.id = tc.category_id WHERE c.name = ?;", name),
+                                json_integer_value(json_object_get(result, FIELD_TOTAL_WORKFLOWS)));
+        json_decref(result);
+    }
+    json_decref(categories);
+}
+
+void test_snapshot_workflows_match_database(void) {
+    char url[MAX_URL_LENGTH];
+    snprintf(url, sizeof(url), "%s%s", get_local_base_url(), ENDPOINT_WORKFLOWS);
+    json_t *result = http_get(url);
+    TEST_ASSERT_NOT_NULL(result);
+    assert_same_ids(result, "SELECT id FROM templates ORDER BY id;", 0);
+    json_decref(result);
+}
+
+// Assert that the plan of a query searches or scans the given index. With ordered set, also
+// assert that the rows come out of the index in order, without a temporary sort.
+static void assert_query_uses_index(const char *sql, const char *index_name, bool ordered) {
+    sqlite3 *db = NULL;
+    TEST_ASSERT_EQUAL_INT_MESSAGE(SQLITE_OK, sqlite3_open_v2(DATABASE_FILE, &db, SQLITE_OPEN_READONLY, NULL), "Can't open " DATABASE_FILE);
+    
+    char explain_sql[QUERY_PLAN_BUFFER_SIZE];
+    snprintf(explain_sql, sizeof(explain_sql), "EXPLAIN QUERY PLAN %s", sql);
+    sqlite3_stmt *stmt = NULL;
+    int rc = sqlite3_prepare_v2(db, explain_sql, -1, &stmt, NULL);
+    if (rc != SQLITE_OK) {
+        sqlite3_close(db);
+        TEST_FAIL_MESSAGE(sql);
+    }
+    
+    char plan[QUERY_PLAN_BUFFER_SIZE] = "";
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        strncat(plan, (const char *)sqlite3_column_text(stmt, 3), sizeof(plan) - strlen(plan) - 2);
+        strcat(plan, "\n");
+    }
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+    
+    if (g_config.verbose_mode) {
+        printf("%s\n%s", sql, plan);
+    }
+    
+    char using_index[MAX_PATH_LENGTH];
+    snprintf(using_index, sizeof(using_index), "INDEX %s", index_name);
+    TEST_ASSERT_NOT_NULL_MESSAGE(strstr(plan, using_index), plan);
+    if (ordered) {
+        TEST_ASSERT_NULL_MESSAGE(strstr(plan, "TEMP B-TREE FOR ORDER BY"), plan);
+    }
+}
+
+// Query plan tests, against the database the running server has migrated
+void test_collections_order_plan(void) {
+    assert_query_uses_index("SELECT DISTINCT c.id, c.rank, c.name, c.description, c.total_views, c.created_at "
+                            "FROM collections c ORDER BY c.rank, c.name;", "collections_rank_name", true);
+}
+
+void test_collections_category_filter_plan(void) {
+    assert_query_uses_index("SELECT DISTINCT c.id FROM collections c JOIN collection_categories cc ON c.id = cc.collection_id "
+                            "WHERE cc.category_id IN (?, ?);", "collection_categories_category", false);
+}
+
+void test_search_category_filter_plan(void) {
+    assert_query_uses_index("SELECT DISTINCT t.id FROM templates t JOIN users u ON t.user_id = u.id "
+                            "JOIN template_categories tc ON t.id = tc.template_id JOIN categories c ON tc.category_id = c.id "
+                            "WHERE (c.name = ? OR c.name = ?) ORDER BY t.id DESC;", "template_categories_category", false);
+}
+
+void test_user_templates_plan(void) {
+    // Run by the render trigger of every user update
+    assert_query_uses_index("SELECT id FROM templates WHERE user_id = ?;", "templates_user", false);
+}
+
+void test_category_children_plan(void) {
+    // Run by the ON DELETE SET NULL action of every category delete
+    assert_query_uses_index("SELECT id FROM categories WHERE parent_id = ?;", "categories_parent", false);
+}
+
 // Wait for server with timeout
 bool wait_for_server(const char *base_url, int timeout_seconds) {
     char health_url[MAX_URL_LENGTH];
@@ -483,7 +1236,7 @@ void setUp(void) {
 }
 
 void tearDown(void) {
-    // Nothing specific needed per test
+    delete_test_workflows();
 }
 
 // Parse command line arguments
@@ -555,6 +1308,27 @@ int main(int argc, char *argv[]) {
     
     // Field validation tests
     RUN_TEST(test_workflow_field_types);
+    RUN_TEST(test_search_facets);
+    RUN_TEST(test_search_substring);
+    RUN_TEST(test_search_cursor);
+    RUN_TEST(test_conditional_get);
+    RUN_TEST(test_bulk_ingest);
+    RUN_TEST(test_unchanged_reput);
+    RUN_TEST(test_workflow_views_recorded);
+    RUN_TEST(test_views_reach_detail_after_flush);
+    
+    // Catalog snapshot against the database
+    RUN_TEST(test_snapshot_categories_match_database);
+    RUN_TEST(test_snapshot_collections_match_database);
+    RUN_TEST(test_snapshot_search_matches_database);
+    RUN_TEST(test_snapshot_workflows_match_database);
+    
+    // Query plan tests
+    RUN_TEST(test_collections_order_plan);
+    RUN_TEST(test_collections_category_filter_plan);
+    RUN_TEST(test_search_category_filter_plan);
+    RUN_TEST(test_user_templates_plan);
+    RUN_TEST(test_category_children_plan);
     
     int result = UNITY_END();
     